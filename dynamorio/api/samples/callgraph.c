@@ -0,0 +1,726 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Code Manipulation API Sample:
+ * callgraph.c
+ *
+ * Builds a caller->callee call graph of the target application.  Unlike
+ * instrcalls.c, which performs a clean call and writes a log line for
+ * every call and return, this client maintains a per-thread shadow stack
+ * of callee entry points using inlined code only.  Caller->callee edges
+ * are appended inline to a per-thread buffer, which is folded into a
+ * per-thread hashtable of edge counts whenever it fills up.  At thread
+ * exit the edges and the module list are written to a compact binary
+ * file (see callgraph.h) that the standalone callgraph2dot tool converts
+ * to a DOT graph.
+ *
+ * Passing "-sample <millisec>" (Linux only) switches to callstack sampling:
+ * the inline code only maintains the shadow stack, and an itimer callback
+ * adds each edge on the current shadow stack once per sample.
+ *
+ * Illustrates how to keep per-thread state up to date with inlined
+ * instrumentation that does not modify the arithmetic flags (using the
+ * lea + jecxz trick from memtrace.c), how to use a lean procedure for the
+ * rare slow path, and how to use the drcontainers hashtable.
+ *
+ * The shadow stack assumes calls and returns are matched.  Unwinding
+ * via longjmp or exceptions leaves stale frames behind, and when the
+ * stack fills up its oldest half is discarded; both only affect the
+ * attribution of callers for the affected frames.
+ */
+
+#include <string.h> /* for memset, strcmp, strlen */
+#include <stddef.h> /* for offsetof */
+#ifdef LINUX
+# include <sys/time.h> /* for ITIMER_PROF */
+#endif
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drutil.h"
+#include "hashtable.h"
+#include "callgraph.h"
+
+#ifdef WINDOWS
+# define DISPLAY_STRING(msg) dr_messagebox(msg)
+#else
+# define DISPLAY_STRING(msg) dr_printf("%s\n", msg);
+#endif
+
+#define NULL_TERMINATE(buf) buf[(sizeof(buf)/sizeof(buf[0])) - 1] = '\0'
+#define BUFFER_SIZE_ELEMENTS(buf) (sizeof(buf)/sizeof(buf[0]))
+
+/* Max number of shadow stack frames.  When full, the oldest half is dropped. */
+#define MAX_STACK_DEPTH 4096
+/* Max number of edges buffered before they are folded into the hashtable */
+#define MAX_NUM_EDGES 8192
+#define EDGE_TABLE_BITS 10
+
+/* An edge as written by the inlined code */
+typedef struct _buf_edge_t {
+    app_pc caller;
+    app_pc callee;
+} buf_edge_t;
+
+/* An entry in the per-thread edge hashtable.  The key is the edge itself. */
+typedef struct _edge_count_t {
+    buf_edge_t edge;
+    uint64 count;
+} edge_count_t;
+
+/* The first five fields are accessed by inlined code.  The "neg" fields hold
+ * the negative of the address they represent so that a single lea can
+ * compare them to a pointer in xcx for use with jecxz.
+ */
+typedef struct {
+    /* next free shadow stack slot */
+    app_pc *stack_ptr;
+    /* negative of the first real shadow stack slot: the stack is empty */
+    ptr_int_t stack_neg_floor;
+    /* negative of the end of the shadow stack: the stack is full */
+    ptr_int_t stack_neg_end;
+    /* next free edge buffer slot */
+    buf_edge_t *edge_ptr;
+    /* negative of the end of the edge buffer */
+    ptr_int_t edge_neg_end;
+    /* The shadow stack.  Slot 0 is a NULL guard entry which serves as the
+     * caller of the outermost frame.
+     */
+    app_pc *stack_base;
+    buf_edge_t *edge_base;
+    hashtable_t edges;
+    file_t log;
+    /* set while folding the edge buffer so the itimer leaves it alone */
+    volatile bool flushing;
+    uint64 num_calls;
+    uint64 stack_truncations;
+    uint64 dropped_samples;
+} per_thread_t;
+
+#define STACK_ALLOC_SIZE ((MAX_STACK_DEPTH + 1) * sizeof(app_pc))
+#define EDGE_BUF_SIZE (MAX_NUM_EDGES * sizeof(buf_edge_t))
+
+static client_id_t client_id;
+static app_pc code_cache;
+static void *mutex; /* for multithread support */
+static int tls_index;
+/* itimer period in milliseconds, or 0 to record every call */
+static uint sample_ms;
+static uint64 num_calls;   /* global count of instrumented calls executed */
+static uint num_edges;     /* global count of distinct per-thread edges */
+
+static void event_exit(void);
+static void event_thread_init(void *drcontext);
+static void event_thread_exit(void *drcontext);
+static dr_emit_flags_t event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                         bool for_trace, bool translating,
+                                         OUT void **user_data);
+static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                                       instr_t *instr, bool for_trace, bool translating,
+                                       void *user_data);
+#ifdef LINUX
+static void event_timer(void *drcontext, dr_mcontext_t *mcontext);
+#endif
+static void code_cache_init(void);
+static void code_cache_exit(void);
+
+static void
+options_init(client_id_t id)
+{
+    const char *opstr = dr_get_options(id);
+    char token[64];
+    while ((opstr = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token))) != NULL) {
+        if (strcmp(token, "-sample") == 0) {
+            opstr = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token));
+            if (opstr == NULL || dr_sscanf(token, "%u", &sample_ms) != 1) {
+                dr_fprintf(STDERR, "callgraph: -sample requires a period in ms\n");
+                dr_abort();
+            }
+        } else {
+            dr_fprintf(STDERR, "callgraph: unknown option %s\n", token);
+            dr_abort();
+        }
+    }
+#ifndef LINUX
+    if (sample_ms > 0) {
+        dr_log(NULL, LOG_ALL, 1, "callgraph: -sample is only supported on Linux\n");
+        sample_ms = 0;
+    }
+#endif
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    /* Specify priority relative to other instrumentation operations: */
+    drmgr_priority_t priority = {
+        sizeof(priority), /* size of struct */
+        "callgraph",      /* name of our operation */
+        NULL,             /* optional name of operation we should precede */
+        NULL,             /* optional name of operation we should follow */
+        0};               /* numeric priority */
+    drmgr_init();
+    drutil_init();
+    client_id = id;
+    options_init(id);
+    mutex = dr_mutex_create();
+    dr_register_exit_event(event_exit);
+    if (!drmgr_register_thread_init_event(event_thread_init) ||
+        !drmgr_register_thread_exit_event(event_thread_exit) ||
+        !drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                 event_bb_insert,
+                                                 &priority)) {
+        /* something is wrong: can't continue */
+        DR_ASSERT(false);
+        return;
+    }
+    tls_index = drmgr_register_tls_field();
+    DR_ASSERT(tls_index != -1);
+
+    code_cache_init();
+    /* make it easy to tell, by looking at log file, which client executed */
+    dr_log(NULL, LOG_ALL, 1, "Client 'callgraph' initializing\n");
+#ifdef SHOW_RESULTS
+    if (dr_is_notify_on()) {
+# ifdef WINDOWS
+        /* ask for best-effort printing to cmd window.  must be called in dr_init(). */
+        dr_enable_console_printing();
+# endif
+        dr_fprintf(STDERR, "Client callgraph is running\n");
+    }
+#endif
+}
+
+static void
+event_exit(void)
+{
+#ifdef SHOW_RESULTS
+    char msg[512];
+    int len;
+    len = dr_snprintf(msg, sizeof(msg)/sizeof(msg[0]),
+                      "Instrumentation results:\n"
+                      "  saw %llu calls\n"
+                      "  recorded %u caller->callee edges\n",
+                      num_calls, num_edges);
+    DR_ASSERT(len > 0);
+    NULL_TERMINATE(msg);
+    DISPLAY_STRING(msg);
+#endif /* SHOW_RESULTS */
+#ifdef LINUX
+    if (sample_ms > 0)
+        dr_set_itimer(ITIMER_PROF, 0, NULL);
+#endif
+    code_cache_exit();
+    drmgr_unregister_tls_field(tls_index);
+    dr_mutex_destroy(mutex);
+    drutil_exit();
+    drmgr_exit();
+}
+
+/***************************************************************************
+ * Edge table
+ */
+
+static uint
+edge_hash(void *key)
+{
+    buf_edge_t *edge = (buf_edge_t *) key;
+    ptr_uint_t hash = (ptr_uint_t)edge->caller ^ ((ptr_uint_t)edge->callee << 7) ^
+        ((ptr_uint_t)edge->callee >> 3);
+    return (uint) hash;
+}
+
+static bool
+edge_cmp(void *key1, void *key2)
+{
+    buf_edge_t *edge1 = (buf_edge_t *) key1;
+    buf_edge_t *edge2 = (buf_edge_t *) key2;
+    return edge1->caller == edge2->caller && edge1->callee == edge2->callee;
+}
+
+static void
+edge_free(void *payload)
+{
+    dr_global_free(payload, sizeof(edge_count_t));
+}
+
+static void
+edge_add(per_thread_t *data, buf_edge_t *edge)
+{
+    edge_count_t *entry = (edge_count_t *) hashtable_lookup(&data->edges, edge);
+    if (entry == NULL) {
+        entry = (edge_count_t *) dr_global_alloc(sizeof(*entry));
+        entry->edge = *edge;
+        entry->count = 0;
+        hashtable_add(&data->edges, &entry->edge, entry);
+    }
+    entry->count++;
+}
+
+/* Folds the edge buffer into the edge table */
+static void
+flush_edges(per_thread_t *data)
+{
+    buf_edge_t *edge;
+    data->flushing = true;
+    for (edge = data->edge_base; edge < data->edge_ptr; edge++)
+        edge_add(data, edge);
+    if (sample_ms == 0)
+        data->num_calls += data->edge_ptr - data->edge_base;
+    data->edge_ptr = data->edge_base;
+    data->flushing = false;
+}
+
+/* Discards the oldest half of a full shadow stack */
+static void
+truncate_stack(per_thread_t *data)
+{
+    uint i;
+    for (i = 1; i <= MAX_STACK_DEPTH/2; i++)
+        data->stack_base[i] = data->stack_base[i + MAX_STACK_DEPTH/2];
+    data->stack_ptr -= MAX_STACK_DEPTH/2;
+    data->stack_truncations++;
+}
+
+#ifdef LINUX
+/* Called from a signal handler: we must not take locks or perform I/O.
+ * We add each edge of the current shadow stack to the edge buffer, which
+ * the inlined call sequence flushes at its next call once it is full.
+ */
+static void
+event_timer(void *drcontext, dr_mcontext_t *mcontext)
+{
+    per_thread_t *data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_index);
+    app_pc *frame;
+    if (data == NULL || data->flushing)
+        return;
+    for (frame = data->stack_ptr - 1; frame > data->stack_base; frame--) {
+        if (data->edge_ptr >= data->edge_base + MAX_NUM_EDGES) {
+            data->dropped_samples++;
+            break;
+        }
+        data->edge_ptr->caller = *(frame - 1);
+        data->edge_ptr->callee = *frame;
+        data->edge_ptr++;
+    }
+}
+#endif
+
+/***************************************************************************
+ * Thread events
+ */
+
+#ifdef WINDOWS
+# define IF_WINDOWS(x) x
+#else
+# define IF_WINDOWS(x) /* nothing */
+#endif
+
+static void
+event_thread_init(void *drcontext)
+{
+    char logname[MAXIMUM_PATH];
+    char *dirsep;
+    int len;
+    per_thread_t *data;
+
+    /* allocate thread private data */
+    data = dr_thread_alloc(drcontext, sizeof(per_thread_t));
+    memset(data, 0, sizeof(*data));
+    data->stack_base = dr_thread_alloc(drcontext, STACK_ALLOC_SIZE);
+    data->stack_base[0] = NULL;
+    data->stack_ptr = &data->stack_base[1];
+    data->stack_neg_floor = -(ptr_int_t)&data->stack_base[1];
+    data->stack_neg_end = -(ptr_int_t)&data->stack_base[MAX_STACK_DEPTH + 1];
+    data->edge_base = dr_thread_alloc(drcontext, EDGE_BUF_SIZE);
+    data->edge_ptr = data->edge_base;
+    data->edge_neg_end = -(ptr_int_t)(data->edge_base + MAX_NUM_EDGES);
+    hashtable_init_ex(&data->edges, EDGE_TABLE_BITS, HASH_CUSTOM, false/*!strdup*/,
+                      false/*!synch: thread-private*/, edge_free, edge_hash, edge_cmp);
+    drmgr_set_tls_field(drcontext, tls_index, data);
+
+    /* We're going to dump our data to a per-thread file.
+     * On Windows we need an absolute path so we place it in
+     * the same directory as our library.
+     */
+    len = dr_snprintf(logname, sizeof(logname)/sizeof(logname[0]),
+                      "%s", dr_get_client_path(client_id));
+    DR_ASSERT(len > 0);
+    for (dirsep = logname + len; *dirsep != '/' IF_WINDOWS(&& *dirsep != '\\'); dirsep--)
+        DR_ASSERT(dirsep > logname);
+    len = dr_snprintf(dirsep + 1,
+                      (sizeof(logname) - (dirsep - logname))/sizeof(logname[0]),
+                      "callgraph.%d.log", dr_get_thread_id(drcontext));
+    DR_ASSERT(len > 0);
+    NULL_TERMINATE(logname);
+    data->log = dr_open_file(logname, DR_FILE_WRITE_OVERWRITE);
+    DR_ASSERT(data->log != INVALID_FILE);
+    dr_log(drcontext, LOG_ALL, 1,
+           "callgraph: log for thread %d is %s\n",
+           dr_get_thread_id(drcontext), logname);
+
+#ifdef LINUX
+    /* Itimers are shared by a thread group, so only install one if this
+     * thread's group does not have one yet.
+     */
+    if (sample_ms > 0 && dr_get_itimer(ITIMER_PROF) == 0) {
+        if (!dr_set_itimer(ITIMER_PROF, sample_ms, event_timer))
+            dr_log(drcontext, LOG_ALL, 1, "callgraph: unable to install itimer\n");
+    }
+#endif
+}
+
+static uint
+write_modules(file_t f)
+{
+    uint count = 0;
+    dr_module_iterator_t *iter = dr_module_iterator_start();
+    while (dr_module_iterator_hasnext(iter)) {
+        module_data_t *mod = dr_module_iterator_next(iter);
+        callgraph_module_t rec;
+        if (mod->full_path != NULL) {
+            rec.start = (uint64)(ptr_uint_t) mod->start;
+            rec.end = (uint64)(ptr_uint_t) mod->end;
+            rec.path_len = (uint) strlen(mod->full_path);
+            rec.padding = 0;
+            dr_write_file(f, &rec, sizeof(rec));
+            dr_write_file(f, mod->full_path, rec.path_len);
+            count++;
+        }
+        dr_free_module_data(mod);
+    }
+    dr_module_iterator_stop(iter);
+    return count;
+}
+
+static uint
+write_edges(file_t f, hashtable_t *table)
+{
+    uint count = 0, i;
+    /* drcontainers does not provide an iterator so we walk the buckets */
+    for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = table->table[i]; he != NULL; he = he->next) {
+            edge_count_t *entry = (edge_count_t *) he->payload;
+            callgraph_edge_t rec;
+            rec.caller = (uint64)(ptr_uint_t) entry->edge.caller;
+            rec.callee = (uint64)(ptr_uint_t) entry->edge.callee;
+            rec.count = entry->count;
+            dr_write_file(f, &rec, sizeof(rec));
+            count++;
+        }
+    }
+    return count;
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    per_thread_t *data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_index);
+    callgraph_file_header_t hdr;
+
+    flush_edges(data);
+
+    /* We write a placeholder header and fill in the counts afterward */
+    memset(&hdr, 0, sizeof(hdr));
+    dr_write_file(data->log, &hdr, sizeof(hdr));
+    hdr.magic = CALLGRAPH_MAGIC;
+    hdr.version = CALLGRAPH_VERSION;
+    hdr.flags = (sample_ms > 0) ? CALLGRAPH_FLAG_SAMPLED : 0;
+    hdr.thread_id = (uint) dr_get_thread_id(drcontext);
+    hdr.num_modules = write_modules(data->log);
+    hdr.num_edges = write_edges(data->log, &data->edges);
+    hdr.stack_truncations = data->stack_truncations;
+    hdr.dropped_samples = data->dropped_samples;
+    if (dr_file_seek(data->log, 0, DR_SEEK_SET))
+        dr_write_file(data->log, &hdr, sizeof(hdr));
+    dr_close_file(data->log);
+
+    dr_mutex_lock(mutex);
+    num_calls += data->num_calls;
+    num_edges += hdr.num_edges;
+    dr_mutex_unlock(mutex);
+
+    /* Keep the itimer from seeing freed memory */
+    drmgr_set_tls_field(drcontext, tls_index, NULL);
+    hashtable_delete(&data->edges);
+    dr_thread_free(drcontext, data->edge_base, EDGE_BUF_SIZE);
+    dr_thread_free(drcontext, data->stack_base, STACK_ALLOC_SIZE);
+    dr_thread_free(drcontext, data, sizeof(per_thread_t));
+}
+
+/***************************************************************************
+ * Slow path
+ */
+
+/* clean_call empties a full edge buffer and makes room on a full shadow stack */
+static void
+clean_call(void)
+{
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_index);
+    if (data->edge_ptr > data->edge_base)
+        flush_edges(data);
+    if (data->stack_ptr >= &data->stack_base[MAX_STACK_DEPTH + 1])
+        truncate_stack(data);
+}
+
+static void
+code_cache_init(void)
+{
+    void         *drcontext;
+    instrlist_t  *ilist;
+    instr_t      *where;
+    byte         *end;
+
+    drcontext  = dr_get_current_drcontext();
+    code_cache = dr_nonheap_alloc(PAGE_SIZE,
+                                  DR_MEMPROT_READ  |
+                                  DR_MEMPROT_WRITE |
+                                  DR_MEMPROT_EXEC);
+    ilist = instrlist_create(drcontext);
+    /* The lean procecure simply performs a clean call, and then jumps back
+     * to the return address placed in xcx by the inlined code.
+     */
+    where = INSTR_CREATE_jmp_ind(drcontext, opnd_create_reg(DR_REG_XCX));
+    instrlist_meta_append(ilist, where);
+    dr_insert_clean_call(drcontext, ilist, where, (void *)clean_call, false, 0);
+    /* Encodes the instructions into memory and then cleans up. */
+    end = instrlist_encode(drcontext, ilist, code_cache, false);
+    DR_ASSERT((end - code_cache) < PAGE_SIZE);
+    instrlist_clear_and_destroy(drcontext, ilist);
+    /* set the memory as just +rx now */
+    dr_memory_protect(code_cache, PAGE_SIZE, DR_MEMPROT_READ | DR_MEMPROT_EXEC);
+}
+
+static void
+code_cache_exit(void)
+{
+    dr_nonheap_free(code_cache, PAGE_SIZE);
+}
+
+/***************************************************************************
+ * Instrumentation
+ */
+
+/* Inserts a "jecxz slowpath" after computing xcx = ptr_field - neg_field, i.e.,
+ * branches if the pointer field has reached the limit in neg_field.
+ * Clobbers xcx and xax.
+ */
+static void
+insert_limit_check(void *drcontext, instrlist_t *ilist, instr_t *where,
+                   reg_id_t reg_data, int ptr_offs, int neg_offs, instr_t *target)
+{
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+        (drcontext, opnd_create_reg(DR_REG_XCX), OPND_CREATE_MEMPTR(reg_data, ptr_offs)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+        (drcontext, opnd_create_reg(DR_REG_XAX), OPND_CREATE_MEMPTR(reg_data, neg_offs)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lea
+        (drcontext, opnd_create_reg(DR_REG_XCX),
+         opnd_create_base_disp(DR_REG_XAX, DR_REG_XCX, 1, 0, OPSZ_lea)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_jecxz
+        (drcontext, opnd_create_instr(target)));
+}
+
+/* Places the target of the call "where" into xdx.  Must be called before
+ * any scratch register is modified, as the target may depend on them.
+ */
+static void
+insert_get_call_target(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    opnd_t target = instr_get_target(where);
+    if (opnd_is_pc(target)) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_imm
+            (drcontext, opnd_create_reg(DR_REG_XDX),
+             OPND_CREATE_INTPTR((ptr_int_t)opnd_get_pc(target))));
+    } else if (opnd_is_reg(target)) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+            (drcontext, opnd_create_reg(DR_REG_XDX), target));
+    } else {
+        /* use drutil to get the address of the pointer, then load it */
+        bool ok = drutil_insert_get_mem_addr(drcontext, ilist, where, target,
+                                             DR_REG_XDX, DR_REG_XCX);
+        DR_ASSERT(ok);
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+            (drcontext, opnd_create_reg(DR_REG_XDX), OPND_CREATE_MEMPTR(DR_REG_XDX, 0)));
+    }
+}
+
+/* Inserts code before the call "where" that performs:
+ *   callee = target of where;
+ *   caller = *(stack_ptr - 1);
+ *   *stack_ptr++ = callee;
+ *   if (!sampling)
+ *     *edge_ptr++ = (caller, callee);
+ *   if (edge_ptr == edge_end || stack_ptr == stack_end)
+ *     clean_call();
+ * The sampling itimer also fills the edge buffer so we check it in both modes.
+ */
+static void
+instrument_call(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    instr_t *call, *restore;
+    reg_id_t reg_data = DR_REG_XBX;
+
+    /* We could avoid some of these spills via a liveness analysis */
+    dr_save_reg(drcontext, ilist, where, DR_REG_XAX, SPILL_SLOT_1);
+    dr_save_reg(drcontext, ilist, where, DR_REG_XBX, SPILL_SLOT_2);
+    dr_save_reg(drcontext, ilist, where, DR_REG_XCX, SPILL_SLOT_3);
+    dr_save_reg(drcontext, ilist, where, DR_REG_XDX, SPILL_SLOT_4);
+
+    insert_get_call_target(drcontext, ilist, where);
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg_data);
+
+    /* push the callee onto the shadow stack, remembering the caller */
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+        (drcontext, opnd_create_reg(DR_REG_XCX),
+         OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, stack_ptr))));
+    if (sample_ms == 0) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+            (drcontext, opnd_create_reg(DR_REG_XAX),
+             OPND_CREATE_MEMPTR(DR_REG_XCX, -(int)sizeof(app_pc))));
+    }
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+        (drcontext, OPND_CREATE_MEMPTR(DR_REG_XCX, 0), opnd_create_reg(DR_REG_XDX)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lea
+        (drcontext, opnd_create_reg(DR_REG_XCX),
+         opnd_create_base_disp(DR_REG_XCX, DR_REG_NULL, 0, sizeof(app_pc), OPSZ_lea)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+        (drcontext, OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, stack_ptr)),
+         opnd_create_reg(DR_REG_XCX)));
+
+    /* append the edge to the edge buffer */
+    if (sample_ms == 0) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+            (drcontext, opnd_create_reg(DR_REG_XCX),
+             OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, edge_ptr))));
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+            (drcontext, OPND_CREATE_MEMPTR(DR_REG_XCX, offsetof(buf_edge_t, caller)),
+             opnd_create_reg(DR_REG_XAX)));
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+            (drcontext, OPND_CREATE_MEMPTR(DR_REG_XCX, offsetof(buf_edge_t, callee)),
+             opnd_create_reg(DR_REG_XDX)));
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lea
+            (drcontext, opnd_create_reg(DR_REG_XCX),
+             opnd_create_base_disp(DR_REG_XCX, DR_REG_NULL, 0, sizeof(buf_edge_t),
+                                   OPSZ_lea)));
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+            (drcontext, OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, edge_ptr)),
+             opnd_create_reg(DR_REG_XCX)));
+    }
+
+    /* lea + jecxz do not touch the eflags so we need not preserve them */
+    call = INSTR_CREATE_label(drcontext);
+    restore = INSTR_CREATE_label(drcontext);
+    insert_limit_check(drcontext, ilist, where, reg_data,
+                       offsetof(per_thread_t, edge_ptr),
+                       offsetof(per_thread_t, edge_neg_end), call);
+    insert_limit_check(drcontext, ilist, where, reg_data,
+                       offsetof(per_thread_t, stack_ptr),
+                       offsetof(per_thread_t, stack_neg_end), call);
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_jmp
+        (drcontext, opnd_create_instr(restore)));
+
+    /* We jump to the lean procedure, passing the return address in xcx */
+    instrlist_meta_preinsert(ilist, where, call);
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_imm
+        (drcontext, opnd_create_reg(DR_REG_XCX), opnd_create_instr(restore)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_jmp
+        (drcontext, opnd_create_pc(code_cache)));
+
+    instrlist_meta_preinsert(ilist, where, restore);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XAX, SPILL_SLOT_1);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XBX, SPILL_SLOT_2);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XCX, SPILL_SLOT_3);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XDX, SPILL_SLOT_4);
+}
+
+/* Inserts code before the return "where" that performs:
+ *   if (stack_ptr != stack_floor)
+ *     stack_ptr--;
+ */
+static void
+instrument_return(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    instr_t *restore = INSTR_CREATE_label(drcontext);
+    reg_id_t reg_data = DR_REG_XBX;
+
+    dr_save_reg(drcontext, ilist, where, DR_REG_XAX, SPILL_SLOT_1);
+    dr_save_reg(drcontext, ilist, where, DR_REG_XBX, SPILL_SLOT_2);
+    dr_save_reg(drcontext, ilist, where, DR_REG_XCX, SPILL_SLOT_3);
+
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg_data);
+    /* an unmatched return (e.g., the thread's outermost) leaves the stack empty */
+    insert_limit_check(drcontext, ilist, where, reg_data,
+                       offsetof(per_thread_t, stack_ptr),
+                       offsetof(per_thread_t, stack_neg_floor), restore);
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_ld
+        (drcontext, opnd_create_reg(DR_REG_XCX),
+         OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, stack_ptr))));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lea
+        (drcontext, opnd_create_reg(DR_REG_XCX),
+         opnd_create_base_disp(DR_REG_XCX, DR_REG_NULL, 0, -(int)sizeof(app_pc),
+                               OPSZ_lea)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_mov_st
+        (drcontext, OPND_CREATE_MEMPTR(reg_data, offsetof(per_thread_t, stack_ptr)),
+         opnd_create_reg(DR_REG_XCX)));
+
+    instrlist_meta_preinsert(ilist, where, restore);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XAX, SPILL_SLOT_1);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XBX, SPILL_SLOT_2);
+    dr_restore_reg(drcontext, ilist, where, DR_REG_XCX, SPILL_SLOT_3);
+}
+
+/* our operations here only need to see a single-instruction window so
+ * we do not need to do any whole-bb analysis
+ */
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating,
+                  OUT void **user_data)
+{
+    return DR_EMIT_DEFAULT;
+}
+
+/* event_bb_insert instruments calls and returns -- ignoring far calls/rets */
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                instr_t *instr, bool for_trace, bool translating,
+                void *user_data)
+{
+    if (instr_get_app_pc(instr) == NULL || !instr_opcode_valid(instr))
+        return DR_EMIT_DEFAULT;
+    if (instr_is_call_direct(instr) || instr_is_call_indirect(instr))
+        instrument_call(drcontext, bb, instr);
+    else if (instr_is_return(instr))
+        instrument_return(drcontext, bb, instr);
+    return DR_EMIT_DEFAULT;
+}
@@ -0,0 +1,79 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Binary call graph file format shared by the callgraph.c client and the
+ * callgraph2dot.c offline converter.
+ *
+ * A file consists of a callgraph_file_header_t followed by num_modules
+ * module records (a callgraph_module_t followed by path_len bytes of
+ * path, not NULL-terminated) and then num_edges callgraph_edge_t records.
+ * Addresses are always stored as 64-bit values so that a 64-bit converter
+ * can read 32-bit files and vice versa.
+ */
+
+#ifndef _CALLGRAPH_H_
+#define _CALLGRAPH_H_ 1
+
+#define CALLGRAPH_MAGIC   0x48504743 /* "CGPH" */
+#define CALLGRAPH_VERSION 1
+
+/* callgraph_file_header_t.flags */
+#define CALLGRAPH_FLAG_SAMPLED 0x1 /* counts are timer samples, not calls */
+
+typedef struct _callgraph_file_header_t {
+    uint magic;
+    uint version;
+    uint flags;
+    uint thread_id;
+    uint num_modules;
+    uint num_edges;
+    /* number of times the shadow stack overflowed and dropped its oldest frames */
+    uint64 stack_truncations;
+    /* number of sampled edges that did not fit in the edge buffer */
+    uint64 dropped_samples;
+} callgraph_file_header_t;
+
+typedef struct _callgraph_module_t {
+    uint64 start;
+    uint64 end;
+    uint path_len;
+    uint padding; /* keeps the layout identical for 32-bit and 64-bit */
+} callgraph_module_t;
+
+/* A caller of 0 is the root of the thread (no known caller) */
+typedef struct _callgraph_edge_t {
+    uint64 caller;
+    uint64 callee;
+    uint64 count;
+} callgraph_edge_t;
+
+#endif /* _CALLGRAPH_H_ */
@@ -0,0 +1,298 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Standalone API Sample:
+ * callgraph2dot.c
+ *
+ * Merges one or more per-thread call graph files produced by the
+ * callgraph.c client and prints the combined graph to stdout in DOT
+ * format.  Nodes are labeled as module+offset using the module list
+ * stored in each file.
+ *
+ * Usage: callgraph2dot <callgraph.tid.log> [<callgraph.tid.log> ...]
+ */
+
+#include "dr_api.h"
+#include <stdlib.h> /* for malloc, realloc, qsort */
+#include <string.h> /* for strrchr */
+#include "callgraph.h"
+
+typedef struct _module_t {
+    uint64 start;
+    uint64 end;
+    char *name;
+} module_t;
+
+typedef struct _node_t {
+    uint64 pc;
+    uint id;
+} node_t;
+
+static module_t *modules;
+static uint num_modules, max_modules;
+static callgraph_edge_t *edges;
+static uint num_edges, max_edges;
+static node_t *nodes;
+static uint num_nodes;
+
+static void *
+grow_array(void *array, uint *max, size_t elem_size)
+{
+    *max = (*max == 0) ? 64 : *max * 2;
+    array = realloc(array, *max * elem_size);
+    if (array == NULL) {
+        dr_fprintf(STDERR, "Error: out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static void
+add_module(callgraph_module_t *rec, char *path)
+{
+    uint i;
+    char *name;
+    for (i = 0; i < num_modules; i++) {
+        if (modules[i].start == rec->start && modules[i].end == rec->end)
+            return; /* already listed by another thread */
+    }
+    if (num_modules == max_modules)
+        modules = grow_array(modules, &max_modules, sizeof(*modules));
+    name = strrchr(path, '/');
+#ifdef WINDOWS
+    if (name == NULL)
+        name = strrchr(path, '\\');
+#endif
+    modules[num_modules].start = rec->start;
+    modules[num_modules].end = rec->end;
+    modules[num_modules].name = (name == NULL) ? path : name + 1;
+    num_modules++;
+}
+
+static void
+add_edge(callgraph_edge_t *rec)
+{
+    if (num_edges == max_edges)
+        edges = grow_array(edges, &max_edges, sizeof(*edges));
+    edges[num_edges++] = *rec;
+}
+
+static int
+edge_compare(const void *a, const void *b)
+{
+    const callgraph_edge_t *e1 = (const callgraph_edge_t *) a;
+    const callgraph_edge_t *e2 = (const callgraph_edge_t *) b;
+    if (e1->caller != e2->caller)
+        return (e1->caller < e2->caller) ? -1 : 1;
+    if (e1->callee != e2->callee)
+        return (e1->callee < e2->callee) ? -1 : 1;
+    return 0;
+}
+
+/* Threads are merged by summing the counts of identical edges */
+static void
+merge_edges(void)
+{
+    uint i, j;
+    qsort(edges, num_edges, sizeof(*edges), edge_compare);
+    for (i = 0, j = 0; i < num_edges; i++) {
+        if (j > 0 && edge_compare(&edges[j-1], &edges[i]) == 0) {
+            edges[j-1].count += edges[i].count;
+            continue;
+        }
+        edges[j++] = edges[i];
+    }
+    num_edges = j;
+}
+
+static bool
+read_file(const char *fname)
+{
+    file_t f;
+    callgraph_file_header_t hdr;
+    uint i;
+    bool ok = false;
+
+    f = dr_open_file(fname, DR_FILE_READ);
+    if (f == INVALID_FILE) {
+        dr_fprintf(STDERR, "Error opening %s\n", fname);
+        return false;
+    }
+    if (dr_read_file(f, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != CALLGRAPH_MAGIC) {
+        dr_fprintf(STDERR, "Error: %s is not a call graph file\n", fname);
+        goto read_file_done;
+    }
+    if (hdr.version != CALLGRAPH_VERSION) {
+        dr_fprintf(STDERR, "Error: %s has version %d but tool expects %d\n",
+                   fname, hdr.version, CALLGRAPH_VERSION);
+        goto read_file_done;
+    }
+    if (hdr.stack_truncations > 0 || hdr.dropped_samples > 0) {
+        dr_fprintf(STDERR, "Warning: thread %d had %llu shadow stack truncations "
+                   "and %llu dropped samples\n", hdr.thread_id,
+                   hdr.stack_truncations, hdr.dropped_samples);
+    }
+    for (i = 0; i < hdr.num_modules; i++) {
+        callgraph_module_t rec;
+        char *path;
+        if (dr_read_file(f, &rec, sizeof(rec)) != sizeof(rec))
+            goto read_file_truncated;
+        /* we leak the path: it's referenced by the module table until exit */
+        path = malloc(rec.path_len + 1);
+        if (path == NULL ||
+            dr_read_file(f, path, rec.path_len) != (ssize_t) rec.path_len)
+            goto read_file_truncated;
+        path[rec.path_len] = '\0';
+        add_module(&rec, path);
+    }
+    for (i = 0; i < hdr.num_edges; i++) {
+        callgraph_edge_t rec;
+        if (dr_read_file(f, &rec, sizeof(rec)) != sizeof(rec))
+            goto read_file_truncated;
+        add_edge(&rec);
+    }
+    ok = true;
+    goto read_file_done;
+ read_file_truncated:
+    dr_fprintf(STDERR, "Error: %s is truncated\n", fname);
+ read_file_done:
+    dr_close_file(f);
+    return ok;
+}
+
+static int
+node_compare(const void *a, const void *b)
+{
+    const node_t *n1 = (const node_t *) a;
+    const node_t *n2 = (const node_t *) b;
+    if (n1->pc < n2->pc)
+        return -1;
+    return (n1->pc > n2->pc) ? 1 : 0;
+}
+
+/* Returns the node id for pc from the sorted node array */
+static uint
+node_lookup(uint64 pc)
+{
+    uint lo = 0, hi = num_nodes;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (nodes[mid].pc == pc)
+            return nodes[mid].id;
+        if (nodes[mid].pc < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    DR_ASSERT(false);
+    return 0;
+}
+
+static void
+build_nodes(void)
+{
+    uint i, j;
+    nodes = malloc(2 * (num_edges + 1) * sizeof(*nodes));
+    if (nodes == NULL) {
+        dr_fprintf(STDERR, "Error: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < num_edges; i++) {
+        nodes[2*i].pc = edges[i].caller;
+        nodes[2*i+1].pc = edges[i].callee;
+    }
+    qsort(nodes, 2 * num_edges, sizeof(*nodes), node_compare);
+    /* remove duplicates and assign ids in address order */
+    for (i = 0, j = 0; i < 2 * num_edges; i++) {
+        if (j > 0 && nodes[j-1].pc == nodes[i].pc)
+            continue;
+        nodes[j].pc = nodes[i].pc;
+        nodes[j].id = j;
+        j++;
+    }
+    num_nodes = j;
+}
+
+static void
+print_node_label(uint64 pc)
+{
+    uint i;
+    if (pc == 0) {
+        dr_printf("<root>");
+        return;
+    }
+    for (i = 0; i < num_modules; i++) {
+        if (pc >= modules[i].start && pc < modules[i].end) {
+            dr_printf("%s+0x%llx", modules[i].name, pc - modules[i].start);
+            return;
+        }
+    }
+    dr_printf("0x%llx", pc);
+}
+
+static void
+print_dot(void)
+{
+    uint i;
+    dr_printf("digraph {\n");
+    for (i = 0; i < num_nodes; i++) {
+        dr_printf("n%d [color=blue label=\"", nodes[i].id);
+        print_node_label(nodes[i].pc);
+        dr_printf("\"] ;\n");
+    }
+    for (i = 0; i < num_edges; i++) {
+        dr_printf("n%d -> n%d [label=\"%llu\"];\n", node_lookup(edges[i].caller),
+                  node_lookup(edges[i].callee), edges[i].count);
+    }
+    dr_printf("}\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i;
+    if (argc < 2) {
+        dr_fprintf(STDERR, "Usage: %s <callgraph file> [<callgraph file> ...]\n",
+                   argv[0]);
+        return 1;
+    }
+    dr_standalone_init();
+    for (i = 1; i < argc; i++) {
+        if (!read_file(argv[i]))
+            return 1;
+    }
+    merge_edges();
+    build_nodes();
+    print_dot();
+    return 0;
+}
@@ -41,18 +41,42 @@
  * (1) It fills a buffer and dumps the buffer when it is full.
  * (2) It inlines the buffer filling code to avoid full context switch.
  * (3) It uses lean procedure calling clean call to reduce code cache size.
+ * (4) It uses drutil_insert_get_mem_addrs() to fill in the records for all
+ *     of an instruction's memory references with one set of register spills.
  *
  * Illustrates the use of drutil_expand_rep_string() to expand string
  * loops to obtain every memory reference and of
  * drutil_opnd_mem_size_in_bytes() to obtain the size of OP_enter
- * memory references.
+ * memory references.  If REP_STRING_RANGES is defined, string loops are
+ * instead left intact and drutil_insert_get_rep_string_range() is used to
+ * record each of their memory references as a single range, which avoids
+ * one record per element for large copies.
+ *
+ * Unless READABLE_TRACE is defined, the trace file is mapped into memory
+ * a chunk at a time with dr_map_file() and each thread's buffer is a
+ * window into its mapped file, so a full buffer is "flushed" just by
+ * advancing the window.  The file is extended a chunk at a time, each
+ * chunk is handed to the OS for asynchronous write-back with
+ * dr_flush_mapped_file() when the window leaves it, and at thread exit
+ * the file is truncated to the records written.
+ * With -compress, each full buffer is instead delta-encoded into the
+ * compact format described in memtrace.h, which memtrace_reader decodes.
+ *
+ * Options, which are applied when a block is instrumented:
+ *   -reads_only         record only memory reads
+ *   -writes_only        record only memory writes
+ *   -min_size <bytes>   record only references of at least this size
+ *   -module <name>      record only references made by code in the module
+ *                       with this preferred name; may be repeated
+ *   -compress           write the compressed format (binary traces only)
  */
 
-#include <string.h> /* for memset */
+#include <string.h> /* for memset, strcmp */
 #include <stddef.h> /* for offsetof */
 #include "dr_api.h"
 #include "drmgr.h"
 #include "drutil.h"
+#include "memtrace.h"
 
 #ifdef WINDOWS
 # define DISPLAY_STRING(msg) dr_messagebox(msg)
@@ -60,27 +84,43 @@
 # define DISPLAY_STRING(msg) dr_printf("%s\n", msg);
 #endif
 
+#define BUFFER_SIZE_ELEMENTS(buf) (sizeof(buf)/sizeof(buf[0]))
 #define NULL_TERMINATE(buf) buf[(sizeof(buf)/sizeof(buf[0])) - 1] = '\0'
 
 
-/* Each mem_ref_t includes the type of reference (read or write), 
- * the address referenced, and the size of the reference.
- */
-typedef struct _mem_ref_t {
-    bool  write;
-    void *addr;
-    size_t size;
-    app_pc pc;
-} mem_ref_t;
-
-/* Control the format of memory trace: readable or hexl */
-#define READABLE_TRACE 
+/* Write a text trace rather than the binary mem_ref_t records */
+/* #define READABLE_TRACE */
+/* Record string loops as ranges rather than expanding them */
+/* #define REP_STRING_RANGES */
 /* Max number of mem_ref a buffer can have */
 #define MAX_NUM_MEM_REFS 8192
+/* Max number of mem_refs filled in at once for one instruction.
+ * Instructions with more use one instrument_mem sequence per reference.
+ */
+#define MAX_BATCH_MEM_REFS 4
 /* The size of memory buffer for holding mem_refs. When it fills up, 
  * we dump data from the buffer to the file.
  */
 #define MEM_BUF_SIZE (sizeof(mem_ref_t) * MAX_NUM_MEM_REFS)
+/* A batch can run past the end of the buffer by up to MAX_BATCH_MEM_REFS-1
+ * mem_refs before the full buffer is noticed.
+ */
+#define MEM_BUF_ALLOC_SIZE \
+    (sizeof(mem_ref_t) * (MAX_NUM_MEM_REFS + MAX_BATCH_MEM_REFS - 1))
+
+#ifndef READABLE_TRACE
+/* The amount of the trace file mapped at once.  It is a multiple of 64K,
+ * the file mapping granularity on Windows.
+ */
+# define TRACE_CHUNK_SIZE (MEM_BUF_SIZE * 64)
+# define TRACE_MAP_ALIGN  (64 * 1024)
+/* The size of the buffer that -compress encodes a full mem_ref_t buffer into */
+# define ZBUF_SIZE (64 * 1024)
+#endif
+
+/* Max number of -module options and of loaded modules matching them */
+#define MAX_FILTER_MODULES 16
+#define MAX_MODULE_RANGES  64
 
 /* thread private log file and counter */
 typedef struct {
@@ -91,14 +131,42 @@ typedef struct {
     void   *cache;
     file_t  log;
     uint64  num_refs;
+#ifndef READABLE_TRACE
+    char   *map_base;  /* the currently mapped chunk of log */
+    uint64  map_offs;  /* file offset of map_base */
+    uint64  file_size; /* size log has been extended to */
+    /* for -compress */
+    memtrace_z_state_t *zstate;
+    byte   *zbuf;
+    uint64  zbytes;    /* compressed bytes written to log */
+#endif
 } per_thread_t;
 
+typedef struct _module_range_t {
+    app_pc start;
+    app_pc end;
+} module_range_t;
+
 static client_id_t client_id;
 static app_pc code_cache;
 static void  *mutex;    /* for multithread support */
 static uint64 num_refs; /* keep a global memory reference count */
 static int tls_index;
 
+/* options */
+static bool reads_only;
+static bool writes_only;
+static uint min_size;
+static char filter_modules[MAX_FILTER_MODULES][MAXIMUM_PATH];
+static uint num_filter_modules;
+#ifndef READABLE_TRACE
+static bool compress;
+#endif
+
+/* address ranges of loaded modules named by -module, protected by mutex */
+static module_range_t module_ranges[MAX_MODULE_RANGES];
+static uint num_module_ranges;
+
 static void event_exit(void);
 static void event_thread_init(void *drcontext);
 static void event_thread_exit(void *drcontext);
@@ -113,8 +181,11 @@ static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *
                                        instr_t *instr, bool for_trace, bool translating,
                                        void *user_data);
 
+static void event_module_load(void *drcontext, const module_data_t *info,
+                              bool loaded);
+static void event_module_unload(void *drcontext, const module_data_t *info);
 static void clean_call(void);
-static void memtrace(void *drcontext);
+static void memtrace(void *drcontext, bool thread_exit);
 static void code_cache_init(void);
 static void code_cache_exit(void);
 static void instrument_mem(void        *drcontext, 
@@ -122,6 +193,56 @@ static void instrument_mem(void        *drcontext,
                            instr_t     *where, 
                            int          pos, 
                            bool         write);
+static void instrument_instr(void        *drcontext,
+                             instrlist_t *ilist,
+                             instr_t     *where,
+                             uint         num_refs);
+
+static void
+options_init(client_id_t id)
+{
+    const char *opstr = dr_get_options(id);
+    char token[MAXIMUM_PATH];
+    while ((opstr = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token))) != NULL) {
+        if (strcmp(token, "-reads_only") == 0) {
+            reads_only = true;
+        } else if (strcmp(token, "-writes_only") == 0) {
+            writes_only = true;
+        } else if (strcmp(token, "-min_size") == 0) {
+            opstr = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token));
+            if (opstr == NULL || dr_sscanf(token, "%u", &min_size) != 1) {
+                dr_fprintf(STDERR, "memtrace: -min_size requires a size in bytes\n");
+                dr_abort();
+            }
+        } else if (strcmp(token, "-compress") == 0) {
+#ifdef READABLE_TRACE
+            dr_log(NULL, LOG_ALL, 1,
+                   "memtrace: -compress is ignored for a readable trace\n");
+#else
+            compress = true;
+#endif
+        } else if (strcmp(token, "-module") == 0) {
+            if (num_filter_modules == MAX_FILTER_MODULES) {
+                dr_fprintf(STDERR, "memtrace: too many -module options\n");
+                dr_abort();
+            }
+            opstr = dr_get_token(opstr, filter_modules[num_filter_modules],
+                                 BUFFER_SIZE_ELEMENTS(filter_modules[0]));
+            if (opstr == NULL) {
+                dr_fprintf(STDERR, "memtrace: -module requires a module name\n");
+                dr_abort();
+            }
+            num_filter_modules++;
+        } else {
+            dr_fprintf(STDERR, "memtrace: unknown option %s\n", token);
+            dr_abort();
+        }
+    }
+    if (reads_only && writes_only) {
+        dr_fprintf(STDERR, "memtrace: -reads_only and -writes_only are exclusive\n");
+        dr_abort();
+    }
+}
 
 DR_EXPORT void 
 dr_init(client_id_t id)
@@ -133,6 +254,7 @@ dr_init(client_id_t id)
         NULL,             /* optional name of operation we should precede */
         NULL,             /* optional name of operation we should follow */
         0};               /* numeric priority */
+    options_init(id);
     drmgr_init();
     drutil_init();
     client_id = id;
@@ -149,6 +271,12 @@ dr_init(client_id_t id)
         DR_ASSERT(false);
         return;
     }
+    if (num_filter_modules > 0 &&
+        (!drmgr_register_module_load_event(event_module_load) ||
+         !drmgr_register_module_unload_event(event_module_unload))) {
+        DR_ASSERT(false);
+        return;
+    }
     tls_index = drmgr_register_tls_field();
     DR_ASSERT(tls_index != -1);
 
@@ -194,6 +322,81 @@ event_exit()
 # define IF_WINDOWS(x) /* nothing */
 #endif
 
+#ifndef READABLE_TRACE
+/* Maps the chunk of the trace file containing file_pos, extending the file
+ * if necessary, and points the buffer at file_pos.
+ */
+static void
+trace_map_chunk(per_thread_t *data, uint64 file_pos)
+{
+    size_t size = TRACE_CHUNK_SIZE;
+    uint64 offs = file_pos & ~((uint64)TRACE_MAP_ALIGN - 1);
+    if (data->map_base != NULL) {
+        /* start writing the old chunk back now rather than leaving it all
+         * to the OS's periodic write-back
+         */
+        dr_flush_mapped_file(data->map_base, TRACE_CHUNK_SIZE);
+        dr_unmap_file(data->map_base, TRACE_CHUNK_SIZE);
+    }
+    if (data->file_size < offs + TRACE_CHUNK_SIZE) {
+        /* writing the last byte extends the file with zeroes (sparsely, where
+         * the file system supports it) so that the whole chunk is backed
+         */
+        char zero = 0;
+        data->file_size = offs + TRACE_CHUNK_SIZE;
+        if (!dr_file_seek(data->log, data->file_size - 1, DR_SEEK_SET) ||
+            dr_write_file(data->log, &zero, 1) != 1)
+            DR_ASSERT(false);
+    }
+    data->map_base = dr_map_file(data->log, &size, offs, NULL,
+                                 DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0);
+    DR_ASSERT(data->map_base != NULL && size >= TRACE_CHUNK_SIZE);
+    data->map_offs = offs;
+    data->buf_base = data->map_base + (size_t)(file_pos - offs);
+    data->buf_ptr  = data->buf_base;
+    data->buf_end  = -(ptr_int_t)(data->buf_base + MEM_BUF_SIZE);
+}
+
+/* Moves the buffer window past the records just written, mapping the next
+ * chunk once the current one cannot hold a full buffer.
+ */
+static void
+trace_advance_window(per_thread_t *data)
+{
+    if ((size_t)(data->map_base + TRACE_CHUNK_SIZE - data->buf_ptr) <
+        MEM_BUF_ALLOC_SIZE) {
+        trace_map_chunk(data, data->map_offs + (data->buf_ptr - data->map_base));
+        return;
+    }
+    data->buf_base = data->buf_ptr;
+    data->buf_end  = -(ptr_int_t)(data->buf_base + MEM_BUF_SIZE);
+}
+
+/* Encodes the num_refs mem_refs in the buffer and writes them to the log */
+static void
+trace_compress(per_thread_t *data, int num_refs)
+{
+    mem_ref_t *mem_ref = (mem_ref_t *)data->buf_base;
+    memtrace_z_record_t rec;
+    size_t len = 0;
+    int i;
+    for (i = 0; i < num_refs; i++, mem_ref++) {
+        if (len + MEMTRACE_Z_MAX_RECORD_SIZE > ZBUF_SIZE) {
+            dr_write_file(data->log, data->zbuf, len);
+            data->zbytes += len;
+            len = 0;
+        }
+        rec.pc = (ptr_uint_t)mem_ref->pc;
+        rec.addr = (ptr_uint_t)mem_ref->addr;
+        rec.size = mem_ref->size;
+        rec.type = mem_ref->type;
+        len += memtrace_z_encode(data->zstate, &rec, data->zbuf + len);
+    }
+    dr_write_file(data->log, data->zbuf, len);
+    data->zbytes += len;
+}
+#endif
+
 static void 
 event_thread_init(void *drcontext)
 {
@@ -205,10 +408,6 @@ event_thread_init(void *drcontext)
     /* allocate thread private data */
     data = dr_thread_alloc(drcontext, sizeof(per_thread_t));
     drmgr_set_tls_field(drcontext, tls_index, data);
-    data->buf_base = dr_thread_alloc(drcontext, MEM_BUF_SIZE);
-    data->buf_ptr  = data->buf_base;
-    /* set buf_end to be negative of address of buffer end for the lea later */
-    data->buf_end  = -(ptr_int_t)(data->buf_base + MEM_BUF_SIZE);
     data->num_refs = 0;
 
     /* We're going to dump our data to a per-thread file.
@@ -226,9 +425,37 @@ event_thread_init(void *drcontext)
                       "memtrace.%d.log", dr_get_thread_id(drcontext));
     DR_ASSERT(len > 0);
     NULL_TERMINATE(logname);
+#ifdef READABLE_TRACE
     data->log = dr_open_file(logname, 
                              DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
     DR_ASSERT(data->log != INVALID_FILE);
+    data->buf_base = dr_thread_alloc(drcontext, MEM_BUF_ALLOC_SIZE);
+    data->buf_ptr  = data->buf_base;
+    /* set buf_end to be negative of address of buffer end for the lea later */
+    data->buf_end  = -(ptr_int_t)(data->buf_base + MEM_BUF_SIZE);
+#else
+    if (compress) {
+        memtrace_z_file_header_t hdr = {MEMTRACE_Z_MAGIC, MEMTRACE_Z_VERSION};
+        data->log = dr_open_file(logname,
+                                 DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(data->log != INVALID_FILE);
+        data->buf_base = dr_thread_alloc(drcontext, MEM_BUF_ALLOC_SIZE);
+        data->buf_ptr  = data->buf_base;
+        data->buf_end  = -(ptr_int_t)(data->buf_base + MEM_BUF_SIZE);
+        data->zstate = dr_thread_alloc(drcontext, sizeof(*data->zstate));
+        memtrace_z_init(data->zstate);
+        data->zbuf = dr_thread_alloc(drcontext, ZBUF_SIZE);
+        data->zbytes = dr_write_file(data->log, &hdr, sizeof(hdr));
+    } else {
+        /* read access is needed to map the file */
+        data->log = dr_open_file(logname, DR_FILE_READ | DR_FILE_WRITE_OVERWRITE |
+                                 DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(data->log != INVALID_FILE);
+        data->map_base  = NULL;
+        data->file_size = 0;
+        trace_map_chunk(data, 0);
+    }
+#endif
     dr_log(drcontext, LOG_ALL, 1, 
            "memtrace: log for thread %d is memtrace.%03d\n",
            dr_get_thread_id(drcontext), dr_get_thread_id(drcontext));
@@ -246,13 +473,31 @@ event_thread_exit(void *drcontext)
 {
     per_thread_t *data;
 
-    memtrace(drcontext);
+    memtrace(drcontext, true);
     data = drmgr_get_tls_field(drcontext, tls_index);
     dr_mutex_lock(mutex);
     num_refs += data->num_refs;
     dr_mutex_unlock(mutex);
+#ifdef READABLE_TRACE
+    dr_thread_free(drcontext, data->buf_base, MEM_BUF_ALLOC_SIZE);
+#else
+    if (compress) {
+        dr_log(drcontext, LOG_ALL, 1,
+               "memtrace: thread %d compressed %llu bytes of mem_refs to %llu\n",
+               dr_get_thread_id(drcontext), data->num_refs * sizeof(mem_ref_t),
+               data->zbytes);
+        dr_thread_free(drcontext, data->buf_base, MEM_BUF_ALLOC_SIZE);
+        dr_thread_free(drcontext, data->zstate, sizeof(*data->zstate));
+        dr_thread_free(drcontext, data->zbuf, ZBUF_SIZE);
+    } else {
+        /* drop the zero padding past the last record */
+        uint64 end = data->map_offs + (data->buf_ptr - data->map_base);
+        dr_unmap_file(data->map_base, TRACE_CHUNK_SIZE);
+        if (!dr_file_set_size(data->log, end))
+            DR_ASSERT(false);
+    }
+#endif
     dr_close_file(data->log);
-    dr_thread_free(drcontext, data->buf_base, MEM_BUF_SIZE);
     dr_thread_free(drcontext, data, sizeof(per_thread_t));
 }
 
@@ -264,10 +509,12 @@ static dr_emit_flags_t
 event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
                  bool for_trace, bool translating)
 {
+#ifndef REP_STRING_RANGES
     if (!drutil_expand_rep_string(drcontext, bb)) {
         DR_ASSERT(false);
         /* in release build, carry on: we'll just miss per-iter refs */
     }
+#endif
     return DR_EMIT_DEFAULT;
 }
 
@@ -282,8 +529,77 @@ event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
     return DR_EMIT_DEFAULT;
 }
 
-/* event_bb_insert calls instrument_mem to instrument every
- * application memory reference.
+static void
+event_module_load(void *drcontext, const module_data_t *info, bool loaded)
+{
+    const char *name = dr_module_preferred_name(info);
+    uint i;
+    if (name == NULL)
+        return;
+    for (i = 0; i < num_filter_modules; i++) {
+        if (strcmp(name, filter_modules[i]) == 0)
+            break;
+    }
+    if (i == num_filter_modules)
+        return;
+    dr_mutex_lock(mutex);
+    if (num_module_ranges < MAX_MODULE_RANGES) {
+        module_ranges[num_module_ranges].start = info->start;
+        module_ranges[num_module_ranges].end = info->end;
+        num_module_ranges++;
+    } else {
+        dr_log(drcontext, LOG_ALL, 1,
+               "memtrace: too many modules to trace: ignoring %s\n", name);
+    }
+    dr_mutex_unlock(mutex);
+}
+
+static void
+event_module_unload(void *drcontext, const module_data_t *info)
+{
+    uint i;
+    dr_mutex_lock(mutex);
+    for (i = 0; i < num_module_ranges; i++) {
+        if (module_ranges[i].start == info->start) {
+            module_ranges[i] = module_ranges[--num_module_ranges];
+            break;
+        }
+    }
+    dr_mutex_unlock(mutex);
+}
+
+static bool
+pc_in_filter_module(app_pc pc)
+{
+    bool found = false;
+    uint i;
+    dr_mutex_lock(mutex);
+    for (i = 0; i < num_module_ranges; i++) {
+        if (pc >= module_ranges[i].start && pc < module_ranges[i].end) {
+            found = true;
+            break;
+        }
+    }
+    dr_mutex_unlock(mutex);
+    return found;
+}
+
+/* Returns whether the memory reference ref of instr passes the -reads_only,
+ * -writes_only, and -min_size filters.  For a string loop recorded as a
+ * range, the size compared is that of a single element.
+ */
+static bool
+memref_is_traced(instr_t *instr, opnd_t ref, bool write)
+{
+    if (write ? reads_only : writes_only)
+        return false;
+    if (min_size > 0 && drutil_opnd_mem_size_in_bytes(ref, instr) < min_size)
+        return false;
+    return true;
+}
+
+/* event_bb_insert calls instrument_instr or instrument_mem to instrument
+ * every application memory reference.
  */
 static dr_emit_flags_t
 event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
@@ -291,18 +607,43 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
                 void *user_data)
 {
     int i;
+    uint num_refs, num_traced = 0;
+    bool write;
     if (instr_get_app_pc(instr) == NULL)
         return DR_EMIT_DEFAULT;
+    num_refs = drutil_instr_num_memrefs(instr);
+    if (num_refs == 0)
+        return DR_EMIT_DEFAULT;
+    if (num_filter_modules > 0 && !pc_in_filter_module(instr_get_app_pc(instr)))
+        return DR_EMIT_DEFAULT;
+    for (i = 0; i < (int)num_refs; i++) {
+        opnd_t ref = drutil_instr_get_memref(instr, i, &write);
+        if (memref_is_traced(instr, ref, write))
+            num_traced++;
+    }
+    if (num_traced == 0)
+        return DR_EMIT_DEFAULT;
+    if (num_traced == num_refs && num_refs <= MAX_BATCH_MEM_REFS
+#ifdef REP_STRING_RANGES
+        /* ranges are recorded one reference at a time */
+        && !drutil_instr_is_stringop_loop(instr)
+#endif
+        ) {
+        instrument_instr(drcontext, bb, instr, num_refs);
+        return DR_EMIT_DEFAULT;
+    }
     if (instr_reads_memory(instr)) {
         for (i = 0; i < instr_num_srcs(instr); i++) {
-            if (opnd_is_memory_reference(instr_get_src(instr, i))) {
+            if (opnd_is_memory_reference(instr_get_src(instr, i)) &&
+                memref_is_traced(instr, instr_get_src(instr, i), false)) {
                 instrument_mem(drcontext, bb, instr, i, false);
             }
         }
     }
     if (instr_writes_memory(instr)) {
         for (i = 0; i < instr_num_dsts(instr); i++) {
-            if (opnd_is_memory_reference(instr_get_dst(instr, i))) {
+            if (opnd_is_memory_reference(instr_get_dst(instr, i)) &&
+                memref_is_traced(instr, instr_get_dst(instr, i), true)) {
                 instrument_mem(drcontext, bb, instr, i, true);
             }
         }
@@ -310,8 +651,11 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
     return DR_EMIT_DEFAULT;
 }
 
+/* Dumps the buffered mem_refs.  At thread_exit the buffer is not reset for
+ * more records.
+ */
 static void
-memtrace(void *drcontext)
+memtrace(void *drcontext, bool thread_exit)
 {
     per_thread_t *data;
     int num_refs;
@@ -328,18 +672,31 @@ memtrace(void *drcontext)
     dr_fprintf(data->log,
                "Format: <instr address>,<(r)ead/(w)rite>,<data size>,<data address>\n");
     for (i = 0; i < num_refs; i++) {
+        byte *addr = (byte *) mem_ref->addr;
+        char type = (mem_ref->type & MEMREF_WRITE) != 0 ? 'w' : 'r';
+        if ((mem_ref->type & MEMREF_RANGE) != 0) {
+            /* print string loop ranges in upper case, from their lowest address */
+            size_t elem_size = mem_ref->type >> MEMREF_ELEM_SIZE_SHIFT;
+            type = (char) (type - 'a' + 'A');
+            if ((mem_ref->type & MEMREF_DESCENDING) != 0 && mem_ref->size > 0)
+                addr = addr + elem_size - mem_ref->size;
+        }
         dr_fprintf(data->log, PFX",%c,%d,"PFX"\n",
-                   mem_ref->pc, mem_ref->write ? 'w' : 'r', mem_ref->size, mem_ref->addr);
+                   mem_ref->pc, type, mem_ref->size, addr);
         ++mem_ref;
     }
+    memset(data->buf_base, 0, MEM_BUF_ALLOC_SIZE);
+    data->buf_ptr   = data->buf_base;
 #else
-    dr_write_file(data->log, data->buf_base,
-                  (size_t)(data->buf_ptr - data->buf_base));
+    if (compress) {
+        trace_compress(data, num_refs);
+        data->buf_ptr = data->buf_base;
+    } else if (!thread_exit) {
+        /* the records are already in the file */
+        trace_advance_window(data);
+    }
 #endif
-
-    memset(data->buf_base, 0, MEM_BUF_SIZE);
     data->num_refs += num_refs;
-    data->buf_ptr   = data->buf_base;
 }
 
 /* clean_call dumps the memory reference info to the log file */
@@ -347,7 +704,7 @@ static void
 clean_call(void)
 {
     void *drcontext = dr_get_current_drcontext();
-    memtrace(drcontext);
+    memtrace(drcontext, false);
 }
 
 static void
@@ -399,9 +756,13 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where,
     opnd_t   ref, opnd1, opnd2;
     reg_id_t reg1 = DR_REG_XBX; /* We can optimize it by picking dead reg */
     reg_id_t reg2 = DR_REG_XCX; /* reg2 must be ECX or RCX for jecxz */
+    reg_id_t reg_count = DR_REG_XDX; /* only used for string loop ranges */
+    reg_id_t reg_dir = DR_REG_XAX;   /* only used for string loop ranges */
     per_thread_t *data;
     app_pc pc;
-    
+    uint size;
+    bool range = false;
+
     data = drmgr_get_tls_field(drcontext, tls_index);
 
     /* Steal the register for memory reference address *
@@ -415,12 +776,28 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where,
        ref = instr_get_dst(where, pos);
     else
        ref = instr_get_src(where, pos);
+    /* drutil_opnd_mem_size_in_bytes handles OP_enter */
+    size = drutil_opnd_mem_size_in_bytes(ref, where);
 
-    /* use drutil to get mem address */
-    drutil_insert_get_mem_addr(drcontext, ilist, where, ref, reg1, reg2);
+#ifdef REP_STRING_RANGES
+    if (drutil_instr_is_stringop_loop(where)) {
+        /* use drutil to get the start, count, and direction: we need two more
+         * registers, and the count must be read before reg2 (xcx) is clobbered
+         */
+        dr_save_reg(drcontext, ilist, where, reg_count, SPILL_SLOT_4);
+        dr_save_reg(drcontext, ilist, where, reg_dir, SPILL_SLOT_5);
+        range = drutil_insert_get_rep_string_range(drcontext, ilist, where, ref,
+                                                   reg1, reg_count, reg_dir, reg2);
+        DR_ASSERT(range);
+    }
+#endif
+    if (!range) {
+        /* use drutil to get mem address */
+        drutil_insert_get_mem_addr(drcontext, ilist, where, ref, reg1, reg2);
+    }
     
     /* The following assembly performs the following instructions
-     * buf_ptr->write = write;
+     * buf_ptr->type  = type;
      * buf_ptr->addr  = addr;
      * buf_ptr->size  = size;
      * buf_ptr->pc    = pc;
@@ -435,11 +812,27 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where,
     instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
     instrlist_meta_preinsert(ilist, where, instr);
 
-    /* Move write/read to write field */
-    opnd1 = OPND_CREATE_MEM32(reg2, offsetof(mem_ref_t, write));
-    opnd2 = OPND_CREATE_INT32(write);
-    instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
-    instrlist_meta_preinsert(ilist, where, instr);
+    if (range) {
+        /* type = MEMREF_RANGE | write | (dir * MEMREF_DESCENDING) | elem size:
+         * we use lea to avoid touching the eflags
+         */
+        opnd1 = opnd_create_reg(reg_dir);
+        opnd2 = opnd_create_base_disp(DR_REG_NULL, reg_dir, MEMREF_DESCENDING,
+                                      MEMREF_RANGE | (write ? MEMREF_WRITE : 0) |
+                                      (size << MEMREF_ELEM_SIZE_SHIFT), OPSZ_lea);
+        instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+        opnd1 = OPND_CREATE_MEM32(reg2, offsetof(mem_ref_t, type));
+        opnd2 = opnd_create_reg(reg_resize_to_opsz(reg_dir, OPSZ_4));
+        instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+    } else {
+        /* Move write/read to type field */
+        opnd1 = OPND_CREATE_MEM32(reg2, offsetof(mem_ref_t, type));
+        opnd2 = OPND_CREATE_INT32(write ? MEMREF_WRITE : 0);
+        instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+    }
 
     /* Store address in memory ref */
     opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(mem_ref_t, addr));
@@ -449,9 +842,18 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where,
 
     /* Store size in memory ref */
     opnd1 = OPND_CREATE_MEMPTR(reg2, offsetof(mem_ref_t, size));
-    /* drutil_opnd_mem_size_in_bytes handles OP_enter */
-    opnd2 = OPND_CREATE_INT32(drutil_opnd_mem_size_in_bytes(ref, where));
-    instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+    if (range) {
+        /* count * size, where size is 1, 2, 4, or 8 and thus a valid scale */
+        opnd2 = opnd_create_reg(reg_count);
+        instr = INSTR_CREATE_lea(drcontext, opnd2,
+                                 opnd_create_base_disp(DR_REG_NULL, reg_count,
+                                                       size, 0, OPSZ_lea));
+        instrlist_meta_preinsert(ilist, where, instr);
+        instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+    } else {
+        opnd2 = OPND_CREATE_INT32(size);
+        instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+    }
     instrlist_meta_preinsert(ilist, where, instr);
 
     /* Store pc in memory ref */
@@ -531,5 +933,139 @@ instrument_mem(void *drcontext, instrlist_t *ilist, instr_t *where,
     instrlist_meta_preinsert(ilist, where, restore);
     dr_restore_reg(drcontext, ilist, where, reg1, SPILL_SLOT_2);
     dr_restore_reg(drcontext, ilist, where, reg2, SPILL_SLOT_3);
+    if (range) {
+        dr_restore_reg(drcontext, ilist, where, reg_count, SPILL_SLOT_4);
+        dr_restore_reg(drcontext, ilist, where, reg_dir, SPILL_SLOT_5);
+    }
 }
 
+
+/*
+ * instrument_instr is called for an instruction with num_refs memory
+ * references.  It fills in num_refs consecutive mem_refs at once: drutil
+ * computes all of the addresses using the same scratch registers, so we
+ * spill three registers per instruction rather than two per reference.
+ */
+static void
+instrument_instr(void *drcontext, instrlist_t *ilist, instr_t *where, uint num_refs)
+{
+    instr_t *instr, *call, *restore;
+    opnd_t   ref, opnd1, opnd2;
+    reg_id_t reg1 = DR_REG_XBX; /* holds each address, then the pc */
+    reg_id_t reg2 = DR_REG_XCX; /* reg2 must be ECX or RCX for jecxz */
+    reg_id_t reg3 = DR_REG_XDX; /* scratch for drutil */
+    bool write, ok;
+    uint i, num_addrs;
+
+    dr_save_reg(drcontext, ilist, where, reg1, SPILL_SLOT_2);
+    dr_save_reg(drcontext, ilist, where, reg2, SPILL_SLOT_3);
+    dr_save_reg(drcontext, ilist, where, reg3, SPILL_SLOT_4);
+
+    /* Load data->buf_ptr into reg2 */
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg2);
+    opnd1 = opnd_create_reg(reg2);
+    opnd2 = OPND_CREATE_MEMPTR(reg2, offsetof(per_thread_t, buf_ptr));
+    instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* use drutil to store every mem address into buf_ptr[i].addr */
+    ok = drutil_insert_get_mem_addrs(drcontext, ilist, where, reg2,
+                                     offsetof(mem_ref_t, addr), sizeof(mem_ref_t),
+                                     reg1, reg3, SPILL_SLOT_3, SPILL_SLOT_2,
+                                     SPILL_SLOT_4, &num_addrs);
+    DR_ASSERT(ok && num_addrs == num_refs);
+
+    /* Store type and size in each memory ref */
+    for (i = 0; i < num_refs; i++) {
+        ref = drutil_instr_get_memref(where, i, &write);
+        opnd1 = OPND_CREATE_MEM32(reg2, i * sizeof(mem_ref_t) +
+                                  offsetof(mem_ref_t, type));
+        opnd2 = OPND_CREATE_INT32(write ? MEMREF_WRITE : 0);
+        instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+        opnd1 = OPND_CREATE_MEMPTR(reg2, i * sizeof(mem_ref_t) +
+                                   offsetof(mem_ref_t, size));
+        /* drutil_opnd_mem_size_in_bytes handles OP_enter */
+        opnd2 = OPND_CREATE_INT32(drutil_opnd_mem_size_in_bytes(ref, where));
+        instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+    }
+
+    /* Store pc in each memory ref: a register can take a 64-bit immediate */
+    opnd1 = opnd_create_reg(reg1);
+    opnd2 = OPND_CREATE_INTPTR((ptr_int_t)instr_get_app_pc(where));
+    instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+    for (i = 0; i < num_refs; i++) {
+        opnd1 = OPND_CREATE_MEMPTR(reg2, i * sizeof(mem_ref_t) +
+                                   offsetof(mem_ref_t, pc));
+        opnd2 = opnd_create_reg(reg1);
+        instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+    }
+
+    /* Increment reg value by num_refs mem_refs using lea instr */
+    opnd1 = opnd_create_reg(reg2);
+    opnd2 = opnd_create_base_disp(reg2, DR_REG_NULL, 0,
+                                  num_refs * sizeof(mem_ref_t), OPSZ_lea);
+    instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* Update the data->buf_ptr */
+    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, reg1);
+    opnd1 = OPND_CREATE_MEMPTR(reg1, offsetof(per_thread_t, buf_ptr));
+    opnd2 = opnd_create_reg(reg2);
+    instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* As in instrument_mem we use lea + jecxz to avoid touching the eflags.
+     * buf_ptr advanced by num_refs mem_refs, so it may have passed buf_end:
+     * we check each of the num_refs positions at which it could have hit it.
+     */
+    /* lea [reg2 - buf_end] => reg3 */
+    opnd1 = opnd_create_reg(reg3);
+    opnd2 = OPND_CREATE_MEMPTR(reg1, offsetof(per_thread_t, buf_end));
+    instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+    opnd1 = opnd_create_reg(reg3);
+    opnd2 = opnd_create_base_disp(reg3, reg2, 1, 0, OPSZ_lea);
+    instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    call  = INSTR_CREATE_label(drcontext);
+    restore = INSTR_CREATE_label(drcontext);
+    for (i = 0; i < num_refs; i++) {
+        /* lea [reg3 - i mem_refs] => reg2; jecxz call */
+        opnd1 = opnd_create_reg(reg2);
+        opnd2 = opnd_create_base_disp(reg3, DR_REG_NULL, 0,
+                                      -(int)(i * sizeof(mem_ref_t)), OPSZ_lea);
+        instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
+        instrlist_meta_preinsert(ilist, where, instr);
+        instr = INSTR_CREATE_jecxz(drcontext, opnd_create_instr(call));
+        instrlist_meta_preinsert(ilist, where, instr);
+    }
+
+    /* jump restore to skip clean call */
+    instr = INSTR_CREATE_jmp(drcontext, opnd_create_instr(restore));
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* We jump to lean procedure which performs full context switch and 
+     * clean call invocation. This is to reduce the code cache size. 
+     */
+    instrlist_meta_preinsert(ilist, where, call);
+    /* mov restore DR_REG_XCX: the return address for the lean procedure */
+    opnd1 = opnd_create_reg(reg2);
+    opnd2 = opnd_create_instr(restore);
+    instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+    /* jmp code_cache */
+    opnd1 = opnd_create_pc(code_cache);
+    instr = INSTR_CREATE_jmp(drcontext, opnd1);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* restore %reg */
+    instrlist_meta_preinsert(ilist, where, restore);
+    dr_restore_reg(drcontext, ilist, where, reg1, SPILL_SLOT_2);
+    dr_restore_reg(drcontext, ilist, where, reg2, SPILL_SLOT_3);
+    dr_restore_reg(drcontext, ilist, where, reg3, SPILL_SLOT_4);
+}
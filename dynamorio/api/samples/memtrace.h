@@ -0,0 +1,136 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Trace formats shared by the memtrace.c client and the memtrace_reader.c
+ * offline tool.
+ *
+ * The raw format is a sequence of mem_ref_t records in the layout of the
+ * client's build, zero-padded at the end.
+ *
+ * The compressed format (memtrace -compress) is a memtrace_z_file_header_t
+ * followed by a stream of variable-length records.  Each record is
+ * encoded relative to the state left by the previous ones:
+ *
+ *   varint   zigzag(pc - previous pc)
+ *   varint   zigzag(addr - reference addr) << 1 | explicit
+ *   [varint  type]   only if explicit
+ *   [varint  size]   only if explicit
+ *
+ * The reference addr is the last address recorded for the same static
+ * memory reference, looked up in a direct-mapped table keyed by pc and by
+ * the position of the record among consecutive records with that pc.  On a
+ * table miss, the previous record's addr is used instead.  The type and size
+ * are omitted when they match the table entry.  Varints are little-endian
+ * base-128, and the address varint carries one extra bit so that any 64-bit
+ * delta fits.  The decoder keeps the same table and so reproduces every
+ * record exactly.
+ */
+
+#ifndef _MEMTRACE_H_
+#define _MEMTRACE_H_ 1
+
+/* Each mem_ref_t includes the type of reference (read or write), 
+ * the address referenced, and the size of the reference.
+ * For a string loop range, addr is the first element referenced and size
+ * is the total number of bytes, with the element size in the type.
+ */
+typedef struct _mem_ref_t {
+    uint  type;
+    void *addr;
+    size_t size;
+    app_pc pc;
+} mem_ref_t;
+
+/* mem_ref_t.type */
+#define MEMREF_WRITE      0x1
+#define MEMREF_DESCENDING 0x2 /* must be 2: see memtrace.c instrument_mem */
+#define MEMREF_RANGE      0x4
+#define MEMREF_ELEM_SIZE_SHIFT 8
+
+#define MEMTRACE_Z_MAGIC   0x5a52544d /* "MTRZ" */
+#define MEMTRACE_Z_VERSION 1
+
+typedef struct _memtrace_z_file_header_t {
+    uint magic;
+    uint version;
+} memtrace_z_file_header_t;
+
+/* The maximum number of bytes taken by one encoded record */
+#define MEMTRACE_Z_MAX_RECORD_SIZE 35
+
+/* A mem_ref_t with pointer-sized fields widened, as used by the codec */
+typedef struct _memtrace_z_record_t {
+    uint64 pc;
+    uint64 addr;
+    uint64 size;
+    uint type;
+} memtrace_z_record_t;
+
+#define MEMTRACE_Z_TABLE_BITS 12
+#define MEMTRACE_Z_TABLE_SIZE (1 << MEMTRACE_Z_TABLE_BITS)
+
+typedef struct _memtrace_z_entry_t {
+    uint64 key;
+    uint64 addr;
+    uint64 size;
+    uint type;
+} memtrace_z_entry_t;
+
+/* Encoder or decoder state: one per stream */
+typedef struct _memtrace_z_state_t {
+    uint64 prev_pc;
+    uint64 prev_addr;
+    uint run; /* index of the previous record among those with prev_pc */
+    memtrace_z_entry_t table[MEMTRACE_Z_TABLE_SIZE];
+} memtrace_z_state_t;
+
+/* Initializes state for the start of a stream */
+void
+memtrace_z_init(memtrace_z_state_t *state);
+
+/* Encodes rec into out, which must have room for MEMTRACE_Z_MAX_RECORD_SIZE
+ * bytes, and returns the number of bytes written.
+ */
+size_t
+memtrace_z_encode(memtrace_z_state_t *state, const memtrace_z_record_t *rec,
+                  byte *out);
+
+/* Decodes the record at the start of the avail bytes at in into rec and
+ * returns the number of bytes consumed.  Returns 0, leaving state
+ * unchanged, if the record is incomplete.  If avail is at least
+ * MEMTRACE_Z_MAX_RECORD_SIZE, a return of 0 means the stream is corrupt.
+ */
+size_t
+memtrace_z_decode(memtrace_z_state_t *state, const byte *in, size_t avail,
+                  OUT memtrace_z_record_t *rec);
+
+#endif /* _MEMTRACE_H_ */
@@ -0,0 +1,205 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Encoder and decoder for the compressed memtrace format described in
+ * memtrace.h, shared by the memtrace.c client and memtrace_reader.c.
+ */
+
+#include "dr_api.h"
+#include "memtrace.h"
+
+/* records with the same pc beyond this many share the last table entry */
+#define MAX_RUN 3
+
+static uint64
+zigzag_encode(uint64 delta)
+{
+    return (delta << 1) ^ (uint64)((int64)delta >> 63);
+}
+
+static uint64
+zigzag_decode(uint64 val)
+{
+    return (val >> 1) ^ (uint64)(-(int64)(val & 1));
+}
+
+/* Writes val as a varint whose first byte also holds the low bit flag, if
+ * use_flag is set.  Returns the number of bytes written.
+ */
+static size_t
+put_varint(byte *out, uint64 val, bool use_flag, bool flag)
+{
+    size_t len = 0;
+    byte b;
+    if (use_flag) {
+        b = (byte)(((val & 0x3f) << 1) | (flag ? 1 : 0));
+        val >>= 6;
+    } else {
+        b = (byte)(val & 0x7f);
+        val >>= 7;
+    }
+    while (val != 0) {
+        out[len++] = b | 0x80;
+        b = (byte)(val & 0x7f);
+        val >>= 7;
+    }
+    out[len++] = b;
+    return len;
+}
+
+/* The inverse of put_varint.  Returns 0 if the varint does not end within
+ * the avail bytes at in.
+ */
+static size_t
+get_varint(const byte *in, size_t avail, OUT uint64 *val, bool use_flag,
+           OUT bool *flag)
+{
+    size_t len = 0;
+    uint bits = use_flag ? 6 : 7;
+    uint shift;
+    uint64 res;
+    if (avail == 0)
+        return 0;
+    if (use_flag)
+        *flag = (in[0] & 1) != 0;
+    res = (in[0] & 0x7f) >> (7 - bits);
+    shift = bits;
+    while ((in[len++] & 0x80) != 0) {
+        if (len == avail || shift >= 64)
+            return 0;
+        res |= (uint64)(in[len] & 0x7f) << shift;
+        shift += 7;
+    }
+    *val = res;
+    return len;
+}
+
+static memtrace_z_entry_t *
+lookup_entry(memtrace_z_state_t *state, uint64 pc, uint run, OUT uint64 *key)
+{
+    *key = (pc << 2) | (run > MAX_RUN ? MAX_RUN : run);
+    return &state->table[(*key ^ (*key >> MEMTRACE_Z_TABLE_BITS)) &
+                         (MEMTRACE_Z_TABLE_SIZE - 1)];
+}
+
+void
+memtrace_z_init(memtrace_z_state_t *state)
+{
+    uint i;
+    state->prev_pc = 0;
+    state->prev_addr = 0;
+    state->run = 0;
+    for (i = 0; i < MEMTRACE_Z_TABLE_SIZE; i++) {
+        state->table[i].key = 0;
+        state->table[i].addr = 0;
+        state->table[i].size = 0;
+        state->table[i].type = 0;
+    }
+}
+
+size_t
+memtrace_z_encode(memtrace_z_state_t *state, const memtrace_z_record_t *rec,
+                  byte *out)
+{
+    uint run = (rec->pc == state->prev_pc) ? state->run + 1 : 0;
+    uint64 key, ref_addr;
+    memtrace_z_entry_t *entry = lookup_entry(state, rec->pc, run, &key);
+    bool hit = (entry->key == key);
+    bool is_explicit = !hit || entry->type != rec->type || entry->size != rec->size;
+    size_t len;
+
+    ref_addr = hit ? entry->addr : state->prev_addr;
+    len = put_varint(out, zigzag_encode(rec->pc - state->prev_pc), false, false);
+    len += put_varint(out + len, zigzag_encode(rec->addr - ref_addr), true, is_explicit);
+    if (is_explicit) {
+        len += put_varint(out + len, rec->type, false, false);
+        len += put_varint(out + len, rec->size, false, false);
+    }
+
+    entry->key = key;
+    entry->addr = rec->addr;
+    entry->size = rec->size;
+    entry->type = rec->type;
+    state->prev_pc = rec->pc;
+    state->prev_addr = rec->addr;
+    state->run = run;
+    return len;
+}
+
+size_t
+memtrace_z_decode(memtrace_z_state_t *state, const byte *in, size_t avail,
+                  OUT memtrace_z_record_t *rec)
+{
+    uint64 val, key, ref_addr, type;
+    memtrace_z_entry_t *entry;
+    size_t len, used;
+    bool is_explicit, unused;
+    uint run;
+
+    len = get_varint(in, avail, &val, false, &unused);
+    if (len == 0)
+        return 0;
+    used = len;
+    rec->pc = state->prev_pc + zigzag_decode(val);
+    run = (rec->pc == state->prev_pc) ? state->run + 1 : 0;
+    entry = lookup_entry(state, rec->pc, run, &key);
+    ref_addr = (entry->key == key) ? entry->addr : state->prev_addr;
+
+    len = get_varint(in + used, avail - used, &val, true, &is_explicit);
+    if (len == 0)
+        return 0;
+    used += len;
+    rec->addr = ref_addr + zigzag_decode(val);
+    if (is_explicit) {
+        len = get_varint(in + used, avail - used, &type, false, &unused);
+        if (len == 0 || type > 0xffffffff)
+            return 0;
+        used += len;
+        rec->type = (uint)type;
+        len = get_varint(in + used, avail - used, &rec->size, false, &unused);
+        if (len == 0)
+            return 0;
+        used += len;
+    } else {
+        rec->type = entry->type;
+        rec->size = entry->size;
+    }
+
+    entry->key = key;
+    entry->addr = rec->addr;
+    entry->size = rec->size;
+    entry->type = rec->type;
+    state->prev_pc = rec->pc;
+    state->prev_addr = rec->addr;
+    state->run = run;
+    return used;
+}
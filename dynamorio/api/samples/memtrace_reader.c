@@ -0,0 +1,194 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Standalone API Sample:
+ * memtrace_reader.c
+ *
+ * Decodes a compressed trace written by the memtrace.c client with
+ * -compress.  By default the records are printed in the same format as
+ * memtrace's readable trace.  With -raw, the records are instead written to
+ * a file as mem_ref_t structs, which reproduces the trace memtrace would
+ * have written without -compress when both are built for the same
+ * architecture.  -stats prints the compression ratio and the decoding
+ * throughput.
+ *
+ * Usage: memtrace_reader [-raw <out file>] [-stats] <memtrace.tid.log>
+ */
+
+#include "dr_api.h"
+#include <string.h> /* for strcmp, memmove */
+#include "memtrace.h"
+
+#define IN_BUF_SIZE  (64 * 1024)
+#define OUT_BUF_REFS 4096
+
+static byte in_buf[IN_BUF_SIZE];
+static mem_ref_t out_buf[OUT_BUF_REFS];
+static memtrace_z_state_t state;
+
+/* Prints num/den with two decimal places.  We avoid floating point, which
+ * dr_printf does not support on Windows.
+ */
+static void
+print_ratio(uint64 num, uint64 den)
+{
+    uint64 hundredths = (den == 0) ? 0 : (num * 100 + den / 2) / den;
+    dr_printf("%llu.%02llu", hundredths / 100, hundredths % 100);
+}
+
+static void
+print_record(const memtrace_z_record_t *rec)
+{
+    uint64 addr = rec->addr;
+    char type = (rec->type & MEMREF_WRITE) != 0 ? 'w' : 'r';
+    if ((rec->type & MEMREF_RANGE) != 0) {
+        /* print string loop ranges in upper case, from their lowest address */
+        uint64 elem_size = rec->type >> MEMREF_ELEM_SIZE_SHIFT;
+        type = (char) (type - 'a' + 'A');
+        if ((rec->type & MEMREF_DESCENDING) != 0 && rec->size > 0)
+            addr = addr + elem_size - rec->size;
+    }
+    dr_printf("0x%llx,%c,%llu,0x%llx\n", rec->pc, type, rec->size, addr);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *raw_name = NULL;
+    bool stats = false;
+    file_t f, raw = INVALID_FILE;
+    memtrace_z_file_header_t hdr;
+    memtrace_z_record_t rec;
+    uint64 num_refs = 0, in_bytes = sizeof(hdr), start_ms, ms;
+    size_t avail = 0, pos, len;
+    uint num_out = 0;
+    ssize_t got;
+    int i;
+
+    for (i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-raw") == 0 && i < argc - 2)
+            raw_name = argv[++i];
+        else if (strcmp(argv[i], "-stats") == 0)
+            stats = true;
+        else
+            break;
+    }
+    if (i != argc - 1) {
+        dr_fprintf(STDERR, "Usage: %s [-raw <out file>] [-stats] <trace file>\n",
+                   argv[0]);
+        return 1;
+    }
+    dr_standalone_init();
+    f = dr_open_file(argv[i], DR_FILE_READ | DR_FILE_ALLOW_LARGE);
+    if (f == INVALID_FILE) {
+        dr_fprintf(STDERR, "Error opening %s\n", argv[i]);
+        return 1;
+    }
+    if (dr_read_file(f, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != MEMTRACE_Z_MAGIC) {
+        dr_fprintf(STDERR, "Error: %s is not a compressed memtrace file\n", argv[i]);
+        return 1;
+    }
+    if (hdr.version != MEMTRACE_Z_VERSION) {
+        dr_fprintf(STDERR, "Error: %s has version %d but tool expects %d\n",
+                   argv[i], hdr.version, MEMTRACE_Z_VERSION);
+        return 1;
+    }
+    if (raw_name != NULL) {
+        raw = dr_open_file(raw_name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        if (raw == INVALID_FILE) {
+            dr_fprintf(STDERR, "Error opening %s\n", raw_name);
+            return 1;
+        }
+    }
+
+    memtrace_z_init(&state);
+    start_ms = dr_get_milliseconds();
+    while ((got = dr_read_file(f, in_buf + avail, IN_BUF_SIZE - avail)) > 0) {
+        in_bytes += got;
+        avail += got;
+        pos = 0;
+        while ((len = memtrace_z_decode(&state, in_buf + pos, avail - pos, &rec)) > 0) {
+            pos += len;
+            num_refs++;
+            if (raw == INVALID_FILE) {
+                if (!stats)
+                    print_record(&rec);
+                continue;
+            }
+            out_buf[num_out].type = rec.type;
+            out_buf[num_out].addr = (void *)(ptr_uint_t)rec.addr;
+            out_buf[num_out].size = (size_t)rec.size;
+            out_buf[num_out].pc = (app_pc)(ptr_uint_t)rec.pc;
+            if (++num_out == OUT_BUF_REFS) {
+                dr_write_file(raw, out_buf, sizeof(out_buf));
+                num_out = 0;
+            }
+        }
+        if (avail - pos >= MEMTRACE_Z_MAX_RECORD_SIZE) {
+            dr_fprintf(STDERR, "Error: corrupt record after %llu records\n", num_refs);
+            return 1;
+        }
+        /* keep the partial record for the next read */
+        memmove(in_buf, in_buf + pos, avail - pos);
+        avail -= pos;
+    }
+    if (avail > 0)
+        dr_fprintf(STDERR, "Warning: trace ends in a partial record\n");
+    if (raw != INVALID_FILE) {
+        dr_write_file(raw, out_buf, num_out * sizeof(mem_ref_t));
+        dr_close_file(raw);
+    }
+    dr_close_file(f);
+
+    if (stats) {
+        uint64 raw_bytes = num_refs * sizeof(mem_ref_t);
+        ms = dr_get_milliseconds() - start_ms;
+        dr_printf("%llu records\n", num_refs);
+        dr_printf("%llu compressed bytes, ", in_bytes);
+        print_ratio(in_bytes, num_refs);
+        dr_printf(" bytes per record\n");
+        dr_printf("%llu bytes as mem_ref_t, compression ratio ", raw_bytes);
+        print_ratio(raw_bytes, in_bytes);
+        dr_printf("\ndecoded in %llu ms", ms);
+        if (ms > 0) {
+            /* per ms * 1000 / 1M */
+            dr_printf(", ");
+            print_ratio(num_refs, ms * 1000);
+            dr_printf(" million records/s, ");
+            print_ratio(raw_bytes, ms * 1000);
+            dr_printf(" MB/s of mem_ref_t");
+        }
+        dr_printf("\n");
+    }
+    return 0;
+}
@@ -34,7 +34,10 @@
  * tracedump.c
  *
  * Disassembles a trace dump in binary format produced by the
- * -tracedump_binary option.  Also illustrates the standalone API.
+ * -tracedump_binary option, or lists the basic blocks of each trace in a
+ * dump produced by -tracedump_compact.  If given a tag, uses the index at
+ * the end of the file to show only the traces starting there.  Also
+ * illustrates the standalone API.
  */
 
 #include "dr_api.h"
@@ -63,19 +66,213 @@ dis(void *drcontext, app_pc pc, app_pc display_pc)
 #define STUBIDX(stubs, i) \
     ((tracedump_stub_data_t *)(((byte *)stubs)+(i)*STUB_STRUCT_MAX_SIZE))
 
-static void
-read_data(file_t f, void *drcontext)
+/* Reads and prints the trace at the current file position.
+ * Returns false at the end of the data.
+ */
+static bool
+read_trace(file_t f, void *drcontext, tracedump_file_header_t *fhdr,
+           byte **dbuf, int *dlen)
 {
     byte sbuf[BUF_SIZE];
-    byte *dbuf = NULL;
     ssize_t read;
-    int dlen = 0, i;
+    int i;
     byte *p = sbuf, *pc, *next_pc;
     tracedump_trace_header_t hdrs;
-    tracedump_file_header_t fhdr;
     tracedump_stub_data_t *stubs;
     int next_stub_offs;
     int cur_stub;
+    bool compact = (fhdr->flags & TRACEDUMP_FILE_COMPACT) != 0;
+
+    read = dr_read_file(f, &hdrs, sizeof(tracedump_trace_header_t));
+    if (read != sizeof(tracedump_trace_header_t))
+        return false; /* assume end of file */
+#ifdef X86_64
+    set_x86_mode(drcontext, !hdrs.x64);
+#endif
+    dr_printf("\nTRACE # %d\n", hdrs.frag_id);
+    dr_printf("Tag = "PFX"\n", hdrs.tag);
+    if (hdrs.num_bbs > 0) {
+        uint j;
+        app_pc tag;
+        if (!compact)
+            dr_printf("\nORIGINAL CODE\n");
+        for (j=0; j<hdrs.num_bbs; j++) {
+            read = dr_read_file(f, sbuf, BB_ORIGIN_HEADER_SIZE);
+            assert(read == BB_ORIGIN_HEADER_SIZE);
+            p = sbuf;
+            tag = *((app_pc*)p);
+            p += sizeof(tag);
+            dr_printf("Basic block %d: tag "PFX"\n", j, tag);
+            i = *((int*)p);
+            p += sizeof(i);
+            dr_printf("Size: %d bytes\n", i);
+            if (compact)
+                continue;
+            if (i >= BUF_SIZE) {
+                if (i >= *dlen) {
+                    *dbuf = realloc(*dbuf, i);
+                    *dlen = i;
+                }
+                p = *dbuf;
+            } else
+                p = sbuf;
+            read = dr_read_file(f, p, i);
+            assert(read == i);
+            pc = p;
+            while (pc - p < i) {
+                pc = dis(drcontext, pc, tag + (pc - p));
+            }
+        }
+        if (!compact)
+            dr_printf("END ORIGINAL CODE\n\n");
+    }
+    if (compact) {
+        dr_printf("Size = %d\n", hdrs.code_size);
+        dr_printf("END TRACE %d\n", hdrs.frag_id);
+        return true;
+    }
+    stubs = dr_global_alloc(hdrs.num_exits * STUB_STRUCT_MAX_SIZE);
+    assert(stubs != NULL);
+    next_stub_offs = hdrs.code_size;
+    if (fhdr->linkcount_size > 0) {
+        dr_printf("Exit stubs:\n");
+    }
+    for (i = 0; i<hdrs.num_exits; i++) {
+        assert(STUB_DATA_FIXED_SIZE+fhdr->linkcount_size < BUF_SIZE);
+        read = dr_read_file(f, sbuf, STUB_DATA_FIXED_SIZE+fhdr->linkcount_size);
+        assert(read == (int) STUB_DATA_FIXED_SIZE+fhdr->linkcount_size);
+        p = sbuf;
+
+        /* We read in whole struct.  The union and code fields are of
+         * course variable-sized so we update them after.
+         */
+        *STUBIDX(stubs,i) = *(tracedump_stub_data_t *)p;
+        p += STUB_DATA_FIXED_SIZE;
+        /* linkcounts are no longer available but we have backward compatibility */
+        if (fhdr->linkcount_size == 8) {
+            STUBIDX(stubs,i)->count.count64 = *((uint64*)p);
+            p += 8;
+            dr_printf("\t#%d: target = "PFX", %s, count = %" UINT64_FORMAT_CODE "\n",
+                      i, STUBIDX(stubs,i)->target,
+                      STUBIDX(stubs,i)->linked ? "not linked" : "linked",
+                      STUBIDX(stubs,i)->count.count64);
+        } else if (fhdr->linkcount_size == 4) {
+            STUBIDX(stubs,i)->count.count32 = *((uint *)p);
+            p += 4;
+            dr_printf("\t#%d: target = "PFX", %s, count = %lu\n",
+                      i, STUBIDX(stubs,i)->target,
+                      STUBIDX(stubs,i)->linked ? "not linked" : "linked",
+                      STUBIDX(stubs,i)->count.count32);
+        } else {
+            dr_printf("\t#%d: target = "PFX", %s\n",
+                      i, STUBIDX(stubs,i)->target,
+                      STUBIDX(stubs,i)->linked ? "not linked" : "linked");
+        }
+        assert(p - sbuf == (int) STUB_DATA_FIXED_SIZE+fhdr->linkcount_size);
+        if (STUBIDX(stubs,i)->stub_pc < hdrs.cache_start_pc ||
+            STUBIDX(stubs,i)->stub_pc >= hdrs.cache_start_pc + hdrs.code_size) {
+            assert(STUBIDX(stubs,i)->stub_size < BUF_SIZE);
+            assert(STUBIDX(stubs,i)->stub_size <= SEPARATE_STUB_MAX_SIZE);
+            read = dr_read_file(f, sbuf, STUBIDX(stubs,i)->stub_size);
+            assert(read == STUBIDX(stubs,i)->stub_size);
+            p = sbuf;
+            memcpy(STUBIDX(stubs,i)->stub_code, p, STUBIDX(stubs,i)->stub_size);
+            p += STUBIDX(stubs,i)->stub_size;
+        } else if (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc < next_stub_offs) {
+            next_stub_offs = (int) (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc);
+        }
+    }
+    if (hdrs.code_size >= *dlen) {
+        *dbuf = realloc(*dbuf, hdrs.code_size);
+        *dlen = hdrs.code_size;
+    }
+    p = *dbuf;
+    read = dr_read_file(f, p, hdrs.code_size);
+    assert(read == hdrs.code_size);
+    pc = p;
+    dr_printf("Size = %d\n", hdrs.code_size);
+    dr_printf("Body:\n");
+    dr_printf("  -------- indirect branch target entry: --------\n");
+    while (pc - p < next_stub_offs) {
+        if (pc - p == hdrs.entry_offs)
+            dr_printf("  -------- normal entry: --------\n");
+        next_pc = decode_next_pc(drcontext, pc);
+        if ((next_pc - p) == hdrs.entry_offs && (next_pc - pc == 6))
+            dr_printf("  -------- prefix entry: --------\n");
+        pc = dis(drcontext, pc, hdrs.cache_start_pc + (pc - p));
+    }
+    /* stubs */
+    for (cur_stub = 0; cur_stub < hdrs.num_exits; cur_stub++) {
+        bool separate = STUBIDX(stubs,cur_stub)->stub_pc < hdrs.cache_start_pc ||
+            STUBIDX(stubs,cur_stub)->stub_pc >= hdrs.cache_start_pc + hdrs.code_size;
+        app_pc stub_pc = (app_pc) STUBIDX(stubs,cur_stub)->stub_code;
+        dr_printf("  -------- exit stub %d: -------- <target: "PFX">\n",
+                  cur_stub, STUBIDX(stubs,cur_stub)->target);
+        next_stub_offs = hdrs.code_size;
+        for (i=cur_stub + 1; i<hdrs.num_exits; i++) {
+            if (STUBIDX(stubs,i)->stub_pc >= hdrs.cache_start_pc &&
+                STUBIDX(stubs,i)->stub_pc < hdrs.cache_start_pc + hdrs.code_size) {
+                next_stub_offs = (int)
+                    (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc);
+                break;
+            }
+        }
+        if (separate) {
+            app_pc spc = stub_pc;
+            while (spc - stub_pc < STUBIDX(stubs,cur_stub)->stub_size) {
+                spc = dis(drcontext, spc, STUBIDX(stubs,cur_stub)->stub_pc +
+                          (spc - stub_pc));
+            }
+        } else {
+            while (pc - p < next_stub_offs) {
+                pc = dis(drcontext, pc, hdrs.cache_start_pc + (pc - p));
+            }
+        }
+    }
+    dr_printf("END TRACE %d\n", hdrs.frag_id);
+    dr_global_free(stubs, hdrs.num_exits * STUB_STRUCT_MAX_SIZE);
+    return true;
+}
+
+/* Reads the index at the end of the file, if there is one */
+static tracedump_index_entry_t *
+read_index(file_t f, uint64 *data_end, uint64 *num_entries)
+{
+    tracedump_index_trailer_t trailer;
+    tracedump_index_entry_t *index;
+    uint64 size;
+    size_t index_size;
+    if (!dr_file_size(f, &size) ||
+        size < sizeof(tracedump_file_header_t) + sizeof(trailer) ||
+        !dr_file_seek(f, size - sizeof(trailer), DR_SEEK_SET) ||
+        dr_read_file(f, &trailer, sizeof(trailer)) != sizeof(trailer) ||
+        memcmp(trailer.magic, TRACEDUMP_INDEX_MAGIC, sizeof(trailer.magic)) != 0 ||
+        trailer.index_offset + trailer.num_entries * sizeof(*index) +
+        sizeof(trailer) != size)
+        return NULL;
+    *data_end = trailer.index_offset;
+    *num_entries = trailer.num_entries;
+    index_size = (size_t) (trailer.num_entries * sizeof(*index));
+    index = dr_global_alloc(index_size == 0 ? 1 : index_size);
+    assert(index != NULL);
+    if (!dr_file_seek(f, trailer.index_offset, DR_SEEK_SET) ||
+        dr_read_file(f, index, index_size) != (ssize_t) index_size) {
+        dr_global_free(index, index_size == 0 ? 1 : index_size);
+        return NULL;
+    }
+    return index;
+}
+
+/* Prints all traces, or only those for tag if it is not NULL */
+static void
+read_data(file_t f, void *drcontext, app_pc tag)
+{
+    byte *dbuf = NULL;
+    int dlen = 0;
+    ssize_t read;
+    tracedump_file_header_t fhdr;
+    tracedump_index_entry_t *index;
+    uint64 data_end = 0, num_entries = 0, i;
 
     read = dr_read_file(f, &fhdr, sizeof(fhdr));
     assert(read == sizeof(fhdr));
@@ -95,141 +292,28 @@ read_data(file_t f, void *drcontext)
         return;
     }
 
-    while (1) {
-        read = dr_read_file(f, &hdrs, sizeof(tracedump_trace_header_t));
-        if (read != sizeof(tracedump_trace_header_t))
-            break; /* assume end of file */
-#ifdef X86_64
-        set_x86_mode(drcontext, !hdrs.x64);
-#endif
-        dr_printf("\nTRACE # %d\n", hdrs.frag_id);
-        dr_printf("Tag = "PFX"\n", hdrs.tag);
-        if (hdrs.num_bbs > 0) {
-            uint j;
-            app_pc tag;
-            dr_printf("\nORIGINAL CODE\n");
-            for (j=0; j<hdrs.num_bbs; j++) {
-                read = dr_read_file(f, sbuf, BB_ORIGIN_HEADER_SIZE);
-                assert(read == BB_ORIGIN_HEADER_SIZE);
-                p = sbuf;
-                tag = *((app_pc*)p);
-                p += sizeof(tag);
-                dr_printf("Basic block %d: tag "PFX"\n", j, tag);
-                i = *((int*)p);
-                p += sizeof(i);
-                dr_printf("Size: %d bytes\n", i);
-                if (i >= BUF_SIZE) {
-                    if (i >= dlen)
-                        dbuf = realloc(dbuf, i);
-                    p = dbuf;
-                } else
-                    p = sbuf;
-                read = dr_read_file(f, p, i);
-                assert(read == i);
-                pc = p;
-                while (pc - p < i) {
-                    pc = dis(drcontext, pc, tag + (pc - p));
-                }
-            }
-            dr_printf("END ORIGINAL CODE\n\n");
+    index = read_index(f, &data_end, &num_entries);
+    if (tag != NULL) {
+        if (index == NULL) {
+            dr_fprintf(STDERR, "Error: file has no index\n");
+            return;
         }
-        stubs = dr_global_alloc(hdrs.num_exits * STUB_STRUCT_MAX_SIZE);
-        assert(stubs != NULL);
-        next_stub_offs = hdrs.code_size;
-        if (fhdr.linkcount_size > 0) {
-            dr_printf("Exit stubs:\n");
-        }
-        for (i = 0; i<hdrs.num_exits; i++) {
-            assert(STUB_DATA_FIXED_SIZE+fhdr.linkcount_size < BUF_SIZE);
-            read = dr_read_file(f, sbuf, STUB_DATA_FIXED_SIZE+fhdr.linkcount_size);
-            assert(read == (int) STUB_DATA_FIXED_SIZE+fhdr.linkcount_size);
-            p = sbuf;
-
-            /* We read in whole struct.  The union and code fields are of
-             * course variable-sized so we update them after.
-             */
-            *STUBIDX(stubs,i) = *(tracedump_stub_data_t *)p;
-            p += STUB_DATA_FIXED_SIZE;
-            /* linkcounts are no longer available but we have backward compatibility */
-            if (fhdr.linkcount_size == 8) {
-                STUBIDX(stubs,i)->count.count64 = *((uint64*)p);
-                p += 8;
-                dr_printf("\t#%d: target = "PFX", %s, count = %" UINT64_FORMAT_CODE "\n",
-                          i, STUBIDX(stubs,i)->target,
-                          STUBIDX(stubs,i)->linked ? "not linked" : "linked",
-                          STUBIDX(stubs,i)->count.count64);
-            } else if (fhdr.linkcount_size == 4) {
-                STUBIDX(stubs,i)->count.count32 = *((uint *)p);
-                p += 4;
-                dr_printf("\t#%d: target = "PFX", %s, count = %lu\n",
-                          i, STUBIDX(stubs,i)->target,
-                          STUBIDX(stubs,i)->linked ? "not linked" : "linked",
-                          STUBIDX(stubs,i)->count.count32);
-            } else {
-                dr_printf("\t#%d: target = "PFX", %s\n",
-                          i, STUBIDX(stubs,i)->target,
-                          STUBIDX(stubs,i)->linked ? "not linked" : "linked");
-            }
-            assert(p - sbuf == (int) STUB_DATA_FIXED_SIZE+fhdr.linkcount_size);
-            if (STUBIDX(stubs,i)->stub_pc < hdrs.cache_start_pc ||
-                STUBIDX(stubs,i)->stub_pc >= hdrs.cache_start_pc + hdrs.code_size) {
-                assert(STUBIDX(stubs,i)->stub_size < BUF_SIZE);
-                assert(STUBIDX(stubs,i)->stub_size <= SEPARATE_STUB_MAX_SIZE);
-                read = dr_read_file(f, sbuf, STUBIDX(stubs,i)->stub_size);
-                assert(read == STUBIDX(stubs,i)->stub_size);
-                p = sbuf;
-                memcpy(STUBIDX(stubs,i)->stub_code, p, STUBIDX(stubs,i)->stub_size);
-                p += STUBIDX(stubs,i)->stub_size;
-            } else if (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc < next_stub_offs) {
-                next_stub_offs = (int) (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc);
-            }
-        }
-        if (hdrs.code_size >= dlen)
-            dbuf = realloc(dbuf, hdrs.code_size);
-        p = dbuf;
-        read = dr_read_file(f, p, hdrs.code_size);
-        assert(read == hdrs.code_size);
-        pc = p;
-        dr_printf("Size = %d\n", hdrs.code_size);
-        dr_printf("Body:\n");
-        dr_printf("  -------- indirect branch target entry: --------\n");
-        while (pc - p < next_stub_offs) {
-            if (pc - p == hdrs.entry_offs)
-                dr_printf("  -------- normal entry: --------\n");
-            next_pc = decode_next_pc(drcontext, pc);
-            if ((next_pc - p) == hdrs.entry_offs && (next_pc - pc == 6))
-                dr_printf("  -------- prefix entry: --------\n");
-            pc = dis(drcontext, pc, hdrs.cache_start_pc + (pc - p));
+        for (i = 0; i < num_entries; i++) {
+            if (index[i].tag == tag &&
+                dr_file_seek(f, index[i].offset, DR_SEEK_SET))
+                read_trace(f, drcontext, &fhdr, &dbuf, &dlen);
         }
-        /* stubs */
-        for (cur_stub = 0; cur_stub < hdrs.num_exits; cur_stub++) {
-            bool separate = STUBIDX(stubs,cur_stub)->stub_pc < hdrs.cache_start_pc ||
-                STUBIDX(stubs,cur_stub)->stub_pc >= hdrs.cache_start_pc + hdrs.code_size;
-            app_pc stub_pc = (app_pc) STUBIDX(stubs,cur_stub)->stub_code;
-            dr_printf("  -------- exit stub %d: -------- <target: "PFX">\n",
-                      cur_stub, STUBIDX(stubs,cur_stub)->target);
-            next_stub_offs = hdrs.code_size;
-            for (i=cur_stub + 1; i<hdrs.num_exits; i++) {
-                if (STUBIDX(stubs,i)->stub_pc >= hdrs.cache_start_pc &&
-                    STUBIDX(stubs,i)->stub_pc < hdrs.cache_start_pc + hdrs.code_size) {
-                    next_stub_offs = (int)
-                        (STUBIDX(stubs,i)->stub_pc - hdrs.cache_start_pc);
-                    break;
-                }
-            }
-            if (separate) {
-                app_pc spc = stub_pc;
-                while (spc - stub_pc < STUBIDX(stubs,cur_stub)->stub_size) {
-                    spc = dis(drcontext, spc, STUBIDX(stubs,cur_stub)->stub_pc +
-                              (spc - stub_pc));
-                }
-            } else {
-                while (pc - p < next_stub_offs) {
-                    pc = dis(drcontext, pc, hdrs.cache_start_pc + (pc - p));
-                }
-            }
+    } else {
+        dr_file_seek(f, sizeof(fhdr), DR_SEEK_SET);
+        while (index == NULL ||
+               dr_file_tell(f) + sizeof(tracedump_trace_header_t) <= data_end) {
+            if (!read_trace(f, drcontext, &fhdr, &dbuf, &dlen))
+                break;
         }
-        dr_printf("END TRACE %d\n", hdrs.frag_id);
+    }
+    if (index != NULL) {
+        size_t index_size = (size_t) (num_entries * sizeof(*index));
+        dr_global_free(index, index_size == 0 ? 1 : index_size);
     }
     if (dbuf != NULL)
         free(dbuf);
@@ -240,16 +324,19 @@ main(int argc, char *argv[])
 {
     file_t f;
     void *drcontext = dr_standalone_init();
-    if (argc != 2) {
-        dr_fprintf(STDERR, "Usage: %s <tracefile>\n", argv[0]);
+    app_pc tag = NULL;
+    if (argc != 2 && argc != 3) {
+        dr_fprintf(STDERR, "Usage: %s <tracefile> [<tag>]\n", argv[0]);
         return 1;
     }
+    if (argc == 3)
+        tag = (app_pc) strtoull(argv[2], NULL, 16);
     f = dr_open_file(argv[1], DR_FILE_READ | DR_FILE_ALLOW_LARGE);
     if (f == INVALID_FILE) {
         dr_fprintf(STDERR, "Error opening %s\n", argv[1]);
         return 1;
     }
-    read_data(f, drcontext);
+    read_data(f, drcontext, tag);
     dr_close_file(f);
     return 0;
 }
@@ -364,6 +364,14 @@ dispatch_enter_fcache(dcontext_t *dcontext, fragment_t *targetf)
     }
 
     dispatch_enter_fcache_stats(dcontext, targetf);
+
+    /* Entering through dispatch is our cheap sample of fragment hotness for
+     * clock replacement.  Private fragments are only touched by their owner
+     * so no lock is needed.
+     */
+    if (DYNAMO_OPTION(cache_replace_clock) &&
+        !TESTANY(FRAG_SHARED | FRAG_COARSE_GRAIN, targetf->flags))
+        targetf->flags |= FRAG_FIFO_REFERENCED;
                     
     /* FIXME: for now we do this before the synch point to avoid complexity of
      * missing a KSTART(fcache_* for cases like NtSetContextThread where a thread
@@ -210,6 +210,7 @@ static protect_info_t *protect_info;
 
 static void data_section_init(void);
 static void data_section_exit(void);
+static void dcontext_pool_exit(void);
 
 #ifdef DEBUG /*************************/
 
@@ -339,9 +340,75 @@ statistics_init(void)
 #undef RSTATS_DEF
 }
 
+#ifdef UNIX
+/* -stats_export_dir: stats points into the shared file
+ * <dir>/dynamorio.<pid>.stats, where external viewers map it read-only.
+ */
+static dr_statistics_t *stats_export;
+static char stats_export_path[MAXIMUM_PATH];
+# define STATS_EXPORT_SIZE ALIGN_FORWARD(sizeof(dr_statistics_t), PAGE_SIZE)
+
+static void
+statistics_export_set_path(void)
+{
+    string_option_read_lock();
+    snprintf(stats_export_path, BUFFER_SIZE_ELEMENTS(stats_export_path),
+             "%s/dynamorio.%d.stats", DYNAMO_OPTION(stats_export_dir),
+             get_process_id());
+    string_option_read_unlock();
+    NULL_TERMINATE_BUFFER(stats_export_path);
+}
+
+/* Must be called before there are other threads to update stats */
+static void
+statistics_export_init(void)
+{
+    ASSERT(stats == &nonshared_stats);
+    if (IS_STRING_OPTION_EMPTY(stats_export_dir))
+        return;
+    statistics_export_set_path();
+    stats_export = (dr_statistics_t *)
+        map_export_file(stats_export_path, stats, NULL, STATS_EXPORT_SIZE);
+    if (stats_export == NULL)
+        return;
+    /* DYNAMORIO_MAGIC_STRING is longer than the field: readers compare only
+     * the first DYNAMORIO_MAGIC_STRING_LEN-1 chars.
+     */
+    memcpy(stats_export->magicstring, DYNAMORIO_MAGIC_STRING,
+           sizeof(stats_export->magicstring) - 1);
+    NULL_TERMINATE_BUFFER(stats_export->magicstring);
+    stats = stats_export;
+}
+
+static void
+statistics_export_fork_init(void)
+{
+    if (stats_export == NULL)
+        return;
+    statistics_export_set_path();
+    fork_export_file(stats_export_path, (byte *)stats_export, STATS_EXPORT_SIZE);
+    stats_export->process_id = get_process_id();
+}
+
+static void
+statistics_export_exit(void)
+{
+    if (stats_export == NULL)
+        return;
+    /* keep the final values readable for anything logged from here on */
+    memcpy(&nonshared_stats, stats_export, sizeof(nonshared_stats));
+    stats = &nonshared_stats;
+    unmap_export_file(stats_export_path, (byte *)stats_export, STATS_EXPORT_SIZE);
+    stats_export = NULL;
+}
+#endif
+
 static void
 statistics_exit(void)
 {
+#ifdef UNIX
+    statistics_export_exit();
+#endif
     stats = NULL;
 }
 
@@ -502,6 +569,9 @@ dynamorio_app_init(void)
         modules_init(); /* before vm_areas_init() */
         os_init();
         config_heap_init(); /* after heap_init */
+#ifdef UNIX
+        statistics_export_init(); /* after dynamo_vm_areas_init */
+#endif
 
         /* Setup for handling faults in loader_init() */
         /* initial stack so we don't have to use app's 
@@ -717,6 +787,11 @@ dynamorio_fork_init(dcontext_t *dcontext)
      * create log dirs (xref i#189/PR 452168)
      */
     os_fork_init(dcontext);
+    statistics_export_fork_init();
+# ifdef KSTATS
+    /* before the parent's other threads are exited and merged below */
+    kstat_fork_init(dcontext);
+# endif
 
     /* sanity check, plus need to set this for statistics_init:
      * even if parent did an execve, env var should be reset by now
@@ -902,6 +977,8 @@ void
 dynamo_process_exit_with_thread_info(void)
 {
     perscache_fast_exit(); /* "fast" b/c called in release as well */
+    /* before the stats are dumped or the export is unmapped */
+    monitor_ibl_inline_fold_sites();
 }
 
 /* shared between app_exit and detach */
@@ -926,6 +1003,7 @@ dynamo_shared_exit(IF_WINDOWS_(thread_record_t *toexit)
 #  ifdef INTERNAL
     print_optimization_stats();
 #  endif
+    monitor_ibl_inline_dump_sites();
     DOLOG(1, LOG_STATS, {
         dump_global_stats(false);
     });
@@ -1036,6 +1114,7 @@ dynamo_shared_exit(IF_WINDOWS_(thread_record_t *toexit)
     stack_free(exception_stack, EXCEPTION_STACK_SIZE);
     exception_stack = NULL;
 #endif
+    dcontext_pool_exit();
     config_heap_exit();
     heap_exit();
     vmm_heap_exit();
@@ -1419,17 +1498,114 @@ dynamo_process_exit(void)
 #endif /* !DEBUG */
 }
 
+/* -thread_state_pool: dcontext allocations of exited threads, along with
+ * any separate upcontext, kept for reuse by new threads and callbacks.
+ * Their dstacks and signal stacks are pooled separately by stack_alloc() and
+ * stack_free(), and the heap and cache units backing the rest of their
+ * module state are kept on the dead unit lists, so the per-module
+ * *_thread_init routines rebuild that state without going back to the OS.
+ */
+typedef struct _dcontext_pool_entry_t {
+    void *allocated_start;
+    void *separate_upcontext;
+    struct _dcontext_pool_entry_t *next;
+} dcontext_pool_entry_t;
+
+DECLARE_CXTSWPROT_VAR(static mutex_t dcontext_pool_lock,
+                      INIT_LOCK_FREE(dcontext_pool_lock));
+DECLARE_CXTSWPROT_VAR(static dcontext_pool_entry_t *dcontext_pool, NULL);
+DECLARE_CXTSWPROT_VAR(static uint dcontext_pool_count, 0);
+
+static void
+free_dynamo_context_memory(void *allocated_start, void *separate_upcontext)
+{
+    if (TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
+        global_unprotected_heap_free(separate_upcontext,
+                                     sizeof(unprotected_context_t) HEAPACCT(ACCT_OTHER));
+    }
+    if (TEST(SELFPROT_GLOBAL, dynamo_options.protect_mask) &&
+        !TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
+        /* if protecting global but not dcontext, we put whole thing in unprot mem */
+        global_unprotected_heap_free(allocated_start,
+                                     sizeof(dcontext_t) + proc_get_cache_line_size()
+                                     HEAPACCT(ACCT_OTHER));
+    } else {
+        global_heap_free(allocated_start,
+                         sizeof(dcontext_t) + proc_get_cache_line_size()
+                         HEAPACCT(ACCT_OTHER));
+    }
+}
+
+/* The pool entry is stored in the old dcontext's own memory, past the
+ * cache-line bump, so pooling never allocates.
+ */
+static bool
+dcontext_pool_add(dcontext_t *dcontext)
+{
+    dcontext_pool_entry_t *entry = (dcontext_pool_entry_t *) dcontext;
+    void *allocated_start = dcontext->allocated_start;
+    void *separate_upcontext = dcontext->upcontext.separate_upcontext;
+    bool added = false;
+    if (DYNAMO_OPTION(thread_state_pool) == 0 || dynamo_exited)
+        return false;
+    mutex_lock(&dcontext_pool_lock);
+    if (dcontext_pool_count < DYNAMO_OPTION(thread_state_pool)) {
+        entry->allocated_start = allocated_start;
+        entry->separate_upcontext = separate_upcontext;
+        entry->next = dcontext_pool;
+        dcontext_pool = entry;
+        dcontext_pool_count++;
+        added = true;
+    }
+    mutex_unlock(&dcontext_pool_lock);
+    return added;
+}
+
+static dcontext_pool_entry_t *
+dcontext_pool_remove(void)
+{
+    dcontext_pool_entry_t *entry = NULL;
+    if (dcontext_pool == NULL)
+        return NULL;
+    mutex_lock(&dcontext_pool_lock);
+    if (dcontext_pool != NULL) {
+        entry = dcontext_pool;
+        dcontext_pool = entry->next;
+        dcontext_pool_count--;
+    }
+    mutex_unlock(&dcontext_pool_lock);
+    return entry;
+}
+
+/* Frees all pooled dcontexts.  Called at exit before the heap is torn down. */
+static void
+dcontext_pool_exit(void)
+{
+    dcontext_pool_entry_t *entry;
+    while ((entry = dcontext_pool_remove()) != NULL)
+        free_dynamo_context_memory(entry->allocated_start, entry->separate_upcontext);
+    DELETE_LOCK(dcontext_pool_lock);
+}
+
 dcontext_t *
 create_new_dynamo_context(bool initial, byte *dstack_in)
 {
     dcontext_t *dcontext;
     size_t alloc = sizeof(dcontext_t) + proc_get_cache_line_size();
-    void *alloc_start = (void *) 
-        ((TEST(SELFPROT_GLOBAL, dynamo_options.protect_mask) &&
-          !TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) ?
-         /* if protecting global but not dcontext, put whole thing in unprot mem */
-         global_unprotected_heap_alloc(alloc HEAPACCT(ACCT_OTHER)) :
-         global_heap_alloc(alloc HEAPACCT(ACCT_OTHER)));
+    dcontext_pool_entry_t *pooled = dcontext_pool_remove();
+    void *alloc_start, *separate_upcontext = NULL;
+    if (pooled != NULL) {
+        STATS_INC(thread_state_pool_dcontexts);
+        alloc_start = pooled->allocated_start;
+        separate_upcontext = pooled->separate_upcontext;
+    } else {
+        alloc_start = (void *) 
+            ((TEST(SELFPROT_GLOBAL, dynamo_options.protect_mask) &&
+              !TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) ?
+             /* if protecting global but not dcontext, put whole thing in unprot mem */
+             global_unprotected_heap_alloc(alloc HEAPACCT(ACCT_OTHER)) :
+             global_heap_alloc(alloc HEAPACCT(ACCT_OTHER)));
+    }
     dcontext = (dcontext_t*) proc_bump_to_end_of_cache_line((ptr_uint_t)alloc_start);
     ASSERT(proc_is_cache_aligned(dcontext));
     /* 264138: ensure xmm/ymm slots are aligned so we can use vmovdqa */
@@ -1457,7 +1633,8 @@ create_new_dynamo_context(bool initial, byte *dstack_in)
         ASSERT(dstack_in == NULL);
     }
     if (TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
-        dcontext->upcontext.separate_upcontext =
+        dcontext->upcontext.separate_upcontext = (separate_upcontext != NULL) ?
+            separate_upcontext :
             global_unprotected_heap_alloc(sizeof(unprotected_context_t) HEAPACCT(ACCT_OTHER));
         /* don't need to initialize upcontext */
         LOG(GLOBAL, LOG_TOP, 2, "new dcontext="PFX", dcontext->upcontext="PFX"\n",
@@ -1499,21 +1676,10 @@ delete_dynamo_context(dcontext_t *dcontext, bool free_stack)
 
     ASSERT(dcontext->try_except.try_except_state == NULL);
 
-    if (TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
-        global_unprotected_heap_free(dcontext->upcontext.separate_upcontext,
-                                     sizeof(unprotected_context_t) HEAPACCT(ACCT_OTHER));
-    }
-    if (TEST(SELFPROT_GLOBAL, dynamo_options.protect_mask) &&
-        !TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
-        /* if protecting global but not dcontext, we put whole thing in unprot mem */
-        global_unprotected_heap_free(dcontext->allocated_start,
-                                     sizeof(dcontext_t) + proc_get_cache_line_size()
-                                     HEAPACCT(ACCT_OTHER));
-    } else {
-        global_heap_free(dcontext->allocated_start,
-                         sizeof(dcontext_t) + proc_get_cache_line_size()
-                         HEAPACCT(ACCT_OTHER));
-    }
+    if (dcontext_pool_add(dcontext))
+        return;
+    free_dynamo_context_memory(dcontext->allocated_start,
+                               dcontext->upcontext.separate_upcontext);
 }
 
 /* This routine is called not only at thread initialization,
@@ -164,6 +164,10 @@ typedef struct _live_header_t {
  * take the form of the empty_slot_t struct.
  * Target fragments to delete are represented in the FIFO by their fragment_t
  * struct, using the next_fcache field to chain them.
+ * With -cache_replace_clock the FIFO becomes a clock: dispatch sets
+ * FRAG_FIFO_REFERENCED on each private fragment it enters, and replace_fifo
+ * moves a referenced victim to the back of the FIFO with its bit cleared
+ * rather than deleting it.
  * We use a header for each fragment so we can delete adjacent-in-cache
  * (different from indirected FIFO list) to make contiguous space available.
  * Padding for alignment is always at the end of the fragment, so it can be
@@ -391,6 +395,11 @@ struct _fcache;
 
 #define UNIT_RESERVED_SIZE(u) ((size_t)((u)->reserved_end_pc - (u)->start_pc))
 
+/* For -cache_large_pages: the 2MB x86 PAE/x64 large page size.  Units smaller
+ * than this cannot contain a whole large page and are not worth advising.
+ */
+#define FCACHE_LARGE_PAGE_SIZE (2*1024*1024)
+
 typedef struct _fcache_unit_t {
     cache_pc start_pc;         /* start address of fcache storage */
     cache_pc end_pc;           /* end address of committed storage, open-ended */
@@ -506,6 +515,12 @@ typedef struct _fcache {
     /* sizes of real requests and frees */
     uint request_size_histogram[HISTOGRAM_MAX_SIZE/HISTOGRAM_GRANULARITY];
     uint free_size_histogram[HISTOGRAM_MAX_SIZE/HISTOGRAM_GRANULARITY];
+    /* replacement policy stats: unlike num_{replaced,regenerated} these are
+     * never reset by the adaptive working set checks
+     */
+    uint stats_replaced;
+    uint stats_regenerated;
+    uint stats_second_chances;
 #endif
 } fcache_t;
 
@@ -1248,6 +1263,32 @@ in_fcache(void * pc)
     return fcache_lookup_unit((cache_pc)pc) != NULL;
 }
 
+/* Asks the OS to back a newly reserved unit with large pages for
+ * -cache_large_pages.  If it declines we just use regular pages.
+ */
+static void
+fcache_unit_advise_large_pages(cache_pc start_pc, size_t size)
+{
+    cache_pc large_start, large_end;
+    if (!DYNAMO_OPTION(cache_large_pages))
+        return;
+    large_start = (cache_pc) ALIGN_FORWARD(start_pc, FCACHE_LARGE_PAGE_SIZE);
+    large_end = (cache_pc) ALIGN_BACKWARD(start_pc + size, FCACHE_LARGE_PAGE_SIZE);
+    if (large_end <= large_start)
+        return;
+    if (os_heap_advise_large_pages(start_pc, size)) {
+        RSTATS_INC(fcache_large_page_units);
+        STATS_ADD(fcache_large_page_capacity, large_end - large_start);
+        LOG(GLOBAL, LOG_CACHE, 2, "fcache unit "PFX"-"PFX": %d large pages of %d KB\n",
+            start_pc, start_pc + size, (large_end - large_start)/FCACHE_LARGE_PAGE_SIZE,
+            FCACHE_LARGE_PAGE_SIZE/1024);
+    } else {
+        RSTATS_INC(fcache_large_page_failures);
+        DO_ONCE({
+            SYSLOG_INTERNAL_WARNING("large pages not available for code cache");
+        });
+    }
+}
 
 /* Pass NULL for pc if this routine should allocate the cache space.
  * If pc is non-NULL, this routine assumes that size is fully
@@ -1318,6 +1359,7 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
             commit_size = DYNAMO_OPTION(cache_commit_increment);
             ASSERT(commit_size <= size);
             u->start_pc = (cache_pc) heap_mmap_reserve(size, commit_size);
+            fcache_unit_advise_large_pages(u->start_pc, size);
         }
         ASSERT(u->start_pc != NULL);
         ASSERT(proc_is_cache_aligned((void *)u->start_pc));
@@ -1418,9 +1460,13 @@ fcache_free_unit(dcontext_t *dcontext, fcache_unit_t *unit, bool dealloc_or_reus
         /* we do want to update cache->size and fcache_unit_areas: */
         fcache_really_free_unit(unit, false/*live*/, false/*do not dealloc unit*/);
     }
-    /* heuristic: don't keep around more dead units than max(5, 1/4 num threads) */
+    /* heuristic: don't keep around more dead units than max(5, 1/4 num threads),
+     * plus a bb and a trace unit for each -thread_state_pool thread so pooled
+     * threads can rebuild private caches without going back to the OS
+     */
     else if (allunits->num_dead < 5 ||
-             allunits->num_dead * 4U <= (uint) get_num_threads()) {
+             allunits->num_dead * 4U <= (uint) get_num_threads() ||
+             allunits->num_dead < 2 * DYNAMO_OPTION(thread_state_pool)) {
         /* Keep dead list sorted small-to-large to avoid grabbing large
          * when can take small and then needing to allocate when only
          * have small left.  Helps out with lots of small threads.
@@ -1532,6 +1578,11 @@ fcache_cache_init(dcontext_t *dcontext, uint flags, bool initial_unit)
     cache->num_replaced = 0;
     cache->wset_check = 0;
     cache->record_wset = false;
+    DODEBUG({
+        cache->stats_replaced = 0;
+        cache->stats_regenerated = 0;
+        cache->stats_second_chances = 0;
+    });
     if (cache->is_shared) { /* else won't use free list */
         memset(cache->free_list, 0, sizeof(cache->free_list));
         DODEBUG({
@@ -1692,6 +1743,12 @@ fcache_cache_stats(dcontext_t *dcontext, fcache_t *cache)
     }
     LOG(THREAD, LOG_CACHE, 1, "%s cache: capacity %d KB, used %d KB, %s\n",
         cache->name, capacity/1024, used/1024, full ? "full" : "not full");
+    if (cache->finite_cache) {
+        LOG(THREAD, LOG_CACHE, 1,
+            "%s cache: %d replaced, %d regenerated, %d second chances\n",
+            cache->name, cache->stats_replaced, cache->stats_regenerated,
+            cache->stats_second_chances);
+    }
     if (DYNAMO_OPTION(cache_shared_free_list) && 
         cache->is_shared) { /* using free list */
         int bucket;
@@ -1978,6 +2035,7 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         commit_size += unit->size;
         ASSERT(commit_size <= new_size);
         new_memory = (cache_pc) heap_mmap_reserve(new_size, commit_size);
+        fcache_unit_advise_large_pages(new_memory, new_size);
         STATS_FCACHE_SUB(cache, capacity, unit->size);
         STATS_FCACHE_ADD(cache, capacity, commit_size);
         STATS_FCACHE_MAX(cache, capacity_peak, capacity);
@@ -2500,8 +2558,10 @@ try_for_more_space(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
          * re-linking when resize.
          * i#696: Don't try to resize fcache units when clients are present.
          * They may use labels to insert absolute fragment PCs.
+         * -shadow_ret_stack call sites embed them as well.
          */
         if (unit->size >= cache->max_unit_size
+            || DYNAMO_OPTION(shadow_ret_stack)
             IF_CLIENT_INTERFACE(|| dr_bb_hook_exists()
                                 || dr_trace_hook_exists())) {
             fcache_unit_t *newunit;
@@ -2669,8 +2729,10 @@ place_fragment(dcontext_t *dcontext, fragment_t *f, fcache_unit_t *unit,
         ASSERT(!USE_FIFO_FOR_CACHE(cache));
         ASSERT(!cache->is_coarse);
         cache->num_replaced++; /* simply number created past record_wset point */
+        DODEBUG({ cache->stats_replaced++; });
         if (fut != NULL) {
             cache->num_regenerated++;
+            DODEBUG({ cache->stats_regenerated++; });
             STATS_INC(num_fragments_regenerated);
             SHARED_FLAGS_RECURSIVE_LOCK(fut->flags, acquire, change_linking_lock);
             fut->flags &= ~FRAG_WAS_DELETED;
@@ -2736,8 +2798,10 @@ force_fragment_from_cache(dcontext_t *dcontext, fcache_t *cache, fragment_t *vic
         /* don't need to add deleted -- that's done by link.c for us,
          * when it makes a future fragment it uses the FRAG_WAS_DELETED flag 
          */
-        if (cache->finite_cache)
+        if (cache->finite_cache) {
             cache->num_replaced++;
+            DODEBUG({ cache->stats_replaced++; });
+        }
         DOSTATS({ removed_fragment_stats(dcontext, cache, victim); });
         STATS_INC(num_fragments_replaced);
         fragment_delete(dcontext, victim, FRAGDEL_NO_FCACHE);
@@ -2843,6 +2907,7 @@ replace_fragments(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         ASSERT(cache->finite_cache && cache->replace_param > 0);
         if (fut != NULL) {
             cache->num_regenerated++;
+            DODEBUG({ cache->stats_regenerated++; });
             STATS_INC(num_fragments_regenerated);
             SHARED_FLAGS_RECURSIVE_LOCK(fut->flags, acquire, change_linking_lock);
             fut->flags &= ~FRAG_WAS_DELETED;
@@ -2860,9 +2925,27 @@ replace_fifo(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_siz
              fragment_t *fifo)
 {
     fcache_unit_t *unit;
+    fragment_t *next;
     ASSERT(USE_FIFO(f));
     ASSERT(CACHE_PROTECTED(cache));
     while (fifo != NULL) {
+        if (DYNAMO_OPTION(cache_replace_clock) && !FRAG_EMPTY(fifo) &&
+            TEST(FRAG_FIFO_REFERENCED, fifo->flags)) {
+            /* Second chance: entered since the hand last passed, so move it to
+             * the back.  Each fragment is moved at most once per call as its
+             * bit is now clear, so this terminates even if all are referenced.
+             */
+            next = FIFO_NEXT(fifo);
+            fifo->flags &= ~FRAG_FIFO_REFERENCED;
+            fifo_remove(dcontext, cache, fifo);
+            fifo_append(cache, fifo);
+            LOG(THREAD, LOG_CACHE, 4, "\tsecond chance for F%d\n", FRAG_ID(fifo));
+            DODEBUG({ cache->stats_second_chances++; });
+            STATS_INC(num_fragments_second_chance);
+            /* if it was already at the back we must now consider it */
+            fifo = (next == NULL) ? fifo : next;
+            continue;
+        }
         unit = FIFO_UNIT(fifo);
         if ((ptr_uint_t)(unit->end_pc - FRAG_HDR_START(fifo)) >= slot_size) {
             /* try to replace fifo and possibly subsequent frags with f
@@ -4243,10 +4326,12 @@ fcache_reset_all_caches_proactively(uint target)
         /* free entire shared deletion list */
         vm_area_check_shared_pending(GLOBAL_DCONTEXT, NULL);
     } else {
+        /* monitor's only global data is the -trace_build_async queue */
+        monitor_flush_pending_traces(GLOBAL_DCONTEXT, UNIVERSAL_REGION_BASE,
+                                     UNIVERSAL_REGION_SIZE);
         fragment_reset_free();
         link_reset_free();
         fcache_reset_free();
-        /* monitor only has thread-private data */
         /* arch and os data is all persistent */
         vm_areas_reset_free();
 # ifdef HOT_PATCHING_INTERFACE
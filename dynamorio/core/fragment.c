@@ -258,11 +258,64 @@ process_client_flush_requests(dcontext_t *dcontext, dcontext_t *alloc_dcontext,
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
 /* trace logging and synch for shared trace file: */
 DECLARE_CXTSWPROT_VAR(static mutex_t tracedump_mutex, INIT_LOCK_FREE(tracedump_mutex));
-DECLARE_FREQPROT_VAR(static stats_int_t tcount, 0); /* protected by tracedump_mutex */
+/* protected by tracedump_mutex, except for binary dumps which increment it atomically */
+DECLARE_FREQPROT_VAR(static stats_int_t tcount, 0);
 static void exit_trace_file(per_thread_t *pt);
 static void output_trace(dcontext_t *dcontext, per_thread_t *pt,
                          fragment_t *f, stats_int_t deleted_at);
 static void init_trace_file(per_thread_t *pt);
+
+/* -tracedump_binary and -tracedump_compact records are formatted into
+ * per-thread buffers and written a buffer at a time, with -tracedump_async
+ * by a background writer thread.  A buffer only holds whole records, so the
+ * shared trace file can take buffers from several threads.  Each record's
+ * file offset is noted when its buffer is written, for the index that ends
+ * the file.
+ */
+#define TRACEDUMP_BUFFERED() \
+    (INTERNAL_OPTION(tracedump_binary) || INTERNAL_OPTION(tracedump_compact))
+
+typedef struct _tracedump_file_t {
+    file_t file;
+    uint64 offs;                    /* bytes written so far */
+    tracedump_index_entry_t *index; /* one entry per record written */
+    uint index_entries;
+    uint index_capacity;
+} tracedump_file_t;
+
+/* A buffer is handed off once this full; a larger record grows it */
+#define TRACEDUMP_BUF_SIZE (64*1024)
+#define TRACEDUMP_BUF_FLUSH_SIZE (48*1024)
+#define TRACEDUMP_BUF_MAX_RECORDS 256
+
+typedef struct _tracedump_buf_t {
+    tracedump_file_t *dest;
+    byte *data;
+    size_t size;
+    size_t used;
+    bool close_dest;                /* close dest once written */
+    uint num_records;
+    /* offsets here are relative to data */
+    tracedump_index_entry_t records[TRACEDUMP_BUF_MAX_RECORDS];
+    struct _tracedump_buf_t *next;  /* on the writer's queue */
+} tracedump_buf_t;
+
+# ifdef CLIENT_SIDELINE
+/* -tracedump_async: buffers waiting for the writer thread */
+DECLARE_CXTSWPROT_VAR(static mutex_t tracedump_queue_lock,
+                      INIT_LOCK_FREE(tracedump_queue_lock));
+DECLARE_CXTSWPROT_VAR(static tracedump_buf_t *tracedump_queue_head, NULL);
+DECLARE_CXTSWPROT_VAR(static tracedump_buf_t *tracedump_queue_tail, NULL);
+DECLARE_CXTSWPROT_VAR(static bool tracedump_writer_attempted, false);
+/* set once the writer exists: until then buffers are written synchronously */
+DECLARE_CXTSWPROT_VAR(static bool tracedump_writer_running, false);
+static event_t tracedump_queue_event;
+static void tracedump_writer_drain(void);
+# endif
+static void tracedump_buf_free(tracedump_buf_t *buf);
+static void tracedump_file_free(tracedump_file_t *tf);
+static void tracedump_buf_flush(tracedump_buf_t **bufp, bool final, bool close_dest,
+                                bool no_lock);
 #endif
 
 #define SHOULD_OUTPUT_FRAGMENT(flags) \
@@ -762,6 +815,10 @@ hashtable_ibl_myinit(dcontext_t *dcontext, ibl_table_t *table, uint bits,
     flags |= FRAG_TABLE_INCLUSIVE_HIERARCHY;
     flags |= FRAG_TABLE_IBL_TARGETED;
     flags |= HASHTABLE_ALIGN_TABLE;
+    if (DYNAMO_OPTION(ibl_bucket_lines)) {
+        /* a probe now normally walks part of a line so clusters look longer */
+        flags |= HASHTABLE_BUCKET_LINES | HASHTABLE_RELAX_CLUSTER_CHECKS;
+    }
     /* use entry stats with all our ibl-targeted tables */
     flags |= HASHTABLE_USE_ENTRY_STATS;
 #ifdef HASHTABLE_STATISTICS
@@ -1434,6 +1491,15 @@ fragment_init()
     fragment_reset_init();
 
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
+    if (USE_SHARED_PT()) {
+        shared_pt->tracedump_file = NULL;
+        shared_pt->tracedump_buf = NULL;
+        shared_pt->tracedump_shared_buf = NULL;
+    }
+# ifdef CLIENT_SIDELINE
+    if (INTERNAL_OPTION(tracedump_async) && TRACEDUMP_BUFFERED())
+        tracedump_queue_event = create_event();
+# endif
     if (TRACEDUMP_ENABLED() && DYNAMO_OPTION(shared_traces)) {
         ASSERT(USE_SHARED_PT());
         shared_pt->tracefile = open_log_file("traces-shared", NULL, 0);
@@ -1600,8 +1666,15 @@ fragment_exit()
         }
         TABLE_RWLOCK(shared_trace, read, unlock);
         release_recursive_lock(&change_linking_lock);
-        exit_trace_file(shared_pt);
     }
+# ifdef CLIENT_SIDELINE
+    /* the writer thread may be gone by now: finish its work ourselves */
+    tracedump_writer_drain();
+    if (INTERNAL_OPTION(tracedump_async) && TRACEDUMP_BUFFERED())
+        destroy_event(tracedump_queue_event);
+# endif
+    if (TRACEDUMP_ENABLED() && DYNAMO_OPTION(shared_traces))
+        exit_trace_file(shared_pt);
 #endif
 
 #ifdef FRAGMENT_SIZES_STUDY
@@ -1701,6 +1774,9 @@ fragment_exit()
     /* FIXME: we shouldn't need these locks anyway for hotp_only & thin_client */
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
     DELETE_LOCK(tracedump_mutex);
+# ifdef CLIENT_SIDELINE
+    DELETE_LOCK(tracedump_queue_lock);
+# endif
 #endif
 #ifdef CLIENT_INTERFACE
     process_client_flush_requests(NULL, GLOBAL_DCONTEXT, client_flush_requests,
@@ -1824,6 +1900,59 @@ dec_all_table_ref_counts(dcontext_t *dcontext, per_thread_t *pt)
     }
 }
 
+/* -shadow_ret_stack: the ring lives in unprotected heap since the cache
+ * writes it, and is pointed at from TLS.  Its landing pcs are only ever in
+ * shared bbs, which are not freed until every thread has passed through
+ * vm_area_check_shared_pending() (or been synched for a reset or an
+ * all-threads flush), so emptying the ring there keeps it from pointing at
+ * freed cache.
+ */
+static void
+shadow_ret_stack_thread_init(dcontext_t *dcontext)
+{
+    local_state_extended_t *state = (local_state_extended_t *) dcontext->local_state;
+    ASSERT(state != NULL);
+    state->shadow_ret_stack =
+        HEAP_TYPE_ALLOC(dcontext, shadow_ret_stack_t, ACCT_OTHER, UNPROTECTED);
+    /* the entries are emptied by fragment_thread_reset_init() */
+    state->shadow_ret_stack->hits = 0;
+    state->shadow_ret_stack->misses = 0;
+    state->shadow_ret_target = NULL;
+}
+
+static void
+shadow_ret_stack_thread_exit(dcontext_t *dcontext)
+{
+    local_state_extended_t *state = (local_state_extended_t *) dcontext->local_state;
+    ASSERT(state != NULL && state->shadow_ret_stack != NULL);
+    STATS_ADD(shadow_ret_hits, state->shadow_ret_stack->hits);
+    STATS_ADD(shadow_ret_misses, state->shadow_ret_stack->misses);
+    HEAP_TYPE_FREE(dcontext, state->shadow_ret_stack, shadow_ret_stack_t,
+                   ACCT_OTHER, UNPROTECTED);
+    state->shadow_ret_stack = NULL;
+}
+
+void
+fragment_shadow_ret_stack_clear(dcontext_t *dcontext)
+{
+    local_state_extended_t *state;
+    shadow_ret_stack_t *ring;
+    uint i;
+    if (!DYNAMO_OPTION(shadow_ret_stack) || dcontext == GLOBAL_DCONTEXT)
+        return;
+    state = (local_state_extended_t *) dcontext->local_state;
+    if (state == NULL || state->shadow_ret_stack == NULL)
+        return;
+    ring = state->shadow_ret_stack;
+    /* an entry that can never match: no app return targets our heap */
+    for (i = 0; i < SHADOW_RET_STACK_ENTRIES; i++) {
+        ring->entry[i].neg_retaddr = -(ptr_int_t)ring;
+        ring->entry[i].landing = NULL;
+    }
+    ring->top = 0;
+    STATS_INC(shadow_ret_clears);
+}
+
 /* re-initializes non-persistent memory */
 void
 fragment_thread_reset_init(dcontext_t *dcontext)
@@ -1845,6 +1974,9 @@ fragment_thread_reset_init(dcontext_t *dcontext)
      */
     pt->flushtime_last_update = (dynamo_resetting) ? 0 : flushtime_global;
 
+    /* a reset frees every fragment the ring could point into */
+    fragment_shadow_ret_stack_clear(dcontext);
+
     /* set initial hashtable sizes */
     hashtable_fragment_init(dcontext, &pt->bb, INIT_HTABLE_SIZE_BB,
                             INTERNAL_OPTION(private_bb_load),
@@ -2022,9 +2154,15 @@ fragment_thread_init(dcontext_t *dcontext)
     pt = (per_thread_t *) global_heap_alloc(sizeof(per_thread_t) HEAPACCT(ACCT_OTHER));
     dcontext->fragment_field = (void *) pt;
 
+    if (DYNAMO_OPTION(shadow_ret_stack))
+        shadow_ret_stack_thread_init(dcontext);
+
     fragment_thread_reset_init(dcontext);
 
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
+    pt->tracedump_file = NULL;
+    pt->tracedump_buf = NULL;
+    pt->tracedump_shared_buf = NULL;
     if (TRACEDUMP_ENABLED() && PRIVATE_TRACES_ENABLED()) {
         pt->tracefile = open_log_file("traces", NULL, 0);
         ASSERT(pt->tracefile != INVALID_FILE);
@@ -2204,10 +2342,17 @@ fragment_thread_exit(dcontext_t *dcontext)
         }
         exit_trace_file(pt);
     }
+    if (pt->tracedump_shared_buf != NULL) {
+        /* our records for the shared file */
+        tracedump_buf_flush(&pt->tracedump_shared_buf, true/*final*/, false, false);
+    }
 #endif
 
     fragment_thread_reset_free(dcontext);
 
+    if (DYNAMO_OPTION(shadow_ret_stack))
+        shadow_ret_stack_thread_exit(dcontext);
+
     /* events are global */
     destroy_event(pt->waiting_for_unlink);
     destroy_event(pt->finished_with_unlink);
@@ -2229,6 +2374,32 @@ fragment_fork_init(dcontext_t *dcontext)
     /* FIXME: what about global file? */
 # if defined(INTERNAL) || defined(CLIENT_INTERFACE)
     per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    /* drop the parent's unwritten records: they are the parent's to write */
+    if (pt->tracedump_buf != NULL) {
+        tracedump_buf_free(pt->tracedump_buf);
+        pt->tracedump_buf = NULL;
+    }
+    if (pt->tracedump_file != NULL) {
+        tracedump_file_free(pt->tracedump_file);
+        pt->tracedump_file = NULL;
+    }
+    if (pt->tracedump_shared_buf != NULL) {
+        tracedump_buf_free(pt->tracedump_shared_buf);
+        pt->tracedump_shared_buf = NULL;
+    }
+#  ifdef CLIENT_SIDELINE
+    /* the writer thread was not forked */
+    while (tracedump_queue_head != NULL) {
+        tracedump_buf_t *buf = tracedump_queue_head;
+        tracedump_queue_head = buf->next;
+        if (buf->close_dest)
+            tracedump_file_free(buf->dest);
+        tracedump_buf_free(buf);
+    }
+    tracedump_queue_tail = NULL;
+    tracedump_writer_running = false;
+    tracedump_writer_attempted = false;
+#  endif
     if (TRACEDUMP_ENABLED() && PRIVATE_TRACES_ENABLED()) {
         /* new log dir has already been created, so just open a new log file */
         pt->tracefile = open_log_file("traces", NULL, 0);
@@ -5604,7 +5775,9 @@ wait_for_flusher_nolinking(dcontext_t *dcontext)
             dcontext->owning_thread, flusher->owning_thread, flushtime_global);
         mutex_unlock(&pt->linking_lock);
         STATS_INC(num_wait_flush);
+        KSTART_DC(dcontext, flush_wait);
         wait_for_event(pt->finished_all_unlink);
+        KSTOP_DC(dcontext, flush_wait);
         LOG(THREAD, LOG_DISPATCH|LOG_THREADS, 2,
             "Thread %d resuming after flush\n", dcontext->owning_thread);
         mutex_lock(&pt->linking_lock);
@@ -5627,7 +5800,9 @@ wait_for_flusher_linking(dcontext_t *dcontext)
         mutex_unlock(&pt->linking_lock);
         signal_event(pt->waiting_for_unlink);
         STATS_INC(num_wait_flush);
+        KSTART_DC(dcontext, flush_wait);
         wait_for_event(pt->finished_with_unlink);
+        KSTOP_DC(dcontext, flush_wait);
         LOG(THREAD, LOG_DISPATCH|LOG_THREADS, 2,
             "Thread %d resuming after flush\n", dcontext->owning_thread);
         mutex_lock(&pt->linking_lock);
@@ -5753,6 +5928,12 @@ enter_nolinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache_tran
             fcache_flush_pending_units(dcontext, was_I_flushed);
     }
 
+    /* -ibl_inline_targets sites asking to be re-specialized */
+    if (ibl_inline_retarget_pending) {
+        if (!monitor_ibl_inline_retarget(dcontext))
+            not_flushed = false;
+    }
+
 #ifdef UNIX
     /* i#61/PR 211530: nudges on Linux do not use separate threads */
     while (dcontext->nudge_pending != NULL) {
@@ -6051,6 +6232,10 @@ flush_fragments_synchall_start(dcontext_t *ignored, app_pc base, size_t size,
         "flush_fragments_synchall_start: from "PFX"-"PFX" => coarse "PFX"-"PFX"\n",
         base, base+size, exec_start, exec_end);
 
+    /* queued -trace_build_async traces are squashed like in-progress ones below */
+    monitor_flush_pending_traces(my_dcontext, UNIVERSAL_REGION_BASE,
+                                 UNIVERSAL_REGION_SIZE);
+
     /* FIXME: share some of this code that I duplicated from reset */
     for (i = 0; i < flush_num_threads; i++) {
         dcontext_t *dcontext = flush_threads[i]->dcontext;
@@ -6123,6 +6308,8 @@ flush_fragments_synchall_start(dcontext_t *ignored, app_pc base, size_t size,
             LOG(THREAD, LOG_FRAGMENT, 2,
                 "\tremoved %d ibl entries in "PFX"-"PFX"\n",
                 removed, exec_start, exec_end);
+            /* shared fragments are freed below without a pending-delete pass */
+            fragment_shadow_ret_stack_clear(dcontext);
             /* Free any fine private fragments in the region */
             vm_area_allsynch_flush_fragments(dcontext, dcontext, base, base+size,
                                              exec_invalid, all_synched/*ignored*/);
@@ -6309,6 +6496,29 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
     if (!special_ibl_xfer_is_thread_private())
         unlink_special_ibl_xfer(GLOBAL_DCONTEXT);
 
+    if (DYNAMO_OPTION(flush_pipelined_synch)) {
+        /* Ask every thread that is in DR to stop at its next synch point before
+         * waiting for any of them, so they all get there in parallel and our
+         * wait below is bounded by the slowest rather than by the sum.
+         * A thread asked here cannot stop being could_be_linking until we let
+         * it go in flush_fragments_end_synch() (or it exits, which sets
+         * about_to_exit), so the loop below treats it just as if it were the
+         * one setting wait_for_unlink.
+         */
+        for (i=0; i<flush_num_threads; i++) {
+            tgt_dcontext = flush_threads[i]->dcontext;
+            if (tgt_dcontext == dcontext)
+                continue;
+            tgt_pt = (per_thread_t *) tgt_dcontext->fragment_field;
+            mutex_lock(&tgt_pt->linking_lock);
+            if (tgt_pt->could_be_linking) {
+                tgt_pt->wait_for_unlink = true;
+                STATS_INC(num_flush_synch_prerequested);
+            }
+            mutex_unlock(&tgt_pt->linking_lock);
+        }
+    }
+
     for (i=0; i<flush_num_threads; i++) {
         tgt_dcontext = flush_threads[i]->dcontext;
         tgt_pt = (per_thread_t *) tgt_dcontext->fragment_field;
@@ -6334,7 +6544,9 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
                 "\twaiting for thread %d\n", tgt_dcontext->owning_thread);
             tgt_pt->wait_for_unlink = true;
             mutex_unlock(&tgt_pt->linking_lock);
+            KSTART(flush_synch_wait);
             wait_for_event(tgt_pt->waiting_for_unlink);
+            KSTOP(flush_synch_wait);
             mutex_lock(&tgt_pt->linking_lock);
             tgt_pt->wait_for_unlink = false;
             LOG(THREAD, LOG_FRAGMENT, 2,
@@ -6496,6 +6708,12 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
         mutex_unlock(&tgt_pt->linking_lock);
     }
 
+    /* Traces queued for -trace_build_async are on no thread's trace_vmlist.
+     * Now that every thread is synched, none can queue a new one until we're done.
+     */
+    if (size > 0)
+        monitor_flush_pending_traces(dcontext, base, size);
+
     return true;
 }
 
@@ -6785,6 +7003,8 @@ flush_fragments_in_region_start(dcontext_t *dcontext, app_pc base, size_t size,
                                 _IF_DGCDIAG(app_pc written_pc))
 {
     KSTART(flush_region);
+    /* the region's code may be about to change: drop its cached decodings */
+    decode_cache_invalidate(base, size);
     while (true) {
         if (flush_fragments_synch_unlink_priv(dcontext, base, size, own_initexit_lock,
                                               exec_invalid, force_synchall
@@ -6939,15 +7159,249 @@ fragment_output(dcontext_t *dcontext, fragment_t *f)
     }
 }
 
+static tracedump_buf_t *
+tracedump_buf_create(tracedump_file_t *dest, size_t size)
+{
+    tracedump_buf_t *buf = (tracedump_buf_t *)
+        global_heap_alloc(sizeof(*buf) HEAPACCT(ACCT_OTHER));
+    buf->dest = dest;
+    buf->data = (byte *) global_heap_alloc(size HEAPACCT(ACCT_OTHER));
+    buf->size = size;
+    buf->used = 0;
+    buf->close_dest = false;
+    buf->num_records = 0;
+    buf->next = NULL;
+    return buf;
+}
+
+static void
+tracedump_buf_free(tracedump_buf_t *buf)
+{
+    global_heap_free(buf->data, buf->size HEAPACCT(ACCT_OTHER));
+    global_heap_free(buf, sizeof(*buf) HEAPACCT(ACCT_OTHER));
+}
+
+static void
+tracedump_file_free(tracedump_file_t *tf)
+{
+    if (tf->index != NULL) {
+        global_heap_free(tf->index, tf->index_capacity * sizeof(tf->index[0])
+                         HEAPACCT(ACCT_OTHER));
+    }
+    global_heap_free(tf, sizeof(*tf) HEAPACCT(ACCT_OTHER));
+}
+
+/* Appends the index and closes the file */
+static void
+tracedump_file_close(tracedump_file_t *tf)
+{
+    tracedump_index_trailer_t trailer;
+    trailer.index_offset = tf->offs;
+    trailer.num_entries = tf->index_entries;
+    memcpy(trailer.magic, TRACEDUMP_INDEX_MAGIC, sizeof(trailer.magic));
+    if (tf->index_entries > 0)
+        os_write(tf->file, tf->index, tf->index_entries * sizeof(tf->index[0]));
+    os_write(tf->file, &trailer, sizeof(trailer));
+    close_log_file(tf->file);
+    tracedump_file_free(tf);
+}
+
+/* Writes buf to its file, then frees it.  Callers serialize on
+ * tracedump_mutex, except during reset, when nothing else writes.
+ */
+static void
+tracedump_buf_write(tracedump_buf_t *buf)
+{
+    tracedump_file_t *tf = buf->dest;
+    uint i;
+    if (buf->used > 0)
+        os_write(tf->file, buf->data, buf->used);
+    if (tf->index_entries + buf->num_records > tf->index_capacity) {
+        uint capacity = MAX(tf->index_capacity * 2, TRACEDUMP_BUF_MAX_RECORDS);
+        tracedump_index_entry_t *index = (tracedump_index_entry_t *)
+            global_heap_alloc(capacity * sizeof(*index) HEAPACCT(ACCT_OTHER));
+        if (tf->index != NULL) {
+            memcpy(index, tf->index, tf->index_entries * sizeof(*index));
+            global_heap_free(tf->index, tf->index_capacity * sizeof(*index)
+                             HEAPACCT(ACCT_OTHER));
+        }
+        tf->index = index;
+        tf->index_capacity = capacity;
+    }
+    for (i = 0; i < buf->num_records; i++) {
+        tf->index[tf->index_entries].tag = buf->records[i].tag;
+        tf->index[tf->index_entries].offset = tf->offs + buf->records[i].offset;
+        tf->index_entries++;
+    }
+    tf->offs += buf->used;
+    if (buf->close_dest)
+        tracedump_file_close(tf);
+    tracedump_buf_free(buf);
+}
+
+/* Hands *bufp to the writer thread, or writes it now if there is none.
+ * Unless final, *bufp is replaced with an empty buffer; if close_dest as
+ * well, the file is closed after the buffer is written.  no_lock says the
+ * caller holds tracedump_mutex or needs no synchronization.
+ */
+static void
+tracedump_buf_flush(tracedump_buf_t **bufp, bool final, bool close_dest, bool no_lock)
+{
+    tracedump_buf_t *buf = *bufp;
+    ASSERT(final || !close_dest);
+    buf->close_dest = close_dest;
+    *bufp = final ? NULL : tracedump_buf_create(buf->dest, TRACEDUMP_BUF_SIZE);
+#ifdef CLIENT_SIDELINE
+    if (tracedump_writer_running) {
+        bool queued = false;
+        mutex_lock(&tracedump_queue_lock);
+        /* re-check: fragment_exit stops queueing to drain the queue */
+        if (tracedump_writer_running) {
+            if (tracedump_queue_tail == NULL)
+                tracedump_queue_head = buf;
+            else
+                tracedump_queue_tail->next = buf;
+            tracedump_queue_tail = buf;
+            queued = true;
+        }
+        mutex_unlock(&tracedump_queue_lock);
+        if (queued) {
+            signal_event(tracedump_queue_event);
+            return;
+        }
+    }
+#endif
+    if (!no_lock)
+        mutex_lock(&tracedump_mutex);
+    tracedump_buf_write(buf);
+    if (!no_lock)
+        mutex_unlock(&tracedump_mutex);
+}
+
+/* Returns room for sz more bytes of the current record, growing buf if
+ * needed so that records are never split across buffers
+ */
+static byte *
+tracedump_buf_reserve(tracedump_buf_t *buf, size_t sz)
+{
+    if (buf->used + sz > buf->size) {
+        size_t size = MAX(buf->size * 2, buf->used + sz);
+        byte *data = (byte *) global_heap_alloc(size HEAPACCT(ACCT_OTHER));
+        memcpy(data, buf->data, buf->used);
+        global_heap_free(buf->data, buf->size HEAPACCT(ACCT_OTHER));
+        buf->data = data;
+        buf->size = size;
+    }
+    return buf->data + buf->used;
+}
+
+static void
+tracedump_buf_append(tracedump_buf_t *buf, const void *src, size_t sz)
+{
+    memcpy(tracedump_buf_reserve(buf, sz), src, sz);
+    buf->used += sz;
+}
+
+static void
+tracedump_buf_end_record(tracedump_buf_t **bufp, app_pc tag, size_t start, bool no_lock)
+{
+    tracedump_buf_t *buf = *bufp;
+    buf->records[buf->num_records].tag = tag;
+    buf->records[buf->num_records].offset = start;
+    buf->num_records++;
+    if (buf->used >= TRACEDUMP_BUF_FLUSH_SIZE ||
+        buf->num_records == TRACEDUMP_BUF_MAX_RECORDS)
+        tracedump_buf_flush(bufp, false/*keep going*/, false, no_lock);
+}
+
+#ifdef CLIENT_SIDELINE
+static void
+tracedump_writer_main(void *arg)
+{
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    tracedump_buf_t *buf;
+    LOG(THREAD, LOG_FRAGMENT, 1, "Trace dump writer thread started\n");
+    while (true) {
+        /* we hold no locks while waiting */
+        dcontext->client_data->client_thread_safe_for_synch = true;
+        wait_for_event(tracedump_queue_event);
+        dcontext->client_data->client_thread_safe_for_synch = false;
+        do {
+            mutex_lock(&tracedump_queue_lock);
+            buf = tracedump_queue_head;
+            if (buf != NULL) {
+                tracedump_queue_head = buf->next;
+                if (tracedump_queue_head == NULL)
+                    tracedump_queue_tail = NULL;
+            }
+            mutex_unlock(&tracedump_queue_lock);
+            if (buf != NULL) {
+                mutex_lock(&tracedump_mutex);
+                tracedump_buf_write(buf);
+                mutex_unlock(&tracedump_mutex);
+            }
+        } while (buf != NULL);
+    }
+}
+
+/* Stops queueing and writes out what is queued, in case the writer thread
+ * is gone.
+ */
+static void
+tracedump_writer_drain(void)
+{
+    tracedump_buf_t *buf, *next;
+    mutex_lock(&tracedump_queue_lock);
+    tracedump_writer_running = false;
+    buf = tracedump_queue_head;
+    tracedump_queue_head = NULL;
+    tracedump_queue_tail = NULL;
+    mutex_unlock(&tracedump_queue_lock);
+    mutex_lock(&tracedump_mutex);
+    for (; buf != NULL; buf = next) {
+        next = buf->next;
+        tracedump_buf_write(buf);
+    }
+    mutex_unlock(&tracedump_mutex);
+}
+#endif
+
+void
+fragment_start_tracedump_writer(dcontext_t *dcontext)
+{
+#ifdef CLIENT_SIDELINE
+    bool start = false;
+    if (!INTERNAL_OPTION(tracedump_async) || !TRACEDUMP_BUFFERED() ||
+        !TRACEDUMP_ENABLED() || tracedump_writer_attempted)
+        return;
+    mutex_lock(&tracedump_queue_lock);
+    if (!tracedump_writer_attempted) {
+        tracedump_writer_attempted = true;
+        start = true;
+    }
+    mutex_unlock(&tracedump_queue_lock);
+    if (!start)
+        return;
+    if (!dr_create_client_thread(tracedump_writer_main, NULL)) {
+        SYSLOG_INTERNAL_WARNING("unable to create trace dump writer thread");
+        return;
+    }
+    mutex_lock(&tracedump_queue_lock);
+    tracedump_writer_running = true;
+    mutex_unlock(&tracedump_queue_lock);
+#endif
+}
+
 void
 init_trace_file(per_thread_t *pt)
 {
-    if (INTERNAL_OPTION(tracedump_binary)) {
+    if (TRACEDUMP_BUFFERED()) {
         /* first 4 bytes in binary file gives size of linkcounts
          * 0 if no linkcounts
          */
         tracedump_file_header_t hdr =
-            {CURRENT_API_VERSION, IF_X64_ELSE(true, false), 0 };
+            {CURRENT_API_VERSION, IF_X64_ELSE(true, false), 0,
+             INTERNAL_OPTION(tracedump_compact) ? TRACEDUMP_FILE_COMPACT : 0};
 #ifdef PROFILE_LINKCOUNT
         if (dynamo_options.profile_counts) {
             hdr.linkcount_size = sizeof(linkcount_type_t);
@@ -6956,6 +7410,12 @@ init_trace_file(per_thread_t *pt)
         }
 #endif
         os_write(pt->tracefile, &hdr, sizeof(hdr));
+        pt->tracedump_file = (tracedump_file_t *)
+            global_heap_alloc(sizeof(tracedump_file_t) HEAPACCT(ACCT_OTHER));
+        memset(pt->tracedump_file, 0, sizeof(tracedump_file_t));
+        pt->tracedump_file->file = pt->tracefile;
+        pt->tracedump_file->offs = sizeof(hdr);
+        pt->tracedump_buf = tracedump_buf_create(pt->tracedump_file, TRACEDUMP_BUF_SIZE);
     }
 }
 
@@ -6964,11 +7424,12 @@ exit_trace_file(per_thread_t *pt)
 {
 #ifdef PROFILE_LINKCOUNT
     if (dynamo_options.tracedump_threshold > 0) {
-        if (INTERNAL_OPTION(tracedump_binary)) {
-            os_write(pt->tracefile, &pt->tracedump_num_below_threshold,
-                     sizeof(pt->tracedump_num_below_threshold));
-            os_write(pt->tracefile, &pt->tracedump_count_below_threshold,
-                     sizeof(pt->tracedump_count_below_threshold));
+        if (TRACEDUMP_BUFFERED()) {
+            tracedump_buf_append(pt->tracedump_buf, &pt->tracedump_num_below_threshold,
+                                 sizeof(pt->tracedump_num_below_threshold));
+            tracedump_buf_append(pt->tracedump_buf,
+                                 &pt->tracedump_count_below_threshold,
+                                 sizeof(pt->tracedump_count_below_threshold));
         } else {
             print_file(pt->tracefile, "\nTraces below dump threshold of %d: %d\n",
                        dynamo_options.tracedump_threshold, pt->tracedump_num_below_threshold);
@@ -6977,7 +7438,12 @@ exit_trace_file(per_thread_t *pt)
         }
     }
 #endif
-    close_log_file(pt->tracefile);
+    if (TRACEDUMP_BUFFERED()) {
+        /* the file is closed once its last buffer is written */
+        tracedump_buf_flush(&pt->tracedump_buf, true/*final*/, true/*close*/, false);
+        pt->tracedump_file = NULL;
+    } else
+        close_log_file(pt->tracefile);
 }
 
 /* Binary trace dump is used to save time and space.
@@ -6988,14 +7454,22 @@ exit_trace_file(per_thread_t *pt)
  *   But links will target cache pcs...
  */
 
-#define TRACEBUF_SIZE 2048
-
-#define TRACEBUF_MAKE_ROOM(p, buf, sz) do {           \
-      if (p+sz >= &buf[TRACEBUF_SIZE]) {              \
-          os_write(pt->tracefile, buf, (p - buf));    \
-          p = buf;                                    \
-      }                                               \
-  } while (0)
+/* Returns the buffer that f's record goes in: a shared trace output by a
+ * thread goes in that thread's buffer for the shared file.
+ */
+static tracedump_buf_t **
+tracedump_buf_for(dcontext_t *dcontext, per_thread_t *pt)
+{
+    per_thread_t *own_pt;
+    if (pt != shared_pt || dcontext == GLOBAL_DCONTEXT)
+        return &pt->tracedump_buf;
+    own_pt = (per_thread_t *) dcontext->fragment_field;
+    if (own_pt->tracedump_shared_buf == NULL) {
+        own_pt->tracedump_shared_buf =
+            tracedump_buf_create(shared_pt->tracedump_file, TRACEDUMP_BUF_SIZE);
+    }
+    return &own_pt->tracedump_shared_buf;
+}
 
 static void
 output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
@@ -7004,14 +7478,15 @@ output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
     /* FIXME:
      * We do not support PROFILE_RDTSC or various small fields
      */
-    /* FIXME: should allocate buffer elsewhere */
-    byte buf[TRACEBUF_SIZE];
-    byte *p = buf;
+    tracedump_buf_t **bufp = tracedump_buf_for(dcontext, pt);
+    tracedump_buf_t *buf = *bufp;
+    size_t start = buf->used;
+    bool compact = INTERNAL_OPTION(tracedump_compact);
     trace_only_t *t = TRACE_FIELDS(f);
     linkstub_t *l;
     tracedump_trace_header_t hdr = {
         (int) trace_num, f->tag, f->start_pc, f->prefix_size, 0, f->size,
-        (INTERNAL_OPTION(tracedump_origins) ? t->num_bbs : 0),
+        ((INTERNAL_OPTION(tracedump_origins) || compact) ? t->num_bbs : 0),
         IF_X64_ELSE(!TEST(FRAG_32_BIT, f->flags), false),
     };
     tracedump_stub_data_t stub;
@@ -7021,20 +7496,16 @@ output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
     for (l = FRAGMENT_EXIT_STUBS(f); l != NULL; l = LINKSTUB_NEXT_EXIT(l))
         hdr.num_exits++;
 
-    TRACEBUF_MAKE_ROOM(p, buf, sizeof(hdr));
-    *((tracedump_trace_header_t *)p) = hdr;
-    p += sizeof(hdr);
+    tracedump_buf_append(buf, &hdr, sizeof(hdr));
 
-    if (INTERNAL_OPTION(tracedump_origins)) {
+    if (hdr.num_bbs > 0) {
         uint i;
         for (i=0; i<t->num_bbs; i++) {
             instr_t *inst;
             instrlist_t *ilist;
             int size = 0;
 
-            TRACEBUF_MAKE_ROOM(p, buf, sizeof(app_pc));
-            *((app_pc *)p) = t->bbs[i].tag;
-            p += sizeof(app_pc);
+            tracedump_buf_append(buf, &t->bbs[i].tag, sizeof(app_pc));
 
             /* we assume that the target is readable, since we dump prior
              * to unloading of modules on flush events
@@ -7044,18 +7515,16 @@ output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
                 size += instr_length(dcontext, inst);
             }
 
-            TRACEBUF_MAKE_ROOM(p, buf, sizeof(int));
-            *((int *)p) = size;
-            p += sizeof(int);
+            tracedump_buf_append(buf, &size, sizeof(int));
 
-            for (inst = instrlist_first(ilist); inst; inst = instr_get_next(inst)) {
-                TRACEBUF_MAKE_ROOM(p, buf, instr_length(dcontext, inst));
+            for (inst = instrlist_first(ilist); inst != NULL && !compact;
+                 inst = instr_get_next(inst)) {
                 /* PR 302353: we can't use instr_encode() as it will
                  * try to re-relativize rip-rel instrs, which may fail
                  */
                 ASSERT(instr_get_raw_bits(inst) != NULL);
-                memcpy(p, instr_get_raw_bits(inst), instr_length(dcontext, inst));
-                p += instr_length(dcontext, inst);
+                tracedump_buf_append(buf, instr_get_raw_bits(inst),
+                                     instr_length(dcontext, inst));
             }
             /* free the instrlist_t elements */
             instrlist_clear_and_destroy(dcontext, ilist);
@@ -7064,7 +7533,7 @@ output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
 
     ASSERT(SEPARATE_STUB_MAX_SIZE == DIRECT_EXIT_STUB_SIZE(0));
 
-    for (l = FRAGMENT_EXIT_STUBS(f); l != NULL; l = LINKSTUB_NEXT_EXIT(l)) {
+    for (l = FRAGMENT_EXIT_STUBS(f); l != NULL && !compact; l = LINKSTUB_NEXT_EXIT(l)) {
         cache_pc stub_pc = EXIT_STUB_PC(dcontext, f, l);
         stub.cti_offs = l->cti_offset;
         stub.stub_pc = stub_pc;
@@ -7073,39 +7542,26 @@ output_trace_binary(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
         stub.stub_size = DIRECT_EXIT_STUB_SIZE(f->flags);
         ASSERT(DIRECT_EXIT_STUB_SIZE(f->flags) <= SEPARATE_STUB_MAX_SIZE);
 
-        TRACEBUF_MAKE_ROOM(p, buf, STUB_DATA_FIXED_SIZE);
-        memcpy(p, &stub, STUB_DATA_FIXED_SIZE);
-        p += STUB_DATA_FIXED_SIZE;
+        tracedump_buf_append(buf, &stub, STUB_DATA_FIXED_SIZE);
 
 #ifdef PROFILE_LINKCOUNT
-        if (dynamo_options.profile_counts) {
-            *((linkcount_type_t *)p) = l->count;
-            p += sizeof(linkcount_type_t);
-        }
+        if (dynamo_options.profile_counts)
+            tracedump_buf_append(buf, &l->count, sizeof(linkcount_type_t));
 #endif
         if (TEST(LINK_SEPARATE_STUB, l->flags) && stub_pc != NULL) {
-            TRACEBUF_MAKE_ROOM(p, buf, DIRECT_EXIT_STUB_SIZE(f->flags));
             ASSERT(stub_pc < f->start_pc || stub_pc >= f->start_pc+f->size);
-            memcpy(p, stub_pc, DIRECT_EXIT_STUB_SIZE(f->flags));
-            p += DIRECT_EXIT_STUB_SIZE(f->flags);
+            tracedump_buf_append(buf, stub_pc, DIRECT_EXIT_STUB_SIZE(f->flags));
         } else { /* ensure client's method of identifying separate stubs works */
             ASSERT(stub_pc == NULL /* no stub at all */ ||
                    (stub_pc >= f->start_pc && stub_pc < f->start_pc+f->size));
         }
     }
 
-    if (f->size >= TRACEBUF_SIZE) {
-        os_write(pt->tracefile, buf, (p - buf));
-        p = buf;
-        os_write(pt->tracefile, f->start_pc, f->size);
-    } else {
-        /* single syscall for all but largest traces */
-        TRACEBUF_MAKE_ROOM(p, buf, f->size);
-        memcpy(p, f->start_pc, f->size);
-        p += f->size;
-        os_write(pt->tracefile, buf, (p - buf));
-        p = buf;
-    }
+    if (!compact)
+        tracedump_buf_append(buf, f->start_pc, f->size);
+
+    tracedump_buf_end_record(bufp, f->tag, start,
+                             dcontext == GLOBAL_DCONTEXT || dynamo_resetting);
 }
 
 /* Output the contents of the specified trace.
@@ -7150,6 +7606,18 @@ output_trace(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
     /* Recreate in same mode as original fragment */
     IF_X64(old_mode = set_x86_mode(dcontext, FRAG_IS_32(f->flags)));
 
+    if (TRACEDUMP_BUFFERED() && dcontext != GLOBAL_DCONTEXT) {
+        /* Records go in a buffer of our own (see tracedump_buf_for()), so
+         * we need no lock until it is flushed.
+         */
+        trace_num = XSTATS_ATOMIC_ADD_EXCHANGE(&tcount, 1) - 1;
+        ASSERT(TEST(FRAG_SHARED, f->flags) == (pt == shared_pt));
+        output_trace_binary(dcontext, pt, f, trace_num);
+        IF_X64(set_x86_mode(dcontext, old_mode));
+        ASSERT_DO_NOT_OWN_MUTEX(true, &tracedump_mutex);
+        return;
+    }
+
     /* xref 8131/8202 if dynamo_resetting we don't need to grab the tracedump
      * mutex to ensure we're the only writer and grabbing here on reset path
      * can lead to a rank-order violation. */
@@ -7158,8 +7626,12 @@ output_trace(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
         locked_vmareas = acquire_vm_areas_lock_if_not_already(dcontext, FRAG_SHARED);
         mutex_lock(&tracedump_mutex);
     }
-    trace_num = tcount;
-    tcount++;
+    if (TRACEDUMP_BUFFERED())
+        trace_num = XSTATS_ATOMIC_ADD_EXCHANGE(&tcount, 1) - 1;
+    else {
+        trace_num = tcount;
+        tcount++;
+    }
     if (!TEST(FRAG_SHARED, f->flags)) {
         /* No lock is needed because we use thread-private files.
          * If dumping traces for a different thread (dynamo_other_thread_exit
@@ -7177,7 +7649,7 @@ output_trace(dcontext_t *dcontext, per_thread_t *pt, fragment_t *f,
     }
 
     /* binary dump requested? */
-    if (INTERNAL_OPTION(tracedump_binary)) {
+    if (TRACEDUMP_BUFFERED()) {
         output_trace_binary(dcontext, pt, f, trace_num);
         goto output_trace_done;
     }
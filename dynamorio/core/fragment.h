@@ -151,6 +151,12 @@
 
 /* This fragment immediately follows a free entry in the fcache */
 #define FRAG_FOLLOWS_FREE_ENTRY   0x80000000
+/* Free lists are only used for shared caches, so for private fragments we
+ * re-use the same bit as the -cache_replace_clock reference bit: set when
+ * dispatch enters the fragment and cleared when the FIFO replacement hand
+ * passes over it.
+ */
+#define FRAG_FIFO_REFERENCED      FRAG_FOLLOWS_FREE_ENTRY
 
 /* Flags that a future fragment can transfer to a real on taking its place:
  * Naturally we don't want FRAG_IS_FUTURE or FRAG_WAS_DELETED.
@@ -463,6 +469,10 @@ typedef struct _per_thread_t {
     mutex_t fragment_delete_mutex;
 #endif
     file_t tracefile;
+    /* -tracedump_binary and -tracedump_compact: see output_trace_binary() */
+    struct _tracedump_file_t *tracedump_file;      /* wraps tracefile */
+    struct _tracedump_buf_t *tracedump_buf;        /* records for tracedump_file */
+    struct _tracedump_buf_t *tracedump_shared_buf; /* records for shared_pt's file */
 
     /* used for unlinking other threads' caches for flushing */
     bool           could_be_linking;     /* accessing link data structs? */
@@ -570,6 +580,12 @@ fragment_thread_reset_init(dcontext_t *dcontext);
 void
 fragment_thread_reset_free(dcontext_t *dcontext);
 
+/* Empties dcontext's -shadow_ret_stack ring.  dcontext must be the current
+ * thread or be synched with it.
+ */
+void
+fragment_shadow_ret_stack_clear(dcontext_t *dcontext);
+
 #ifdef UNIX
 void
 fragment_fork_init(dcontext_t *dcontext);
@@ -932,6 +948,12 @@ fragment_coarse_htable_resurrect(dcontext_t *dcontext,  coarse_info_t *info,
 void
 fragment_output(dcontext_t *dcontext, fragment_t *f);
 
+/* Starts the -tracedump_async writer thread if it is not yet running.
+ * Must be called holding no locks.
+ */
+void
+fragment_start_tracedump_writer(dcontext_t *dcontext);
+
 bool
 fragment_overlaps(dcontext_t *dcontext, fragment_t *f,
                   byte *region_start, byte *region_end, bool page_only,
@@ -1136,11 +1158,16 @@ get_ibl_per_type_statistics(dcontext_t *dcontext, ibl_branch_type_t branch_type)
  * the file starts with a tracedump_file_header_t
  * then, for each trace:
      struct _tracedump_trace_header
-     if num_bbs > 0 # tracedump_origins
+     if num_bbs > 0 # tracedump_origins or TRACEDUMP_FILE_COMPACT
        foreach bb:
            app_pc tag;
            int bb_code_size;
-           byte code[bb_code_size];
+           if !TRACEDUMP_FILE_COMPACT
+             byte code[bb_code_size];
+           endif
+     endif
+     if TRACEDUMP_FILE_COMPACT
+       continue; # no exits or code
      endif
      foreach exit:
        struct _tracedump_stub_data
@@ -1157,14 +1184,42 @@ get_ibl_per_type_statistics(dcontext_t *dcontext, ibl_branch_type_t branch_type)
      int num_below_treshold
      linkcount_type_t count_below_threshold
    endif
+ * if the file was closed normally:
+     tracedump_index_entry_t index[num_entries]; # one per trace, in file order
+     struct _tracedump_index_trailer_t
 </pre>
+ * Traces from different threads may be interleaved in a file shared by
+ * several threads, and so trace identifiers need not be in increasing order.
  */
 typedef struct _tracedump_file_header_t {
     int version;           /**< The DynamoRIO version that created the file. */
     bool x64;              /**< Whether a 64-bit DynamoRIO library created the file. */
     int linkcount_size;    /**< Size of the linkcount (linkcounts are deprecated). */
+    uint flags;            /**< TRACEDUMP_FILE_ flags. */
 } tracedump_file_header_t;
 
+/**
+ * tracedump_file_header_t.flags value: the file was written with
+ * -tracedump_compact and holds only trace headers and bb tags and sizes.
+ */
+#define TRACEDUMP_FILE_COMPACT 0x1
+
+/** An entry in the index at the end of a binary trace dump file. */
+typedef struct _tracedump_index_entry_t {
+    app_pc tag;            /**< Application address for start of the trace. */
+    uint64 offset;         /**< File offset of the trace's tracedump_trace_header_t. */
+} tracedump_index_entry_t;
+
+/** tracedump_index_trailer_t.magic value. */
+#define TRACEDUMP_INDEX_MAGIC "DRTRIDX"
+
+/** The final bytes of a binary trace dump file that has an index. */
+typedef struct _tracedump_index_trailer_t {
+    uint64 index_offset;   /**< File offset of the first tracedump_index_entry_t. */
+    uint64 num_entries;    /**< Number of tracedump_index_entry_t in the index. */
+    char magic[8];         /**< TRACEDUMP_INDEX_MAGIC. */
+} tracedump_index_trailer_t;
+
 /** Header for an individual trace in a binary trace dump file. */
 typedef struct _tracedump_trace_header_t {
     int frag_id;           /**< Identifier for the trace. */
@@ -70,6 +70,10 @@
 #define HASHTABLE_READ_ONLY             0x00000040
 /* Align the main table to the cache line */
 #define HASHTABLE_ALIGN_TABLE           0x00000080
+/* Hash to the first entry of a cache line so that each probe sequence starts
+ * with a whole line of candidates.  Requires HASHTABLE_ALIGN_TABLE.
+ */
+#define HASHTABLE_BUCKET_LINES          0x00000100
 
 /* Specific tables can add their own flags starting with this value
  * FIXME: any better way? how know when hit limit with <<?
@@ -109,9 +113,10 @@
 
 /* table capacity includes a sentinel so this is equivalent to
  * hash_index % (ftable->capacity - 1) 
+ * We do not use hash_mask as HASHTABLE_BUCKET_LINES clears its low bits.
  */
 #define HASH_INDEX_WRAPAROUND(hash_index,ftable) \
-    ((hash_index) & (uint)(ftable->hash_mask >> ftable->hash_mask_offset))
+    ((hash_index) & (uint)HASH_MASK(ftable->hash_bits))
 
 #ifdef HASHTABLE_STATISTICS
 /* Just a typechecking memset() wrapper */
@@ -346,6 +346,17 @@ HTNAME(hashtable_,NAME_KEY,_init_internal)
     table->hash_func = func;
     table->hash_mask_offset = hash_mask_offset;
     table->hash_mask = HASH_MASK(table->hash_bits) << hash_mask_offset;
+    if (TEST(HASHTABLE_BUCKET_LINES, table->table_flags)) {
+        /* Drop the index bits that select an entry within a cache line.
+         * Linear probing then fills a line before spilling into the next.
+         */
+        uint per_line = (uint) (proc_get_cache_line_size() / sizeof(ENTRY_TYPE));
+        ASSERT(TEST(HASHTABLE_ALIGN_TABLE, table->table_flags));
+        if (per_line > 1 && (uint)(1 << table->hash_bits) > per_line * 2) {
+            ASSERT(IS_POWER_OF_2(per_line));
+            table->hash_mask &= ~((ptr_uint_t)(per_line - 1) << hash_mask_offset);
+        }
+    }
     table->capacity = HASHTABLE_SIZE(table->hash_bits);
 
     /* 
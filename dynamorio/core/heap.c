@@ -263,12 +263,49 @@ typedef struct _thread_units_t {
 #endif
 } thread_units_t;
 
+/* Per-thread cache ("magazine") of free blocks taken from the fixed-size
+ * free lists of the global units, so that most global_heap_alloc() and
+ * global_heap_free() calls do not need global_alloc_lock.  The magazine
+ * is a thread_units_t with no units of its own: its free_list[] holds
+ * blocks detached from heapmgt->global_units, and its acct holds the
+ * accounting for the allocs and frees that went through it, which is
+ * added to the process totals when the thread exits.
+ */
+typedef struct _heap_magazine_t {
+    thread_units_t tu;
+    uint count[BLOCK_TYPES]; /* length of each tu.free_list[] */
+    bool enabled;
+} heap_magazine_t;
+
+/* A chunk of the per-thread IR arena (see heap_ir_alloc()).  The header
+ * sits at the start of the chunk and allocations are bumped from top.
+ */
+typedef struct _ir_arena_chunk_t {
+    byte *top;   /* next free byte */
+    byte *end;
+    uint live;   /* allocations not yet freed */
+    struct _ir_arena_chunk_t *next; /* for the pinned list */
+} ir_arena_chunk_t;
+
+typedef struct _ir_arena_t {
+    ir_arena_chunk_t *cur;    /* chunk we allocate from */
+    /* full chunks still holding instrs that outlived their build */
+    ir_arena_chunk_t *pinned;
+    uint num_pinned;
+    bool in_build;            /* between heap_ir_arena_{enter,exit} */
+} ir_arena_t;
+
 /* per-thread structure: */
 typedef struct _thread_heap_t {
     thread_units_t *local_heap;
     thread_units_t *nonpersistent_heap;
+    ir_arena_t ir_arena;
+    heap_magazine_t magazine;
 } thread_heap_t;
 
+static void
+ir_arena_thread_exit(dcontext_t *dcontext, ir_arena_t *arena);
+
 /* global, unique thread-shared structure: 
  * FIXME: give this name to thread_units_t, and name this AllHeapUnits
  */
@@ -279,6 +316,8 @@ typedef struct _heap_t {
      * for release build too, so it's separate...can we do better?
      */
     uint num_dead;
+    /* -thread_state_pool: most units any one thread held at exit */
+    uint max_thread_units;
 } heap_t;
 
 /* no synch needed since only written once */
@@ -526,9 +565,13 @@ static void *common_heap_alloc(thread_units_t *tu, size_t size
                                HEAPACCT(which_heap_t which));
 static bool common_heap_free(thread_units_t *tu, void *p, size_t size
                              HEAPACCT(which_heap_t which));
+#ifdef HEAP_ACCOUNTING
+static void add_heapacct_to_global_stats(heap_acct_t *acct);
+#endif
 static void release_real_memory(void *p, size_t size, bool remove_vm);
 static void release_guarded_real_memory(vm_addr_t p, size_t size, bool remove_vm,
                                         bool guarded);
+static void stack_pool_exit(void);
 
 typedef enum {
     /* I - Init, Interop - first allocation failed
@@ -1595,6 +1638,7 @@ heap_reset_free()
     }
     heapmgt->heap.dead = NULL;
     heapmgt->heap.num_dead = 0;
+    heapmgt->heap.max_thread_units = 0;
     release_recursive_lock(&heap_unit_lock);
     DODEBUG({ release_recursive_lock(&global_alloc_lock); });
     dynamo_vm_areas_unlock();
@@ -1608,6 +1652,7 @@ heap_exit()
     heap_management_t *temp;
 
     heap_exiting = true;
+    stack_pool_exit();
     /* FIXME: we shouldn't need either lock if executed last */
     dynamo_vm_areas_lock();
     acquire_recursive_lock(&heap_unit_lock);
@@ -2323,6 +2368,89 @@ heap_munmap(void *p, size_t size)
 # define STACK_GUARD_PAGES 1    
 #endif
 
+/* -thread_state_pool: freed DYNAMORIO_STACK_SIZE stacks are kept here, still
+ * mapped, guarded, and in the DR areas, for the next thread to pick up.  The
+ * list is threaded through the top slot of each stack.
+ * On UNIX each thread also has a signal stack of the same size, so we keep
+ * two stacks per pooled thread.
+ */
+#define STACK_POOL_MAX \
+    (DYNAMO_OPTION(thread_state_pool) * IF_UNIX_ELSE(2, 1))
+
+DECLARE_CXTSWPROT_VAR(static mutex_t stack_pool_lock, INIT_LOCK_FREE(stack_pool_lock));
+DECLARE_CXTSWPROT_VAR(static byte *stack_pool, NULL);
+DECLARE_CXTSWPROT_VAR(static uint stack_pool_count, 0);
+
+#define STACK_POOL_NEXT(tos) (*(byte **)((tos) - sizeof(byte *)))
+
+static void *
+stack_pool_remove(size_t size)
+{
+    byte *tos = NULL;
+    if (size != DYNAMORIO_STACK_SIZE || stack_pool == NULL)
+        return NULL;
+    mutex_lock(&stack_pool_lock);
+    if (stack_pool != NULL) {
+        tos = stack_pool;
+        stack_pool = STACK_POOL_NEXT(tos);
+        stack_pool_count--;
+    }
+    mutex_unlock(&stack_pool_lock);
+    if (tos != NULL) {
+        STATS_INC(thread_state_pool_stacks);
+#ifdef DEBUG_MEMORY
+# ifdef STACK_GUARD_PAGE
+        /* skip the guard pages stack_alloc made unwritable or guard pages */
+        memset(tos - size + STACK_GUARD_PAGES * PAGE_SIZE, HEAP_ALLOCATED_BYTE,
+               size - STACK_GUARD_PAGES * PAGE_SIZE);
+# else
+        memset(tos - size, HEAP_ALLOCATED_BYTE, size);
+# endif
+#endif
+    }
+    return tos;
+}
+
+static bool
+stack_pool_add(byte *tos, size_t size)
+{
+    bool added = false;
+    if (size != DYNAMORIO_STACK_SIZE || DYNAMO_OPTION(thread_state_pool) == 0 ||
+        heap_exiting || dynamo_exited)
+        return false;
+    mutex_lock(&stack_pool_lock);
+    if (stack_pool_count < STACK_POOL_MAX) {
+        STACK_POOL_NEXT(tos) = stack_pool;
+        stack_pool = tos;
+        stack_pool_count++;
+        added = true;
+    }
+    mutex_unlock(&stack_pool_lock);
+    return added;
+}
+
+/* Unmaps all pooled stacks.  Called at exit before the heap is torn down. */
+static void
+stack_pool_exit(void)
+{
+    byte *tos, *next;
+    mutex_lock(&stack_pool_lock);
+    tos = stack_pool;
+    stack_pool = NULL;
+    stack_pool_count = 0;
+    mutex_unlock(&stack_pool_lock);
+    for (; tos != NULL; tos = next) {
+        next = STACK_POOL_NEXT(tos);
+        release_guarded_real_memory((vm_addr_t)(tos - DYNAMORIO_STACK_SIZE),
+                                    DYNAMORIO_STACK_SIZE, true/*update DR areas*/, true);
+        DOSTATS({
+            if (!dynamo_exited_log_and_stats)
+                STATS_SUB(stack_capacity, DYNAMORIO_STACK_SIZE);
+        });
+    }
+    DELETE_LOCK(stack_pool_lock);
+}
+
 /* use stack_alloc to build a stack -- it returns TOS
  * For STACK_GUARD_PAGE, it also marks the bottom STACK_GUARD_PAGES==1 
  * to detect overflows when used.
@@ -2330,7 +2458,9 @@ heap_munmap(void *p, size_t size)
 void *
 stack_alloc(size_t size)
 {
-    void *p;
+    void *p = stack_pool_remove(size);
+    if (p != NULL)
+        return p;
 
     /* we reserve and commit at once for now
      * FIXME case 2330: commit-on-demand could allow larger max sizes w/o
@@ -2370,6 +2500,8 @@ stack_free(void *p, size_t size)
 {
     if (size == 0)
         size = DYNAMORIO_STACK_SIZE;
+    if (stack_pool_add((byte *)p, size))
+        return;
     p = (void *) ((vm_addr_t)p - size);
     release_guarded_real_memory((vm_addr_t)p, size, true/*update DR areas immediately*/,
                                 true);
@@ -2626,11 +2758,157 @@ common_global_heap_free(thread_units_t *tu, void *p, size_t size HEAPACCT(which_
     ASSERT(ok);
 }
 
+/* Returns the BLOCK_SIZES index used for a request of size bytes */
+static inline int
+heap_bucket_for_size(size_t size)
+{
+    /* the last bucket is UINT_MAX so this terminates */
+    size_t aligned_size = ALIGN_FORWARD(size, HEAP_ALIGNMENT);
+    int bucket = 0;
+    while (aligned_size > BLOCK_SIZES[bucket])
+        bucket++;
+    return bucket;
+}
+
+/* Returns the current thread's global heap magazine, or NULL if it has none */
+static heap_magazine_t *
+heap_magazine_for_thread(void)
+{
+    dcontext_t *dcontext;
+    thread_heap_t *th;
+    if (DYNAMO_OPTION(global_heap_magazine) == 0)
+        return NULL;
+    dcontext = get_thread_private_dcontext();
+    if (dcontext == NULL || dcontext->heap_field == NULL)
+        return NULL;
+    th = (thread_heap_t *) dcontext->heap_field;
+    return th->magazine.enabled ? &th->magazine : NULL;
+}
+
+/* Moves up to half a magazine's worth of free blocks of the given bucket
+ * from the global units into mag.  Returns whether any were moved.
+ */
+static bool
+heap_magazine_refill(heap_magazine_t *mag, int bucket)
+{
+    thread_units_t *gtu = &heapmgt->global_units;
+    uint want = MAX(DYNAMO_OPTION(global_heap_magazine) / 2, 1);
+    uint moved = 0;
+    acquire_recursive_lock(&global_alloc_lock);
+    while (moved < want && gtu->free_list[bucket] != NULL) {
+        heap_pc p = gtu->free_list[bucket];
+        gtu->free_list[bucket] = *((heap_pc *)p);
+        *((heap_pc *)p) = mag->tu.free_list[bucket];
+        mag->tu.free_list[bucket] = p;
+        moved++;
+    }
+    release_recursive_lock(&global_alloc_lock);
+    mag->count[bucket] += moved;
+    if (moved > 0)
+        STATS_INC(heap_magazine_refills);
+    return moved > 0;
+}
+
+/* Returns all but keep of mag's free blocks of the given bucket to the
+ * global units, where other threads can reuse them.
+ */
+static void
+heap_magazine_drain(heap_magazine_t *mag, int bucket, uint keep)
+{
+    thread_units_t *gtu = &heapmgt->global_units;
+    if (mag->count[bucket] <= keep)
+        return;
+    acquire_recursive_lock(&global_alloc_lock);
+    while (mag->count[bucket] > keep) {
+        heap_pc p = mag->tu.free_list[bucket];
+        ASSERT(p != NULL);
+        mag->tu.free_list[bucket] = *((heap_pc *)p);
+        *((heap_pc *)p) = gtu->free_list[bucket];
+        gtu->free_list[bucket] = p;
+        mag->count[bucket]--;
+    }
+    release_recursive_lock(&global_alloc_lock);
+    STATS_INC(heap_magazine_drains);
+}
+
+/* Returns NULL if the request must go to the global units instead */
+static void *
+heap_magazine_alloc(heap_magazine_t *mag, size_t size HEAPACCT(which_heap_t which))
+{
+    void *p;
+    int bucket = heap_bucket_for_size(size);
+    if (bucket == BLOCK_TYPES-1)
+        return NULL; /* variable-sized blocks are not cached */
+    if (mag->tu.free_list[bucket] == NULL && !heap_magazine_refill(mag, bucket))
+        return NULL; /* no free blocks anywhere: carve a new one under the lock */
+    /* with a non-empty free list common_heap_alloc never touches units */
+    p = common_heap_alloc(&mag->tu, size HEAPACCT(which));
+    ASSERT(p != NULL);
+    mag->count[bucket]--;
+    STATS_INC(heap_magazine_allocs);
+    return p;
+}
+
+/* Returns false if the block must go to the global units instead */
+static bool
+heap_magazine_free(heap_magazine_t *mag, void *p, size_t size
+                   HEAPACCT(which_heap_t which))
+{
+    DEBUG_DECLARE(bool ok;)
+    int bucket = heap_bucket_for_size(size);
+    if (bucket == BLOCK_TYPES-1)
+        return false;
+    DEBUG_DECLARE(ok = ) common_heap_free(&mag->tu, p, size HEAPACCT(which));
+    ASSERT(ok);
+    mag->count[bucket]++;
+    STATS_INC(heap_magazine_frees);
+    if (mag->count[bucket] > DYNAMO_OPTION(global_heap_magazine))
+        heap_magazine_drain(mag, bucket, DYNAMO_OPTION(global_heap_magazine) / 2);
+    return true;
+}
+
+static void
+heap_magazine_thread_init(dcontext_t *dcontext, heap_magazine_t *mag)
+{
+    memset(mag, 0, sizeof(*mag));
+    mag->tu.dcontext = dcontext;
+    mag->tu.writable = true;
+    /* The free blocks we cache are in global units, which are only
+     * writable while in DR code when they are self-protected, so
+     * don't bother caching them in that case.
+     */
+    mag->enabled = (DYNAMO_OPTION(global_heap_magazine) > 0 &&
+                    !TEST(SELFPROT_GLOBAL, dynamo_options.protect_mask));
+}
+
+static void
+heap_magazine_thread_exit(dcontext_t *dcontext, heap_magazine_t *mag)
+{
+    int i;
+    if (!mag->enabled)
+        return;
+    mag->enabled = false;
+    for (i = 0; i < BLOCK_TYPES-1; i++)
+        heap_magazine_drain(mag, i, 0);
+#ifdef HEAP_ACCOUNTING
+    /* Blocks are often allocated through one thread's magazine and freed
+     * through another's or through the global units, so only the sum over
+     * all threads is meaningful.
+     */
+    add_heapacct_to_global_stats(&mag->tu.acct);
+#endif
+}
+
 /* these functions use the global heap instead of a thread's heap: */
 void *
 global_heap_alloc(size_t size HEAPACCT(which_heap_t which))
 {
-    void *p = common_global_heap_alloc(&heapmgt->global_units, size HEAPACCT(which));
+    void *p = NULL;
+    heap_magazine_t *mag = heap_magazine_for_thread();
+    if (mag != NULL)
+        p = heap_magazine_alloc(mag, size HEAPACCT(which));
+    if (p == NULL)
+        p = common_global_heap_alloc(&heapmgt->global_units, size HEAPACCT(which));
     ASSERT(p != NULL);
     LOG(GLOBAL, LOG_HEAP, 6, "\nglobal alloc: "PFX" (%d bytes)\n", p, size);
     return p;
@@ -2639,7 +2917,9 @@ global_heap_alloc(size_t size HEAPACCT(which_heap_t which))
 void
 global_heap_free(void *p, size_t size HEAPACCT(which_heap_t which))
 {
-    common_global_heap_free(&heapmgt->global_units, p, size HEAPACCT(which));
+    heap_magazine_t *mag = heap_magazine_for_thread();
+    if (mag == NULL || p == NULL || !heap_magazine_free(mag, p, size HEAPACCT(which)))
+        common_global_heap_free(&heapmgt->global_units, p, size HEAPACCT(which));
     LOG(GLOBAL, LOG_HEAP, 6, "\nglobal free: "PFX" (%d bytes)\n", p, size);
 }
 
@@ -2813,10 +3093,15 @@ heap_free_unit(heap_unit_t *unit, dcontext_t *dcontext)
      * FIXME: share the policy with the fcache dead unit policy
      * also, don't put special larger-than-max units on free list -- though
      * we do now have support for doing so (after PR 415269)
+     * For -thread_state_pool we keep enough units to rebuild the module
+     * state (fragment and ibl tables, monitor, signal, etc.) of the pooled
+     * threads without going back to the OS.
      */
     if (UNITALLOC(unit) <= HEAP_UNIT_MAX_SIZE &&
         (heapmgt->heap.num_dead < 5 ||
-         heapmgt->heap.num_dead * 4U <= (uint) get_num_threads())) {
+         heapmgt->heap.num_dead * 4U <= (uint) get_num_threads() ||
+         heapmgt->heap.num_dead < DYNAMO_OPTION(thread_state_pool) *
+         heapmgt->heap.max_thread_units)) {
         /* Keep dead list sorted small-to-large to avoid grabbing large
          * when can take small and then needing to allocate when only
          * have small left.  Helps out with lots of small threads.
@@ -3015,6 +3300,14 @@ threadunits_exit(thread_units_t *tu, dcontext_t *dcontext)
         tu->free_list[i] = NULL;
     }
 #endif
+    if (DYNAMO_OPTION(thread_state_pool) > 0 && dcontext != GLOBAL_DCONTEXT) {
+        uint num_units = 0;
+        for (u = tu->top_unit; u != NULL; u = u->next_local)
+            num_units++;
+        /* racy, but it is only a retention heuristic */
+        if (num_units > heapmgt->heap.max_thread_units)
+            heapmgt->heap.max_thread_units = num_units;
+    }
     u = tu->top_unit;
     while (u != NULL) {
         DOLOG(1, LOG_HEAP|LOG_STATS, {
@@ -3090,16 +3383,20 @@ heap_thread_init(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *)
         global_heap_alloc(sizeof(thread_heap_t) HEAPACCT(ACCT_MEM_MGT));
+    /* must be valid before heap_field is visible to global_heap_alloc() */
+    th->magazine.enabled = false;
     dcontext->heap_field = (void *) th;
     th->local_heap = (thread_units_t *) global_heap_alloc(sizeof(thread_units_t)
                                                        HEAPACCT(ACCT_MEM_MGT));
     threadunits_init(dcontext, th->local_heap, HEAP_UNIT_MIN_SIZE);
+    memset(&th->ir_arena, 0, sizeof(th->ir_arena));
     if (DYNAMO_OPTION(enable_reset)) {
         th->nonpersistent_heap = (thread_units_t *)
             global_heap_alloc(sizeof(thread_units_t) HEAPACCT(ACCT_MEM_MGT));
     } else
         th->nonpersistent_heap = NULL;
     heap_thread_reset_init(dcontext);
+    heap_magazine_thread_init(dcontext, &th->magazine);
 }
 
 void
@@ -3121,6 +3418,9 @@ void
 heap_thread_exit(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *) dcontext->heap_field;
+    /* first, so that the frees below go straight to the global units */
+    heap_magazine_thread_exit(dcontext, &th->magazine);
+    ir_arena_thread_exit(dcontext, &th->ir_arena);
     threadunits_exit(th->local_heap, dcontext);
     heap_thread_reset_free(dcontext);
     global_heap_free(th->local_heap, sizeof(thread_units_t) HEAPACCT(ACCT_MEM_MGT));
@@ -3130,6 +3430,7 @@ heap_thread_exit(dcontext_t *dcontext)
                          HEAPACCT(ACCT_MEM_MGT));
     }
     global_heap_free(th, sizeof(thread_heap_t) HEAPACCT(ACCT_MEM_MGT));
+    dcontext->heap_field = NULL;
 }
 
 #if defined(DEBUG_MEMORY) && defined(DEBUG)
@@ -3342,9 +3643,11 @@ common_heap_alloc(thread_units_t *tu, size_t size HEAPACCT(which_heap_t which))
             tu->free_list[bucket] = *((heap_pc *)p);
             ASSERT(ALIGNED(tu->free_list[bucket], HEAP_ALIGNMENT));
 #ifdef DEBUG_MEMORY
-            /* ensure memory we got from the free list is in a heap unit */
+            /* ensure memory we got from the free list is in a heap unit
+             * (a magazine has no units of its own to check against)
+             */
             DOCHECK(CHKLVL_DEFAULT, {  /* expensive check */
-                ASSERT(find_heap_unit(tu, p, alloc_size) != NULL);
+                ASSERT(tu->top_unit == NULL || find_heap_unit(tu, p, alloc_size) != NULL);
             });
 #endif
             ACCOUNT_FOR_ALLOC(alloc_reuse, tu, which, alloc_size, aligned_size);
@@ -3660,9 +3963,9 @@ common_heap_free(thread_units_t *tu, void *p_void, size_t size HEAPACCT(which_he
             p, p+alloc_size, alloc_size, p, p+size, size);
         ASSERT_MESSAGE(chklvl, "heap overflow",
                        is_region_memset_to_char(p+size, alloc_size-size, HEAP_PAD_BYTE));
-        /* ensure we are freeing memory in a proper unit */
+        /* ensure we are freeing memory in a proper unit (not for a magazine) */
         DOCHECK(CHKLVL_DEFAULT, {  /* expensive check */
-            ASSERT(find_heap_unit(tu, p, alloc_size) != NULL);
+            ASSERT(tu->top_unit == NULL || find_heap_unit(tu, p, alloc_size) != NULL);
         });
         /* set used and padding memory back to unallocated */
         DOCHECK(CHKLVL_MEMFILL, memset(p, HEAP_UNALLOCATED_BYTE, alloc_size););
@@ -3848,6 +4151,169 @@ nonpersistent_heap_free(dcontext_t *dcontext, void *p, size_t size
     }
 }
 
+/****************************************************************************
+ * IR ARENA
+ *
+ * Decoding and mangling a block allocates an instr_t, its operand arrays,
+ * and often its raw bits, all of which are freed again when the block's
+ * instrlist is destroyed.  While a thread is building a fragment
+ * (heap_ir_arena_enter() to heap_ir_arena_exit()) and -instr_arena is on,
+ * these allocations are bumped from a per-thread chunk instead.  Each
+ * chunk counts its live allocations; a free is just a decrement, and once
+ * the count drops to zero the chunk is rewound in one step.
+ *
+ * Instrs that escape the build (the unmangled copies kept for trace
+ * building, or anything a client holds onto) simply keep their chunk
+ * live.  When a chunk fills up while still live it is moved to the pinned
+ * list and freed when its last allocation is freed.  Once
+ * IR_ARENA_MAX_PINNED chunks are pinned we stop using the arena and fall
+ * back to the regular heap until some are released, which bounds both
+ * the memory held by escapees and the cost of heap_ir_free()'s lookup.
+ */
+
+#define IR_ARENA_CHUNK_SIZE (16*1024)
+/* anything larger than this goes straight to the heap */
+#define IR_ARENA_MAX_ALLOC (IR_ARENA_CHUNK_SIZE / 8)
+#define IR_ARENA_MAX_PINNED 8
+#define IR_ARENA_CHUNK_START(chunk) \
+    ((byte *)(chunk) + ALIGN_FORWARD(sizeof(ir_arena_chunk_t), HEAP_ALIGNMENT))
+
+static inline bool
+ir_arena_chunk_contains(ir_arena_chunk_t *chunk, byte *p)
+{
+    return (p >= IR_ARENA_CHUNK_START(chunk) && p < chunk->end);
+}
+
+static ir_arena_chunk_t *
+ir_arena_chunk_create(dcontext_t *dcontext)
+{
+    ir_arena_chunk_t *chunk = (ir_arena_chunk_t *)
+        heap_alloc(dcontext, IR_ARENA_CHUNK_SIZE HEAPACCT(ACCT_IR));
+    chunk->top = IR_ARENA_CHUNK_START(chunk);
+    chunk->end = (byte *)chunk + IR_ARENA_CHUNK_SIZE;
+    chunk->live = 0;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void
+ir_arena_thread_exit(dcontext_t *dcontext, ir_arena_t *arena)
+{
+    ir_arena_chunk_t *chunk, *next;
+    /* anything still live here was leaked by its owner: free it with its chunk */
+    if (arena->cur != NULL)
+        heap_free(dcontext, arena->cur, IR_ARENA_CHUNK_SIZE HEAPACCT(ACCT_IR));
+    for (chunk = arena->pinned; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        heap_free(dcontext, chunk, IR_ARENA_CHUNK_SIZE HEAPACCT(ACCT_IR));
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+/* Marks the start of a fragment build on this thread.  Builds do not nest.
+ * If a build is aborted (decode fault, going native) the matching exit may
+ * be skipped; that only means the arena stays in use until the next exit.
+ */
+void
+heap_ir_arena_enter(dcontext_t *dcontext)
+{
+    if (!DYNAMO_OPTION(instr_arena) || dcontext == GLOBAL_DCONTEXT)
+        return;
+    ((thread_heap_t *) dcontext->heap_field)->ir_arena.in_build = true;
+}
+
+void
+heap_ir_arena_exit(dcontext_t *dcontext)
+{
+    if (!DYNAMO_OPTION(instr_arena) || dcontext == GLOBAL_DCONTEXT)
+        return;
+    ((thread_heap_t *) dcontext->heap_field)->ir_arena.in_build = false;
+}
+
+/* Allocates IR storage: from the thread's arena while building a fragment,
+ * else from the regular heap.  Must be freed with heap_ir_free().
+ */
+void *
+heap_ir_alloc(dcontext_t *dcontext, size_t size)
+{
+    ir_arena_t *arena;
+    ir_arena_chunk_t *chunk;
+    size_t aligned_size = ALIGN_FORWARD(size, HEAP_ALIGNMENT);
+    void *p;
+    if (!DYNAMO_OPTION(instr_arena) || dcontext == GLOBAL_DCONTEXT)
+        return heap_alloc(dcontext, size HEAPACCT(ACCT_IR));
+    arena = &((thread_heap_t *) dcontext->heap_field)->ir_arena;
+    if (!arena->in_build || aligned_size > IR_ARENA_MAX_ALLOC)
+        return heap_alloc(dcontext, size HEAPACCT(ACCT_IR));
+    chunk = arena->cur;
+    if (chunk == NULL || chunk->top + aligned_size > chunk->end) {
+        if (chunk != NULL) {
+            /* a chunk with no live allocations is rewound when its count
+             * drops to zero, so a full one is held by escaped instrs
+             */
+            ASSERT(chunk->live > 0);
+            if (arena->num_pinned >= IR_ARENA_MAX_PINNED) {
+                STATS_INC(ir_arena_fallbacks);
+                return heap_alloc(dcontext, size HEAPACCT(ACCT_IR));
+            }
+            chunk->next = arena->pinned;
+            arena->pinned = chunk;
+            arena->num_pinned++;
+            STATS_INC(ir_arena_chunks_pinned);
+        }
+        chunk = ir_arena_chunk_create(dcontext);
+        arena->cur = chunk;
+    }
+    p = chunk->top;
+    chunk->top += aligned_size;
+    chunk->live++;
+    STATS_INC(ir_arena_allocs);
+    return p;
+}
+
+void
+heap_ir_free(dcontext_t *dcontext, void *p, size_t size)
+{
+    ir_arena_t *arena;
+    ir_arena_chunk_t *chunk, *prev;
+    if (!DYNAMO_OPTION(instr_arena) || dcontext == GLOBAL_DCONTEXT) {
+        heap_free(dcontext, p, size HEAPACCT(ACCT_IR));
+        return;
+    }
+    arena = &((thread_heap_t *) dcontext->heap_field)->ir_arena;
+    chunk = arena->cur;
+    if (chunk != NULL && ir_arena_chunk_contains(chunk, (byte *)p)) {
+        ASSERT(chunk->live > 0);
+        chunk->live--;
+        if (chunk->live == 0) {
+            DOCHECK(CHKLVL_MEMFILL, {
+                memset(IR_ARENA_CHUNK_START(chunk), HEAP_UNALLOCATED_BYTE,
+                       chunk->top - IR_ARENA_CHUNK_START(chunk));
+            });
+            chunk->top = IR_ARENA_CHUNK_START(chunk);
+            STATS_INC(ir_arena_resets);
+        }
+        return;
+    }
+    for (prev = NULL, chunk = arena->pinned; chunk != NULL;
+         prev = chunk, chunk = chunk->next) {
+        if (ir_arena_chunk_contains(chunk, (byte *)p)) {
+            ASSERT(chunk->live > 0);
+            chunk->live--;
+            if (chunk->live == 0) {
+                if (prev == NULL)
+                    arena->pinned = chunk->next;
+                else
+                    prev->next = chunk->next;
+                arena->num_pinned--;
+                heap_free(dcontext, chunk, IR_ARENA_CHUNK_SIZE HEAPACCT(ACCT_IR));
+            }
+            return;
+        }
+    }
+    heap_free(dcontext, p, size HEAPACCT(ACCT_IR));
+}
+
 /****************************************************************************
  * SPECIAL SINGLE-ALLOC-SIZE HEAP SERVICE
  */
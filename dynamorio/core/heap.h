@@ -196,6 +196,14 @@ void heap_free(dcontext_t *dcontext, void *p, size_t size HEAPACCT(which_heap_t
 void print_heap_statistics(void);
 #endif
 
+/* IR (instr_t, operand, and raw bits) storage, bump-allocated from a
+ * per-thread arena while building a fragment if -instr_arena is on
+ */
+void heap_ir_arena_enter(dcontext_t *dcontext);
+void heap_ir_arena_exit(dcontext_t *dcontext);
+void *heap_ir_alloc(dcontext_t *dcontext, size_t size);
+void heap_ir_free(dcontext_t *dcontext, void *p, size_t size);
+
 /* FIXME: persistence is yet another dimension here
  * let's clean all these up and have a single alloc routine?
  */
@@ -93,6 +93,54 @@ typedef struct _dr_statistics_t {
 #endif
 } dr_statistics_t;
 
+/* -kstats_export_dir: the kstats of a live process, published in the file
+ * <dir>/dynamorio.<pid>.kstats for external viewers to map read-only.
+ * The file holds a kstat_export_header_t, then num_vars names of
+ * KSTAT_EXPORT_NAME_LEN chars (NUL-terminated) in kstatsx.h order, then
+ * the totals of exited threads as num_vars kstat_export_var_t, then
+ * max_threads slots of slot_size bytes each.  A slot is a kstat_export_slot_t whose thread_id is
+ * 0 when it is free; a live thread updates the vars in its slot in place.
+ * Threads that find no free slot are only counted once they exit.
+ * Totals for KSTAT_SUM entries are computed only in the final report.
+ */
+#define KSTAT_EXPORT_MAGIC "DRKSTAT"
+#define KSTAT_EXPORT_VERSION 2
+#define KSTAT_EXPORT_NAME_LEN 64
+#define KSTAT_EXPORT_MAX_THREADS 256
+
+typedef struct _kstat_export_var_t {
+    uint num_self;
+    uint64 total_self;
+    uint64 total_sub;
+    uint64 min_cum;
+    uint64 max_cum;
+    uint64 total_outliers;
+} kstat_export_var_t;
+
+typedef struct _kstat_export_header_t {
+    char magic[8];              /* KSTAT_EXPORT_MAGIC, written last */
+    uint version;
+    uint num_vars;
+    uint max_threads;
+    uint slot_size;
+    process_id_t process_id;
+    uint64 frequency_per_msec;  /* timestamp units per millisecond */
+    /* Incremented before and after an exiting thread's values move from its
+     * slot into the totals: a reader that sees it odd, or changed across
+     * its read, should retry to avoid counting that thread twice.
+     */
+    volatile uint merge_seq;
+    volatile uint num_threads;  /* slots in use */
+    uint64 names_offs;
+    uint64 totals_offs;
+    uint64 slots_offs;
+} kstat_export_header_t;
+
+typedef struct _kstat_export_slot_t {
+    volatile uint64 thread_id;
+    kstat_export_var_t vars[1]; /* num_vars */
+} kstat_export_slot_t;
+
 #ifndef NOT_DYNAMORIO_CORE
 /* Thread local statistics */
 typedef struct {
@@ -67,6 +67,8 @@ KSTAT_DEF("in trace monitor, thci ", monitor_enter_thci)
 KSTAT_DEF("cache flush unit walk ", cache_flush_unit_walk)
 KSTAT_DEF("flush_region", flush_region)
 KSTAT_DEF("synchall flush ", synchall_flush)
+KSTAT_DEF("flusher waiting for a thread to synch", flush_synch_wait)
+KSTAT_DEF("thread paused for a flusher", flush_wait)
 KSTAT_DEF("coarse pclookup", coarse_pclookup)
 KSTAT_DEF("coarse freeze all", coarse_freeze_all)
 KSTAT_DEF("persisted cache generation", persisted_generation)
@@ -148,6 +148,10 @@
     STATS_DEF("Application modules with long names", app_modname_too_long)
     STATS_DEF("Application modules with code", num_app_code_modules)
     STATS_DEF("Application code seen (bytes)", app_code_seen)
+    STATS_DEF("Decode cache hits", decode_cache_hits)
+    STATS_DEF("Decode cache misses", decode_cache_misses)
+    STATS_DEF("Decode cache hits with changed bytes", decode_cache_stale)
+    STATS_DEF("Decode cache entries invalidated", decode_cache_invalidations)
     STATS_DEF("Interpreted calls, direct and indirect", num_all_calls)
     STATS_DEF("Interpreted indirect calls", num_indirect_calls)
     STATS_DEF("Interpreted convertible indirect calls", num_convertible_indcalls)
@@ -396,6 +400,12 @@
     STATS_DEF("Trace fragments aborted: shared race", num_aborted_traces_race)
     STATS_DEF("Trace fragments aborted: client bad mod", num_aborted_traces_client)
     STATS_DEF("Trace building aborted: shared race", num_trace_building_race)
+    RSTATS_DEF("Traces queued for the async trace builder", num_traces_async_queued)
+    STATS_DEF("Traces emitted by the async trace builder", num_traces_async_emitted)
+    STATS_DEF("Async traces aborted: shared race", num_traces_async_race)
+    STATS_DEF("Async traces aborted: region flushed", num_traces_async_flushed)
+    STATS_DEF("Async traces built synchronously: queue full", num_traces_async_queue_full)
+    STATS_DEF("Maximum async trace builder queue length", max_traces_async_pending)
     STATS_DEF("Trace building truncated: next bb deleted", num_trace_next_bb_deleted)
     STATS_DEF("Trace building reset: no trace head",
               num_reset_trace_no_trace_head)
@@ -473,6 +483,7 @@
     STATS_DEF("Shared fragments deleted no-flush, race", shared_delete_noflush_race)
     STATS_DEF("Trace component fragments deleted", trace_components_deleted)
     STATS_DEF("Fragments deleted due to capacity conflicts", num_fragments_replaced)
+    STATS_DEF("Clock replacement second chances", num_fragments_second_chance)
     STATS_DEF("Fragments deleted on thread/process death", num_fragments_deleted_exit)
     STATS_DEF("Fragments deleted on thread/process reset", num_fragments_deleted_reset)
     STATS_DEF("Trace heads marked", num_trace_heads_marked)
@@ -676,10 +687,15 @@
     STATS_DEF("Persisted cache stub writes over limit", pcache_unprot_over_limit)
     STATS_DEF("Persisted cache stub pages touched", pcache_stub_touched)
 
+    STATS_DEF("Privload image cache hits", privload_image_cache_hits)
+    STATS_DEF("Private library image cache files stale", privload_image_cache_stale)
+    STATS_DEF("Private library image cache files written", privload_image_cache_writes)
+
 #ifdef SIDELINE
     STATS_DEF("Waits due to sideline", num_wait_sideline)
 #endif
     STATS_DEF("Waits due to flushing", num_wait_flush)
+    STATS_DEF("Flush synchs requested before waiting", num_flush_synch_prerequested)
     STATS_DEF("Waits due to shared cache barrier", num_wait_shared_barrier)
 
     STATS_DEF("Entrance hooks to DR", num_entering_DR)
@@ -875,6 +891,10 @@
     RSTATS_DEF("Fcache units on free list", fcache_num_free)
     RSTATS_DEF("Peak fcache units on free list", peak_fcache_num_free)
     STATS_DEF("Fcache unit lookups", fcache_unit_lookups)
+    RSTATS_DEF("Fcache unit reservations given large pages", fcache_large_page_units)
+    RSTATS_DEF("Fcache unit reservations refused large pages",
+               fcache_large_page_failures)
+    STATS_DEF("Fcache bytes backed by large pages", fcache_large_page_capacity)
 
     STATS_DEF("Separate shared trace direct exit stubs (bytes)",
               separate_shared_trace_direct_stubs)
@@ -901,6 +921,14 @@
     STATS_DEF("Peak heap bucket pad space (bytes)", peak_heap_bucket_pad)
     STATS_DEF("Heap allocs in buckets", heap_allocs_buckets)
     STATS_DEF("Heap allocs variable-sized", heap_allocs_variable)
+    STATS_DEF("Global heap allocs from a thread magazine", heap_magazine_allocs)
+    STATS_DEF("Global heap frees to a thread magazine", heap_magazine_frees)
+    STATS_DEF("Thread magazine refills from global heap", heap_magazine_refills)
+    STATS_DEF("Thread magazine returns to global heap", heap_magazine_drains)
+    STATS_DEF("IR arena allocs", ir_arena_allocs)
+    STATS_DEF("IR arena chunk rewinds", ir_arena_resets)
+    STATS_DEF("IR arena chunks pinned by escaped instrs", ir_arena_chunks_pinned)
+    STATS_DEF("IR allocs falling back to heap, too many pinned", ir_arena_fallbacks)
     STATS_DEF("Total reserved memory", reserved_memory_capacity)
     STATS_DEF("Peak total reserved memory", peak_reserved_memory_capacity)
     STATS_DEF("Guard pages, reserved virtual pages", guard_pages)
@@ -908,6 +936,8 @@
 
     STATS_DEF("Stack capacity (bytes)", stack_capacity)
     STATS_DEF("Peak stack capacity (bytes)", peak_stack_capacity)
+    STATS_DEF("Thread dstacks reused from the state pool", thread_state_pool_stacks)
+    STATS_DEF("Thread dcontexts reused from the state pool", thread_state_pool_dcontexts)
     STATS_DEF("Mmaps sharing stack alloc region", mmap_share_stack_region)
     STATS_DEF("Mmaps unable to share stack alloc region", mmap_no_share_stack_region)
     STATS_DEF("Mmap capacity (bytes)", mmap_capacity)
@@ -989,6 +1019,9 @@
     STATS_DEF("Number of safe reads", num_safe_reads)
     STATS_DEF("Number of safe writes", num_safe_writes)
     STATS_DEF("Number of vmarea vector resize reallocations", num_vmareas_resized)
+    STATS_DEF("Vmarea vector snapshots published", vmvector_snapshots_published)
+    STATS_DEF("Vmarea vector snapshots freed after retirement", vmvector_snapshots_freed)
+    STATS_DEF("Lock-free vmarea vector snapshot lookups", vmvector_snapshot_lookups)
     STATS_DEF("Number of vmarea vector resize synch fixups", num_vmareas_resize_synch)
     STATS_DEF("Peak vmarea vector length", max_vmareas_length)
     STATS_DEF("Peak dynamo areas vector length", max_DRareas_length)
@@ -1126,6 +1159,19 @@
     STATS_DEF("Trace fragment ending with an IBL, syscall", num_traces_end_at_ibl_syscall)
     STATS_DEF("Trace fragment ending at MUST_END_TRACE", num_traces_at_must_end_trace)
     STATS_DEF("Trace fragment ending with an IBL, speculative", num_traces_end_at_ibl_speculative_link)
+    RSTATS_DEF("Inline IBL sites", ibl_inline_sites)
+    RSTATS_DEF("Traces emitted with inline IBL targets", ibl_inline_traces)
+    RSTATS_DEF("Inline IBL target hits", ibl_inline_hits)
+    RSTATS_DEF("Inline IBL target misses", ibl_inline_misses)
+    RSTATS_DEF("Inline IBL most hits at one site", ibl_inline_site_max_hits)
+    RSTATS_DEF("Inline IBL most misses at one site", ibl_inline_site_max_misses)
+    RSTATS_DEF("Inline IBL sites re-specialized", ibl_inline_retargets)
+    RSTATS_DEF("Inline IBL re-specializations declined", ibl_inline_retargets_declined)
+    STATS_DEF("Shadow ret stack call sites", num_shadow_ret_calls)
+    STATS_DEF("Shadow ret stack return sites", num_shadow_ret_returns)
+    STATS_DEF("Shadow ret stack hits", shadow_ret_hits)
+    STATS_DEF("Shadow ret stack misses", shadow_ret_misses)
+    STATS_DEF("Shadow ret stack clears", shadow_ret_clears)
     STATS_DEF("Yields in intercept_apc wait dynamo_initialized", apc_yields_while_initializing)
     STATS_DEF("IBL Tables groomed", num_ibt_groomed)
     STATS_DEF("IBL Tables reached maximum capacity", num_ibt_max_capacity)
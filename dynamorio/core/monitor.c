@@ -101,6 +101,44 @@ static void reset_trace_state(dcontext_t *dcontext, bool grab_link_lock);
 /* synchronization of shared traces */
 DECLARE_CXTSWPROT_VAR(mutex_t trace_building_lock, INIT_LOCK_FREE(trace_building_lock));
 
+#ifdef CLIENT_SIDELINE
+/* queue of finished shared traces for -trace_build_async's worker thread */
+typedef struct _pending_trace_t {
+    app_pc tag;
+    instrlist_t *ilist;     /* allocated from global heap */
+    uint flags;
+    void *vmlist;           /* shared, so transferable across threads */
+    uint emitted_size;
+    uint num_bbs;
+    trace_bb_info_t *bbs;   /* allocated from global heap */
+    struct _pending_trace_t *next;
+} pending_trace_t;
+
+/* bounds the memory held by queued traces if the worker falls behind */
+#define MAX_PENDING_TRACES 256
+
+DECLARE_CXTSWPROT_VAR(static mutex_t pending_traces_lock,
+                      INIT_LOCK_FREE(pending_traces_lock));
+DECLARE_CXTSWPROT_VAR(static pending_trace_t *pending_traces_head, NULL);
+DECLARE_CXTSWPROT_VAR(static pending_trace_t *pending_traces_tail, NULL);
+DECLARE_CXTSWPROT_VAR(static uint num_pending_traces, 0);
+DECLARE_CXTSWPROT_VAR(static bool trace_worker_started, false);
+DECLARE_CXTSWPROT_VAR(static bool trace_worker_failed, false);
+/* created in monitor_init() so it exists before the worker does */
+static event_t pending_traces_event;
+
+static void free_pending_trace(dcontext_t *dcontext, pending_trace_t *pend,
+                               bool destroy_vmlist);
+#endif
+
+/* -ibl_inline_targets sites, keyed by trace tag */
+#define INIT_HTABLE_SIZE_IBL_INLINE 6 /* 64 */
+static generic_table_t *ibl_inline_sites;
+/* written from the cache by the inline miss path */
+DECLARE_NEVERPROT_VAR(bool ibl_inline_retarget_pending, false);
+/* max sites re-specialized per monitor_ibl_inline_retarget() call */
+#define IBL_INLINE_RETARGET_BATCH 8
+
 /* For clearing counters on trace deletion we follow a lazy strategy
  * using a sentinel value to determine whether we've built a trace or not
  */
@@ -295,6 +333,198 @@ mangle_trace_at_end(void)
 #endif
 }
 
+static void
+ibl_inline_site_free(void *p)
+{
+    HEAP_TYPE_FREE(GLOBAL_DCONTEXT, p, ibl_inline_site_t, ACCT_TRACE, UNPROTECTED);
+}
+
+/* Folds the counters written from the cache since the last (re-)emit into the
+ * site totals and the global stats, and restarts the miss countdown.
+ * Caller must hold the ibl_inline_sites write lock.
+ */
+static uint
+ibl_inline_site_fold_counters(ibl_inline_site_t *site)
+{
+    uint threshold = INTERNAL_OPTION(ibl_inline_retarget_misses);
+    /* the countdown wraps below 0 if we're slow to react, which unsigned
+     * arithmetic handles
+     */
+    uint misses = threshold - site->countdown;
+    uint i;
+    for (i = 0; i < site->num_targets; i++) {
+        site->total_hits += site->hits[i];
+        RSTATS_ADD(ibl_inline_hits, site->hits[i]);
+    }
+    site->total_misses += misses;
+    RSTATS_ADD(ibl_inline_misses, misses);
+    RSTATS_TRACK_MAX(ibl_inline_site_max_hits, site->total_hits);
+    RSTATS_TRACK_MAX(ibl_inline_site_max_misses, site->total_misses);
+    site->countdown = threshold;
+    return misses;
+}
+
+ibl_inline_site_t *
+monitor_ibl_inline_site(dcontext_t *dcontext, app_pc trace_tag, app_pc next_tag)
+{
+    ibl_inline_site_t *site;
+    uint i;
+    ASSERT(ibl_inline_sites != NULL);
+    TABLE_RWLOCK(ibl_inline_sites, write, lock);
+    site = (ibl_inline_site_t *)
+        generic_hash_lookup(GLOBAL_DCONTEXT, ibl_inline_sites, (ptr_uint_t)trace_tag);
+    if (site == NULL) {
+        site = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, ibl_inline_site_t, ACCT_TRACE,
+                               UNPROTECTED);
+        memset(site, 0, sizeof(*site));
+        site->tag = trace_tag;
+        site->countdown = INTERNAL_OPTION(ibl_inline_retarget_misses);
+        generic_hash_add(GLOBAL_DCONTEXT, ibl_inline_sites, (ptr_uint_t)trace_tag,
+                         site);
+        RSTATS_INC(ibl_inline_sites);
+    } else
+        ibl_inline_site_fold_counters(site);
+    /* the target that completed this trace is the most recently observed */
+    for (i = 0; i < site->num_targets; i++) {
+        if (site->targets[i] == next_tag)
+            break;
+    }
+    if (i == site->num_targets && site->num_targets < DYNAMO_OPTION(ibl_inline_targets))
+        site->targets[site->num_targets++] = next_tag;
+    memset(site->hits, 0, sizeof(site->hits));
+    TABLE_RWLOCK(ibl_inline_sites, write, unlock);
+    return site;
+}
+
+/* Decides whether an expired site should be re-specialized: the most recently
+ * missed target is added if there is room, else it replaces the target with the
+ * fewest hits, as long as that target did worse than the misses we saw.
+ * Caller must hold the ibl_inline_sites write lock.
+ */
+static bool
+ibl_inline_site_respecialize(dcontext_t *dcontext, ibl_inline_site_t *site)
+{
+    app_pc new_target = site->last_miss;
+    uint weakest = 0, i;
+    uint weakest_hits = site->hits[0];
+    uint misses = ibl_inline_site_fold_counters(site);
+    bool rewrite = true;
+
+    for (i = 0; i < site->num_targets; i++) {
+        if (site->targets[i] == new_target)
+            rewrite = false; /* raced with the re-emit that added it */
+        if (site->hits[i] < weakest_hits) {
+            weakest = i;
+            weakest_hits = site->hits[i];
+        }
+    }
+    if (rewrite) {
+        if (site->num_targets < DYNAMO_OPTION(ibl_inline_targets))
+            site->targets[site->num_targets++] = new_target;
+        else if (weakest_hits < misses)
+            site->targets[weakest] = new_target;
+        else
+            rewrite = false;
+    }
+    memset(site->hits, 0, sizeof(site->hits));
+    if (rewrite) {
+        site->retargets++;
+        RSTATS_INC(ibl_inline_retargets);
+        LOG(THREAD, LOG_MONITOR, 2,
+            "ibl inline site for trace "PFX": %u misses, now targets "PFX"\n",
+            site->tag, misses, new_target);
+    } else
+        RSTATS_INC(ibl_inline_retargets_declined);
+    return rewrite;
+}
+
+bool
+monitor_ibl_inline_retarget(dcontext_t *dcontext)
+{
+    app_pc toflush[IBL_INLINE_RETARGET_BATCH];
+    uint num_toflush = 0, i;
+    uint threshold = INTERNAL_OPTION(ibl_inline_retarget_misses);
+    int iter = 0;
+    ptr_uint_t key;
+    void *payload;
+
+    if (!ibl_inline_retarget_pending || ibl_inline_sites == NULL)
+        return true;
+    ibl_inline_retarget_pending = false;
+    TABLE_RWLOCK(ibl_inline_sites, write, lock);
+    while ((iter = generic_hash_iterate_next(GLOBAL_DCONTEXT, ibl_inline_sites, iter,
+                                             &key, &payload)) >= 0) {
+        ibl_inline_site_t *site = (ibl_inline_site_t *) payload;
+        if (threshold - site->countdown < threshold)
+            continue; /* not expired */
+        if (num_toflush == IBL_INLINE_RETARGET_BATCH) {
+            /* pick up the rest next time */
+            ibl_inline_retarget_pending = true;
+            break;
+        }
+        if (ibl_inline_site_respecialize(dcontext, site))
+            toflush[num_toflush++] = site->tag;
+    }
+    TABLE_RWLOCK(ibl_inline_sites, write, unlock);
+    /* The trace is re-emitted against the new targets the next time its
+     * head gets hot.  Flushing the head's first byte takes out every trace
+     * built from it, including private copies in other threads.
+     */
+    for (i = 0; i < num_toflush; i++)
+        flush_fragments_from_region(dcontext, toflush[i], 1, false/*no synchall*/);
+    return num_toflush == 0;
+}
+
+/* Folds the live per-site counters into the site totals and the release
+ * stats.  Called at process exit, in release builds as well, so the final
+ * totals reach the stats export.
+ */
+void
+monitor_ibl_inline_fold_sites(void)
+{
+    int iter = 0;
+    ptr_uint_t key;
+    void *payload;
+    if (ibl_inline_sites == NULL)
+        return;
+    TABLE_RWLOCK(ibl_inline_sites, write, lock);
+    while ((iter = generic_hash_iterate_next(GLOBAL_DCONTEXT, ibl_inline_sites, iter,
+                                             &key, &payload)) >= 0) {
+        ibl_inline_site_t *site = (ibl_inline_site_t *) payload;
+        ibl_inline_site_fold_counters(site);
+        memset(site->hits, 0, sizeof(site->hits));
+    }
+    TABLE_RWLOCK(ibl_inline_sites, write, unlock);
+}
+
+#ifdef DEBUG
+/* Logs the per-site totals ahead of the final stats dump */
+void
+monitor_ibl_inline_dump_sites(void)
+{
+    int iter = 0;
+    ptr_uint_t key;
+    void *payload;
+    uint i;
+    if (ibl_inline_sites == NULL)
+        return;
+    LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1, "Inline IBL sites:\n");
+    TABLE_RWLOCK(ibl_inline_sites, read, lock);
+    while ((iter = generic_hash_iterate_next(GLOBAL_DCONTEXT, ibl_inline_sites, iter,
+                                             &key, &payload)) >= 0) {
+        ibl_inline_site_t *site = (ibl_inline_site_t *) payload;
+        LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1,
+            "  trace "PFX": "UINT64_FORMAT_STRING" hits, "UINT64_FORMAT_STRING
+            " misses, %u retargets, targets", site->tag, site->total_hits,
+            site->total_misses, site->retargets);
+        for (i = 0; i < site->num_targets; i++)
+            LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1, " "PFX, site->targets[i]);
+        LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1, "\n");
+    }
+    TABLE_RWLOCK(ibl_inline_sites, read, unlock);
+}
+#endif
+
 /* Initialization */
 /* thread-shared init does nothing, thread-private init does it all */
 void
@@ -305,6 +535,17 @@ monitor_init()
      * this does not include exit stubs
      */
     ASSERT(MAX_TRACE_BUFFER_SIZE <= MAX_FRAGMENT_SIZE);
+#ifdef CLIENT_SIDELINE
+    if (DYNAMO_OPTION(trace_build_async))
+        pending_traces_event = create_event();
+#endif
+    if (DYNAMO_OPTION(ibl_inline_targets) > 0) {
+        ibl_inline_sites =
+            generic_hash_create(GLOBAL_DCONTEXT, INIT_HTABLE_SIZE_IBL_INLINE,
+                                80 /* load factor: not perf-critical */,
+                                HASHTABLE_SHARED | HASHTABLE_PERSISTENT,
+                                ibl_inline_site_free _IF_DEBUG("ibl inline sites"));
+    }
 }
 
 /* re-initializes non-persistent memory */
@@ -336,6 +577,22 @@ monitor_exit()
 {
     LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1,
         "Trace fragments generated: %d\n", GLOBAL_STAT(num_traces));
+#ifdef CLIENT_SIDELINE
+    if (DYNAMO_OPTION(trace_build_async)) {
+        /* the worker thread is gone by now */
+        while (pending_traces_head != NULL) {
+            pending_trace_t *next = pending_traces_head->next;
+            free_pending_trace(GLOBAL_DCONTEXT, pending_traces_head, true);
+            pending_traces_head = next;
+        }
+        destroy_event(pending_traces_event);
+    }
+    DELETE_LOCK(pending_traces_lock);
+#endif
+    if (ibl_inline_sites != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, ibl_inline_sites);
+        ibl_inline_sites = NULL;
+    }
     DELETE_LOCK(trace_building_lock);
 }
 
@@ -523,6 +780,54 @@ cur_trace_vmlist(dcontext_t *dcontext)
     return md->trace_vmlist;
 }
 
+/* Clears FRAG_TRACE_BUILDING on the shared bb trace head for tag, if any */
+static void
+clear_trace_building_flag(dcontext_t *dcontext, app_pc tag, bool grab_link_lock)
+{
+    /* Look in the shared BB table only since we're only interested 
+     * if a shared BB is present. */
+    fragment_t *bb = fragment_lookup_shared_bb(dcontext, tag);
+    /* FRAG_TRACE_BUILDING may not be set if the BB was regenerated, so
+     * we can't expect it to be set simply because the BB is shared. Check
+     * just for the trace bulding flag.
+     */
+    if (grab_link_lock)
+        acquire_recursive_lock(&change_linking_lock);
+    if (bb != NULL && TEST(FRAG_TRACE_BUILDING, bb->flags)) {
+        /* The regenerate scenario is still racy w/respect to clearing the
+         * flag. The regenerated fragment could have another thread building
+         * a trace from it so the clear would be for the the wrong thread
+         * here. It doesn't cause a correctness problem because the
+         * emit-time race detection logic will catch it. (In testing w/IIS,
+         * we've seen very, very few emit-time aborts -- < 1% of all races.)
+         */
+        ASSERT(TESTALL(FRAG_SHARED | FRAG_IS_TRACE_HEAD, bb->flags));
+        STATS_INC(num_trace_building_ip_cleared);
+        bb->flags &= ~FRAG_TRACE_BUILDING;
+    }
+#ifdef DEBUG
+    /* As noted above, the trace head BB may no longer be present. This
+     * should be rare in most apps but we'll track it w/a counter in case
+     * we see lots of emit-time aborts.
+     */
+    else {
+        STATS_INC(num_reset_trace_no_trace_head);
+        /* The shared BB may been evicted during trace building and subsequently
+         * re-genned and so wouldn't be marked as FRAG_TRACE_BUILDING. It might
+         * be marked as a trace head, though, so we don't assert anything about
+         * that trait.
+         * FIXME We could add a strong ASSERT about the regen case if we added
+         * a trace_head_id field to monitor_data_t. The field would store the id
+         * of the shared BB trace head that caused trace building to begin. If
+         * a shared trace head isn't found but a shared BB is, the shared BB
+         * id should be greater than trace_head_id.
+         */
+    }
+#endif
+    if (grab_link_lock)
+        release_recursive_lock(&change_linking_lock);
+}
+
 static void
 reset_trace_state(dcontext_t *dcontext, bool grab_link_lock)
 {
@@ -552,50 +857,9 @@ reset_trace_state(dcontext_t *dcontext, bool grab_link_lock)
      * consistency). Unset the flag so that a trace can be built from it
      * in the future.
      */
-    if (TEST(FRAG_SHARED, md->trace_flags) && DYNAMO_OPTION(shared_bbs)) {
-        /* Look in the shared BB table only since we're only interested 
-         * if a shared BB is present. */
-        fragment_t *bb = fragment_lookup_shared_bb(dcontext, md->trace_tag);
-        /* FRAG_TRACE_BUILDING may not be set if the BB was regenerated, so
-         * we can't expect it to be set simply because the BB is shared. Check
-         * just for the trace bulding flag.
-         */
-        if (grab_link_lock)
-            acquire_recursive_lock(&change_linking_lock);
-        if (bb != NULL && TEST(FRAG_TRACE_BUILDING, bb->flags)) {
-            /* The regenerate scenario is still racy w/respect to clearing the
-             * flag. The regenerated fragment could have another thread building
-             * a trace from it so the clear would be for the the wrong thread
-             * here. It doesn't cause a correctness problem because the
-             * emit-time race detection logic will catch it. (In testing w/IIS,
-             * we've seen very, very few emit-time aborts -- < 1% of all races.)
-             */
-            ASSERT(TESTALL(FRAG_SHARED | FRAG_IS_TRACE_HEAD, bb->flags));
-            STATS_INC(num_trace_building_ip_cleared);
-            bb->flags &= ~FRAG_TRACE_BUILDING;
-        }
-#ifdef DEBUG
-        /* As noted above, the trace head BB may no longer be present. This
-         * should be rare in most apps but we'll track it w/a counter in case
-         * we see lots of emit-time aborts.
-         */
-        else {
-            STATS_INC(num_reset_trace_no_trace_head);
-            /* The shared BB may been evicted during trace building and subsequently
-             * re-genned and so wouldn't be marked as FRAG_TRACE_BUILDING. It might
-             * be marked as a trace head, though, so we don't assert anything about
-             * that trait.
-             * FIXME We could add a strong ASSERT about the regen case if we added
-             * a trace_head_id field to monitor_data_t. The field would store the id
-             * of the shared BB trace head that caused trace building to begin. If
-             * a shared trace head isn't found but a shared BB is, the shared BB
-             * id should be greater than trace_head_id.
-             */
-        }
-#endif
-        if (grab_link_lock)
-            release_recursive_lock(&change_linking_lock);
-    }
+    if (TEST(FRAG_SHARED, md->trace_flags) && DYNAMO_OPTION(shared_bbs) &&
+        md->trace_tag != NULL)
+        clear_trace_building_flag(dcontext, md->trace_tag, grab_link_lock);
     md->trace_tag = NULL;  /* indicate return to search mode */
     md->trace_flags = 0;
     md->emitted_size = 0;
@@ -1246,6 +1510,336 @@ trace_flags_from_trace_head_flags(uint head_flags)
     return trace_flags;
 }
 
+#ifdef CLIENT_SIDELINE
+/* -trace_build_async: rather than stalling the app thread that finished
+ * recording a shared trace in optimize_trace() and emit, we hand the trace
+ * to a DR-owned worker thread and send the app thread back to the shared
+ * trace head bb in the meantime.  The head keeps FRAG_TRACE_BUILDING so no
+ * other thread starts the same trace.  The worker re-checks for races under
+ * trace_building_lock and emits the trace as a replacement for the head,
+ * which moves the head's incoming links over to the trace in one step.
+ *
+ * The recorded ilist points into this thread's trace buffer and heap, so it
+ * is cloned into global heap for the hand-off and again into the worker's
+ * own heap, where optimize_trace() is free to allocate.  A flush of a region
+ * that a queued trace covers squashes it, just as it would squash an
+ * in-progress trace: see monitor_flush_pending_traces().
+ */
+static void
+free_pending_trace(dcontext_t *dcontext, pending_trace_t *pend, bool destroy_vmlist)
+{
+    if (pend->ilist != NULL)
+        instrlist_clear_and_destroy(GLOBAL_DCONTEXT, pend->ilist);
+    if (destroy_vmlist && pend->vmlist != NULL)
+        vm_area_destroy_list(dcontext, pend->vmlist);
+    HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, pend->bbs, trace_bb_info_t, pend->num_bbs,
+                    ACCT_TRACE, PROTECTED);
+    HEAP_TYPE_FREE(GLOBAL_DCONTEXT, pend, pending_trace_t, ACCT_TRACE, PROTECTED);
+}
+
+/* Clones the recorded trace into global heap.  decode_fragment() bundles are
+ * split up first and every instr gets its own raw bits, as the trace buffer
+ * they point into is reused for this thread's next trace.  Raw bits that are
+ * only valid at their current address (pc-relative ctis, and rip-relative
+ * operands for x64) are dropped in favor of re-encoding from operands.
+ */
+static instrlist_t *
+clone_trace_for_worker(dcontext_t *dcontext, instrlist_t *trace)
+{
+    instrlist_t *ilist;
+    instr_t *inst, *copy;
+    for (inst = instrlist_first(trace); inst != NULL; inst = instr_get_next(inst)) {
+        if (instr_is_level_0(inst))
+            inst = instr_expand(dcontext, trace, inst);
+#ifdef X64
+        if (instr_raw_bits_valid(inst) && !instr_has_allocated_bits(inst))
+            instr_decode(dcontext, inst);
+#endif
+    }
+    ilist = instrlist_clone(GLOBAL_DCONTEXT, trace);
+    for (inst = instrlist_first(trace), copy = instrlist_first(ilist);
+         inst != NULL && copy != NULL;
+         inst = instr_get_next(inst), copy = instr_get_next(copy)) {
+        if (!instr_raw_bits_valid(inst) || instr_has_allocated_bits(inst))
+            continue;
+        if (instr_operands_valid(inst))
+            instr_set_raw_bits_valid(copy, false);
+        else
+            instr_allocate_raw_bits(GLOBAL_DCONTEXT, copy, instr_length(dcontext, inst));
+    }
+    return ilist;
+}
+
+static void
+emit_pending_trace(dcontext_t *dcontext, pending_trace_t *pend)
+{
+    instrlist_t *trace;
+    fragment_t *trace_f, *trace_head_f = NULL;
+    fragment_t wrapper;
+    trace_only_t *trace_tr;
+    uint i;
+
+    /* take the ilist into our own heap before anything allocates from it */
+    trace = instrlist_clone(dcontext, pend->ilist);
+    instrlist_clear_and_destroy(GLOBAL_DCONTEXT, pend->ilist);
+    pend->ilist = NULL;
+
+#ifdef INTERNAL
+    if (dynamo_options.optimize
+#  ifdef SIDELINE
+        && !dynamo_options.sideline
+#  endif
+        ) {
+        optimize_trace(dcontext, pend->tag, trace);
+    }
+#endif
+
+    /* Same synchronization as a synchronous shared trace emit: see
+     * end_and_emit_trace().
+     */
+    mutex_lock(&trace_building_lock);
+    trace_f = fragment_lookup_trace(dcontext, pend->tag);
+    if (trace_f != NULL) {
+        ASSERT(TEST(FRAG_IS_TRACE, trace_f->flags));
+        mutex_unlock(&trace_building_lock);
+        LOG(THREAD, LOG_MONITOR, 2,
+            "Async trace for tag "PFX" lost a race with F%d\n", pend->tag, trace_f->id);
+        STATS_INC(num_traces_async_race);
+        STATS_INC(num_aborted_traces);
+        clear_trace_building_flag(dcontext, pend->tag, true);
+        free_pending_trace(dcontext, pend, true/*destroy vmlist*/);
+        instrlist_clear_and_destroy(dcontext, trace);
+        return;
+    }
+    ASSERT(DYNAMO_OPTION(shared_bbs));
+    trace_head_f = fragment_lookup_fine_and_coarse_sharing(dcontext, pend->tag, &wrapper,
+                                                           NULL, FRAG_SHARED);
+    if (trace_head_f != NULL) {
+        if (!TEST(FRAG_IS_TRACE_HEAD, trace_head_f->flags)) {
+            ASSERT(TEST(FRAG_COARSE_GRAIN, trace_head_f->flags));
+            /* local wrapper so change_linking_lock not needed to change flags */
+            trace_head_f->flags |= FRAG_IS_TRACE_HEAD;
+        }
+        trace_f = emit_fragment_as_replacement(dcontext, pend->tag, trace, pend->flags,
+                                               pend->vmlist, trace_head_f);
+    } else {
+        trace_f = emit_fragment(dcontext, pend->tag, trace, pend->flags, pend->vmlist,
+                                true/*link*/);
+    }
+    ASSERT(trace_f != NULL);
+    /* re-encoding dropped raw bits can change sizes, so no exactness checks */
+    LOG(THREAD, LOG_MONITOR, 3, "Async trace estimated size %d vs actual size %d\n",
+        pend->emitted_size, trace_f->size);
+    trace_tr = TRACE_FIELDS(trace_f);
+    trace_tr->num_bbs = pend->num_bbs;
+    trace_tr->bbs = (trace_bb_info_t *)
+        nonpersistent_heap_alloc(FRAGMENT_ALLOC_DC(dcontext, trace_f->flags),
+                                 pend->num_bbs*sizeof(trace_bb_info_t)
+                                 HEAPACCT(ACCT_TRACE));
+    for (i = 0; i < pend->num_bbs; i++)
+        trace_tr->bbs[i] = pend->bbs[i];
+    mutex_unlock(&trace_building_lock);
+
+    RSTATS_INC(num_traces);
+    STATS_INC(num_traces_async_emitted);
+    STATS_ADD(num_bbs_in_all_traces, pend->num_bbs);
+    STATS_TRACK_MAX(max_bbs_in_a_trace, pend->num_bbs);
+    DOLOG(2, LOG_MONITOR, {
+        LOG(THREAD, LOG_MONITOR, 1, "Generated async trace fragment #%d for tag "PFX"\n",
+            GLOBAL_STAT(num_traces), pend->tag);
+        disassemble_fragment(dcontext, trace_f, stats->loglevel < 3);
+    });
+
+    /* the vmlist now belongs to trace_f */
+    pend->vmlist = NULL;
+    if (trace_head_f != NULL && !TEST(FRAG_COARSE_GRAIN, trace_head_f->flags) &&
+        IF_CUSTOM_TRACES(!dr_end_trace_hook_exists() &&)
+        INTERNAL_OPTION(remove_shared_trace_heads)) {
+        fragment_remove_shared_no_flush(dcontext, trace_head_f);
+    } else
+        clear_trace_building_flag(dcontext, pend->tag, true);
+
+    free_pending_trace(dcontext, pend, false/*vmlist now owned by trace_f*/);
+    instrlist_clear_and_destroy(dcontext, trace);
+}
+
+static void
+trace_worker_main(void *arg)
+{
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    pending_trace_t *pend;
+    LOG(THREAD, LOG_MONITOR, 1, "Async trace builder thread started\n");
+    while (true) {
+        /* we hold no locks and reference no fragments while waiting */
+        dcontext->client_data->client_thread_safe_for_synch = true;
+        wait_for_event(pending_traces_event);
+        if (INTERNAL_OPTION(stress_trace_build_async_delay) > 0)
+            thread_sleep(INTERNAL_OPTION(stress_trace_build_async_delay));
+        dcontext->client_data->client_thread_safe_for_synch = false;
+        do {
+            /* Dequeuing and emitting while couldbelinking makes each trace
+             * atomic wrt flushes (see monitor_flush_pending_traces()).
+             * Passing through here also decrements our ref count on any
+             * pending shared deletions from the flushes that woke us up.
+             */
+            enter_couldbelinking(dcontext, NULL, false/*not a cache transition*/);
+            mutex_lock(&pending_traces_lock);
+            pend = pending_traces_head;
+            if (pend != NULL) {
+                pending_traces_head = pend->next;
+                if (pending_traces_head == NULL)
+                    pending_traces_tail = NULL;
+                num_pending_traces--;
+            }
+            mutex_unlock(&pending_traces_lock);
+            if (pend != NULL)
+                emit_pending_trace(dcontext, pend);
+            enter_nolinking(dcontext, NULL, false/*not a cache transition*/);
+        } while (pend != NULL);
+    }
+}
+
+static bool
+trace_build_async_ok(dcontext_t *dcontext, monitor_data_t *md)
+{
+    bool start_worker = false;
+    if (!DYNAMO_OPTION(trace_build_async) || trace_worker_failed ||
+        !TEST(FRAG_SHARED, md->trace_flags) || !DYNAMO_OPTION(shared_bbs) ||
+        IF_X64(FRAG_IS_32(md->trace_flags) ||)
+        /* private components and private heads must be deleted by their owner */
+        DYNAMO_OPTION(remove_trace_components) ||
+        fragment_lookup_same_sharing(dcontext, md->trace_tag,
+                                     0/*FRAG_PRIVATE*/) != NULL ||
+        INTERNAL_OPTION(stress_recreate_pc))
+        return false;
+    if (num_pending_traces >= MAX_PENDING_TRACES) {
+        STATS_INC(num_traces_async_queue_full);
+        return false;
+    }
+    if (!trace_worker_started) {
+        mutex_lock(&pending_traces_lock);
+        if (!trace_worker_started) {
+            trace_worker_started = true;
+            start_worker = true;
+        }
+        mutex_unlock(&pending_traces_lock);
+    }
+    if (start_worker && !dr_create_client_thread(trace_worker_main, NULL)) {
+        SYSLOG_INTERNAL_WARNING("unable to create async trace builder thread");
+        trace_worker_failed = true;
+        /* anyone who queued while we were starting goes back to building */
+        monitor_flush_pending_traces(dcontext, UNIVERSAL_REGION_BASE,
+                                     UNIVERSAL_REGION_SIZE);
+        return false;
+    }
+    return true;
+}
+
+/* Hands the finished trace in md off to the worker and returns this thread to
+ * search mode.  FRAG_TRACE_BUILDING stays set on the shared head.
+ */
+static void
+queue_trace_for_worker(dcontext_t *dcontext, monitor_data_t *md)
+{
+    pending_trace_t *pend;
+    uint i;
+    pend = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, pending_trace_t, ACCT_TRACE, PROTECTED);
+    pend->tag = md->trace_tag;
+    pend->ilist = clone_trace_for_worker(dcontext, &md->trace);
+    pend->flags = md->trace_flags;
+    pend->vmlist = md->trace_vmlist;
+    pend->emitted_size = md->emitted_size;
+    pend->num_bbs = md->num_blks;
+    pend->bbs = HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, trace_bb_info_t, md->num_blks,
+                                 ACCT_TRACE, PROTECTED);
+    for (i = 0; i < md->num_blks; i++)
+        pend->bbs[i] = md->blk_info[i].info;
+    pend->next = NULL;
+
+    /* we can't flush the region out from under the trace while we're
+     * couldbelinking, so the trace is still valid once it's on the queue
+     */
+    ASSERT(is_couldbelinking(dcontext));
+    mutex_lock(&pending_traces_lock);
+    if (pending_traces_tail == NULL)
+        pending_traces_head = pend;
+    else
+        pending_traces_tail->next = pend;
+    pending_traces_tail = pend;
+    num_pending_traces++;
+    STATS_TRACK_MAX(max_traces_async_pending, num_pending_traces);
+    mutex_unlock(&pending_traces_lock);
+    signal_event(pending_traces_event);
+    RSTATS_INC(num_traces_async_queued);
+    LOG(THREAD, LOG_MONITOR, 2, "Queued trace (tag "PFX") for async emit\n",
+        md->trace_tag);
+
+    md->trace_vmlist = NULL;
+    instrlist_clear(dcontext, &md->trace);
+    /* a NULL tag leaves FRAG_TRACE_BUILDING alone: the worker clears it */
+    md->trace_tag = NULL;
+    reset_trace_state(dcontext, true /* might need change_linking_lock */);
+}
+#endif /* CLIENT_SIDELINE */
+
+/* Squashes traces queued for -trace_build_async that overlap [base, base+size).
+ * Called by a flusher once every thread has been synched with, so no new
+ * overlapping trace can be queued until the flush is over.
+ */
+void
+monitor_flush_pending_traces(dcontext_t *dcontext, app_pc base, size_t size)
+{
+#ifdef CLIENT_SIDELINE
+    pending_trace_t *list, *pend, *next, *keep = NULL, *keep_tail = NULL;
+    uint num_kept = 0;
+    if (!DYNAMO_OPTION(trace_build_async) || !trace_worker_started)
+        return;
+    /* vm_list_overlaps() takes vm locks, so we walk a detached list */
+    mutex_lock(&pending_traces_lock);
+    list = pending_traces_head;
+    pending_traces_head = NULL;
+    pending_traces_tail = NULL;
+    num_pending_traces = 0;
+    mutex_unlock(&pending_traces_lock);
+    for (pend = list; pend != NULL; pend = next) {
+        next = pend->next;
+        if (trace_worker_failed || size == UNIVERSAL_REGION_SIZE ||
+            (pend->vmlist != NULL &&
+             vm_list_overlaps(dcontext, pend->vmlist, base, base+size))) {
+            LOG(THREAD, LOG_MONITOR, 2,
+                "\tsquashing queued async trace (tag "PFX")\n", pend->tag);
+            STATS_INC(num_traces_async_flushed);
+            STATS_INC(num_aborted_traces);
+            clear_trace_building_flag(dcontext, pend->tag, true);
+            free_pending_trace(dcontext, pend, true/*destroy vmlist*/);
+        } else {
+            pend->next = NULL;
+            if (keep_tail == NULL)
+                keep = pend;
+            else
+                keep_tail->next = pend;
+            keep_tail = pend;
+            num_kept++;
+        }
+    }
+    mutex_lock(&pending_traces_lock);
+    if (keep != NULL) {
+        /* anything queued meanwhile goes after the survivors */
+        keep_tail->next = pending_traces_head;
+        if (pending_traces_tail == NULL)
+            pending_traces_tail = keep_tail;
+        pending_traces_head = keep;
+        num_pending_traces += num_kept;
+    }
+    mutex_unlock(&pending_traces_lock);
+    /* Wake the worker even if it has nothing to emit so it passes through a
+     * synch point and doesn't hold up deletion of the flushed fragments.
+     */
+    if (!trace_worker_failed)
+        signal_event(pending_traces_event);
+#endif
+}
+
 /* Be careful with the case where the current fragment f to be executed
  * has the same tag as the one we're emitting as a trace. 
  */
@@ -1260,6 +1854,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     fragment_t *trace_f;
     trace_only_t *trace_tr;
     bool replace_trace_head = false;
+    bool async = false;
     fragment_t wrapper;
     uint i;
 #if defined(DEBUG) || defined(INTERNAL) || defined(CLIENT_INTERFACE)
@@ -1288,6 +1883,8 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         }
     });
 
+    heap_ir_arena_enter(dcontext);
+
 #ifdef CLIENT_INTERFACE
     if (md->pass_to_client) {
         /* PR 299808: we pass the unmangled ilist we've been maintaining to the
@@ -1326,7 +1923,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         md->emitted_size -= local_exit_stub_size(dcontext, target, md->trace_flags);
     }
 
-    if (DYNAMO_OPTION(speculate_last_exit)
+    if (DYNAMO_OPTION(speculate_last_exit) || DYNAMO_OPTION(ibl_inline_targets) > 0
 #ifdef HASHTABLE_STATISTICS
         || INTERNAL_OPTION(speculate_last_exit_stats) || INTERNAL_OPTION(stay_on_trace_stats)
 #endif
@@ -1355,7 +1952,13 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
                     "Last trace IBL exit (trace "PFX", next_tag "PFX")\n", 
                     tag, dcontext->next_tag);
                 ASSERT_CURIOSITY(dcontext->next_tag != NULL);
-                if (DYNAMO_OPTION(speculate_last_exit)) {
+                if (DYNAMO_OPTION(ibl_inline_targets) > 0) {
+                    ibl_inline_site_t *site =
+                        monitor_ibl_inline_site(dcontext, tag, dcontext->next_tag);
+                    md->emitted_size +=
+                        append_trace_inline_ibl_targets(dcontext, trace, site);
+                    RSTATS_INC(ibl_inline_traces);
+                } else if (DYNAMO_OPTION(speculate_last_exit)) {
                     app_pc speculate_next_tag = dcontext->next_tag;
 #ifdef SPECULATE_LAST_EXIT_STUDY 
                     /* for a performance study: add overhead on
@@ -1401,8 +2004,15 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
      * must change recreate_app_state in x86/arch.c as well
      */
     
+#ifdef CLIENT_SIDELINE
+    /* the worker thread optimizes the trace too */
+    async = trace_build_async_ok(dcontext, md);
+    /* we hold no locks here, as creating the writer thread requires */
+    if (INTERNAL_OPTION(tracedump_async))
+        fragment_start_tracedump_writer(dcontext);
+#endif
 #ifdef INTERNAL
-    if (dynamo_options.optimize
+    if (dynamo_options.optimize && !async
 #  ifdef SIDELINE
         && !dynamo_options.sideline
 #  endif
@@ -1440,6 +2050,17 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         delete_private_copy(dcontext);
     }
 
+#ifdef CLIENT_SIDELINE
+    if (async) {
+        /* we keep executing the head bb until the worker has the trace ready */
+        queue_trace_for_worker(dcontext, md);
+        if (cur_f == NULL)
+            cur_f = fragment_lookup(dcontext, cur_f_tag);
+        heap_ir_arena_exit(dcontext);
+        return cur_f;
+    }
+#endif
+
     /* Shared trace synchronization model:
      * We can't hold locks across cache executions, and we wouldn't want to have a
      * massive trace building lock anyway, so we only grab a lock at the final emit
@@ -1683,6 +2304,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
 #endif
 
  end_and_emit_trace_return:
+    heap_ir_arena_exit(dcontext);
     if (cur_f == NULL && cur_f_tag == tag)
         return trace_f;
     else {
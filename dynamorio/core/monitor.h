@@ -58,6 +58,8 @@ void monitor_thread_reset_init(dcontext_t *dcontext);
 void monitor_thread_reset_free(dcontext_t *dcontext);
 
 void monitor_remove_fragment(dcontext_t *dcontext, fragment_t *f);
+/* Squashes traces queued for -trace_build_async that overlap [base, base+size) */
+void monitor_flush_pending_traces(dcontext_t *dcontext, app_pc base, size_t size);
 bool monitor_delete_would_abort_trace(dcontext_t *dcontext, fragment_t *f);
 bool monitor_is_linkable(dcontext_t *dcontext, fragment_t *from_f,
                          linkstub_t *from_l, fragment_t *to_f,
@@ -198,4 +200,46 @@ typedef struct _monitor_data_t {
 app_pc
 get_trace_exit_component_tag(dcontext_t *dcontext, fragment_t *f, linkstub_t *l);
 
+/* -ibl_inline_targets: polymorphic inline cache at a trace's final indirect
+ * branch exit.  One site per trace tag, kept for the life of the process since
+ * emitted code refers to the counters.  The cache-written fields are updated
+ * racily by every thread executing the trace, which is fine for counters.
+ */
+typedef struct _ibl_inline_site_t {
+    app_pc tag;                                 /* tag of the trace */
+    uint num_targets;
+    app_pc targets[IBL_INLINE_MAX_TARGETS];
+    /* written from the cache */
+    uint hits[IBL_INLINE_MAX_TARGETS];
+    uint countdown;          /* misses left until we ask to re-specialize */
+    app_pc last_miss;        /* most recent target not in targets[] */
+    /* totals across re-specializations, for stats */
+    uint64 total_hits;
+    uint64 total_misses;
+    uint retargets;
+} ibl_inline_site_t;
+
+/* Global flag set from the cache when some site's countdown expires */
+extern bool ibl_inline_retarget_pending;
+
+/* Returns the site for trace_tag, primed to emit against next_tag */
+ibl_inline_site_t *
+monitor_ibl_inline_site(dcontext_t *dcontext, app_pc trace_tag, app_pc next_tag);
+
+/* Re-specializes expired sites by flushing their traces.  Must be called
+ * while nolinking and holding no locks.  Returns false iff any trace was
+ * flushed, as was_I_flushed may then be gone.
+ */
+bool
+monitor_ibl_inline_retarget(dcontext_t *dcontext);
+
+/* Folds live per-site counters into the stats; called at process exit */
+void
+monitor_ibl_inline_fold_sites(void);
+
+#ifdef DEBUG
+void
+monitor_ibl_inline_dump_sites(void);
+#endif
+
 #endif /* _MONITOR_H_ */
@@ -66,7 +66,8 @@ native_exec_init(void)
     native_module_init();
     if (!DYNAMO_OPTION(native_exec) || DYNAMO_OPTION(thin_client))
         return;
-    VMVECTOR_ALLOC_VECTOR(native_exec_areas, GLOBAL_DCONTEXT, VECTOR_SHARED,
+    VMVECTOR_ALLOC_VECTOR(native_exec_areas, GLOBAL_DCONTEXT,
+                          VECTOR_SHARED | VMVECTOR_SNAPSHOT_FLAG(),
                           native_exec_areas);
     ASSERT(retstub_end == retstub_start +
            MAX_NATIVE_RETSTACK * BACK_FROM_NATIVE_RETSTUB_SIZE);
@@ -220,6 +221,7 @@ call_to_native(app_pc *sp)
      * - non-native jmp native@plt      # TOS is native PC: don't swap
      * - native ret                     # should stay native
      * XXX: Doing a vmvector binary search on every call to native is expensive.
+     * -vmarea_snapshots at least avoids the lock.
      */
     if (!is_native_pc(*sp)) {
         dcontext->native_retstack[i].retaddr = *sp;
@@ -814,6 +814,13 @@ check_option_compatibility_helper(int recurse_count)
         SET_DEFAULT_VALUE(tracedump_text);
         changed_options = true;
     }
+    if (INTERNAL_OPTION(tracedump_compact) &&
+        (INTERNAL_OPTION(tracedump_binary) || INTERNAL_OPTION(tracedump_text))) {
+        USAGE_ERROR("Cannot combine -tracedump_compact with -tracedump_binary or "
+                    "-tracedump_text, setting to default");
+        SET_DEFAULT_VALUE(tracedump_compact);
+        changed_options = true;
+    }
     if (INTERNAL_OPTION(trace_threshold) > USHRT_MAX) {
         USAGE_ERROR("trace threshold (%d) must be <= USHRT_MAX (%d), setting to max",
                     INTERNAL_OPTION(trace_threshold), USHRT_MAX, USHRT_MAX);
@@ -1215,6 +1222,12 @@ check_option_compatibility_helper(int recurse_count)
         dynamo_options.syscalls_synch_flush = false;
         changed_options = true;
     }
+    if (DYNAMO_OPTION(vmarea_snapshots) && !DYNAMO_OPTION(shared_deletion)) {
+        /* retired snapshots are only freed at shared deletion synch points */
+        USAGE_ERROR("-vmarea_snapshots requires -shared_deletion, disabling");
+        dynamo_options.vmarea_snapshots = false;
+        changed_options = true;
+    }
     if (DYNAMO_OPTION(free_private_stubs) && !DYNAMO_OPTION(separate_private_stubs)) {
         USAGE_ERROR("-free_private_stubs requires -separate_private_stubs, disabling");
         dynamo_options.free_private_stubs = false;
@@ -1257,6 +1270,34 @@ check_option_compatibility_helper(int recurse_count)
         }
 #endif
     }
+#endif
+    if (DYNAMO_OPTION(ibl_inline_targets) > IBL_INLINE_MAX_TARGETS) {
+        USAGE_ERROR("-ibl_inline_targets is at most %d, clamping",
+                    IBL_INLINE_MAX_TARGETS);
+        dynamo_options.ibl_inline_targets = IBL_INLINE_MAX_TARGETS;
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(ibl_inline_targets) > 0 && DYNAMO_OPTION(speculate_last_exit)) {
+        USAGE_ERROR("-ibl_inline_targets subsumes -speculate_last_exit, disabling the latter");
+        dynamo_options.speculate_last_exit = false;
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(shadow_ret_stack) && !DYNAMO_OPTION(ibl_table_in_tls)) {
+        USAGE_ERROR("-shadow_ret_stack requires -ibl_table_in_tls, disabling");
+        dynamo_options.shadow_ret_stack = false;
+        changed_options = true;
+    }
+#if defined(UNIX) && defined(EXPOSE_INTERNAL_OPTIONS)
+    if (INTERNAL_OPTION(prof_pcs_folded) && !INTERNAL_OPTION(profile_pcs)) {
+        USAGE_ERROR("-prof_pcs_folded requires -prof_pcs, enabling");
+        dynamo_options.profile_pcs = true;
+        changed_options = true;
+    }
+    if (INTERNAL_OPTION(prof_pcs_depth) > PROF_PCS_MAX_DEPTH) {
+        USAGE_ERROR("-prof_pcs_depth is at most %d, clamping", PROF_PCS_MAX_DEPTH);
+        dynamo_options.prof_pcs_depth = PROF_PCS_MAX_DEPTH;
+        changed_options = true;
+    }
 #endif
     if ((DYNAMO_OPTION(finite_shared_bb_cache) ||
          DYNAMO_OPTION(finite_shared_trace_cache)) &&
@@ -1836,13 +1877,22 @@ check_option_compatibility_helper(int recurse_count)
 
     if (!DYNAMO_OPTION(persist_per_user) &&
         (DYNAMO_OPTION(validate_owner_dir) ||
-         DYNAMO_OPTION(validate_owner_file))) {
+         IF_WINDOWS_ELSE(DYNAMO_OPTION(validate_owner_file), false))) {
         USAGE_ERROR("-no_persist_per_user is insecure\n"
                     "disabling validation, you are on your own!");
         dynamo_options.validate_owner_file = false;
         dynamo_options.validate_owner_dir = false;
         changed_options = true;
     }
+#ifdef UNIX
+    /* -validate_owner_file is on by default here, but files in a cache shared
+     * among users are not all ours, so it only applies with -persist_per_user
+     */
+    if (!DYNAMO_OPTION(persist_per_user) && DYNAMO_OPTION(validate_owner_file)) {
+        dynamo_options.validate_owner_file = false;
+        changed_options = true;
+    }
+#endif
 
 #ifdef DGC_DIAGNOSTICS
     if (INTERNAL_OPTION(mangle_app_seg)) {
@@ -1899,6 +1949,29 @@ check_option_compatibility_helper(int recurse_count)
             changed_options = true;
         }
     }
+
+#ifdef WINDOWS
+    /* large pages must be requested when the memory is first allocated */
+    if (DYNAMO_OPTION(cache_large_pages)) {
+        USAGE_ERROR("-cache_large_pages is not supported in Windows");
+        dynamo_options.cache_large_pages = false;
+        changed_options = true;
+    }
+#endif
+#ifndef CLIENT_SIDELINE
+    if (DYNAMO_OPTION(trace_build_async)) {
+        USAGE_ERROR("-trace_build_async requires CLIENT_SIDELINE, disabling");
+        dynamo_options.trace_build_async = false;
+        changed_options = true;
+    }
+#endif
+#if defined(EXPOSE_INTERNAL_OPTIONS) && !defined(CLIENT_SIDELINE)
+    if (INTERNAL_OPTION(tracedump_async)) {
+        USAGE_ERROR("-tracedump_async requires CLIENT_SIDELINE, disabling");
+        dynamo_options.tracedump_async = false;
+        changed_options = true;
+    }
+#endif
     
 #ifndef NOT_DYNAMORIO_CORE
     /* fcache param checks rather involved, leave them in fcache.c */
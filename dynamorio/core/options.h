@@ -348,10 +348,11 @@ set_dynamo_options(options_t *options, const char *optstr);
 #define SHARED_IBT_TABLES_ENABLED() \
     (DYNAMO_OPTION(shared_bb_ibt_tables) || DYNAMO_OPTION(shared_trace_ibt_tables))
  
-#define TRACEDUMP_ENABLED()                 \
-     (!DYNAMO_OPTION(disable_traces) &&     \
-      (INTERNAL_OPTION(tracedump_text) ||   \
-       INTERNAL_OPTION(tracedump_binary) || \
+#define TRACEDUMP_ENABLED()                  \
+     (!DYNAMO_OPTION(disable_traces) &&      \
+      (INTERNAL_OPTION(tracedump_text) ||    \
+       INTERNAL_OPTION(tracedump_binary) ||  \
+       INTERNAL_OPTION(tracedump_compact) || \
        INTERNAL_OPTION(tracedump_origins)))
 
 #define RUNNING_WITHOUT_CODE_CACHE()        \
@@ -229,6 +229,11 @@
     OPTION_INTERNAL(bool, tracedump_binary, "binary dump of traces (after optimization)")
     OPTION_INTERNAL(bool, tracedump_text, "text dump of traces (after optimization)")
     OPTION_INTERNAL(bool, tracedump_origins, "write out original instructions for each trace")
+    OPTION_INTERNAL(bool, tracedump_compact,
+        "binary dump of each trace's basic block tags and sizes only")
+    /* Requires CLIENT_SIDELINE for the writer thread: rejected w/o it */
+    OPTION_INTERNAL(bool, tracedump_async,
+        "write binary trace dumps from a background thread")
     OPTION(bool, syntax_intel, "use Intel disassembly syntax")
     OPTION(bool, syntax_att, "use AT&T disassembly syntax")
     /* whether to mark gray-area instrs as invalid when we know the length (i#1118) */
@@ -247,6 +252,11 @@
     OPTION_INTERNAL(bool, bbdump_tags, "dump tags, sizes, and sharedness of all bbs")
     OPTION_INTERNAL(bool, gendump, "dump generated code")
     OPTION_DEFAULT(bool, global_rstats, true, "enable global release-build statistics")
+#ifdef UNIX
+    OPTION_DEFAULT(pathstring_t, stats_export_dir, EMPTY_STRING,
+        "directory, e.g. /dev/shm, in which to publish live statistics for "
+        "external viewers (empty = off)")
+#endif
 
     /* this takes precedence over the DYNAMORIO_VAR_LOGDIR config var */
     OPTION_DEFAULT(pathstring_t, logdir, EMPTY_STRING,
@@ -290,6 +300,11 @@
 #ifdef KSTATS
      /* turn on kstats by default for debug builds */
     OPTION_DEFAULT(bool, kstats, IF_DEBUG_ELSE_0(true), "enable path timing statistics")
+# ifdef UNIX
+    OPTION_DEFAULT(pathstring_t, kstats_export_dir, EMPTY_STRING,
+        "directory in which to publish live -kstats values for external viewers "
+        "(empty = off)")
+# endif
 #endif
 
 #ifdef DEADLOCK_AVOIDANCE
@@ -309,6 +324,11 @@
 
 #if defined(UNIX)
     OPTION_NAME_INTERNAL(bool, profile_pcs, "prof_pcs", "pc-sampling profiling")
+    OPTION_DEFAULT_INTERNAL(bool, prof_pcs_folded, false,
+        "with -prof_pcs, sample per-thread cpu time and write app callstacks, "
+        "translated out of the code cache, as a folded-stack profile")
+    OPTION_DEFAULT_INTERNAL(uint, prof_pcs_depth, 16,
+        "maximum app callers recorded per -prof_pcs_folded sample")
 #else
 # ifdef WINDOWS_PC_SAMPLE
      OPTION_NAME(bool, profile_pcs, "prof_pcs", "pc-sampling profiling")
@@ -789,8 +809,14 @@
     OPTION_DEFAULT(bool, remove_trace_components, false,
         "remove bb components of new traces")
 
+    /* Requires CLIENT_SIDELINE for the worker thread: rejected w/o it */
+    OPTION_DEFAULT(bool, trace_build_async, false,
+        "optimize, emit, and link finished shared traces on a background thread")
+
     OPTION_DEFAULT(bool, shared_deletion, true, "enable shared fragment deletion")
     OPTION_DEFAULT(bool, syscalls_synch_flush, true, "syscalls are flush synch points (currently for shared_deletion only)")
+    OPTION_DEFAULT(bool, flush_pipelined_synch, false,
+        "ask every thread in DR to stop for a flush up front rather than one at a time")
     OPTION_DEFAULT(uint, lazy_deletion_max_pending, 128,
         "maximum size of lazy shared deletion list before moving to normal list")
 
@@ -924,6 +950,12 @@
                    "share ibl routine for traces")
     OPTION_DEFAULT(bool, speculate_last_exit, false, 
         "enable speculative linking of trace last IB exit")
+    OPTION_DEFAULT(uint, ibl_inline_targets, 0,
+        "compare a trace's last IB exit inline against up to this many (max 4) observed targets")
+    OPTION_DEFAULT_INTERNAL(uint, ibl_inline_retarget_misses, 1024,
+        "inline IB misses before a site is considered for re-specialization")
+    OPTION_DEFAULT(bool, shadow_ret_stack, false,
+        "match returns against a per-thread stack of bb call sites before the ibl")
 
     OPTION_DEFAULT(uint, max_trace_bbs, 128, "maximum number of basic blocks in a trace")
 
@@ -949,6 +981,13 @@
         /* Ignore LSB bits for indcall hashtables. */
         "mask out lower bits in indcall IBL table hash function")
 
+    /* Each cache line of an IBL table is treated as a bucket: targets hash to
+     * the first entry of a line and the generated lookup probes the rest of
+     * the line with straight-line code rather than a loop.
+     */
+    OPTION_DEFAULT(bool, ibl_bucket_lines, false,
+        "hash IBL targets to cache-line buckets probed by unrolled lookup code")
+
     OPTION_DEFAULT_INTERNAL(uint, shared_bb_load,
         /* FIXME: since resizing is costly (no delete) this used to be up to 65 but that 
          * hurt us lot (case 1677) when we hit a bad hash function distribution - 
@@ -1068,7 +1107,23 @@
      */
     OPTION_DEFAULT_INTERNAL(uint_size, max_heap_unit_size, 256*1024, "maximum heap unit size")
     OPTION_DEFAULT(uint_size, heap_commit_increment, 4*1024, "heap commit increment")
+    OPTION_DEFAULT(uint, global_heap_magazine, 0,
+        "free global heap blocks per bucket cached by each thread to avoid the global heap lock (0 = off)")
+    OPTION_DEFAULT(bool, instr_arena, false,
+        "bump-allocate instrs from a per-thread arena while building fragments")
+    OPTION_DEFAULT(uint, decode_cache_size, 0,
+        "entries in the cache of decoded app instrs reused when rebuilding blocks (0 = off)")
+    OPTION_DEFAULT(bool, vmarea_snapshots, false,
+        "look up executable and native_exec areas in lock-free copy-on-write snapshots")
+    OPTION_DEFAULT(uint, thread_state_pool, 0,
+        "exited threads whose dcontexts, stacks, and heap units are kept for reuse by new threads (0 = off)")
     OPTION_DEFAULT(uint, cache_commit_increment, 4*1024, "cache commit increment")
+    /* Only units of at least FCACHE_LARGE_PAGE_SIZE benefit, so this is
+     * typically combined with larger -cache_shared_*_unit_* sizes.
+     * Not supported on Windows, where it is rejected.
+     */
+    OPTION_DEFAULT(bool, cache_large_pages, false,
+        "ask the OS to back code cache units with large pages, where supported")
 
     /* cache capacity control
      * FIXME: these are external for now while we study the right way to
@@ -1210,6 +1265,11 @@
         /* doesn't mean much for shared sizing, so default 100 makes
          * regen param a percentage */
         "#regen per #replaced ratio for sizing shared coarse cache")
+    /* Only affects private caches, which use a FIFO, once they are full and
+     * the regen/replace ratio or -cache_*_max prevents further growth.
+     */
+    OPTION_DEFAULT(bool, cache_replace_clock, false,
+        "use clock (second-chance) replacement instead of FIFO for private caches")
 
     OPTION_DEFAULT(uint, cache_trace_align, 8, "alignment of trace cache slots")
     OPTION_DEFAULT(uint, cache_bb_align, 4, "alignment of bb cache slots")
@@ -1880,11 +1940,13 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
      /* case 8812 - owner validation possible only on Win32 */
      /* Note that we expect correct ACLs to prevent anyone other than
       * owner to have overwritten the files.
-      * XXX: not supported on linux
+      * On Linux an open directory can still be renamed, so we instead
+      * validate each file's owner and mode once it is open, for
+      * -persist_per_user caches only.
       */
     OPTION_DEFAULT(bool, validate_owner_dir, IF_WINDOWS_ELSE(true, false),
                    "validate owner of persisted cache or ASLR directory")
-    OPTION_DEFAULT(bool, validate_owner_file, false,
+    OPTION_DEFAULT(bool, validate_owner_file, IF_WINDOWS_ELSE(false, true),
                    "validate owner of persisted cache or ASLR, on each file")
 
     /* PR 326815: off until we fix gcc+gap perf */
@@ -2035,6 +2097,13 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     /* the DYNAMORIO_VAR_PERSCACHE_SHARED config var takes precedence over this */
     OPTION_DEFAULT(pathstring_t, persist_shared_dir, EMPTY_STRING,
         "base shared directory for persistent caches")
+#if defined(UNIX) && defined(CLIENT_INTERFACE)
+    /* Files here are trusted: they are mapped into client libraries unchecked
+     * beyond matching the library's identity and load environment.
+     */
+    OPTION_DEFAULT(pathstring_t, privload_image_cache_dir, EMPTY_STRING,
+        "directory for caching pre-relocated private library images (empty = off)")
+#endif
     /* convenience option */
     OPTION_COMMAND(bool, persist, false, "persist", {
         if (options->persist) {
@@ -2593,6 +2662,9 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     { if (options->stress_recreate_state) 
         options->stress_recreate_pc = true;
     }, "stress test recreate state after each trace or bb", STATIC, OP_PCACHE_NOP)
+    OPTION_DEFAULT_INTERNAL(uint, stress_trace_build_async_delay, 0,
+        "ms the -trace_build_async worker waits after waking, so traces pile up "
+        "and some are still queued at exit")
     OPTION_DEFAULT_INTERNAL(bool, detect_dangling_fcache, false, 
         "detect any execution of a freed fragment")
     OPTION_DEFAULT_INTERNAL(bool, stress_detach_with_stacked_callbacks, false,
@@ -140,6 +140,12 @@ bool os_heap_systemwide_overcommit(heap_error_code_t last_error_code);
 
 bool os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit);
 
+/* Hints that the reserved region [p, p+size) should be backed by large pages
+ * where the OS can do so.  Returns whether the hint was accepted; on failure
+ * the region is still usable with regular pages.
+ */
+bool os_heap_advise_large_pages(void *p, size_t size);
+
 thread_id_t get_thread_id(void);
 process_id_t get_process_id(void);
 void thread_yield(void);
@@ -700,6 +706,8 @@ file_t os_open_directory(const char *fname, int os_open_flags);
 bool os_file_exists(const char *fname, bool is_dir);
 bool os_get_file_size(const char *file, uint64 *size); /* NYI on Linux */
 bool os_get_file_size_by_handle(file_t fd, uint64 *size);
+/* truncates or extends the file */
+bool os_set_file_size(file_t fd, uint64 size);
 
 typedef enum {
     CREATE_DIR_ALLOW_EXISTING = 0x0,
@@ -753,6 +761,8 @@ bool os_rename_file(const char *orig_name, const char *new_name, bool replace);
 byte *os_map_file(file_t f, size_t *size INOUT, uint64 offs, app_pc addr,
                   uint prot, map_flags_t map_flags);
 bool os_unmap_file(byte *map, size_t size);
+/* starts writing back dirty pages of a shared file mapping without waiting */
+bool os_flush_mapped_file(byte *map, size_t size);
 /* unlike set_protection, os_set_protection does not update 
  * the allmem info in Linux. */
 bool os_set_protection(byte *pc, size_t length, uint prot/*MEMPROT_*/);
@@ -2339,6 +2339,12 @@ get_persist_filename(char *filename /*OUT*/, uint filename_max /* max #chars */,
     /* should we go to a 64-bit hash? */
     IF_X64(ASSERT(CHECK_TRUNCATE_TYPE_uint(size)));
     hash = checksum ^ timestamp ^ (uint)size;
+#ifdef UNIX
+    /* file_version holds the ELF build id, so a rebuilt library that keeps
+     * its name, size, and headers still gets a new file
+     */
+    hash ^= (uint)file_version ^ (uint)(file_version >> 32);
+#endif
     /* case 9799: make options part of namespace */
     if (option_string != NULL) {
         uint i;
@@ -61,6 +61,7 @@
 #include "stats.h"
 
 #include <string.h>  /* for memset */
+#include <stddef.h>  /* for offsetof */
 
 #ifdef KSTATS
 
@@ -173,6 +174,168 @@ DECLARE_CXTSWPROT_VAR(mutex_t process_kstats_lock, INIT_LOCK_FREE(process_kstats
 DECLARE_NEVERPROT_VAR(kstat_variables_t process_kstats, {{0,}});
 DECLARE_NEVERPROT_VAR(file_t process_kstats_outfile, INVALID_FILE);
 
+#ifdef UNIX
+/* -kstats_export_dir: see the layout description in dr_stats.h.  We keep
+ * our own copy of the exited-thread totals in process_kstats and copy it
+ * out after each merge, so the file is purely an output.
+ */
+static kstat_export_header_t *kstat_export;
+static size_t kstat_export_size;
+static char kstat_export_path[MAXIMUM_PATH];
+
+#define KSTAT_NUM_VARS (sizeof(kstat_variables_t) / sizeof(kstat_variable_t))
+#define KSTAT_EXPORT_SLOT_SIZE \
+    ALIGN_FORWARD(offsetof(kstat_export_slot_t, vars) + sizeof(kstat_variables_t), 64)
+
+/* Fails to compile if a kstat name plus its NUL does not fit in the
+ * exported names array.
+ */
+#define KSTAT_DEF(desc, name)                                           \
+    typedef char kstat_export_name_fits_##name                          \
+        [(sizeof(#name) <= KSTAT_EXPORT_NAME_LEN) ? 1 : -1];
+#include "kstatsx.h"
+#undef KSTAT_DEF
+
+static inline kstat_variables_t *
+kstat_export_totals(void)
+{
+    return (kstat_variables_t *) ((byte *)kstat_export + kstat_export->totals_offs);
+}
+
+static inline kstat_export_slot_t *
+kstat_export_slot(uint i)
+{
+    return (kstat_export_slot_t *) ((byte *)kstat_export + kstat_export->slots_offs +
+                                    i * kstat_export->slot_size);
+}
+
+static void
+kstat_export_set_path(void)
+{
+    string_option_read_lock();
+    snprintf(kstat_export_path, BUFFER_SIZE_ELEMENTS(kstat_export_path),
+             "%s/dynamorio.%d.kstats", DYNAMO_OPTION(kstats_export_dir),
+             get_process_id());
+    string_option_read_unlock();
+    NULL_TERMINATE_BUFFER(kstat_export_path);
+}
+
+static void
+kstat_export_init(void)
+{
+    uint i = 0;
+    char *names;
+    size_t names_size = KSTAT_NUM_VARS * KSTAT_EXPORT_NAME_LEN;
+    ASSERT(sizeof(kstat_variable_t) == sizeof(kstat_export_var_t));
+    kstat_export_size =
+        ALIGN_FORWARD(ALIGN_FORWARD(sizeof(kstat_export_header_t) + names_size, 64) +
+                      sizeof(kstat_variables_t), 64) +
+        KSTAT_EXPORT_MAX_THREADS * KSTAT_EXPORT_SLOT_SIZE;
+    kstat_export_size = ALIGN_FORWARD(kstat_export_size, PAGE_SIZE);
+    kstat_export_set_path();
+    kstat_export = (kstat_export_header_t *)
+        map_export_file(kstat_export_path, NULL, NULL, kstat_export_size);
+    if (kstat_export == NULL)
+        return;
+    /* the file is new, so already zeroed */
+    kstat_export->version = KSTAT_EXPORT_VERSION;
+    kstat_export->num_vars = KSTAT_NUM_VARS;
+    kstat_export->max_threads = KSTAT_EXPORT_MAX_THREADS;
+    kstat_export->slot_size = KSTAT_EXPORT_SLOT_SIZE;
+    kstat_export->process_id = get_process_id();
+    kstat_export->frequency_per_msec = kstat_frequency_per_msec;
+    kstat_export->names_offs = sizeof(kstat_export_header_t);
+    kstat_export->totals_offs =
+        ALIGN_FORWARD(kstat_export->names_offs + names_size, 64);
+    kstat_export->slots_offs =
+        ALIGN_FORWARD(kstat_export->totals_offs + sizeof(kstat_variables_t), 64);
+    names = (char *)kstat_export + kstat_export->names_offs;
+#define KSTAT_DEF(desc, name)                                           \
+    memcpy(names + i * KSTAT_EXPORT_NAME_LEN, #name, sizeof(#name) - 1); \
+    names[(i++) * KSTAT_EXPORT_NAME_LEN + sizeof(#name) - 1] = '\0';
+#include "kstatsx.h"
+#undef KSTAT_DEF
+    ASSERT(i == KSTAT_NUM_VARS);
+    memcpy(kstat_export_totals(), &process_kstats, sizeof(process_kstats));
+    memcpy(kstat_export->magic, KSTAT_EXPORT_MAGIC, sizeof(kstat_export->magic));
+}
+
+/* Gives tkstats a slot for its live values if one is free */
+static void
+kstat_export_thread_init(thread_kstats_t *tkstats)
+{
+    uint i;
+    if (kstat_export == NULL)
+        return;
+    mutex_lock(&process_kstats_lock);
+    for (i = 0; i < kstat_export->max_threads; i++) {
+        kstat_export_slot_t *slot = kstat_export_slot(i);
+        if (slot->thread_id == 0) {
+            memcpy(slot->vars, tkstats->vars_kstats, sizeof(kstat_variables_t));
+            slot->thread_id = tkstats->thread_id;
+            tkstats->vars_kstats = (kstat_variables_t *) slot->vars;
+            kstat_export->num_threads++;
+            break;
+        }
+    }
+    mutex_unlock(&process_kstats_lock);
+}
+
+/* Caller must hold process_kstats_lock and have just merged tkstats into
+ * process_kstats.
+ */
+static void
+kstat_export_thread_exit(thread_kstats_t *tkstats)
+{
+    ASSERT_OWN_MUTEX(true, &process_kstats_lock);
+    if (kstat_export == NULL)
+        return;
+    kstat_export->merge_seq++;
+    memcpy(kstat_export_totals(), &process_kstats, sizeof(process_kstats));
+    if (tkstats->vars_kstats != &tkstats->vars_private) {
+        kstat_export_slot_t *slot = (kstat_export_slot_t *)
+            ((byte *)tkstats->vars_kstats - offsetof(kstat_export_slot_t, vars));
+        /* keep the values for the thread's report */
+        memcpy(&tkstats->vars_private, tkstats->vars_kstats, sizeof(kstat_variables_t));
+        tkstats->vars_kstats = &tkstats->vars_private;
+        slot->thread_id = 0;
+        kstat_export->num_threads--;
+    }
+    kstat_export->merge_seq++;
+}
+
+/* Gives the child of a fork its own file, keeping the mapping's address so
+ * that threads' pointers into their slots stay valid.  Must be called before
+ * the parent's other threads are exited in the child.
+ */
+void
+kstat_fork_init(dcontext_t *dcontext)
+{
+    thread_kstats_t *tkstats = dcontext->thread_kstats;
+    if (tkstats != NULL)
+        tkstats->thread_id = get_thread_id();
+    if (kstat_export == NULL)
+        return;
+    kstat_export_set_path();
+    fork_export_file(kstat_export_path, (byte *)kstat_export, kstat_export_size);
+    kstat_export->process_id = get_process_id();
+    if (tkstats != NULL && tkstats->vars_kstats != &tkstats->vars_private) {
+        kstat_export_slot_t *slot = (kstat_export_slot_t *)
+            ((byte *)tkstats->vars_kstats - offsetof(kstat_export_slot_t, vars));
+        slot->thread_id = tkstats->thread_id;
+    }
+}
+
+static void
+kstat_export_exit(void)
+{
+    if (kstat_export == NULL)
+        return;
+    unmap_export_file(kstat_export_path, (byte *)kstat_export, kstat_export_size);
+    kstat_export = NULL;
+}
+#endif /* UNIX */
+
 /* Log files are only needed for non-debug builds. */
 #ifndef DEBUG
 static const char *
@@ -214,6 +377,10 @@ kstat_init()
     process_kstats_outfile =
         open_log_file(kstats_main_logfile_name(), NULL, 0);
 #endif
+#ifdef UNIX
+    if (!IS_STRING_OPTION_EMPTY(kstats_export_dir))
+        kstat_export_init();
+#endif
 }
 
 void
@@ -233,6 +400,9 @@ kstat_exit()
 #ifndef DEBUG
     os_close(process_kstats_outfile);
 #endif
+#ifdef UNIX
+    kstat_export_exit();
+#endif
 }    
 
 static void
@@ -270,11 +440,15 @@ kstat_thread_init(dcontext_t *dcontext)
     LOG(THREAD, LOG_STATS, 2, "thread_kstats="PFX" size=%d\n", new_thread_kstats, 
         sizeof(thread_kstats_t));
     /* initialize any thread stats bookkeeping fields before assigning to dcontext */
-    kstat_init_variables(&new_thread_kstats->vars_kstats);
+    kstat_init_variables(&new_thread_kstats->vars_private);
+    new_thread_kstats->vars_kstats = &new_thread_kstats->vars_private;
     /* add a dummy node to save one branch in UPDATE_CURRENT_COUNTER */
     new_thread_kstats->stack_kstats.depth = 1;
 
     new_thread_kstats->thread_id = get_thread_id();
+#ifdef UNIX
+    kstat_export_thread_init(new_thread_kstats);
+#endif
 #ifdef DEBUG
     new_thread_kstats->outfile_kstats = THREAD;
 #else
@@ -323,7 +497,7 @@ dump_thread_kstats(dcontext_t *dcontext)
     print_file(dcontext->thread_kstats->outfile_kstats, "Thread %d KSTATS {\n",
                dcontext->thread_kstats->thread_id);
     kstat_report(dcontext->thread_kstats->outfile_kstats, 
-                 &dcontext->thread_kstats->vars_kstats);
+                 dcontext->thread_kstats->vars_kstats);
     print_file(dcontext->thread_kstats->outfile_kstats, "} KSTATS\n");
 }
 
@@ -334,7 +508,7 @@ dump_thread_kstats(dcontext_t *dcontext)
 static const char *
 kstat_var_name(dcontext_t *dcontext, kstat_variable_t *kvar)
 {
-    kstat_variables_t *kvs = &dcontext->thread_kstats->vars_kstats;
+    kstat_variables_t *kvs = dcontext->thread_kstats->vars_kstats;
 #define KSTAT_DEF(desc, name) \
     if (kvar == &kvs->name)   \
         return #name;
@@ -372,7 +546,10 @@ kstat_thread_exit(dcontext_t *dcontext)
 
     /* a good time to combine all of these with the global statistics */
     mutex_lock(&process_kstats_lock);
-    kstat_merge(&process_kstats, &old_thread_kstats->vars_kstats);
+    kstat_merge(&process_kstats, old_thread_kstats->vars_kstats);
+#ifdef UNIX
+    kstat_export_thread_exit(old_thread_kstats);
+#endif
     mutex_unlock(&process_kstats_lock);
 
 #ifdef DEBUG
@@ -50,6 +50,10 @@ void
 kstat_thread_exit(dcontext_t *dcontext);
 void
 dump_thread_kstats(dcontext_t *dcontext);
+#ifdef UNIX
+void
+kstat_fork_init(dcontext_t *dcontext);
+#endif
 
 /* for debugging only */
 #ifdef DEBUG
@@ -121,7 +125,9 @@ typedef struct {
 /* Thread local context and collected data */
 typedef struct {
     thread_id_t       thread_id;
-    kstat_variables_t vars_kstats;
+    /* vars_private, or with -kstats_export_dir this thread's export slot */
+    kstat_variables_t *vars_kstats;
+    kstat_variables_t vars_private;
     kstat_stack_t     stack_kstats;
     file_t           outfile_kstats;
 } thread_kstats_t;
@@ -129,8 +135,11 @@ typedef struct {
 extern timestamp_t
 kstat_ignore_context_switch; 
 
+/* The option check comes first so that with -no_kstats a timer point costs
+ * only a load and a branch, without the TLS lookup.
+ */
 #define KSTAT_THREAD_NO_PV_START(dc) do {                                       \
-    dcontext_t *cur_dcontext = (dc);                                         \
+    dcontext_t *cur_dcontext = DYNAMO_OPTION(kstats) ? (dc) : NULL;          \
     if (cur_dcontext != NULL && cur_dcontext->thread_kstats != NULL) {          \
         kstat_stack_t *ks = &cur_dcontext->thread_kstats->stack_kstats;    
 
@@ -138,12 +147,12 @@ kstat_ignore_context_switch;
     }                                           \
 } while (0)
 
-/* ensures statement can safely use ks=stack_kstats and pv=&vars_kstats.name,
+/* ensures statement can safely use ks=stack_kstats and pv=&vars_kstats->name,
  */
 #define KSTAT_THREAD(name, statement)                           \
         KSTAT_THREAD_NO_PV_START(get_thread_private_dcontext()) \
         kstat_variable_t *pv = &cur_dcontext->thread_kstats->      \
-                            vars_kstats.name;                   \
+                            vars_kstats->name;                  \
         UNUSED_VARIABLE(pv);                                    \
         statement;                                              \
         KSTAT_THREAD_NO_PV_END()
@@ -151,7 +160,7 @@ kstat_ignore_context_switch;
 #define KSTAT_OTHER_THREAD(dc, name, statement)                 \
         KSTAT_THREAD_NO_PV_START(dc)                            \
         kstat_variable_t *pv = &cur_dcontext->thread_kstats->      \
-                            vars_kstats.name;                   \
+                            vars_kstats->name;                  \
         UNUSED_VARIABLE(pv);                                    \
         statement;                                              \
         KSTAT_THREAD_NO_PV_END()
@@ -209,7 +218,7 @@ kstat_ignore_context_switch;
 /* avoid recursion in logging KSTAT - do not checkin uses */
 #define KSTAT_DUMP_STACK(kstack)                                        \
     if ((kstack)->node[(kstack)->depth - 1].var !=                      \
-        &cur_dcontext->thread_kstats->vars_kstats.logging) {            \
+        &cur_dcontext->thread_kstats->vars_kstats->logging) {           \
         LOG(THREAD_GET, LOG_STATS, 1, "ks %s:%d\n"__FILE__, __LINE__);  \
         kstats_dump_stack(cur_dcontext);                                \
     } 
@@ -135,6 +135,17 @@ privload_delete_os_privmod_data(privmod_t *privmod);
 static void
 privload_mod_tls_init(privmod_t *mod);
 
+#ifdef CLIENT_INTERFACE
+static app_pc
+image_cache_base_hint(const char *filename);
+
+static bool
+image_cache_map(privmod_t *mod);
+
+static void
+image_cache_write(privmod_t *mod);
+#endif
+
 /***************************************************************************/
 
 /* os specific loader initialization prologue before finalizing the load. */
@@ -372,6 +383,9 @@ privload_map_and_relocate(const char *filename, size_t *size OUT, bool reachable
         }
         return NULL;
     }
+#ifdef CLIENT_INTERFACE
+    loader.base_hint = image_cache_base_hint(filename);
+#endif
 
     base = elf_loader_map_phdrs(&loader, false /* fixed */, map_func,
                                 unmap_func, prot_func, reachable);
@@ -828,6 +842,10 @@ privload_relocate_mod(privmod_t *mod)
     if (opd->tls_block_size != 0) 
         privload_mod_tls_init(mod);
 
+#ifdef CLIENT_INTERFACE
+    if (image_cache_map(mod))
+        goto relocated;
+#endif
     if (opd->rel != NULL) {
         module_relocate_rel(mod->base, opd,
                             opd->rel,
@@ -847,6 +865,10 @@ privload_relocate_mod(privmod_t *mod)
                                  (ELF_RELA_TYPE *)(opd->jmprel + opd->pltrelsz));
         }
     }
+#ifdef CLIENT_INTERFACE
+    image_cache_write(mod);
+ relocated:
+#endif
     /* special handling on I/O file */
     if (strstr(mod->name, "libc.so") == mod->name) {
         privmod_stdout = 
@@ -867,6 +889,311 @@ privload_relocate_mod(privmod_t *mod)
     }
 }
 
+#ifdef CLIENT_INTERFACE
+/****************************************************************************
+ *                  Pre-relocated Image Cache                               *
+ */
+
+/* -privload_image_cache_dir: once a library's relocations are processed, the
+ * pages of its writable segments are saved to a file named after the library's
+ * path.  A later process that maps the same file at the same base, with the
+ * same libraries (and DR) already loaded at the same places, maps those pages
+ * over the fresh image instead of relocating it, skipping the symbol lookup for
+ * every import.  The saved base is requested as a hint when mapping the
+ * library; if the hint is not honored or anything else differs, the file is
+ * stale and we relocate as usual and rewrite it.
+ */
+#define IMAGE_CACHE_MAGIC      0x49435244 /* "DRCI" */
+#define IMAGE_CACHE_VERSION    1
+#define IMAGE_CACHE_MAX_RANGES 8
+
+typedef struct _image_cache_file_id_t {
+    uint64 dev;
+    uint64 ino;
+    uint64 size;
+    uint64 mtime;
+} image_cache_file_id_t;
+
+typedef struct _image_cache_range_t {
+    size_t offs;        /* page-aligned offset from the image base */
+    size_t size;        /* multiple of PAGE_SIZE */
+    uint64 cache_offs;  /* page-aligned offset in the cache file */
+    uint64 lib_offs;    /* page-aligned offset in the library file */
+    size_t lib_bytes;   /* bytes backed by the library file, the rest is zero */
+    uint prot;          /* MEMPROT_ */
+} image_cache_range_t;
+
+typedef struct _image_cache_header_t {
+    uint magic;
+    uint version;
+    image_cache_file_id_t lib_id;
+    app_pc base;
+    size_t size;
+    uint64 env_hash;    /* see image_cache_env_hash() */
+    uint num_ranges;
+    image_cache_range_t ranges[IMAGE_CACHE_MAX_RANGES];
+} image_cache_header_t;
+
+/* FNV-1a */
+static uint64
+image_cache_hash(uint64 hash, const void *data, size_t size)
+{
+    const byte *p = (const byte *) data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool
+image_cache_file_id(const char *path, image_cache_file_id_t *id OUT)
+{
+    memset(id, 0, sizeof(*id));
+    return os_get_file_identity(path, &id->dev, &id->ino, &id->size, &id->mtime);
+}
+
+static void
+image_cache_path(const char *libpath, char *buf OUT, size_t bufsz)
+{
+    const char *name = double_strrchr(libpath, DIRSEP, ALT_DIRSEP);
+    /* the full path goes into the name so same-named libraries don't collide */
+    uint64 hash = image_cache_hash(0xcbf29ce484222325ULL, libpath, strlen(libpath));
+    string_option_read_lock();
+    snprintf(buf, bufsz, "%s/%s-"ZHEX64_FORMAT_STRING".img",
+             DYNAMO_OPTION(privload_image_cache_dir),
+             (name == NULL) ? libpath : name + 1, hash);
+    string_option_read_unlock();
+    buf[bufsz - 1] = '\0';
+}
+
+/* Returns the open cache file for libpath if it has a valid header for the
+ * library's current contents, else INVALID_FILE.
+ */
+static file_t
+image_cache_open(const char *libpath, image_cache_header_t *hdr OUT)
+{
+    char path[MAXIMUM_PATH];
+    image_cache_file_id_t id;
+    file_t fd;
+    if (IS_STRING_OPTION_EMPTY(privload_image_cache_dir))
+        return INVALID_FILE;
+    image_cache_path(libpath, path, BUFFER_SIZE_ELEMENTS(path));
+    fd = os_open(path, OS_OPEN_READ);
+    if (fd == INVALID_FILE)
+        return INVALID_FILE;
+    if (os_read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+        hdr->magic != IMAGE_CACHE_MAGIC || hdr->version != IMAGE_CACHE_VERSION ||
+        hdr->num_ranges > IMAGE_CACHE_MAX_RANGES ||
+        !image_cache_file_id(libpath, &id) ||
+        memcmp(&id, &hdr->lib_id, sizeof(id)) != 0) {
+        LOG(GLOBAL, LOG_LOADER, 2, "%s: %s is stale or invalid\n", __FUNCTION__, path);
+        os_close(fd);
+        return INVALID_FILE;
+    }
+    return fd;
+}
+
+/* Called before the heap is initialized for the client libraries, so this
+ * must not allocate.
+ */
+static app_pc
+image_cache_base_hint(const char *filename)
+{
+    image_cache_header_t hdr;
+    file_t fd = image_cache_open(filename, &hdr);
+    if (fd == INVALID_FILE)
+        return NULL;
+    os_close(fd);
+    return hdr.base;
+}
+
+/* Hashes everything besides the library itself and its base that its
+ * relocated contents depend on: its TLS placement and the identity and
+ * placement of DR and of every other loaded library, since imports may
+ * resolve to any of them.
+ */
+static uint64
+image_cache_env_hash(privmod_t *mod)
+{
+    os_privmod_data_t *opd = (os_privmod_data_t *) mod->os_privmod_data;
+    image_cache_file_id_t id;
+    uint64 hash = 0xcbf29ce484222325ULL;
+    app_pc dr_base = get_dynamorio_dll_start();
+    privmod_t *m;
+    ASSERT_OWN_RECURSIVE_LOCK(true, &privload_lock);
+    hash = image_cache_hash(hash, &opd->tls_modid, sizeof(opd->tls_modid));
+    hash = image_cache_hash(hash, &opd->tls_offset, sizeof(opd->tls_offset));
+    hash = image_cache_hash(hash, &dr_base, sizeof(dr_base));
+    if (image_cache_file_id(get_dynamorio_library_path(), &id))
+        hash = image_cache_hash(hash, &id, sizeof(id));
+    for (m = privload_first_module(); m != NULL; m = privload_next_module(m)) {
+        if (m == mod)
+            continue;
+        hash = image_cache_hash(hash, &m->base, sizeof(m->base));
+        hash = image_cache_hash(hash, &m->size, sizeof(m->size));
+        hash = image_cache_hash(hash, m->path, strlen(m->path));
+        if (image_cache_file_id(m->path, &id))
+            hash = image_cache_hash(hash, &id, sizeof(id));
+    }
+    return hash;
+}
+
+/* Puts the library's own pages back under a range we failed to map */
+static bool
+image_cache_restore_range(privmod_t *mod, image_cache_range_t *range)
+{
+    size_t size = range->size;
+    byte *map;
+    file_t fd = os_open(mod->path, OS_OPEN_READ);
+    if (fd == INVALID_FILE)
+        return false;
+    map = os_map_file(fd, &size, range->lib_offs, mod->base + range->offs,
+                      range->prot | MEMPROT_WRITE,
+                      MAP_FILE_COPY_ON_WRITE | MAP_FILE_IMAGE | MAP_FILE_FIXED);
+    os_close(fd);
+    if (map != mod->base + range->offs)
+        return false;
+    memset(map + range->lib_bytes, 0, range->size - range->lib_bytes);
+    os_set_protection(map, range->size, range->prot);
+    return true;
+}
+
+/* Returns whether mod's relocated pages were mapped from its cache file */
+static bool
+image_cache_map(privmod_t *mod)
+{
+    image_cache_header_t hdr;
+    uint64 cache_size;
+    uint i, j;
+    file_t fd = image_cache_open(mod->path, &hdr);
+    if (fd == INVALID_FILE)
+        return false;
+    if (hdr.base != mod->base || hdr.size != mod->size ||
+        hdr.env_hash != image_cache_env_hash(mod) ||
+        !os_get_file_size_by_handle(fd, &cache_size))
+        goto stale;
+    for (i = 0; i < hdr.num_ranges; i++) {
+        image_cache_range_t *range = &hdr.ranges[i];
+        if (!ALIGNED(range->offs, PAGE_SIZE) || !ALIGNED(range->size, PAGE_SIZE) ||
+            !ALIGNED(range->cache_offs, PAGE_SIZE) ||
+            range->offs + range->size > mod->size ||
+            range->cache_offs + range->size > cache_size ||
+            range->lib_bytes > range->size)
+            goto stale;
+    }
+    for (i = 0; i < hdr.num_ranges; i++) {
+        image_cache_range_t *range = &hdr.ranges[i];
+        size_t size = range->size;
+        byte *map = os_map_file(fd, &size, range->cache_offs, mod->base + range->offs,
+                                range->prot,
+                                MAP_FILE_COPY_ON_WRITE | MAP_FILE_IMAGE |
+                                MAP_FILE_FIXED);
+        if (map != mod->base + range->offs) {
+            /* a fixed mapping may have replaced the old one before failing */
+            for (j = 0; j <= i; j++) {
+                if (!image_cache_restore_range(mod, &hdr.ranges[j])) {
+                    SYSLOG_INTERNAL_ERROR("unable to restore %s after a failed "
+                                          "image cache mapping", mod->path);
+                    ASSERT_NOT_REACHED();
+                }
+            }
+            goto stale;
+        }
+    }
+    os_close(fd);
+    STATS_INC(privload_image_cache_hits);
+    LOG(GLOBAL, LOG_LOADER, 1, "%s: mapped relocated %s from the image cache\n",
+        __FUNCTION__, mod->name);
+    return true;
+
+ stale:
+    os_close(fd);
+    STATS_INC(privload_image_cache_stale);
+    LOG(GLOBAL, LOG_LOADER, 2, "%s: image cache for %s is stale\n",
+        __FUNCTION__, mod->name);
+    return false;
+}
+
+/* Saves mod's writable segments, which must have just been relocated and
+ * not yet been touched by the library's own initializers.
+ */
+static void
+image_cache_write(privmod_t *mod)
+{
+    os_privmod_data_t *opd = (os_privmod_data_t *) mod->os_privmod_data;
+    ELF_HEADER_TYPE *ehdr = (ELF_HEADER_TYPE *) mod->base;
+    image_cache_header_t hdr;
+    char path[MAXIMUM_PATH], tmp[MAXIMUM_PATH];
+    uint64 cache_offs = ALIGN_FORWARD(sizeof(hdr), PAGE_SIZE);
+    file_t fd;
+    uint i;
+    bool ok;
+
+    if (IS_STRING_OPTION_EMPTY(privload_image_cache_dir) || mod->externally_loaded)
+        return;
+    /* text relocations would land outside the segments we save */
+    if (opd->textrel || !is_elf_so_header(mod->base, mod->size))
+        return;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = IMAGE_CACHE_MAGIC;
+    hdr.version = IMAGE_CACHE_VERSION;
+    if (!image_cache_file_id(mod->path, &hdr.lib_id))
+        return;
+    hdr.base = mod->base;
+    hdr.size = mod->size;
+    hdr.env_hash = image_cache_env_hash(mod);
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        ELF_PROGRAM_HEADER_TYPE *prog_hdr = (ELF_PROGRAM_HEADER_TYPE *)
+            (mod->base + ehdr->e_phoff + i * ehdr->e_phentsize);
+        image_cache_range_t *range;
+        app_pc seg_base, file_end;
+        if (prog_hdr->p_type != PT_LOAD || !TEST(PF_W, prog_hdr->p_flags) ||
+            prog_hdr->p_filesz == 0)
+            continue;
+        if (hdr.num_ranges == IMAGE_CACHE_MAX_RANGES)
+            return;
+        range = &hdr.ranges[hdr.num_ranges++];
+        seg_base = (app_pc) ALIGN_BACKWARD(prog_hdr->p_vaddr, PAGE_SIZE) +
+            opd->load_delta;
+        file_end = (app_pc) prog_hdr->p_vaddr + prog_hdr->p_filesz + opd->load_delta;
+        range->offs = seg_base - mod->base;
+        range->size = ALIGN_FORWARD(file_end, PAGE_SIZE) - (ptr_uint_t)seg_base;
+        range->cache_offs = cache_offs;
+        range->lib_offs = ALIGN_BACKWARD(prog_hdr->p_offset, PAGE_SIZE);
+        range->lib_bytes = file_end - seg_base;
+        range->prot = module_segment_prot_to_osprot(prog_hdr);
+        cache_offs += range->size;
+    }
+    if (hdr.num_ranges == 0)
+        return;
+
+    /* write to a private file and rename it into place, so readers never see
+     * a partial image
+     */
+    image_cache_path(mod->path, path, BUFFER_SIZE_ELEMENTS(path));
+    snprintf(tmp, BUFFER_SIZE_ELEMENTS(tmp), "%s.%d.tmp", path, get_process_id());
+    NULL_TERMINATE_BUFFER(tmp);
+    fd = os_open(tmp, OS_OPEN_WRITE | OS_OPEN_REQUIRE_NEW);
+    if (fd == INVALID_FILE)
+        return;
+    ok = (os_write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+    for (i = 0; ok && i < hdr.num_ranges; i++) {
+        image_cache_range_t *range = &hdr.ranges[i];
+        ok = os_seek(fd, range->cache_offs, OS_SEEK_SET) &&
+            os_write(fd, mod->base + range->offs, range->size) == (ssize_t)range->size;
+    }
+    os_close(fd);
+    if (ok && os_rename_file(tmp, path, true/*replace*/)) {
+        STATS_INC(privload_image_cache_writes);
+        LOG(GLOBAL, LOG_LOADER, 1, "%s: saved relocated %s to %s\n",
+            __FUNCTION__, mod->name, path);
+    } else
+        os_delete_file(tmp);
+}
+#endif /* CLIENT_INTERFACE */
+
 static void
 privload_create_os_privmod_data(privmod_t *privmod)
 {
@@ -441,6 +441,54 @@ module_fill_os_data(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_DYNAMIC entry */
     });
 }
 
+/* Fills in out_data->build_id from the NT_GNU_BUILD_ID note in the PT_NOTE
+ * segment prog_hdr, if there is one.  Like module_fill_os_data(), if at_map
+ * we read from the file offset, which must be within the initial map.
+ */
+static void
+module_fill_build_id(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_NOTE entry */
+                     app_pc base,
+                     size_t view_size,
+                     bool at_map,
+                     ptr_int_t load_delta,
+                     OUT os_module_data_t *out_data)
+{
+    app_pc note, end;
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    ASSERT(prog_hdr->p_type == PT_NOTE);
+    if (out_data->build_id_len > 0)
+        return; /* already found in an earlier PT_NOTE */
+    if (at_map) {
+        if (prog_hdr->p_offset + prog_hdr->p_filesz > view_size)
+            return;
+        note = base + prog_hdr->p_offset;
+    } else
+        note = (app_pc)prog_hdr->p_vaddr + load_delta;
+    end = note + prog_hdr->p_filesz;
+
+    TRY_EXCEPT_ALLOW_NO_DCONTEXT(dcontext, {
+        while (note + sizeof(ELF_NOTE_HEADER_TYPE) <= end) {
+            ELF_NOTE_HEADER_TYPE *nhdr = (ELF_NOTE_HEADER_TYPE *) note;
+            /* name and desc are each padded to 4 bytes, for 64-bit too */
+            app_pc name = note + sizeof(*nhdr);
+            app_pc desc = name + ALIGN_FORWARD(nhdr->n_namesz, 4);
+            app_pc next = desc + ALIGN_FORWARD(nhdr->n_descsz, 4);
+            if (next > end || next <= note)
+                break; /* malformed */
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0 && nhdr->n_descsz > 0) {
+                out_data->build_id_len = MIN(nhdr->n_descsz, MODULE_BUILD_ID_MAX);
+                memcpy(out_data->build_id, desc, out_data->build_id_len);
+                break;
+            }
+            note = next;
+        }
+    } , { /* EXCEPT */
+        ASSERT_CURIOSITY(false && "crashed while walking notes");
+        out_data->build_id_len = 0;
+    });
+}
+
 /* Returned addresses out_base and out_end are relative to the actual
  * loaded module base, so the "base" param should be added to produce
  * absolute addresses.
@@ -500,6 +548,10 @@ module_walk_program_headers(app_pc base, size_t view_size, bool at_map,
                                     base, view_size, at_map, load_delta,
                                     &soname, out_data);
             }
+            if (out_data != NULL && prog_hdr->p_type == PT_NOTE) {
+                module_fill_build_id(prog_hdr, base, view_size, at_map,
+                                     load_delta, out_data);
+            }
         }
     }
     ASSERT_CURIOSITY(found_load && mod_base != (app_pc)POINTER_MAX &&
@@ -1157,8 +1209,16 @@ os_get_module_info(const app_pc pc, uint *checksum, uint *timestamp,
             *code_size = rx_sz;
         }
         if (file_version != NULL) {
-            /* FIXME: NYI: make windows-only everywhere if no good linux source */
-            *file_version = 0;
+            /* There is no ELF file version, but the build id identifies the
+             * contents of the file, which is what pcaches want from a version
+             * (a new build of a library often keeps its size and headers).
+             * We fold it into 64 bits.
+             */
+            uint i;
+            uint64 id = 0;
+            for (i = 0; i < ma->os_data.build_id_len; i++)
+                id = ((id << 8) | (id >> 56)) ^ ma->os_data.build_id[i];
+            *file_version = id;
         }
     }
 
@@ -2207,7 +2267,9 @@ elf_loader_map_phdrs(elf_loader_t *elf, bool fixed, map_fn_t map_func,
         /* place an extra no-access page after .bss */
         initial_map_size += PAGE_SIZE;
     }
-    lib_base = (*map_func)(-1, &initial_map_size, 0, map_base,
+    lib_base = (*map_func)(-1, &initial_map_size, 0,
+                           (map_base == NULL && elf->base_hint != NULL) ?
+                           elf->base_hint : map_base,
                            MEMPROT_NONE, /* so the separating page is no-access */
                            MAP_FILE_COPY_ON_WRITE |
                            MAP_FILE_IMAGE |
@@ -55,6 +55,7 @@
 # define ELF_REL_TYPE Elf64_Rel
 # define ELF_RELA_TYPE Elf64_Rela
 # define ELF_AUXV_TYPE Elf64_auxv_t
+# define ELF_NOTE_HEADER_TYPE Elf64_Nhdr
 #else
 # define ELF_HEADER_TYPE Elf32_Ehdr
 # define ELF_ALTARCH_HEADER_TYPE Elf64_Ehdr
@@ -72,6 +73,7 @@
 # define ELF_REL_TYPE Elf32_Rel
 # define ELF_RELA_TYPE Elf32_Rela
 # define ELF_AUXV_TYPE Elf32_auxv_t
+# define ELF_NOTE_HEADER_TYPE Elf32_Nhdr
 #endif
 
 #ifdef X64 
@@ -138,6 +140,9 @@
 #define OS_IMAGE_WRITE   (MEMPROT_WRITE)
 #define OS_IMAGE_EXECUTE (MEMPROT_EXEC)
 
+/* max number of bytes of a module's build id that we keep */
+#define MODULE_BUILD_ID_MAX 32
+
 /* i#160/PR 562667: support non-contiguous library mappings.  While we're at
  * it we go ahead and store info on each segment whether contiguous or not.
  */
@@ -162,6 +167,11 @@ typedef struct _os_module_data_t {
     /* Fields for pcaches (PR 295534) */
     size_t checksum;
     size_t timestamp;
+    /* The NT_GNU_BUILD_ID note, if present, which identifies the file contents.
+     * It is typically a 20-byte SHA-1; longer ids are truncated.
+     */
+    uint build_id_len;
+    byte build_id[MODULE_BUILD_ID_MAX];
 
     /* i#112: Dynamic section info for exported symbol lookup.  Not
      * using elf types here to avoid having to export those.
@@ -316,6 +326,8 @@ typedef struct elf_loader_t {
     size_t image_size;                  /* Size of the mapped image. */
     void *file_map;                     /* Whole file map, if needed. */
     size_t file_size;                   /* Size of the file map. */
+    app_pc base_hint;                   /* Address to request for an image with
+                                         * no preferred base, or NULL. */
 
     /* Static buffer sized to hold most headers in a single read.  A typical ELF
      * file has an ELF header followed by program headers.  On my workstation,
@@ -55,6 +55,10 @@
 #ifndef MAP_32BIT
 # define MAP_32BIT 0x40
 #endif
+/* in case MADV_HUGEPAGE is missing (added in 2.6.38) */
+#ifndef MADV_HUGEPAGE
+# define MADV_HUGEPAGE 14
+#endif
 /* for open */
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -3151,6 +3155,22 @@ os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit)
     return false;
 }
 
+/* We use transparent huge pages rather than MAP_HUGETLB as the latter needs
+ * the admin to set aside hugetlbfs pages and cannot be applied to part of our
+ * existing vmm reservation.  The kernel only uses a huge page for the aligned
+ * pieces of the region, and fails with EINVAL if THP is not configured.
+ */
+bool
+os_heap_advise_large_pages(void *p, size_t size)
+{
+    long res;
+    ASSERT(ALIGNED(p, PAGE_SIZE) && ALIGNED(size, PAGE_SIZE));
+    res = dynamorio_syscall(SYS_madvise, 3, p, size, MADV_HUGEPAGE);
+    LOG(GLOBAL, LOG_HEAP, 2, "os_heap_advise_large_pages: %d bytes @ "PFX" => %d\n",
+        size, p, res);
+    return res == 0;
+}
+
 /* Waits on the futex until woken if the kernel supports SYS_futex syscall
  * and the futex's value has not been changed from mustbe. Does not block
  * if the kernel doesn't support SYS_futex. Returns 0 if woken by another thread, 
@@ -3715,6 +3735,28 @@ os_files_same(const char *path1, const char *path2)
     return st1.st_ino == st2.st_ino;
 }
 
+/* Returns the device, inode, size, and modification time of a file, which
+ * together identify its contents well enough to validate data derived from it.
+ * Follows symlinks.
+ */
+bool
+os_get_file_identity(const char *file, uint64 *dev OUT, uint64 *ino OUT,
+                     uint64 *size OUT, uint64 *mtime OUT)
+{
+    /* _LARGEFILE64_SOURCE should make libc struct match kernel (see top of file) */
+    struct stat64 st;
+    ptr_int_t res = dynamorio_syscall(SYSNUM_STAT, 2, file, &st);
+    if (res != 0) {
+        LOG(THREAD_GET, LOG_SYSCALLS, 2, "%s failed: "PIFX"\n", __func__, res);
+        return false;
+    }
+    *dev = st.st_dev;
+    *ino = st.st_ino;
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
 bool
 os_get_file_size(const char *file, uint64 *size)
 {
@@ -3745,6 +3787,23 @@ os_get_file_size_by_handle(file_t fd, uint64 *size)
     return true;
 }
 
+bool
+os_set_file_size(file_t fd, uint64 size)
+{
+    ptr_int_t res;
+#ifdef X64
+    res = dynamorio_syscall(SYS_ftruncate, 2, fd, size);
+#else
+    /* the 64-bit length is passed as two halves */
+    res = dynamorio_syscall(SYS_ftruncate64, 3, fd, (uint)size, (uint)(size >> 32));
+#endif
+    if (res != 0) {
+        LOG(THREAD_GET, LOG_SYSCALLS, 2, "%s failed: "PIFX"\n", __func__, res);
+        return false;
+    }
+    return true;
+}
+
 /* created directory will be owned by effective uid,
  * Note a symbolic link will never be followed.
  */
@@ -4152,6 +4211,13 @@ os_unmap_file(byte *map, size_t size)
     return (res == 0);
 }
 
+bool
+os_flush_mapped_file(byte *map, size_t size)
+{
+    long res = dynamorio_syscall(SYS_msync, 3, map, size, MS_ASYNC);
+    return (res == 0);
+}
+
 /* around most of file, to exclude preload */
 #if !defined(NOT_DYNAMORIO_CORE_PROPER) || defined(STANDALONE_UNIT_TEST)
 
@@ -9699,12 +9765,31 @@ os_current_user_directory(char *directory_prefix /* INOUT */,
     return true;
 }
 
+/* Unlike on Windows, holding a handle does not prevent a directory from
+ * being renamed and replaced, so -validate_owner_file should be used to
+ * check each file once it is open.  We require that the file be owned by
+ * our effective uid and not writable by anyone else.  We allow group
+ * write access only for our own group, as os_open() and os_create_dir()
+ * grant it.
+ */
 bool
 os_validate_user_owned(file_t file_or_directory_handle)
 {
-    /* note on Linux this scheme should never be used */
-    ASSERT(false && "chown Alice evilfile");
-    return false;
+    struct stat64 st;
+    ptr_int_t res = dynamorio_syscall(SYSNUM_FSTAT, 2, file_or_directory_handle, &st);
+    if (res != 0) {
+        LOG(THREAD_GET, LOG_SYSCALLS, 2, "%s failed: "PIFX"\n", __func__, res);
+        return false;
+    }
+    if (st.st_uid != (uid_t) dynamorio_syscall(SYS_geteuid, 0) ||
+        TEST(S_IWOTH, st.st_mode) ||
+        (TEST(S_IWGRP, st.st_mode) &&
+         st.st_gid != (gid_t) dynamorio_syscall(SYS_getegid, 0))) {
+        LOG(THREAD_GET, LOG_SYSCALLS, 1, "%s: fd %d has owner %d:%d mode 0%o\n",
+            __func__, file_or_directory_handle, st.st_uid, st.st_gid, st.st_mode);
+        return false;
+    }
+    return true;
 }
 
 bool
@@ -309,6 +309,8 @@ sysnum_is_not_restartable(int sysnum);
 /***************************************************************************/
 
 /* in pcprofile.c */
+/* Upper bound on -prof_pcs_depth */
+#define PROF_PCS_MAX_DEPTH 32
 void pcprofile_fragment_deleted(dcontext_t *dcontext, fragment_t *f);
 void pcprofile_thread_exit(dcontext_t *dcontext);
 
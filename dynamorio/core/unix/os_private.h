@@ -157,6 +157,10 @@ mmap_syscall_succeeded(byte *retval);
 bool
 os_files_same(const char *path1, const char *path2);
 
+bool
+os_get_file_identity(const char *file, uint64 *dev OUT, uint64 *ino OUT,
+                     uint64 *size OUT, uint64 *mtime OUT);
+
 extern const reg_id_t syscall_regparms[MAX_SYSCALL_ARGS];
 
 file_t
@@ -245,6 +249,7 @@ set_clone_record_fields(void *record, reg_t app_thread_xsp, app_pc continuation_
 /* in pcprofile.c */
 void pcprofile_thread_init(dcontext_t *dcontext, bool shared_itimer, void *parent_info);
 void pcprofile_fork_init(dcontext_t *dcontext);
+bool pcprofile_handle_timer(dcontext_t *dcontext, void *value, priv_mcontext_t *mc);
 
 /* in module.c */
 bool is_elf_so_header(app_pc base, size_t size);
@@ -48,7 +48,10 @@
 # include "instrument.h"
 #endif
 #include "disassemble.h"
+#include "include/syscall.h"
 #include <sys/time.h> /* ITIMER_VIRTUAL */
+#include <time.h> /* struct itimerspec */
+#include <signal.h> /* SIGEV_* */
 
 /* Don't use symtab, it doesn't give us anything that addr2line or
  * other post-execution tools can't (it doesn't see into shared libraries),
@@ -81,12 +84,52 @@ typedef struct _pc_profile_entry_t {
     where_am_i_t    whereami:8;      /* location of pc */
     bool               trace:1;      /* if in fragment, is it a trace? */
     bool             retired:1;      /* owning fragment was deleted */
+    bool              shared:1;      /* if in fragment, is it FRAG_SHARED? */
     int                counter;      /* execution counter */
+    app_pc          xl8_pc;          /* -prof_pcs_folded: app pc for pc */
     struct _pc_profile_entry_t *next;  /* for chaining entries */
 } pc_profile_entry_t;
 
 #define HASH_BITS 14
 
+/* For -prof_pcs_folded we additionally count each distinct app callstack,
+ * keyed by its frames plus the DR location when the sample was not in app
+ * code.  Entries are fixed-size for the special heap.
+ */
+typedef struct _pc_stack_entry_t {
+    uint                      hash;
+    where_am_i_t              whereami;   /* WHERE_APP or WHERE_FCACHE for app code */
+    uint                    num_frames;
+    int                        counter;
+    struct _pc_stack_entry_t     *next;
+    app_pc frames[PROF_PCS_MAX_DEPTH+1]; /* leaf first: +1 for the sampled pc */
+} pc_stack_entry_t;
+
+#define STACK_HASH_BITS 12
+
+/* The kernel's struct sigevent.  We use SIGEV_THREAD_ID, which older libc
+ * headers do not expose.
+ */
+typedef struct _kernel_sigevent_t {
+    union {
+        int   sival_int;
+        void *sival_ptr;
+    } sigev_value;
+    int sigev_signo;
+    int sigev_notify;
+    union {
+        int pad[(64 - 2*sizeof(int) - sizeof(void *)) / sizeof(int)];
+        int tid;
+    } u;
+} kernel_sigevent_t;
+
+#ifndef SIGEV_THREAD_ID
+# define SIGEV_THREAD_ID 4
+#endif
+#ifndef CLOCK_THREAD_CPUTIME_ID
+# define CLOCK_THREAD_CPUTIME_ID 3
+#endif
+
 /* The timer and all data are per-thread */
 typedef struct _thread_pc_info_t {
     bool thread_shared;
@@ -94,6 +137,12 @@ typedef struct _thread_pc_info_t {
     void *special_heap;
     file_t file;
     int where[WHERE_LAST];
+    /* -prof_pcs_folded: each thread has its own cpu-time timer and data */
+    bool has_timer;
+    int timer_id;                   /* kernel timer_t */
+    pc_stack_entry_t **stack_table; /* STACK_HASH_BITS-bit addressed */
+    void *stack_heap;
+    file_t folded_file;
 } thread_pc_info_t;
 
 #define ALARM_FREQUENCY 10 /* milliseconds */
@@ -101,9 +150,68 @@ typedef struct _thread_pc_info_t {
 /* forward declarations for static functions */
 static pc_profile_entry_t *pcprofile_add_entry(thread_pc_info_t *info, void *pc, int whereami);
 static pc_profile_entry_t *pcprofile_lookup(thread_pc_info_t *info, void *pc);
+static bool pcprofile_shared_entry_valid(dcontext_t *dcontext, pc_profile_entry_t *entry);
 static void pcprofile_reset(thread_pc_info_t *info);
 static void pcprofile_results(thread_pc_info_t *info);
 static void pcprofile_alarm(dcontext_t *dcontext, priv_mcontext_t *mcontext);
+static void pcprofile_folded_results(thread_pc_info_t *info);
+
+/* Per-thread cpu-time sampling for -prof_pcs_folded.  With kernel-shared
+ * itimers (2.6.12+) ITIMER_VIRTUAL counts the whole process and its signal
+ * lands on whichever thread is running, so instead we give each thread a
+ * CLOCK_THREAD_CPUTIME_ID timer targeted at itself.  The timer raises
+ * SIGVTALRM, which we already intercept for -prof_pcs, with our info as the
+ * signal value so signal.c can tell it apart from the itimer.
+ */
+static bool
+pcprofile_start_timer(dcontext_t *dcontext, thread_pc_info_t *info)
+{
+    kernel_sigevent_t sev;
+    struct itimerspec spec;
+    int rc;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_value.sival_ptr = info;
+    sev.sigev_signo = SIGVTALRM;
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.u.tid = get_thread_id();
+    rc = (int) dynamorio_syscall(SYS_timer_create, 3, CLOCK_THREAD_CPUTIME_ID,
+                                 &sev, &info->timer_id);
+    if (rc != 0) {
+        LOG(THREAD, LOG_ALL, 1, "pcprofile: timer_create failed %d\n", rc);
+        SYSLOG_INTERNAL_WARNING_ONCE("-prof_pcs_folded unable to create timer");
+        return false;
+    }
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = ALARM_FREQUENCY * 1000 * 1000;
+    spec.it_value = spec.it_interval;
+    rc = (int) dynamorio_syscall(SYS_timer_settime, 4, info->timer_id, 0, &spec, NULL);
+    ASSERT(rc == 0);
+    info->has_timer = true;
+    return true;
+}
+
+static void
+pcprofile_stop_timer(thread_pc_info_t *info)
+{
+    if (info->has_timer) {
+        /* timer ids are process-wide so this works from another thread */
+        dynamorio_syscall(SYS_timer_delete, 1, info->timer_id);
+        info->has_timer = false;
+    }
+}
+
+/* Called for a SIGVTALRM: returns whether it came from this thread's
+ * -prof_pcs_folded timer, in which case the sample has been recorded.
+ */
+bool
+pcprofile_handle_timer(dcontext_t *dcontext, void *value, priv_mcontext_t *mc)
+{
+    thread_pc_info_t *info = (thread_pc_info_t *) dcontext->pcprofile_field;
+    if (info == NULL || !info->has_timer || value != (void *) info)
+        return false;
+    pcprofile_alarm(dcontext, mc);
+    return true;
+}
 
 /* initialization */
 void
@@ -113,7 +221,7 @@ pcprofile_thread_init(dcontext_t *dcontext, bool shared_itimer, void *parent_inf
     int size = HASHTABLE_SIZE(HASH_BITS) * sizeof(pc_profile_entry_t*);
     thread_pc_info_t *info;
 
-    if (shared_itimer) {
+    if (shared_itimer && !INTERNAL_OPTION(prof_pcs_folded)) {
         /* Linux kernel 2.6.12+ shares itimers across all threads.  We thus
          * share the same data and assume we don't need any synch on these
          * data structs or the file since only one timer fires at a time
@@ -129,7 +237,7 @@ pcprofile_thread_init(dcontext_t *dcontext, bool shared_itimer, void *parent_inf
     info = global_heap_alloc(sizeof(thread_pc_info_t) HEAPACCT(ACCT_OTHER));
     dcontext->pcprofile_field = (void *) info;
     memset(info, 0, sizeof(thread_pc_info_t));
-    info->thread_shared = shared_itimer;
+    info->thread_shared = shared_itimer && !INTERNAL_OPTION(prof_pcs_folded);
 
     info->htable = (pc_profile_entry_t**) global_heap_alloc(size HEAPACCT(ACCT_OTHER));
     memset(info->htable, 0, size);
@@ -147,7 +255,18 @@ pcprofile_thread_init(dcontext_t *dcontext, bool shared_itimer, void *parent_inf
                                            false /* no locks */,
                                            false /* -x */, true /* persistent */);
 
-    set_itimer_callback(dcontext, ITIMER_VIRTUAL, ALARM_FREQUENCY, pcprofile_alarm, NULL);
+    if (INTERNAL_OPTION(prof_pcs_folded)) {
+        size = HASHTABLE_SIZE(STACK_HASH_BITS) * sizeof(pc_stack_entry_t*);
+        info->stack_table = (pc_stack_entry_t**)
+            global_heap_alloc(size HEAPACCT(ACCT_OTHER));
+        memset(info->stack_table, 0, size);
+        info->stack_heap = special_heap_init(sizeof(pc_stack_entry_t),
+                                             false /* no locks */,
+                                             false /* -x */, true /* persistent */);
+        info->folded_file = open_log_file("pcfolded", NULL, 0);
+        pcprofile_start_timer(dcontext, info);
+    } else
+        set_itimer_callback(dcontext, ITIMER_VIRTUAL, ALARM_FREQUENCY, pcprofile_alarm, NULL);
 }
 
 /* cleanup: only called for thread-shared itimer for last thread in group */
@@ -156,17 +275,32 @@ pcprofile_thread_exit(dcontext_t *dcontext)
 {
     int size;
     thread_pc_info_t *info = (thread_pc_info_t *) dcontext->pcprofile_field;
+    /* release-build process exit walks every thread before the full
+     * thread exit path, so we can be called twice
+     */
+    if (info == NULL)
+        return;
     /* don't want any alarms while holding lock for printing results
      * (see notes under pcprofile_cache_flush below)
      */
-    set_itimer_callback(dcontext, ITIMER_VIRTUAL, 0, NULL, NULL);
+    if (INTERNAL_OPTION(prof_pcs_folded))
+        pcprofile_stop_timer(info);
+    else
+        set_itimer_callback(dcontext, ITIMER_VIRTUAL, 0, NULL, NULL);
+    dcontext->pcprofile_field = NULL;
 
     pcprofile_results(info);
+    if (INTERNAL_OPTION(prof_pcs_folded))
+        pcprofile_folded_results(info);
     size = HASHTABLE_SIZE(HASH_BITS) * sizeof(pc_profile_entry_t*);
     pcprofile_reset(info); /* special heap so no fast path */
 #ifdef DEBUG
     /* for non-debug we do fast exit path and don't free local heap */
     global_heap_free(info->htable, size HEAPACCT(ACCT_OTHER));
+    if (info->stack_table != NULL) {
+        global_heap_free(info->stack_table, HASHTABLE_SIZE(STACK_HASH_BITS) *
+                         sizeof(pc_stack_entry_t*) HEAPACCT(ACCT_OTHER));
+    }
 #endif
 #if USE_SYMTAB
     if (valid_symtab)
@@ -174,6 +308,10 @@ pcprofile_thread_exit(dcontext_t *dcontext)
 #endif
     close_log_file(info->file);
     special_heap_exit(info->special_heap);
+    if (info->stack_heap != NULL) {
+        close_log_file(info->folded_file);
+        special_heap_exit(info->stack_heap);
+    }
 #ifdef DEBUG
     /* for non-debug we do fast exit path and don't free local heap */
     global_heap_free(info, sizeof(thread_pc_info_t) HEAPACCT(ACCT_OTHER));
@@ -190,7 +328,13 @@ pcprofile_fork_init(dcontext_t *dcontext)
     info->thread_shared = false;
     pcprofile_reset(info);
     info->file = open_log_file("pcsamples", NULL, 0);
-    set_itimer_callback(dcontext, ITIMER_VIRTUAL, ALARM_FREQUENCY, pcprofile_alarm, NULL);
+    if (INTERNAL_OPTION(prof_pcs_folded)) {
+        /* the parent's timer does not exist in the child */
+        info->has_timer = false;
+        info->folded_file = open_log_file("pcfolded", NULL, 0);
+        pcprofile_start_timer(dcontext, info);
+    } else
+        set_itimer_callback(dcontext, ITIMER_VIRTUAL, ALARM_FREQUENCY, pcprofile_alarm, NULL);
 }
 
 #if 0
@@ -218,6 +362,89 @@ pcprof_dump_callstack(dcontext_t *dcontext, app_pc cur_pc, app_pc ebp, file_t ou
 }
 #endif
 
+/* Walks the app frame pointer chain from xbp, storing up to max return
+ * addresses into frames.  Reads are fault-safe since xbp may not be a frame
+ * pointer at all.
+ */
+static uint
+pcprofile_walk_app_stack(reg_t xbp, app_pc *frames, uint max)
+{
+    uint num = 0;
+    app_pc fp = (app_pc) xbp;
+    while (num < max && fp != NULL && !is_dynamo_address(fp)) {
+        app_pc frame[2]; /* saved xbp, return address */
+        if (!safe_read(fp, sizeof(frame), frame) || frame[1] == NULL)
+            break;
+        frames[num++] = frame[1];
+        /* the stack grows down so callers' frames must be higher */
+        if (frame[0] <= fp)
+            break;
+        fp = frame[0];
+    }
+    return num;
+}
+
+/* Adds one sample to the callstack table.  The leaf is the translated app pc
+ * for code cache and native samples; for samples in DR itself it is the app
+ * pc DR is working on, with the DR location recorded separately, so that
+ * dispatch, ibl, and block building overhead show up under the app code that
+ * incurred it.
+ */
+static void
+pcprofile_record_stack(dcontext_t *dcontext, thread_pc_info_t *info,
+                       pc_profile_entry_t *entry, priv_mcontext_t *mcontext)
+{
+    app_pc frames[PROF_PCS_MAX_DEPTH+1];
+    uint num = 0, hash = 0, i;
+    uint hindex;
+    reg_t xbp;
+    where_am_i_t where = entry->whereami;
+    pc_stack_entry_t *e;
+
+    if (where == WHERE_FCACHE || where == WHERE_APP) {
+        if (entry->xl8_pc != NULL)
+            frames[num++] = entry->xl8_pc;
+        xbp = mcontext->xbp;
+    } else {
+        /* In DR code or generated code: take the app state from the mcontext
+         * saved on cache exit.  Generated code (ibl, context switch) runs
+         * on the app stack, so its frame pointer is still the app's.
+         */
+        if (where == WHERE_IBL || where == WHERE_CONTEXT_SWITCH ||
+            where == WHERE_UNKNOWN)
+            xbp = mcontext->xbp;
+        else {
+            xbp = get_mcontext(dcontext)->xbp;
+            if (dcontext->next_tag != NULL && !is_dynamo_address(dcontext->next_tag) &&
+                !in_fcache(dcontext->next_tag))
+                frames[num++] = dcontext->next_tag;
+        }
+    }
+    num += pcprofile_walk_app_stack(xbp, &frames[num],
+                                    INTERNAL_OPTION(prof_pcs_depth));
+
+    for (i = 0; i < num; i++)
+        hash = hash * 31 + (uint)(ptr_uint_t) frames[i];
+    hash = hash * 31 + where;
+    hindex = HASH_FUNC_BITS((ptr_uint_t)hash, STACK_HASH_BITS);
+    for (e = info->stack_table[hindex]; e != NULL; e = e->next) {
+        if (e->hash == hash && e->whereami == where && e->num_frames == num &&
+            memcmp(e->frames, frames, num * sizeof(app_pc)) == 0) {
+            e->counter++;
+            return;
+        }
+    }
+    /* as with pc entries, special_heap routines do not use any locks */
+    e = (pc_stack_entry_t *) special_heap_alloc(info->stack_heap);
+    e->hash = hash;
+    e->whereami = where;
+    e->num_frames = num;
+    e->counter = 1;
+    memcpy(e->frames, frames, num * sizeof(app_pc));
+    e->next = info->stack_table[hindex];
+    info->stack_table[hindex] = e;
+}
+
 /* Handle a pc sample
  *
  * WARNING: this function could interrupt any part of dynamo!
@@ -236,6 +463,12 @@ pcprofile_alarm(dcontext_t *dcontext, priv_mcontext_t *mcontext)
     void *pc = (void *) mcontext->pc;
 
     entry = pcprofile_lookup(info, pc);
+    if (entry != NULL && entry->shared && dcontext->whereami == WHERE_FCACHE &&
+        !pcprofile_shared_entry_valid(dcontext, entry)) {
+        /* another thread deleted the fragment and the pc now holds new code */
+        entry->retired = true;
+        entry = NULL;
+    }
 
 #if 0
 # ifdef DEBUG
@@ -284,12 +517,45 @@ pcprofile_alarm(dcontext_t *dcontext, priv_mcontext_t *mcontext)
                 ASSERT(CHECK_TRUNCATE_TYPE_int((byte *)pc - fragment->start_pc));
                 entry->offset = (int) ((byte *)pc - fragment->start_pc);
                 entry->trace = (fragment->flags & FRAG_IS_TRACE) != 0;
+                /* only the deleting thread's table sees a shared fragment's
+                 * deletion, so other threads' tables must check for reuse
+                 */
+                entry->shared = !info->thread_shared &&
+                    TEST(FRAG_SHARED, fragment->flags);
+                if (INTERNAL_OPTION(prof_pcs_folded)) {
+                    /* Done once per cache pc, from the fragment's translation
+                     * info when it has it.  We're in the cache, so holding no
+                     * DR locks, just as for translating an app signal.
+                     */
+                    entry->xl8_pc = recreate_app_pc(dcontext, (cache_pc)pc, fragment);
+                    if (entry->xl8_pc == NULL)
+                        entry->xl8_pc = fragment->tag;
+                }
             }
-        }
+        } else if (entry->whereami == WHERE_APP)
+            entry->xl8_pc = (app_pc) pc;
     }
 
     /* update whereami counters */
     info->where[entry->whereami]++;
+
+    if (INTERNAL_OPTION(prof_pcs_folded))
+        pcprofile_record_stack(dcontext, info, entry, mcontext);
+}
+
+/* Whether entry, for a shared fragment, still describes the code at its pc.
+ * Other threads' deletions of shared fragments do not retire the entries in
+ * our table, so we check on each sample that the pc still belongs to the
+ * same fragment before using its tag, offset, or cached translation.
+ */
+static bool
+pcprofile_shared_entry_valid(dcontext_t *dcontext, pc_profile_entry_t *entry)
+{
+    fragment_t wrapper;
+    fragment_t *f = fragment_pclookup(dcontext, (cache_pc) entry->pc, &wrapper);
+    return (f != NULL && f->tag == entry->tag &&
+            (byte *)entry->pc - f->start_pc == entry->offset &&
+            TEST(FRAG_IS_TRACE, f->flags) == entry->trace);
 }
 
 /* create a new, initialized profile pc entry */
@@ -312,6 +578,8 @@ pcprofile_add_entry(thread_pc_info_t *info, void *pc, int whereami)
     e->offset = 0;
     e->trace = false;
     e->retired = false;
+    e->shared = false;
+    e->xl8_pc = NULL;
 
     /* add e to the htable */
     hindex = HASH_FUNC_BITS((ptr_uint_t)pc, HASH_BITS);
@@ -354,6 +622,9 @@ pcprofile_fragment_deleted(dcontext_t *dcontext, fragment_t *f)
         return;
     }
     info = (thread_pc_info_t *) dcontext->pcprofile_field;
+    /* release-build process exit frees our info before fragment_exit() */
+    if (info == NULL)
+        return;
     for (i = 0; i < HASHTABLE_SIZE(HASH_BITS); i++) {
         for (e = info->htable[i]; e; e = e->next) {
             if (e->tag == f->tag) {
@@ -403,6 +674,17 @@ pcprofile_reset(thread_pc_info_t *info)
     }
     for (i = 0; i < WHERE_LAST; i++)
         info->where[i] = 0;
+    if (info->stack_table != NULL) {
+        for (i = 0; i < HASHTABLE_SIZE(STACK_HASH_BITS); i++) {
+            pc_stack_entry_t *e = info->stack_table[i];
+            while (e) {
+                pc_stack_entry_t *nexte = e->next;
+                special_heap_free(info->stack_heap, e);
+                e = nexte;
+            }
+            info->stack_table[i] = NULL;
+        }
+    }
 }
 
 /* Print the profile results 
@@ -585,3 +867,58 @@ pcprofile_results(thread_pc_info_t *info)
         }
     }    
 }
+
+static const char *
+pcprofile_where_name(where_am_i_t where)
+{
+    switch (where) {
+    case WHERE_INTERP:          return "[DR interpreter]";
+    case WHERE_DISPATCH:        return "[DR dispatch]";
+    case WHERE_MONITOR:         return "[DR monitor]";
+    case WHERE_SYSCALL_HANDLER: return "[DR syscall handler]";
+    case WHERE_SIGNAL_HANDLER:  return "[DR signal handler]";
+    case WHERE_TRAMPOLINE:      return "[DR trampoline]";
+    case WHERE_CONTEXT_SWITCH:  return "[DR context switch]";
+    case WHERE_IBL:             return "[DR indirect branch lookup]";
+    default:                    return "[DR unknown]";
+    }
+}
+
+static void
+pcprofile_print_frame(file_t f, app_pc pc)
+{
+    char name[MAXIMUM_PATH];
+    app_pc base = get_module_base(pc);
+    if (base != NULL && os_get_module_name_buf(pc, name, BUFFER_SIZE_ELEMENTS(name)) > 0)
+        print_file(f, "%s+"PIFX, name, pc - base);
+    else
+        print_file(f, PFX, pc);
+}
+
+/* Prints the -prof_pcs_folded callstacks in the folded format that flame
+ * graph and pprof tooling consume: one line per distinct stack with the
+ * frames root first, separated by ';', followed by the sample count.
+ * App frames are module+offset for offline symbolization.
+ */
+static void
+pcprofile_folded_results(thread_pc_info_t *info)
+{
+    int i;
+    uint j;
+    pc_stack_entry_t *e;
+    for (i = 0; i < HASHTABLE_SIZE(STACK_HASH_BITS); i++) {
+        for (e = info->stack_table[i]; e != NULL; e = e->next) {
+            for (j = e->num_frames; j > 0; j--) {
+                if (j < e->num_frames)
+                    print_file(info->folded_file, ";");
+                pcprofile_print_frame(info->folded_file, e->frames[j-1]);
+            }
+            if (e->whereami != WHERE_APP && e->whereami != WHERE_FCACHE) {
+                print_file(info->folded_file, "%s%s", e->num_frames > 0 ? ";" : "",
+                           pcprofile_where_name(e->whereami));
+            } else if (e->num_frames == 0)
+                print_file(info->folded_file, "[unknown]");
+            print_file(info->folded_file, " %d\n", e->counter);
+        }
+    }
+}
@@ -676,6 +676,9 @@ execute_default_from_dispatch(dcontext_t *dcontext, int sig, sigframe_rt_t *fram
 static bool
 handle_alarm(dcontext_t *dcontext, int sig, kernel_ucontext_t *ucxt);
 
+static bool
+handle_pcprofile_timer(dcontext_t *dcontext, siginfo_t *siginfo, kernel_ucontext_t *ucxt);
+
 static bool
 handle_suspend_signal(dcontext_t *dcontext, kernel_ucontext_t *ucxt);
 
@@ -1690,8 +1693,12 @@ signal_thread_exit(dcontext_t *dcontext, bool other_thread)
         (*info->shared_itimer_refcount)--;
         release_recursive_lock(info->shared_itimer_lock);
     }
+    if (INTERNAL_OPTION(prof_pcs_folded)) {
+        /* each thread has its own timer and data */
+        pcprofile_thread_exit(dcontext);
+    }
     if (!info->shared_itimer || *info->shared_itimer_refcount == 0) {
-        if (INTERNAL_OPTION(profile_pcs)) {
+        if (INTERNAL_OPTION(profile_pcs) && !INTERNAL_OPTION(prof_pcs_folded)) {
             /* no cleanup needed for non-final thread in group */
             pcprofile_thread_exit(dcontext);
         }
@@ -4846,6 +4853,10 @@ master_signal_handler_C(byte *xsp)
     case SIGALRM:
     case SIGVTALRM:
     case SIGPROF:
+        /* -prof_pcs_folded's per-thread timers bypass the itimer emulation */
+        if (sig == SIGVTALRM && INTERNAL_OPTION(prof_pcs_folded) &&
+            handle_pcprofile_timer(dcontext, siginfo, ucxt))
+            break;
         if (handle_alarm(dcontext, sig, ucxt))
             record_pending_signal(dcontext, sig, ucxt, frame, false _IF_CLIENT(NULL));
         /* else, don't deliver to app */
@@ -6190,6 +6201,27 @@ handle_alarm(dcontext_t *dcontext, int sig, kernel_ucontext_t *ucxt)
     return pass_to_app;
 }
 
+/* Returns whether this SIGVTALRM came from a -prof_pcs_folded sampling timer
+ * rather than the itimer, in which case it is never for the app.
+ */
+static bool
+handle_pcprofile_timer(dcontext_t *dcontext, siginfo_t *siginfo, kernel_ucontext_t *ucxt)
+{
+    struct sigcontext *sc = (struct sigcontext *) &(ucxt->uc_mcontext);
+    dr_mcontext_t dmc;
+    priv_mcontext_t *mc;
+    if (siginfo->si_code != SI_TIMER)
+        return false;
+    /* i#471: suppress alarms coming in after exit */
+    if (dynamo_exited)
+        return true;
+    /* we save stack space by allocating superset dr_mcontext_t, as handle_alarm does */
+    dr_mcontext_init(&dmc);
+    mc = dr_mcontext_as_priv_mcontext(&dmc);
+    sigcontext_to_mcontext(mc, sc);
+    return pcprofile_handle_timer(dcontext, siginfo->si_value.sival_ptr, mc);
+}
+
 /* Starts itimer if stopped, or increases refcount of existing itimer if already
  * started.  It is *not* safe to call this more than once for the same thread,
  * since it will inflate the refcount and prevent cleanup.
@@ -2868,6 +2868,77 @@ get_unique_logfile(const char *file_type, char *filename_buffer, uint maxlen,
     return success;
 }
 
+#ifdef UNIX
+/* Export files publish live values for external viewers (-stats_export_dir,
+ * -kstats_export_dir).  Creates path, replacing a stale file left by an
+ * earlier process with our pid, fills it from contents if non-NULL and else
+ * with zeroes, and maps it shared and writable: at addr, replacing an
+ * existing mapping of ours, if addr is non-NULL.  Returns the mapping or NULL.
+ */
+byte *
+map_export_file(const char *path, const void *contents, byte *addr, size_t size)
+{
+    bool ok;
+    file_t f;
+    byte *map = NULL;
+    char zero = 0;
+    os_delete_file(path);
+    f = os_open(path, OS_OPEN_READ|OS_OPEN_WRITE|OS_OPEN_REQUIRE_NEW);
+    if (f == INVALID_FILE) {
+        SYSLOG_INTERNAL_WARNING("Cannot create export file %s", path);
+        return NULL;
+    }
+    if (contents != NULL)
+        ok = (os_write(f, contents, size) == (ssize_t) size);
+    else
+        ok = (os_seek(f, size - 1, OS_SEEK_SET) && os_write(f, &zero, 1) == 1);
+    if (ok) {
+        if (addr == NULL) {
+            map = map_file(f, &size, 0, NULL, MEMPROT_READ|MEMPROT_WRITE,
+                           0/*shared*/);
+        } else {
+            /* replacing our existing mapping, so dynamo_areas need no update */
+            map = os_map_file(f, &size, 0, addr, MEMPROT_READ|MEMPROT_WRITE,
+                              MAP_FILE_FIXED);
+        }
+    }
+    os_close(f);
+    if (map == NULL)
+        os_delete_file(path);
+    return map;
+}
+
+/* The child of a fork must not write to its parent's export file.  Moves the
+ * mapping at map to a new file at path holding the same contents, at the same
+ * address so that pointers into it stay valid.  If that fails the mapping
+ * becomes private memory and path is emptied.
+ */
+void
+fork_export_file(char *path, byte *map, size_t size)
+{
+    if (map_export_file(path, map, map, size) != map) {
+        byte *copy = global_heap_alloc(size HEAPACCT(ACCT_STATS));
+        size_t map_size = size;
+        memcpy(copy, map, size);
+        map = os_map_file(-1, &map_size, 0, map, MEMPROT_READ|MEMPROT_WRITE,
+                          MAP_FILE_FIXED|MAP_FILE_COPY_ON_WRITE);
+        ASSERT(map != NULL);
+        memcpy(map, copy, size);
+        global_heap_free(copy, size HEAPACCT(ACCT_STATS));
+        path[0] = '\0';
+    }
+}
+
+/* The process is going away: no update of dynamo_areas, which may be gone */
+void
+unmap_export_file(const char *path, byte *map, size_t size)
+{
+    os_unmap_file(map, size);
+    if (path[0] != '\0')
+        os_delete_file(path);
+}
+#endif /* UNIX */
+
 const char*
 get_app_name_for_path()
 {
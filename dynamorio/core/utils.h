@@ -449,6 +449,8 @@ enum {
     LOCK_RANK(aslr_areas), /* < dynamo_areas < global_alloc_lock */
     LOCK_RANK(aslr_pad_areas), /* < dynamo_areas < global_alloc_lock */
     LOCK_RANK(native_exec_areas), /* < dynamo_areas < global_alloc_lock */
+    LOCK_RANK(vmvector_snapshot_lock), /* > executable_areas, > native_exec_areas,
+                                        * > shared_delete_lock, < global_alloc_lock */
     LOCK_RANK(thread_vm_areas), /* currently never used */
 
     LOCK_RANK(app_pc_table_rwlock), /* > after_call_lock, > rct_module_lock,
@@ -487,6 +489,8 @@ enum {
 #ifdef WINDOWS
     LOCK_RANK(alt_tls_lock),
 #endif
+    LOCK_RANK(pending_traces_lock), /* > thread_initexit_lock */
+    LOCK_RANK(tracedump_queue_lock), /* > tracedump_mutex */
     /* ADD HERE a lock around section that may allocate memory */
 
     /* N.B.: the order of allunits < global_alloc < heap_unit is relied on
@@ -557,6 +561,8 @@ enum {
 #endif
 
     LOCK_RANK(prng_lock),
+    LOCK_RANK(stack_pool_lock), /* leaf: no allocation while held */
+    LOCK_RANK(dcontext_pool_lock), /* leaf: no allocation while held */
     /* ---------------------------------------------------------- */
     /* No new locks below this line, reserved for innermost ASSERT,
      * SYSLOG and STATS facilities */
@@ -1185,6 +1191,12 @@ void close_log_file(file_t f);
 
 file_t get_thread_private_logfile(void);
 bool get_unique_logfile(const char *file_type, char *filename_buffer, uint maxlen, bool open_directory, file_t *file);
+#ifdef UNIX
+/* shared files for external viewers: see utils.c */
+byte *map_export_file(const char *path, const void *contents, byte *addr, size_t size);
+void fork_export_file(char *path, byte *map, size_t size);
+void unmap_export_file(const char *path, byte *map, size_t size);
+#endif
 const char *get_app_name_for_path(void);
 const char *get_short_name(const char *exename);
 
@@ -1561,6 +1573,7 @@ enum {LONGJMP_EXCEPTION = 1};
 #define RSTATS_ADD XSTATS_ADD
 #define RSTATS_SUB XSTATS_SUB
 #define RSTATS_ADD_PEAK XSTATS_ADD_PEAK
+#define RSTATS_TRACK_MAX XSTATS_TRACK_MAX
 
 #if defined(DEBUG) && defined(INTERNAL)
 #   define DODEBUGINT DODEBUG
@@ -819,6 +819,138 @@ writelock_if_not_already(vm_area_vector_t *v)
     return false;
 }
 
+/* VECTOR_SNAPSHOT support.  After every change a writer copies the areas
+ * into a fresh snapshot and swaps it in, so readers can search whichever
+ * snapshot they see without the lock.  A replaced snapshot may still be in
+ * use by a reader, so it is retired with the current flushtime_global and
+ * only freed once a later flush has been acknowledged by every thread at a
+ * shared deletion synch point (vm_area_check_shared_pending()): no thread
+ * can be in the middle of a lookup at such a point.
+ */
+typedef struct _vmvector_snapshot_area_t {
+    app_pc start;
+    app_pc end;
+    void *data;
+} vmvector_snapshot_area_t;
+
+typedef struct _vmvector_snapshot_t {
+    int length;
+    uint flushtime; /* flushtime_global when retired */
+    struct _vmvector_snapshot_t *next_retired;
+    vmvector_snapshot_area_t areas[1]; /* really length entries */
+} vmvector_snapshot_t;
+
+#define VMVECTOR_SNAPSHOT_SIZE(len) \
+    (offsetof(vmvector_snapshot_t, areas) + (len) * sizeof(vmvector_snapshot_area_t))
+
+/* Readers that don't hold the write lock use the snapshot: a writer must see
+ * its own in-progress changes.
+ */
+#define USE_VECTOR_SNAPSHOT(v) \
+    (TEST(VECTOR_SNAPSHOT, (v)->flags) && SHOULD_LOCK_VECTOR(v))
+
+/* Retired snapshots, newest first, so flushtimes are non-increasing */
+DECLARE_CXTSWPROT_VAR(static vmvector_snapshot_t *retired_snapshots, NULL);
+DECLARE_CXTSWPROT_VAR(static mutex_t vmvector_snapshot_lock,
+                      INIT_LOCK_FREE(vmvector_snapshot_lock));
+
+/* Assumes caller holds v->lock, if necessary.
+ * Publishes a copy of v's current areas.
+ */
+static void
+vmvector_snapshot_update(vm_area_vector_t *v)
+{
+    vmvector_snapshot_t *old = v->snapshot;
+    vmvector_snapshot_t *snap = NULL;
+    int i;
+    if (!TEST(VECTOR_SNAPSHOT, v->flags))
+        return;
+    ASSERT_VMAREA_VECTOR_PROTECTED(v, WRITE);
+    if (v->length > 0) {
+        snap = (vmvector_snapshot_t *)
+            global_heap_alloc(VMVECTOR_SNAPSHOT_SIZE(v->length) HEAPACCT(ACCT_VMAREAS));
+        snap->length = v->length;
+        snap->flushtime = 0;
+        snap->next_retired = NULL;
+        for (i = 0; i < v->length; i++) {
+            snap->areas[i].start = v->buf[i].start;
+            snap->areas[i].end = v->buf[i].end;
+            snap->areas[i].data = v->buf[i].custom.client;
+        }
+    }
+    /* the xchg orders the copy before the pointer becomes visible, and the
+     * flushtime read below after it
+     */
+    ATOMIC_ADDR_WRITE(&v->snapshot, snap, false);
+    STATS_INC(vmvector_snapshots_published);
+    if (old != NULL) {
+        mutex_lock(&vmvector_snapshot_lock);
+        /* A reader that still has old finishes its lookup before its next
+         * synch point, so any flush whose increment comes after this read
+         * covers it.  Reading under the lock keeps the list sorted.
+         */
+        old->flushtime = flushtime_global;
+        old->next_retired = retired_snapshots;
+        retired_snapshots = old;
+        mutex_unlock(&vmvector_snapshot_lock);
+    }
+}
+
+/* Frees all retired snapshots retired before flushtime.  Caller must
+ * guarantee that every thread has passed a synch point since flushtime
+ * was reached.
+ */
+static void
+vmvector_snapshot_reclaim(uint flushtime)
+{
+    vmvector_snapshot_t *snap, *next, *tofree = NULL;
+    vmvector_snapshot_t **prev;
+    mutex_lock(&vmvector_snapshot_lock);
+    for (prev = &retired_snapshots; *prev != NULL; prev = &(*prev)->next_retired) {
+        if ((*prev)->flushtime < flushtime) {
+            /* all older entries qualify as well */
+            tofree = *prev;
+            *prev = NULL;
+            break;
+        }
+    }
+    mutex_unlock(&vmvector_snapshot_lock);
+    for (snap = tofree; snap != NULL; snap = next) {
+        next = snap->next_retired;
+        global_heap_free(snap, VMVECTOR_SNAPSHOT_SIZE(snap->length)
+                         HEAPACCT(ACCT_VMAREAS));
+        STATS_INC(vmvector_snapshots_freed);
+    }
+}
+
+/* Lock-free counterpart of binary_search() over a snapshot (which may be NULL).
+ * If index != NULL, sets it as binary_search() does.
+ */
+static bool
+vmvector_snapshot_search(vmvector_snapshot_t *snap, app_pc start, app_pc end,
+                         int *index/*OUT*/)
+{
+    int min = 0;
+    int max = (snap == NULL) ? -1 : snap->length - 1;
+    ASSERT(start < end || end == NULL /* wraparound */);
+    STATS_INC(vmvector_snapshot_lookups);
+    while (max >= min) {
+        int i = (min + max) / 2;
+        if (end != NULL && end <= snap->areas[i].start)
+            max = i - 1;
+        else if (start >= snap->areas[i].end)
+            min = i + 1;
+        else {
+            if (index != NULL)
+                *index = i;
+            return true;
+        }
+    }
+    if (index != NULL)
+        *index = max;
+    return false;
+}
+
 static void
 vm_area_vector_check_size(vm_area_vector_t *v)
 {
@@ -1223,6 +1355,7 @@ add_vm_area(vm_area_vector_t *v, app_pc start, app_pc end,
             vm_area_clean_fraglist(dcontext, &v->buf[i]);
         }
     }
+    vmvector_snapshot_update(v);
     DOLOG(5, LOG_VMAREAS, { print_vm_areas(v, GLOBAL); });
 }
 
@@ -1429,10 +1562,12 @@ remove_vm_area(vm_area_vector_t *v, app_pc start, app_pc end, bool restore_prot)
         if (v->split_payload_func != NULL) {
             new_area.custom.client = v->split_payload_func(new_area.custom.client);
         } /* else, just keep the copy */
+        /* publishes the snapshot */
         add_vm_area(v, new_area.start, new_area.end, new_area.vm_flags,
                     new_area.frag_flags, new_area.custom.client
                     _IF_DEBUG(new_area.comment));
-    }
+    } else
+        vmvector_snapshot_update(v);
     DOLOG(5, LOG_VMAREAS, { print_vm_areas(v, GLOBAL); });
     return true;
 }
@@ -1557,7 +1692,8 @@ vm_areas_init()
      * We're already paying the indirection cost by passing their addresses
      * to generic routines, after all.
      */
-    VMVECTOR_ALLOC_VECTOR(executable_areas, GLOBAL_DCONTEXT, VECTOR_SHARED,
+    VMVECTOR_ALLOC_VECTOR(executable_areas, GLOBAL_DCONTEXT,
+                          VECTOR_SHARED | VMVECTOR_SNAPSHOT_FLAG(),
                           executable_areas);
     VMVECTOR_ALLOC_VECTOR(pretend_writable_areas, GLOBAL_DCONTEXT, VECTOR_SHARED,
                           pretend_writable_areas);
@@ -1667,6 +1803,11 @@ vm_areas_exit()
     vm_areas_exited = true;
     vm_areas_statistics();
 
+    /* no readers remain; the vectors free their current snapshots */
+    vmvector_snapshot_reclaim(flushtime_global+1);
+    ASSERT(retired_snapshots == NULL);
+    DELETE_LOCK(vmvector_snapshot_lock);
+
     if (DYNAMO_OPTION(thin_client)) {
         vmvector_delete_vector(GLOBAL_DCONTEXT, dynamo_areas);
         dynamo_areas = NULL;
@@ -1868,6 +2009,7 @@ vmvector_add_replace(vm_area_vector_t *v, app_pc start, app_pc end, void *data)
     if (overlap && start == area->start && end == area->end) {
         old_data = area->custom.client;
         area->custom.client = data;
+        vmvector_snapshot_update(v);
     } else
         add_vm_area(v, start, end, 0, 0, data _IF_DEBUG(""));
     UNLOCK_VECTOR(v, release_lock, write);
@@ -1923,6 +2065,8 @@ vmvector_overlap(vm_area_vector_t *v, app_pc start, app_pc end)
     bool release_lock; /* 'true' means this routine needs to unlock */
     if (vmvector_empty(v))
         return false;
+    if (USE_VECTOR_SNAPSHOT(v))
+        return vmvector_snapshot_search(v->snapshot, start, end, NULL);
     LOCK_VECTOR(v, release_lock, read);
     ASSERT_OWN_READWRITE_LOCK(SHOULD_LOCK_VECTOR(v), &v->lock);
     overlap = vm_area_overlap(v, start, end);
@@ -1954,7 +2098,22 @@ vmvector_lookup_data(vm_area_vector_t *v, app_pc pc,
     bool overlap;
     vm_area_t *area = NULL;
     bool release_lock; /* 'true' means this routine needs to unlock */
-    
+
+    if (USE_VECTOR_SNAPSHOT(v)) {
+        /* read v->snapshot once: a writer may replace it at any time */
+        vmvector_snapshot_t *snap = v->snapshot;
+        int i;
+        overlap = vmvector_snapshot_search(snap, pc, pc+1, &i);
+        if (overlap) {
+            if (start != NULL)
+                *start = snap->areas[i].start;
+            if (end != NULL)
+                *end = snap->areas[i].end;
+            if (data != NULL)
+                *data = snap->areas[i].data;
+        }
+        return overlap;
+    }
     LOCK_VECTOR(v, release_lock, read);
     ASSERT_OWN_READWRITE_LOCK(SHOULD_LOCK_VECTOR(v), &v->lock);
     overlap = lookup_addr(v, pc, &area);
@@ -1983,7 +2142,20 @@ vmvector_lookup_prev_next(vm_area_vector_t *v, app_pc pc,
     bool success;
     int index;
     bool release_lock; /* 'true' means this routine needs to unlock */
-    
+
+    if (USE_VECTOR_SNAPSHOT(v)) {
+        vmvector_snapshot_t *snap = v->snapshot;
+        success = !vmvector_snapshot_search(snap, pc, pc+1, &index);
+        if (success) {
+            if (prev != NULL)
+                *prev = (index == -1) ? NULL : snap->areas[index].start;
+            if (next != NULL) {
+                *next = (snap == NULL || index >= snap->length - 1) ?
+                    (app_pc) POINTER_MAX : snap->areas[index+1].start;
+            }
+        }
+        return success;
+    }
     LOCK_VECTOR(v, release_lock, read);
     ASSERT_OWN_READWRITE_LOCK(SHOULD_LOCK_VECTOR(v), &v->lock);
     success = !binary_search(v, pc, pc+1, NULL, &index, false);
@@ -2019,8 +2191,10 @@ vmvector_modify_data(vm_area_vector_t *v, app_pc start, app_pc end, void *data)
     LOCK_VECTOR(v, release_lock, write);
     ASSERT_OWN_WRITE_LOCK(SHOULD_LOCK_VECTOR(v), &v->lock);
     overlap = lookup_addr(v, start, &area);
-    if (overlap && start == area->start && end == area->end)
+    if (overlap && start == area->start && end == area->end) {
         area->custom.client = data;
+        vmvector_snapshot_update(v);
+    }
     UNLOCK_VECTOR(v, release_lock, write);
     return overlap;
 }
@@ -2083,6 +2257,12 @@ vmvector_reset_vector(dcontext_t *dcontext, vm_area_vector_t *v)
         v->buf = NULL;
     } else
         ASSERT(v->size == 0 && v->length == 0);
+    if (v->snapshot != NULL) {
+        /* callers only reset a vector no other thread can be reading */
+        global_heap_free(v->snapshot, VMVECTOR_SNAPSHOT_SIZE(v->snapshot->length)
+                         HEAPACCT(ACCT_VMAREAS));
+        v->snapshot = NULL;
+    }
 }
 
 static void
@@ -2417,6 +2597,7 @@ add_executable_vm_area_check_IAT(app_pc *start /*IN/OUT*/, app_pc *end /*IN/OUT*
                 ASSERT(*start == IAT_end); /* set up above */
                 *end = area->end;
                 area->start = *start;
+                vmvector_snapshot_update(executable_areas);
                 *existing_area = area;
                 STATS_INC(coarse_merge_IAT);
                 /* If info was loaded prior to rebinding just use it.
@@ -2909,6 +3090,8 @@ bool
 is_executable_address(app_pc addr)
 {
     bool found;
+    if (USE_VECTOR_SNAPSHOT(executable_areas))
+        return vmvector_snapshot_search(executable_areas->snapshot, addr, addr+1, NULL);
     read_lock(&executable_areas->lock);
     found = lookup_addr(executable_areas, addr, NULL);
     read_unlock(&executable_areas->lock);
@@ -9470,7 +9653,9 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
          * (fcache unit flushing relies on this order).
          */
         check_lazy_deletion_list(dcontext, pend->flushtime_deleted);
-        
+        /* likewise for snapshots retired before this flush */
+        vmvector_snapshot_reclaim(pend->flushtime_deleted);
+
         STATS_TRACK_MAX(num_shared_flush_maxdiff,
                         flushtime_global - pend->flushtime_deleted);
         DOSTATS({
@@ -9525,6 +9710,7 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
     
     if (dcontext == GLOBAL_DCONTEXT) { /* need to free everything */
         check_lazy_deletion_list(dcontext, flushtime_global+1);
+        vmvector_snapshot_reclaim(flushtime_global+1);
         fcache_free_pending_units(dcontext, flushtime_global+1);
         /* reset_every_nth_pending relies on this */
         ASSERT(todelete->shared_delete_count == 0);
@@ -9539,6 +9725,8 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
     if (dcontext != GLOBAL_DCONTEXT) {
         /* update thread timestamp */
         set_flushtime_last_update(dcontext, flushtime_global);
+        /* the shared fragments we just released may be freed at any time now */
+        fragment_shadow_ret_stack_clear(dcontext);
     }
     mutex_unlock(&shared_cache_flush_lock);
 
@@ -11391,6 +11579,32 @@ vmvector_tests()
     res = vmvector_remove(&v, INT_TO_PC(0x20), INT_TO_PC(0x210)); /* truncation allowed? */
     EXPECT(res, true);
     vmvector_print(&v, STDERR);
+
+    /* lock-free snapshot lookups must see every change */
+    {
+        /* needs a lock ranked before vmvector_snapshot_lock */
+        vm_area_vector_t s = {0, 0, 0, VECTOR_SHARED | VECTOR_SNAPSHOT,
+                              INIT_READWRITE_LOCK(native_exec_areas)};
+        app_pc prev = NULL, next = NULL;
+        EXPECT(vmvector_overlap(&s, INT_TO_PC(0x100), INT_TO_PC(0x101)), false);
+        vmvector_add(&s, INT_TO_PC(0x100), INT_TO_PC(0x200), NULL);
+        vmvector_add(&s, INT_TO_PC(0x300), INT_TO_PC(0x400), INT_TO_PC(0x42));
+        EXPECT(vmvector_overlap(&s, INT_TO_PC(0x1f0), INT_TO_PC(0x310)), true);
+        EXPECT(vmvector_lookup(&s, INT_TO_PC(0x3ff)), 0x42);
+        res = vmvector_lookup_prev_next(&s, INT_TO_PC(0x250), &prev, &next);
+        EXPECT(res, true);
+        EXPECT(prev, 0x100);
+        EXPECT(next, 0x300);
+        vmvector_modify_data(&s, INT_TO_PC(0x300), INT_TO_PC(0x400), NULL);
+        EXPECT(vmvector_lookup(&s, INT_TO_PC(0x300)), 0);
+        vmvector_remove(&s, INT_TO_PC(0x100), INT_TO_PC(0x180));
+        EXPECT(vmvector_overlap(&s, INT_TO_PC(0x100), INT_TO_PC(0x180)), false);
+        EXPECT(vmvector_lookup_data(&s, INT_TO_PC(0x180), &start, &end, NULL), true);
+        EXPECT(start, 0x180);
+        EXPECT(end, 0x200);
+        vmvector_reset_vector(GLOBAL_DCONTEXT, &s);
+        vmvector_snapshot_reclaim(flushtime_global+1);
+    }
 }
 
 /* initial vector tests
@@ -67,10 +67,19 @@ enum {
      * flag to avoid the redundant vector-level lock
      */
     VECTOR_NO_LOCK       = 0x0010,
+    /* Publish a read-only copy of the areas after every change so that
+     * address-only lookups need not take the lock.  Only for shared vectors.
+     */
+    VECTOR_SNAPSHOT      = 0x0020,
 };
 
 #define VECTOR_NEVER_MERGE (VECTOR_NEVER_MERGE_ADJACENT | VECTOR_NEVER_OVERLAP)
 
+/* Retired snapshots are only freed at shared deletion synch points */
+#define VMVECTOR_SNAPSHOT_FLAG()                                            \
+    ((DYNAMO_OPTION(vmarea_snapshots) && DYNAMO_OPTION(shared_deletion)) ? \
+     VECTOR_SNAPSHOT : 0)
+
 /* This vector data structure is only exposed here for quick length checks.
  * For external (non-vmareas.c) users, the vmvector_* interface is the
  * preferred way of manipulating vectors.
@@ -89,6 +98,10 @@ struct vm_area_vector_t {
      * to perform a read (don't need full recursive lock)
      */
     read_write_lock_t lock;
+    /* VECTOR_SNAPSHOT: copy of the areas for lock-free readers, replaced
+     * (never modified) by writers holding the lock.  NULL when empty.
+     */
+    struct _vmvector_snapshot_t * volatile snapshot;
 
     /* Callbacks to support payloads */
     /* Frees a payload */
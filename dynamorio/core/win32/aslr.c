@@ -2758,6 +2758,7 @@ aslr_module_force_size(IN HANDLE app_file_handle,
          * SEC_COMMIT use by the loader in ntdll!LdrpCheckForLoadedDll
          * will be given the original file.
          */
+        ASSERT_CURIOSITY(app_file_size != 0);
         ok = os_set_file_size(randomized_file_handle, app_file_size);
         if (!ok) {
             ASSERT_NOT_TESTED();
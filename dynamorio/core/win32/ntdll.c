@@ -244,6 +244,11 @@ GET_NTDLL(NtQueryInformationFile, (IN HANDLE FileHandle,
                                    IN ULONG FileInformationLength,
                                    IN FILE_INFORMATION_CLASS  FileInformationClass));
 
+GET_NTDLL(NtFlushVirtualMemory, (IN HANDLE ProcessHandle,
+                                 IN OUT PVOID *BaseAddress,
+                                 IN OUT PULONG_PTR FlushSize,
+                                 OUT PIO_STATUS_BLOCK IoStatusBlock));
+
 GET_NTDLL(NtQuerySection, (IN HANDLE SectionHandle,
                            IN SECTION_INFORMATION_CLASS SectionInformationClass,
                            OUT PVOID SectionInformation,
@@ -2014,6 +2019,19 @@ nt_free_virtual_memory(void *base)
     return res;
 }
 
+/* Starts writing the dirty pages of a mapped view back to its file */
+NTSTATUS
+nt_flush_virtual_memory(void *base, size_t size)
+{
+    NTSTATUS res;
+    ULONG_PTR sz = size;
+    IO_STATUS_BLOCK iob = {0,0};
+    res = NtFlushVirtualMemory(NT_CURRENT_PROCESS, &base, &sz, &iob);
+    NTPRINT("NtFlushVirtualMemory: "PFX"-"PFX" => 0x%x\n",
+            base, (byte *)base + sz, res);
+    return res;
+}
+
 /* FIXME: change name to nt_protect_virtual_memory() and use
  * nt_remote_protect_virtual_memory(), or maybe just change callers to
  * pass NT_CURRENT_PROCESS to nt_remote_protect_virtual_memory()
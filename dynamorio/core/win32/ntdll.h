@@ -1300,6 +1300,9 @@ nt_decommit_virtual_memory(void *base, size_t size);
 NTSTATUS
 nt_free_virtual_memory(void *base);
 
+NTSTATUS
+nt_flush_virtual_memory(void *base, size_t size);
+
 bool
 protect_virtual_memory(void *base, size_t size, uint prot, uint *old_prot);
 
@@ -4406,6 +4406,15 @@ os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit)
     }
 }
 
+bool
+os_heap_advise_large_pages(void *p, size_t size)
+{
+    /* FIXME NYI: large pages must be requested with MEM_LARGE_PAGES when the
+     * memory is first allocated, and need SeLockMemoryPrivilege.
+     */
+    return false;
+}
+
 /* i#939: for win8 wow64, x64 ntdll is up high but the kernel won't let us
  * allocate new memory within rel32 distance.  Thus we clobber the padding at
  * the end of x64 ntdll.dll's +rx section.  For typical x64 landing pads w/
@@ -5941,7 +5950,6 @@ os_set_file_size(IN HANDLE file_handle,
 {
     NTSTATUS res;
     FILE_END_OF_FILE_INFORMATION file_end_info;
-    ASSERT_CURIOSITY(end_of_file != 0);
     file_end_info.EndOfFile.QuadPart = end_of_file;
     res = nt_set_file_info(file_handle,
                            &file_end_info,
@@ -6604,6 +6612,13 @@ os_unmap_file(byte *map, size_t size/*unused*/)
     return NT_SUCCESS(res);
 }
 
+bool
+os_flush_mapped_file(byte *map, size_t size)
+{
+    /* like FlushViewOfFile, this does not wait for the disk */
+    return NT_SUCCESS(nt_flush_virtual_memory(map, size));
+}
+
 /* FIXME : should check context flags, what if only integer or only control! */
 /* Translates the context cxt for the given thread trec
  * Like any instance where a thread_record_t is used by a thread other than its
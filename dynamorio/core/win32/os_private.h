@@ -293,9 +293,6 @@ exit_syscall_trampolines(void);
 bool
 os_get_file_size_by_handle(IN HANDLE file_handle,
                            uint64 *end_of_file);
-bool
-os_set_file_size(IN HANDLE file_handle,
-                 uint64 end_of_file);
 
 /* use os_rename_file() for cross-platform uses */
 bool
@@ -2465,6 +2465,13 @@ typedef struct _translate_walk_t {
      */
     bool reg_spilled[REG_SPILL_NUM];
     bool reg_tls[REG_SPILL_NUM];
+    /* -shadow_ret_stack: the spills live at the last jecxz in this mangle
+     * region, which are live again in the region's code past an exit cti
+     * (see append_shadow_ret_hit())
+     */
+    bool jecxz_spilled[REG_SPILL_NUM];
+    bool jecxz_tls[REG_SPILL_NUM];
+    bool past_exit;
     /* PR 267260: Track our own mangle-inserted pushes and pops, for
      * restoring state in the middle of our indirect branch mangling.
      * This is the adjustment in the forward direction.
@@ -2623,6 +2630,55 @@ instr_is_seg_ref_load(dcontext_t *dcontext, instr_t *inst)
 }
 #endif
 
+/* Returns whether reg is one whose app value walk has in a spill slot */
+static inline bool
+translate_walk_reg_spilled(translate_walk_t *walk, reg_id_t reg)
+{
+    reg = reg_to_pointer_sized(reg);
+    return (reg >= REG_START_SPILL && reg <= REG_STOP_SPILL &&
+            walk->reg_spilled[reg - REG_START_SPILL]);
+}
+
+static inline bool
+instr_is_shadow_ret_stack(dcontext_t *dcontext, instr_t *inst, translate_walk_t *walk)
+{
+    /* -shadow_ret_stack's ring code writes only registers we've spilled, the
+     * ring (addressed through such a register), and its own TLS slot: none
+     * of that is app state, so a thread can be relocated from within it.
+     */
+    opnd_t opnd;
+    int i;
+    if (!DYNAMO_OPTION(shadow_ret_stack) || !instr_is_our_mangling(inst))
+        return false;
+    if (instr_get_opcode(inst) == OP_jecxz)
+        return translate_walk_reg_spilled(walk, REG_XCX);
+    if (instr_get_opcode(inst) == OP_jmp_ind) {
+        opnd = instr_get_target(inst);
+        return (opnd_is_far_base_disp(opnd) && opnd_get_segment(opnd) == SEG_TLS &&
+                opnd_get_disp(opnd) == os_tls_offset(TLS_SHADOW_RET_TARGET_SLOT));
+    }
+    if (instr_num_dsts(inst) == 0)
+        return false;
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        opnd = instr_get_dst(inst, i);
+        if (opnd_is_reg(opnd)) {
+            if (!translate_walk_reg_spilled(walk, opnd_get_reg(opnd)))
+                return false;
+        } else if (opnd_is_far_base_disp(opnd)) {
+            if (opnd_get_segment(opnd) != SEG_TLS ||
+                opnd_get_disp(opnd) != os_tls_offset(TLS_SHADOW_RET_TARGET_SLOT))
+                return false;
+        } else if (opnd_is_near_base_disp(opnd)) {
+            if (!translate_walk_reg_spilled(walk, opnd_get_base(opnd)) ||
+                (opnd_get_index(opnd) != REG_NULL &&
+                 !translate_walk_reg_spilled(walk, opnd_get_index(opnd))))
+                return false;
+        } else
+            return false;
+    }
+    return true;
+}
+
 static void
 translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *walk)
 {
@@ -2644,7 +2700,9 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
              */
             ASSERT(!walk->reg_spilled[r]);
             walk->reg_spilled[r] = false; /* be paranoid */
+            walk->jecxz_spilled[r] = false;
         }
+        walk->past_exit = false;
     }
 
     if (instr_is_our_mangling(inst)) {
@@ -2665,6 +2723,18 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
             });
             return;
         }
+        /* Code following an exit cti in the same region can only be reached
+         * by the region's jecxz: that's -shadow_ret_stack's match path,
+         * which still has the app's xax, xdx, and xbx (and the ret's xcx)
+         * in their spill slots.
+         */
+        if (walk->past_exit) {
+            walk->past_exit = false;
+            for (r = 0; r < REG_SPILL_NUM; r++) {
+                walk->reg_spilled[r] = walk->jecxz_spilled[r];
+                walk->reg_tls[r] = walk->jecxz_tls[r];
+            }
+        }
         /* PR 263407: track register values that we've spilled.  We assume
          * that spilling to non-canonical slots only happens in ibl or
          * context switch code: never in app code mangling.  Since a client
@@ -2704,7 +2774,13 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
             /* reset for non-exit non-trace-jecxz cti (i.e., selfmod cti) */
             for (r = 0; r < REG_SPILL_NUM; r++)
                 walk->reg_spilled[r] = false;
-        }
+        } else if (instr_get_opcode(inst) == OP_jecxz) {
+            for (r = 0; r < REG_SPILL_NUM; r++) {
+                walk->jecxz_spilled[r] = walk->reg_spilled[r];
+                walk->jecxz_tls[r] = walk->reg_tls[r];
+            }
+        } else if (instr_get_opcode(inst) == OP_jmp)
+            walk->past_exit = true;
         if (instr_is_reg_spill_or_restore(tdcontext, inst, &spill_tls, &spill, &reg)) {
             r = reg - REG_START_SPILL;
             /* if a restore whose spill was before a cti, ignore */
@@ -2763,6 +2839,9 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
              * "our mangling".  There's nothing specific to do for it.
              */
         }
+        else if (instr_is_shadow_ret_stack(tdcontext, inst, walk)) {
+            /* nothing to do */
+        }
         /* We do not support restoring state at arbitrary points for thread
          * relocation (a performance issue, not a correctness one): if not a
          * spill, restore, push, or pop, we will not properly translate.
@@ -3966,10 +4045,16 @@ stress_test_recreate_state(dcontext_t *dcontext, fragment_t *f, instrlist_t *ili
     static const reg_t STRESS_XSP_INIT = 0x08000000; /* arbitrary */
     bool success_so_far = true;
     bool inside_mangle_region = false;
-    bool spill_xcx_outstanding = false;
+    /* spills live at each point, and those live at the target of a jecxz
+     * (-shadow_ret_stack's match path)
+     */
+    bool spill_outstanding[REG_SPILL_NUM] = {0,};
+    bool jecxz_outstanding[REG_SPILL_NUM] = {0,};
+    instr_t *jecxz_target = NULL;
     reg_id_t reg;
-    bool spill;
+    bool spill, spill_tls;
     int xsp_adjust = 0;
+    int r, offs;
     app_pc mangle_translation = f->tag;
 
     LOG(THREAD, LOG_INTERP, 3, "Testing restoring state fragment #%d\n",
@@ -4001,9 +4086,13 @@ stress_test_recreate_state(dcontext_t *dcontext, fragment_t *f, instrlist_t *ili
             inside_mangle_region = false;
             xsp_adjust = 0;
             success_so_far = true;
-            spill_xcx_outstanding = false;
+            memset(spill_outstanding, 0, sizeof(spill_outstanding));
             /* go ahead and fall through and ensure we succeed w/ 0 xsp adjust */
         }
+        if (in == jecxz_target) {
+            memcpy(spill_outstanding, jecxz_outstanding, sizeof(spill_outstanding));
+            jecxz_target = NULL;
+        }
         if (instr_is_our_mangling(in)) {
             if (!inside_mangle_region) {
                 inside_mangle_region = true;
@@ -4014,8 +4103,14 @@ stress_test_recreate_state(dcontext_t *dcontext, fragment_t *f, instrlist_t *ili
                        mangle_translation == instr_get_translation(in));
             }
 
-            mc.xcx = (reg_t) get_tls(os_tls_offset
-                                     ((ushort)reg_spill_tls_offs(REG_XCX))) + 1;
+            /* a register we don't restore keeps a value unlike its slot's */
+            for (r = 0; r < REG_SPILL_NUM; r++) {
+                offs = reg_spill_tls_offs(REG_START_SPILL + r);
+                if (offs != -1) {
+                    reg_set_value_priv(REG_START_SPILL + r, &mc,
+                                       (reg_t)get_tls(os_tls_offset((ushort)offs)) + 1);
+                }
+            }
             mc.xsp = STRESS_XSP_INIT;
             mc.pc = cpc;
             LOG(THREAD, LOG_INTERP, 3,
@@ -4033,20 +4128,30 @@ stress_test_recreate_state(dcontext_t *dcontext, fragment_t *f, instrlist_t *ili
                     (instr_is_reg_spill_or_restore(dcontext, in, NULL, NULL, NULL) ||
                      (!instr_reads_memory(in) && !instr_writes_memory(in)))));
 
-            /* check that xsp and xcx are adjusted properly */
+            /* check that xsp and the spilled registers are restored properly */
             ASSERT(mc.xsp == STRESS_XSP_INIT -/*negate*/ xsp_adjust);
-            ASSERT(!spill_xcx_outstanding ||
-                   mc.xcx == (reg_t)
-                   get_tls(os_tls_offset((ushort)reg_spill_tls_offs(REG_XCX))));
+            for (r = 0; r < REG_SPILL_NUM; r++) {
+                offs = reg_spill_tls_offs(REG_START_SPILL + r);
+                ASSERT(!spill_outstanding[r] || offs == -1 ||
+                       reg_get_value_priv(REG_START_SPILL + r, &mc) ==
+                       (reg_t)get_tls(os_tls_offset((ushort)offs)));
+            }
 
             if (success_so_far && !res)
                 success_so_far = false;
             instr_check_xsp_mangling(dcontext, in, &xsp_adjust);
             if (xsp_adjust != 0)
                 LOG(THREAD, LOG_INTERP, 3, "  xsp_adjust=%d\n", xsp_adjust);
-            if (instr_is_reg_spill_or_restore(dcontext, in, NULL, &spill, &reg) &&
-                reg == REG_XCX)
-                spill_xcx_outstanding = spill;
+            if (instr_is_reg_spill_or_restore(dcontext, in, &spill_tls, &spill, &reg))
+                spill_outstanding[reg - REG_START_SPILL] = spill && spill_tls;
+            else if (instr_get_opcode(in) == OP_jecxz &&
+                     opnd_is_instr(instr_get_target(in))) {
+                jecxz_target = opnd_get_instr(instr_get_target(in));
+                memcpy(jecxz_outstanding, spill_outstanding, sizeof(spill_outstanding));
+            } else if (instr_is_cti(in) && !instr_is_exit_cti(in)) {
+                /* translation forgets spills across a selfmod cti */
+                memset(spill_outstanding, 0, sizeof(spill_outstanding));
+            }
         }
     }
     if (TEST(FRAG_IS_TRACE, f->flags)) {
@@ -137,9 +137,36 @@ typedef struct _local_state_t {
     spill_state_t spill_space;
 } local_state_t;
 
+/* -shadow_ret_stack: a per-thread ring of the return addresses pushed by
+ * mangled calls, each paired with the cache pc of a direct exit to that
+ * return address in the calling bb.  A mangled return pops an entry and, if
+ * the app target matches, jumps to the exit rather than doing an ibl lookup.
+ * The top is a byte index so that it wraps using byte stores, without
+ * touching the eflags.  An empty entry holds the negation of the ring's own
+ * address, which can never be a return target.
+ */
+#define SHADOW_RET_STACK_ENTRIES 256
+typedef struct _shadow_ret_entry_t {
+    ptr_int_t neg_retaddr; /* negated so a lea against the target tests for 0 */
+    cache_pc landing;
+} shadow_ret_entry_t;
+
+typedef struct _shadow_ret_stack_t {
+    byte top;
+    /* keep entry[] at a scale-able offset */
+    byte padding[sizeof(shadow_ret_entry_t) - 1];
+    shadow_ret_entry_t entry[SHADOW_RET_STACK_ENTRIES];
+    /* only updated from the cache in DEBUG builds */
+    uint hits;
+    uint misses;
+} shadow_ret_stack_t;
+
 typedef struct _local_state_extended_t {
     spill_state_t spill_space;
     table_stat_state_t table_space;
+    /* for -shadow_ret_stack: this thread's ring and the landing of a hit */
+    shadow_ret_stack_t *shadow_ret_stack;
+    cache_pc shadow_ret_target;
 } local_state_extended_t;
 
 /* local_state_[extended_]t is allocated in os-specific thread-local storage (TLS),
@@ -166,6 +193,11 @@ typedef struct _local_state_extended_t {
                                   + offsetof(table_stat_state_t, stats)))
 #endif
 
+#define TLS_SHADOW_RET_STACK_SLOT                                     \
+    ((ushort)offsetof(local_state_extended_t, shadow_ret_stack))
+#define TLS_SHADOW_RET_TARGET_SLOT                                    \
+    ((ushort)offsetof(local_state_extended_t, shadow_ret_target))
+
 #define TLS_NUM_SLOTS                                  \
    (DYNAMO_OPTION(ibl_table_in_tls) ?                  \
     sizeof(local_state_extended_t) / sizeof(void *) :  \
@@ -241,6 +273,16 @@ emit_detach_callback_final_jmp(dcontext_t *dcontext,
 #else
 # define CHECK_JMP_TARGET_ALIGNMENT(target, size, hot_patch)
 #endif
+/* Keeps the compiler from moving memory accesses across it.  x86 does not
+ * reorder loads with other loads, so this is enough to order a reader's
+ * loads of data published with a locked instruction.
+ */
+#ifdef WINDOWS
+# define COMPILER_BARRIER() _ReadWriteBarrier()
+#else
+# define COMPILER_BARRIER() __asm__ __volatile__("" : : : "memory")
+#endif
+
 #ifdef WINDOWS
 /* note that the microsoft compiler will not enregister variables across asm
  * blocks that touch those registers, so don't need to worry about clobbering
@@ -1306,9 +1348,15 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start_pc,
                            _IF_CLIENT(instrlist_t **unmangled_ilist));
 
 void interp(dcontext_t *dcontext);
+void decode_cache_invalidate(app_pc base, size_t size);
 uint extend_trace(dcontext_t *dcontext, fragment_t *f, linkstub_t *prev_l);
 int append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
                                     app_pc speculate_next_tag, bool record_translation);
+/* upper bound for -ibl_inline_targets */
+#define IBL_INLINE_MAX_TARGETS 4
+struct _ibl_inline_site_t;
+int append_trace_inline_ibl_targets(dcontext_t *dcontext, instrlist_t *trace,
+                                    struct _ibl_inline_site_t *site);
 
 uint
 forward_eflags_analysis(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr);
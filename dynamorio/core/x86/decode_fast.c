@@ -120,7 +120,7 @@ static const signed char immed_adjustment[256] = {
                                                                 
      0, 0, 0, 0,  0, 0, 0,-2,  0, 0, 0, 0,  0, 0, 0, 0,  /* C */
      0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  /* D */
-     0, 0, 0, 0,  0, 0, 0, 0, -2,-2,-2,-2,  0, 0, 0, 0,  /* E */
+     0, 0, 0, 0,  0, 0, 0, 0, -2,-2,-2, 0,  0, 0, 0, 0,  /* E */
      0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0   /* F */
 };
 
@@ -144,7 +144,7 @@ static const signed char immed_adjustment_intel64[256] = {
                                                                 
      0, 0, 0, 0,  0, 0, 0,-2,  0, 0, 0, 0,  0, 0, 0, 0,  /* C */
      0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  /* D */
-     0, 0, 0, 0,  0, 0, 0, 0,  0, 0,-2,-2,  0, 0, 0, 0,  /* E */
+     0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  /* E */
      0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0   /* F */
 };
 #endif
@@ -384,6 +384,106 @@ static const byte threebyte_3a_fixed_length[256] = {
 };
 #endif
 
+/* Classification of the bytes that can start an instruction, used by
+ * decode_sizeof() to walk the prefixes with a single table load per byte.
+ * PFX_REX entries are only prefixes in 64-bit mode, and PFX_VEX
+ * entries are only prefixes in 64-bit mode or when followed by a
+ * register-form modrm byte.
+ */
+enum {
+    PFX_NONE,
+    PFX_OTHER,  /* lock and segment overrides: no effect on length */
+    PFX_DATA16,
+    PFX_ADDR16,
+    PFX_REPNE,  /* only repne changes a length (insertq) */
+    PFX_REX,
+    PFX_VEX,
+};
+
+#define o PFX_OTHER
+#define d PFX_DATA16
+#define a PFX_ADDR16
+#define r PFX_REPNE
+#define x PFX_REX
+#define v PFX_VEX
+
+static const byte prefix_kind[256] = {
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 0 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 1 */
+    0,0,0,0, 0,0,o,0, 0,0,0,0, 0,0,o,0,  /* 2 */
+    0,0,0,0, 0,0,o,0, 0,0,0,0, 0,0,o,0,  /* 3 */
+    x,x,x,x, x,x,x,x, x,x,x,x, x,x,x,x,  /* 4 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 5 */
+    0,0,0,0, o,o,d,a, 0,0,0,0, 0,0,0,0,  /* 6 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 7 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 8 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 9 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* A */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* B */
+    0,0,0,0, v,v,0,0, 0,0,0,0, 0,0,0,0,  /* C */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* D */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* E */
+    o,0,r,o, 0,0,0,0, 0,0,0,0, 0,0,0,0   /* F */
+};
+
+#undef o
+#undef d
+#undef a
+#undef r
+#undef x
+#undef v
+
+/* Size in bytes of the modrm byte plus any sib byte and displacement for
+ * 32-bit and 64-bit addressing, indexed by the modrm byte.  Entries with
+ * MODRM_SIB_BASE set have a sib byte whose base field must also be checked:
+ * a base of 5 with mod 0 adds a disp32.  See the table above sizeof_modrm().
+ */
+#define MODRM_SIB_BASE 0x10
+#define S (2 | MODRM_SIB_BASE)
+
+static const byte modrm_length[256] = {
+    1,1,1,1, S,5,1,1, 1,1,1,1, S,5,1,1,  /* 0 */
+    1,1,1,1, S,5,1,1, 1,1,1,1, S,5,1,1,  /* 1 */
+    1,1,1,1, S,5,1,1, 1,1,1,1, S,5,1,1,  /* 2 */
+    1,1,1,1, S,5,1,1, 1,1,1,1, S,5,1,1,  /* 3 */
+    2,2,2,2, 3,2,2,2, 2,2,2,2, 3,2,2,2,  /* 4 */
+    2,2,2,2, 3,2,2,2, 2,2,2,2, 3,2,2,2,  /* 5 */
+    2,2,2,2, 3,2,2,2, 2,2,2,2, 3,2,2,2,  /* 6 */
+    2,2,2,2, 3,2,2,2, 2,2,2,2, 3,2,2,2,  /* 7 */
+    5,5,5,5, 6,5,5,5, 5,5,5,5, 6,5,5,5,  /* 8 */
+    5,5,5,5, 6,5,5,5, 5,5,5,5, 6,5,5,5,  /* 9 */
+    5,5,5,5, 6,5,5,5, 5,5,5,5, 6,5,5,5,  /* A */
+    5,5,5,5, 6,5,5,5, 5,5,5,5, 6,5,5,5,  /* B */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* C */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* D */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* E */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1   /* F */
+};
+
+#undef S
+
+/* Same as modrm_length but for 16-bit addressing (addr16 prefix in
+ * 32-bit mode), which never has a sib byte.
+ */
+static const byte modrm_length_addr16[256] = {
+    1,1,1,1, 1,1,3,1, 1,1,1,1, 1,1,3,1,  /* 0 */
+    1,1,1,1, 1,1,3,1, 1,1,1,1, 1,1,3,1,  /* 1 */
+    1,1,1,1, 1,1,3,1, 1,1,1,1, 1,1,3,1,  /* 2 */
+    1,1,1,1, 1,1,3,1, 1,1,1,1, 1,1,3,1,  /* 3 */
+    2,2,2,2, 2,2,2,2, 2,2,2,2, 2,2,2,2,  /* 4 */
+    2,2,2,2, 2,2,2,2, 2,2,2,2, 2,2,2,2,  /* 5 */
+    2,2,2,2, 2,2,2,2, 2,2,2,2, 2,2,2,2,  /* 6 */
+    2,2,2,2, 2,2,2,2, 2,2,2,2, 2,2,2,2,  /* 7 */
+    3,3,3,3, 3,3,3,3, 3,3,3,3, 3,3,3,3,  /* 8 */
+    3,3,3,3, 3,3,3,3, 3,3,3,3, 3,3,3,3,  /* 9 */
+    3,3,3,3, 3,3,3,3, 3,3,3,3, 3,3,3,3,  /* A */
+    3,3,3,3, 3,3,3,3, 3,3,3,3, 3,3,3,3,  /* B */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* C */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* D */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,  /* E */
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1   /* F */
+};
+
 /* Extra size when vex-encoded (from immeds) */
 static const byte threebyte_38_vex_extra[256] = {
     0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 0 */
@@ -422,110 +522,89 @@ decode_sizeof(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
     bool word_operands = false; /* data16 */
     bool qword_operands = false; /* rex.w */
     bool addr16 = false; /* really "addr32" for x64 mode */
-    bool found_prefix = true;
-    bool rep_prefix = false;
+    bool repne_prefix = false;
     byte reg_opcode;    /* reg_opcode field of modrm byte */
 #ifdef X64
     byte *rip_rel_pc = NULL;
 #endif
 
     /* Check for prefix byte(s) */
-    while (found_prefix) {
-        /* NOTE - rex prefixes must come after all other prefixes (including
-         * prefixes that are part of the opcode xref PR 271878).  We match
-         * read_instruction() in considering pre-prefix rex bytes as part of
-         * the following instr, event when ignored, rather then treating them
-         * as invalid.  This in effect nops improperly placed rex prefixes which
-         * (xref PR 241563 and Intel Manual 2A 2.2.1) is the correct thing to do.
-         * Rex prefixes are 0x40-0x4f; >=0x48 has rex.w bit set.
-         */
-        if (X64_MODE_DC(dcontext) && opc >= REX_PREFIX_BASE_OPCODE &&
-            opc <= (REX_PREFIX_BASE_OPCODE | REX_PREFIX_ALL_OPFLAGS)) {
-            if (opc >= (REX_PREFIX_BASE_OPCODE | REX_PREFIX_W_OPFLAG)) {
-                qword_operands = true;
-                if (word_operands)
-                    word_operands = false; /* rex.w trumps data16 */
-            } /* else, doesn't affect instr size */
-            opc = (uint)*(++pc);
-            sz += 1;
-        } else {
-            switch (opc) {
-            case 0x66:    /* operand size */
-                /* rex.w before other prefixes is a nop */
-                if (qword_operands)
-                    qword_operands = false;
-                word_operands = true;
-                opc = (uint)*(++pc);
-                sz += 1;
-                break;
-            case 0xf2: case 0xf3: /* REP */
-                rep_prefix = true;
-                /* fall through */
-            case 0xf0:          /* LOCK */
-            case 0x64: case 0x65: /* segment overrides */
-            case 0x26: case 0x36:
-            case 0x2e: case 0x3e:
-                opc = (uint)*(++pc);
-                sz += 1;
+    while (true) {
+        byte kind = prefix_kind[opc];
+        if (kind == PFX_NONE)
+            break;
+        if (kind == PFX_REX) {
+            /* NOTE - rex prefixes must come after all other prefixes (including
+             * prefixes that are part of the opcode xref PR 271878).  We match
+             * read_instruction() in considering pre-prefix rex bytes as part of
+             * the following instr, event when ignored, rather then treating them
+             * as invalid.  This in effect nops improperly placed rex prefixes which
+             * (xref PR 241563 and Intel Manual 2A 2.2.1) is the correct thing to do.
+             * Only the last rex prefix counts, so a later one without rex.w
+             * cancels an earlier rex.w.
+             */
+            if (!X64_MODE_DC(dcontext))
                 break;
-            case 0x67:
-                addr16 = true;
-                opc = (uint)*(++pc);
+            qword_operands = TEST(REX_PREFIX_W_OPFLAG, opc);
+        } else if (kind == PFX_VEX) {
+            /* If 64-bit mode or mod selects for register, this is vex */
+            if (X64_MODE_DC(dcontext) || TESTALL(MODRM_BYTE(3, 0, 0), *(pc+1))) {
+                /* Assumptions:
+                 * - no vex-encoded instr size differs based on vex.w,
+                 *   so we don't bother to set qword_operands
+                 * - no vex-encoded instr size differs based on prefixes,
+                 *   so we don't bother to decode vex.pp
+                 */
+                bool vex3 = (opc == 0xc4);
+                byte vex_mm = 0;
+                opc = (uint)*(++pc); /* 2nd vex prefix byte */
                 sz += 1;
-                /* up to caller to check for addr prefix! */
-                break;
-            case 0xc4:
-            case 0xc5: {
-                /* If 64-bit mode or mod selects for register, this is vex */
-                if (X64_MODE_DC(dcontext) || TESTALL(MODRM_BYTE(3, 0, 0), *(pc+1))) {
-                    /* Assumptions:
-                     * - no vex-encoded instr size differs based on vex.w,
-                     *   so we don't bother to set qword_operands
-                     * - no vex-encoded instr size differs based on prefixes,
-                     *   so we don't bother to decode vex.pp
-                     */
-                    bool vex3 = (opc == 0xc4);
-                    byte vex_mm = 0;
-                    opc = (uint)*(++pc); /* 2nd vex prefix byte */
+                if (vex3) {
+                    vex_mm = (byte) (opc & 0x1f);
+                    opc = (uint)*(++pc); /* 3rd vex prefix byte */
                     sz += 1;
-                    if (vex3) {
-                        vex_mm = (byte) (opc & 0x1f);
-                        opc = (uint)*(++pc); /* 3rd vex prefix byte */
-                        sz += 1;
-                    }
-                    opc = (uint)*(++pc); /* 1st opcode byte */
-                    sz += 1;
-                    if (num_prefixes != NULL)
-                        *num_prefixes = sz;
-                    /* no prefixes after vex + already did full size, so goto end */
-                    if (!vex3 || (vex3 && (vex_mm == 1))) {
-                        sz += sizeof_escape(dcontext, pc, addr16
-                                            _IF_X64(&rip_rel_pc));
-                        goto decode_sizeof_done;
-                    } else if (vex_mm == 2) {
-                        sz += sizeof_3byte_38(dcontext, pc - 1, addr16, true
-                                              _IF_X64(&rip_rel_pc));
-                        goto decode_sizeof_done;
-                    } else if (vex_mm == 3) {
-                        sz += sizeof_3byte_3a(dcontext, pc - 1, addr16
-                                              _IF_X64(&rip_rel_pc));
-                        goto decode_sizeof_done;
-                    }
-                } else
-                    found_prefix = false;
-                break;
-            }
-            default:
-                found_prefix = false;
+                }
+                opc = (uint)*(++pc); /* 1st opcode byte */
+                sz += 1;
+                if (num_prefixes != NULL)
+                    *num_prefixes = sz;
+                /* no prefixes after vex + already did full size, so goto end */
+                if (!vex3 || (vex3 && (vex_mm == 1))) {
+                    sz += sizeof_escape(dcontext, pc, addr16
+                                        _IF_X64(&rip_rel_pc));
+                    goto decode_sizeof_done;
+                } else if (vex_mm == 2) {
+                    sz += sizeof_3byte_38(dcontext, pc - 1, addr16, true
+                                          _IF_X64(&rip_rel_pc));
+                    goto decode_sizeof_done;
+                } else if (vex_mm == 3) {
+                    sz += sizeof_3byte_3a(dcontext, pc - 1, addr16
+                                          _IF_X64(&rip_rel_pc));
+                    goto decode_sizeof_done;
+                }
             }
+            break;
+        } else {
+            /* rex before other prefixes is a nop */
+            qword_operands = false;
+            if (kind == PFX_DATA16)
+                word_operands = true;
+            else if (kind == PFX_ADDR16)
+                addr16 = true; /* up to caller to check for addr prefix! */
+            else if (kind == PFX_REPNE)
+                repne_prefix = true;
         }
+        opc = (uint)*(++pc);
+        sz += 1;
     }
+    if (qword_operands)
+        word_operands = false; /* rex.w trumps data16 */
     if (num_prefixes != NULL)
         *num_prefixes = sz;
     if (word_operands) {
 #ifdef X64
-        /* for x64 Intel, always 64-bit addr ("f64" in Intel table) 
-         * FIXME: what about 2-byte jcc?
+        /* for x64 Intel, always 64-bit addr ("f64" in Intel table).
+         * 2-byte jcc is handled below.
          */
         if (X64_MODE_DC(dcontext) && proc_get_vendor() == VENDOR_INTEL)
             sz += immed_adjustment_intel64[opc];
@@ -565,10 +644,16 @@ decode_sizeof(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
         /* special case: Intel and AMD added size-differing prefix-dependent instrs! */
         if (*(pc+1) == 0x78) {
             /* XXX: if have rex.w prefix we clear word_operands: is that legal combo? */
-            if (word_operands || rep_prefix) {
+            if (word_operands || repne_prefix) {
                 /* extrq, insertq: 2 1-byte immeds */
                 sz += 2;
             } /* else, vmread, w/ no immeds */
+        } else if (word_operands && (*(pc+1) & 0xf0) == 0x80) {
+            /* jcc Jz: data16 shrinks the displacement except for x64 Intel */
+#ifdef X64
+            if (!X64_MODE_DC(dcontext) || proc_get_vendor() != VENDOR_INTEL)
+#endif
+                sz -= 2;
         }
     } else if (varlen == VARLEN_FP_OP)
         sz += sizeof_fp_op(dcontext, pc+1, addr16 _IF_X64(&rip_rel_pc));
@@ -576,10 +661,11 @@ decode_sizeof(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
         CLIENT_ASSERT(varlen == VARLEN_NONE, "internal decoding error");
 
     /* special case that doesn't fit the mold (of course one had to exist) */
+    /* /1 is an undocumented alias of /0 that decode() also accepts */
     reg_opcode = (byte) (((*(pc + 1)) & 0x38) >> 3);
-    if (opc == 0xf6 && reg_opcode == 0) {
+    if (opc == 0xf6 && reg_opcode <= 1) {
         sz += 1;        /* TEST Eb,ib -- add size of immediate */
-    } else if (opc == 0xf7 && reg_opcode == 0) {
+    } else if (opc == 0xf7 && reg_opcode <= 1) {
         if (word_operands)
             sz += 2;    /* TEST Ew,iw -- add size of immediate */
         else
@@ -677,56 +763,26 @@ sizeof_escape(dcontext_t *dcontext, byte *pc, bool addr16 _IF_X64(byte **rip_rel
 static int
 sizeof_modrm(dcontext_t *dcontext, byte *pc, bool addr16 _IF_X64(byte **rip_rel_pc))
 {
-    int l = 0;          /* return value for sizeof(eAddr) */
-
     uint modrm = (uint)*pc;
-    int r_m = modrm & 0x7;
-    uint mod = modrm >> 6;
-    uint sib;
+    int l;              /* return value for sizeof(eAddr) */
+
+    /* for x64, addr16 simply truncates the computed address: there is
+     * no change in disp sizes */
+    if (addr16 && !X64_MODE_DC(dcontext))
+        return modrm_length_addr16[modrm];
 
 #ifdef X64
-    if (rip_rel_pc != NULL && X64_MODE_DC(dcontext) && mod == 0 && r_m == 5) {
+    /* mod == 0 and r_m == 5 */
+    if (rip_rel_pc != NULL && (modrm & 0xc7) == 0x05 && X64_MODE_DC(dcontext))
         *rip_rel_pc = pc + 1; /* no sib: next 4 bytes are disp */
-    }
 #endif
 
-    if (addr16 && !X64_MODE_DC(dcontext)) {
-        if (mod == 1)
-            return 2; /* modrm + disp8 */
-        else if (mod == 2)
-            return 3; /* modrm + disp16 */
-        else if (mod == 3)
-            return 1; /* just modrm */
-        else {
-            CLIENT_ASSERT(mod == 0, "internal decoding error on addr16 prefix");
-            if (r_m == 6)
-                return 3; /* modrm + disp16 */
-            else
-                return 1; /* just modrm */
-        }
-        CLIENT_ASSERT(false, "internal decoding error on addr16 prefix");
+    l = modrm_length[modrm];
+    if (TEST(MODRM_SIB_BASE, l)) {
+        l &= ~MODRM_SIB_BASE;
+        if (((*(pc+1)) & 0x7) == 5)
+            l += 4; /* disp32(,index,s) */
     }
-    
-    /* for x64, addr16 simply truncates the computed address: there is
-     * no change in disp sizes */
-    
-    if (mod == 3)       /* register operand */
-        return 1;
-
-    switch (mod) {      /* memory or immediate operand */
-      case 0: l = (r_m == 5) ? 5 : 1; break;
-      case 1: l = 2; break;
-      case 2: l = 5; break;
-    }
-    if (r_m == 4) {
-        l += 1;         /* adjust for sib byte */
-        sib = (uint)(*(pc+1));
-        if ((sib & 0x7) == 5) {
-            if (mod == 0)
-                l += 4; /* disp32(,index,s) */
-        }
-    }   
-
     return l;
 }
 
@@ -5368,6 +5368,43 @@ emit_indirect_branch_lookup(dcontext_t *dcontext, generated_code_t *code, byte *
                          DYNAMO_OPTION(bb_single_restore_prefix),
                          NULL);
     } else {
+        /* With -ibl_bucket_lines the first probe lands on a cache line boundary,
+         * so we check the rest of the line without taking a branch per entry:
+         *>>>    cmp     HASHLOOKUP_TAG_OFFS(%xcx),%xbx
+         *>>>    je      compare_tag      # redone there, then falls into found
+         *>>>    cmp     $0, HASHLOOKUP_TAG_OFFS(%xcx)
+         *>>>    je      sentinel_check
+         *>>>    lea     sizeof(fragment_entry_t)(%xcx),%xcx
+         * The collision stats count one per loop iteration so we keep the loop.
+         */
+        bool unroll_bucket = DYNAMO_OPTION(ibl_bucket_lines);
+# ifdef HASHTABLE_STATISTICS
+        if (INTERNAL_OPTION(hashtable_ibl_stats))
+            unroll_bucket = false;
+# endif
+        if (unroll_bucket) {
+            /* bound the gencode growth for unusually long cache lines */
+            uint i, unroll = (uint) MIN(proc_get_cache_line_size() /
+                                        sizeof(fragment_entry_t) - 1, 7);
+            for (i = 0; i < unroll; i++) {
+                APP(&ilist, INSTR_CREATE_cmp(dcontext,
+                                             OPND_CREATE_MEMPTR(REG_XCX,
+                                                                HASHLOOKUP_TAG_OFFS),
+                                             opnd_create_reg(REG_XBX)));
+                APP(&ilist, INSTR_CREATE_jcc(dcontext, OP_je,
+                                             opnd_create_instr(compare_tag)));
+                APP(&ilist, INSTR_CREATE_cmp(dcontext,
+                                             OPND_CREATE_MEMPTR(REG_XCX,
+                                                                HASHLOOKUP_TAG_OFFS),
+                                             OPND_CREATE_INT8(0)));
+                APP(&ilist, INSTR_CREATE_jcc(dcontext, OP_je,
+                                             opnd_create_instr(sentinel_check)));
+                APP(&ilist, INSTR_CREATE_lea
+                    (dcontext, opnd_create_reg(REG_XCX),
+                     opnd_create_base_disp(REG_XCX, REG_NULL, 0,
+                                           sizeof(fragment_entry_t), OPSZ_lea)));
+            }
+        }
         /* case 5232: use INSTR_CREATE_jmp_smart, since release builds can use a short jump */
         APP(&ilist, INSTR_CREATE_jmp_smart(dcontext, opnd_create_instr(compare_tag)));
     }
@@ -3729,6 +3729,13 @@ dr_file_size(file_t fd, OUT uint64 *size)
     return os_get_file_size_by_handle(fd, size);
 }
 
+DR_API
+bool
+dr_file_set_size(file_t fd, uint64 size)
+{
+    return os_set_file_size(fd, size);
+}
+
 DR_API
 void *
 dr_map_file(file_t f, size_t *size INOUT, uint64 offs, app_pc addr, uint prot,
@@ -3764,6 +3771,15 @@ dr_unmap_file(void *map, size_t size)
     return unmap_file((byte *) map, size);
 }
 
+DR_API
+bool
+dr_flush_mapped_file(void *map, size_t size)
+{
+    CLIENT_ASSERT(ALIGNED(map, PAGE_SIZE),
+                  "dr_flush_mapped_file: map is not page aligned");
+    return os_flush_mapped_file((byte *) map, size);
+}
+
 DR_API
 void
 dr_log(void *drcontext, uint mask, uint level, const char *fmt, ...)
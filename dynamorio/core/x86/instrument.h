@@ -3303,6 +3303,15 @@ DR_API
 bool
 dr_file_size(file_t fd, OUT uint64 *size);
 
+DR_API
+/**
+ * Truncates or extends the file \p fd to \p size bytes.  Extending fills
+ * the new space with zeroes.
+ * \return whether successful.
+ */
+bool
+dr_file_set_size(file_t fd, uint64 size);
+
 /* The extra BEGIN END is to get spacing nice. */
 /* DR_API EXPORT BEGIN */
 /* DR_API EXPORT END */
@@ -3379,7 +3388,20 @@ DR_API
 bool
 dr_unmap_file(void *map, size_t size);
 
-/* TODO add copy_file, truncate_file etc.
+DR_API
+/**
+ * Starts writing the modified pages of the region \p map to \p map + \p size,
+ * which must be part of a shared file mapping made with dr_map_file(), back
+ * to the file.  Returns without waiting for the writes to complete.
+ * \return whether successful.
+ *
+ * @param[in]  map   The base address of the region. Must be page size aligned.
+ * @param[in]  size  The size of the region.
+ */
+bool
+dr_flush_mapped_file(void *map, size_t size);
+
+/* TODO add copy_file etc.
  * All should be easy though at some point should perhaps tell people to just use the raw
  * systemcalls, esp for linux where they're documented and let them provide their own
  * wrappers. */
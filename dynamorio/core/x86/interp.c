@@ -115,6 +115,207 @@ volatile bool bb_lock_start;
 file_t bbdump_file = INVALID_FILE;
 #endif
 
+/* Cache of fully decoded application instrs, consulted by build_bb_ilist()
+ * so that rebuilding a block (for a trace, for state translation, or after
+ * a flush) copies its instrs instead of running the decoder again.  It is
+ * direct-mapped on the app pc and so bounded by -decode_cache_size.  An
+ * entry is keyed by (pc, x86 mode).  Flushing a region drops only the
+ * entries for instrs that overlap it, so blocks outside the region are
+ * still rebuilt from the cache.  As a second line of defense a hit is only
+ * used if the bytes at pc still match the ones that were decoded, which
+ * also covers writes DR has not noticed yet.
+ *
+ * The cache takes no locks.  Each entry is guarded by a sequence count that
+ * is odd while a writer owns it: a writer that cannot claim an entry just
+ * does not cache, and a reader that sees the count odd or changed across
+ * its copy treats the lookup as a miss.  Entries store the decoded instr_t
+ * by value along with its operands, so that a hit is a plain copy.
+ * decode() produces at most 8 of each kind of operand.
+ */
+#define DECODE_CACHE_MAX_OPNDS 8
+
+typedef struct _decode_cache_data_t {
+    app_pc pc;           /* NULL if unused */
+    instr_t instr;       /* srcs and dsts pointers unused */
+    opnd_t dsts[DECODE_CACHE_MAX_OPNDS];
+    opnd_t srcs[DECODE_CACHE_MAX_OPNDS]; /* all srcs, including src0 */
+    byte bytes[MAX_INSTR_LENGTH];
+} decode_cache_data_t;
+
+typedef struct _decode_cache_entry_t {
+    volatile int seq;    /* odd while data is being written */
+    decode_cache_data_t data;
+} decode_cache_entry_t;
+
+static decode_cache_entry_t *decode_cache;
+static uint decode_cache_mask;
+
+#define DECODE_CACHE_INDEX(pc) ((uint)(((ptr_uint_t)(pc) ^ ((ptr_uint_t)(pc) >> 12)) & \
+                                       decode_cache_mask))
+
+static void
+decode_cache_init(void)
+{
+    uint entries;
+    if (DYNAMO_OPTION(decode_cache_size) == 0)
+        return;
+    for (entries = 1; entries < DYNAMO_OPTION(decode_cache_size); entries <<= 1)
+        ; /* round up to a power of 2 */
+    decode_cache_mask = entries - 1;
+    decode_cache = HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, decode_cache_entry_t, entries,
+                                    ACCT_IR, UNPROTECTED);
+    memset(decode_cache, 0, entries * sizeof(*decode_cache));
+}
+
+static void
+decode_cache_exit(void)
+{
+    if (decode_cache == NULL)
+        return;
+    HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, decode_cache, decode_cache_entry_t,
+                    decode_cache_mask + 1, ACCT_IR, UNPROTECTED);
+    decode_cache = NULL;
+}
+
+/* Claims entry for writing.  Returns false if another thread owns it. */
+static inline bool
+decode_cache_entry_claim(decode_cache_entry_t *entry)
+{
+    int seq = entry->seq;
+    return (!TEST(1, seq) && atomic_compare_exchange_int(&entry->seq, seq, seq + 1));
+}
+
+static inline void
+decode_cache_entry_release(decode_cache_entry_t *entry)
+{
+    ATOMIC_INC(int, entry->seq);
+}
+
+/* Drops the entry for pc if it holds an instr starting in [start, end) */
+static void
+decode_cache_invalidate_entry(decode_cache_entry_t *entry, app_pc start, app_pc end)
+{
+    app_pc pc = entry->data.pc;
+    if (pc < start || pc >= end)
+        return;
+    /* If a writer owns the entry we leave it: the byte comparison on a hit
+     * still keeps us from using a stale decoding.
+     */
+    if (!decode_cache_entry_claim(entry))
+        return;
+    pc = entry->data.pc;
+    if (pc >= start && pc < end) {
+        entry->data.pc = NULL;
+        STATS_INC(decode_cache_invalidations);
+    }
+    decode_cache_entry_release(entry);
+}
+
+/* Called whenever the app code in [base, base+size) may have changed:
+ * see flush_fragments_in_region_start()
+ */
+void
+decode_cache_invalidate(app_pc base, size_t size)
+{
+    app_pc start, end, pc;
+    uint i;
+    if (decode_cache == NULL)
+        return;
+    /* an instr starting up to MAX_INSTR_LENGTH-1 bytes earlier overlaps */
+    start = (base < (app_pc)(MAX_INSTR_LENGTH - 1)) ? NULL :
+        base - (MAX_INSTR_LENGTH - 1);
+    end = (base + size < base) ? (app_pc)POINTER_MAX : base + size;
+    if ((ptr_uint_t)(end - start) <= decode_cache_mask) {
+        /* fewer pcs than entries: look only where each pc maps */
+        for (pc = start; pc < end; pc++)
+            decode_cache_invalidate_entry(&decode_cache[DECODE_CACHE_INDEX(pc)], pc, pc + 1);
+    } else {
+        for (i = 0; i <= decode_cache_mask; i++)
+            decode_cache_invalidate_entry(&decode_cache[i], start, end);
+    }
+}
+
+/* Fully decodes the instr at pc into instr, which must be empty, using the
+ * decode cache when possible.  Returns the next pc, or NULL for an invalid
+ * instr, just like decode().
+ */
+static byte *
+decode_cached(dcontext_t *dcontext, byte *pc, instr_t *instr)
+{
+    decode_cache_entry_t *entry;
+    decode_cache_data_t copy;
+    byte *next_pc;
+    uint i, len;
+    bool hit = false;
+    int seq;
+    if (decode_cache == NULL)
+        return decode(dcontext, pc, instr);
+    entry = &decode_cache[DECODE_CACHE_INDEX(pc)];
+    seq = entry->seq;
+    COMPILER_BARRIER();
+    if (!TEST(1, seq) && entry->data.pc == pc) {
+        memcpy(&copy, &entry->data, sizeof(copy));
+        COMPILER_BARRIER();
+        hit = (entry->seq == seq && copy.pc == pc
+               IF_X64(&& instr_get_x86_mode(&copy.instr) == get_x86_mode(dcontext)));
+    }
+    if (hit) {
+        /* We stop comparing the app bytes at the first difference, so we
+         * never read past where decode() itself would have stopped.
+         */
+        len = copy.instr.length;
+        for (i = 0; i < len; i++) {
+            if (pc[i] != copy.bytes[i])
+                break;
+        }
+        if (i == len) {
+            STATS_INC(decode_cache_hits);
+            ASSERT(TEST(INSTR_OPERANDS_VALID, copy.instr.flags) &&
+                   !TEST(INSTR_RAW_BITS_ALLOCATED, copy.instr.flags));
+            memcpy(instr, &copy.instr, sizeof(*instr));
+            instr->num_dsts = 0;
+            instr->num_srcs = 0;
+            instr->dsts = NULL;
+            instr->srcs = NULL;
+            instr_set_num_opnds(dcontext, instr, copy.instr.num_dsts,
+                                copy.instr.num_srcs);
+            for (i = 0; i < copy.instr.num_dsts; i++)
+                instr_set_dst(instr, i, copy.dsts[i]);
+            for (i = 0; i < copy.instr.num_srcs; i++)
+                instr_set_src(instr, i, copy.srcs[i]);
+            /* instr_set_{src,dst} invalidate the raw bits */
+            instr->flags = copy.instr.flags;
+            return pc + len;
+        }
+        STATS_INC(decode_cache_stale);
+    } else
+        STATS_INC(decode_cache_misses);
+
+    next_pc = decode(dcontext, pc, instr);
+    if (next_pc == NULL || !instr_operands_valid(instr) ||
+        !instr_raw_bits_valid(instr) || instr_has_allocated_bits(instr) ||
+        instr->num_dsts > DECODE_CACHE_MAX_OPNDS ||
+        instr->num_srcs > DECODE_CACHE_MAX_OPNDS)
+        return next_pc;
+    /* fill in the new entry before claiming it, from what decode() read */
+    memset(&copy, 0, sizeof(copy));
+    copy.pc = pc;
+    memcpy(&copy.instr, instr, sizeof(copy.instr));
+    copy.instr.dsts = NULL;
+    copy.instr.srcs = NULL;
+    for (i = 0; i < instr->num_dsts; i++)
+        copy.dsts[i] = instr_get_dst(instr, i);
+    for (i = 0; i < instr->num_srcs; i++)
+        copy.srcs[i] = instr_get_src(instr, i);
+    ASSERT(instr->length <= MAX_INSTR_LENGTH);
+    memcpy(copy.bytes, instr->bytes, instr->length);
+    if (decode_cache_entry_claim(entry)) {
+        memcpy(&entry->data, &copy, sizeof(entry->data));
+        decode_cache_entry_release(entry);
+    }
+    return next_pc;
+}
+
 /* initialization */
 void
 interp_init()
@@ -125,6 +326,7 @@ interp_init()
         ASSERT(bbdump_file != INVALID_FILE);
     }
 #endif
+    decode_cache_init();
 }
 
 #ifdef CUSTOM_TRACES_RET_REMOVAL
@@ -144,6 +346,7 @@ interp_exit()
     }
 #endif
     DELETE_LOCK(bb_building_lock);
+    decode_cache_exit();
 
     LOG(GLOBAL, LOG_INTERP|LOG_STATS, 1, "Total application code seen: %d KB\n",
         GLOBAL_STAT(app_code_seen)/1024);
@@ -2999,7 +3202,11 @@ build_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
             bb->instr_start = bb->cur_pc;
             if (bb->full_decode) {
                 /* only going through this do loop once! */
-                bb->cur_pc = decode(dcontext, bb->cur_pc, bb->instr);
+                /* selfmod copies and sandboxed code change too often to cache */
+                if (bb->pretend_pc == NULL && !TEST(FRAG_SELFMOD_SANDBOXED, bb->flags))
+                    bb->cur_pc = decode_cached(dcontext, bb->cur_pc, bb->instr);
+                else
+                    bb->cur_pc = decode(dcontext, bb->cur_pc, bb->instr);
                 if (bb->record_translation)
                     instr_set_translation(bb->instr, bb->instr_start);
             } else {
@@ -4518,6 +4725,7 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
     bool image_entry;
     KSTART(bb_building);
     dcontext->whereami = WHERE_INTERP;
+    heap_ir_arena_enter(dcontext);
 
     /* Neither thin_client nor hotp_only should be building any bbs. */
     ASSERT(!RUNNING_WITHOUT_CODE_CACHE());
@@ -4614,6 +4822,7 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
 
     exit_interp_build_bb(dcontext, &bb);
  build_basic_block_fragment_done:
+    heap_ir_arena_exit(dcontext);
     dcontext->whereami = wherewasi;
     KSTOP(bb_building);
     return f;
@@ -4807,7 +5016,12 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
         for (i=0; i<t->num_bbs; i++) {
             void *vmlist = NULL;
             apc = (byte *) t->bbs[i].tag;
-            bb = recreate_bb_ilist(dcontext, apc, apc, 0/*no pre flags*/,
+            /* -shadow_ret_stack code depends on FRAG_SHARED, and trace
+             * components come from temp-private copies of shared bbs
+             */
+            bb = recreate_bb_ilist(dcontext, apc, apc,
+                                   DYNAMO_OPTION(shadow_ret_stack) ?
+                                   FRAG_TEMP_PRIVATE : 0/*no pre flags*/,
                                    &flags, &md.final_exit_flags,
                                    true/*check vm area*/, !mangle_at_end,
                                    (mangle_at_end ? &vmlist : NULL)
@@ -5860,6 +6074,180 @@ append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
     return added_size;
 }
 
+/* Increments a 32-bit counter with no eflags side effects, clobbering XCX. */
+static int
+insert_inline_ibl_counter_inc(dcontext_t *dcontext, instrlist_t *trace, instr_t *where,
+                              uint *counter, int delta)
+{
+    int added_size = 0;
+    opnd_t counter_opnd = OPND_CREATE_ABSMEM(counter, OPSZ_4);
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_ECX), counter_opnd));
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ECX),
+                          opnd_create_base_disp(REG_ECX, REG_NULL, 0, delta, OPSZ_lea)));
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         INSTR_CREATE_mov_st(dcontext, counter_opnd, opnd_create_reg(REG_ECX)));
+    return added_size;
+}
+
+/* Adds tag to XCX (or subtracts it if negate) with no eflags side effects.
+ * Tags that do not fit in a lea displacement need XAX as a temporary.
+ */
+static int
+insert_inline_ibl_add_tag(dcontext_t *dcontext, instrlist_t *trace, instr_t *where,
+                          app_pc tag, bool negate)
+{
+    int added_size = 0;
+    ptr_int_t val = negate ? -(ptr_int_t)tag : (ptr_int_t)tag;
+#ifdef X64
+    if (X64_MODE_DC(dcontext) && !CHECK_TRUNCATE_TYPE_int(val)) {
+        opnd_t xax_slot = opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT));
+        added_size += tracelist_add
+            (dcontext, trace, where,
+             INSTR_CREATE_mov_st(dcontext, xax_slot, opnd_create_reg(REG_XAX)));
+        added_size += tracelist_add
+            (dcontext, trace, where,
+             INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XAX),
+                                  OPND_CREATE_INTPTR(val)));
+        added_size += tracelist_add
+            (dcontext, trace, where,
+             INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XCX),
+                              opnd_create_base_disp(REG_XCX, REG_XAX, 1, 0, OPSZ_lea)));
+        added_size += tracelist_add
+            (dcontext, trace, where,
+             INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_XAX), xax_slot));
+        return added_size;
+    }
+#endif
+    added_size += tracelist_add
+        (dcontext, trace, where,
+         INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XCX),
+                          opnd_create_base_disp(REG_XCX, REG_NULL, 0, (int)val,
+                                                OPSZ_lea)));
+    return added_size;
+}
+
+/* -ibl_inline_targets: turns the last IBL exit of a trace into a polymorphic
+ * inline cache over site->targets, a generalization of
+ * append_trace_speculate_last_ibl() to several targets with counters that
+ * drive re-specialization (see monitor_ibl_inline_retarget()).
+ * Returns additional size to add to trace estimate.
+ */
+int
+append_trace_inline_ibl_targets(dcontext_t *dcontext, instrlist_t *trace,
+                                ibl_inline_site_t *site)
+{
+    int added_size = 0;
+    uint i;
+    instr_t *targeter = instrlist_last(trace);
+    instr_t *jecxz, *skip;
+    instr_t *next_label, *retarget_label, *resume_label;
+    opnd_t xax_slot = opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT));
+
+    ASSERT(targeter != NULL && instr_is_exit_cti(targeter));
+    ASSERT(site->num_targets > 0 && site->num_targets <= IBL_INLINE_MAX_TARGETS);
+#ifdef X64
+    /* the x86-to-x64 ib mangling keeps app state in r8-r10, which we don't
+     * bother to handle
+     */
+    if (X64_CACHE_MODE_DC(dcontext) && !X64_MODE_DC(dcontext))
+        return 0;
+#endif
+    instrlist_set_translation_target(trace, instr_get_translation(targeter));
+    instrlist_set_our_mangling(trace, true); /* PR 267260 */
+
+    /* XCX holds the app target; per target we emit:
+     *
+     *      lea   -tag_i(%xcx) -> %xcx
+     *      jecxz hit_i
+     *      lea   tag_i(%xcx) -> %xcx
+     *      jmp   next_i
+     *   hit_i:                  # xcx is 0 so we can use it for the counter
+     *      <inc hits[i]>
+     *      <restore app xcx>
+     *      jmp   tag_i          # direct exit
+     *   next_i:
+     *
+     * and on a miss we record the target and count down to asking for a
+     * re-specialization, keeping the target in the xax slot, which the ibl
+     * routine itself overwrites on entry:
+     *
+     *      mov   %xcx -> xax_slot
+     *      mov   %xcx -> last_miss
+     *      <dec countdown>
+     *      jecxz retarget
+     *      jmp   resume
+     *   retarget:
+     *      mov   $1 -> ibl_inline_retarget_pending
+     *   resume:
+     *      mov   xax_slot -> %xcx
+     *      jmp   <exit stub: IBL>
+     */
+    for (i = 0; i < site->num_targets; i++) {
+        instr_t *hit_label = INSTR_CREATE_label(dcontext);
+        next_label = INSTR_CREATE_label(dcontext);
+        added_size += insert_inline_ibl_add_tag(dcontext, trace, targeter,
+                                                site->targets[i], true/*negate*/);
+        jecxz = INSTR_CREATE_jecxz(dcontext, opnd_create_instr(hit_label));
+        /* do not treat jecxz as exit cti! */
+        instr_set_ok_to_mangle(jecxz, false);
+        added_size += tracelist_add(dcontext, trace, targeter, jecxz);
+        added_size += insert_inline_ibl_add_tag(dcontext, trace, targeter,
+                                                site->targets[i], false);
+        skip = INSTR_CREATE_jmp_short(dcontext, opnd_create_instr(next_label));
+        instr_set_ok_to_mangle(skip, false);
+        added_size += tracelist_add(dcontext, trace, targeter, skip);
+        added_size += tracelist_add(dcontext, trace, targeter, hit_label);
+        added_size += insert_inline_ibl_counter_inc(dcontext, trace, targeter,
+                                                    &site->hits[i], 1);
+        added_size += insert_restore_spilled_xcx(dcontext, trace, targeter);
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_jmp(dcontext, opnd_create_pc(site->targets[i])));
+        added_size += tracelist_add(dcontext, trace, targeter, next_label);
+    }
+
+    retarget_label = INSTR_CREATE_label(dcontext);
+    resume_label = INSTR_CREATE_label(dcontext);
+    added_size += tracelist_add
+        (dcontext, trace, targeter,
+         INSTR_CREATE_mov_st(dcontext, xax_slot, opnd_create_reg(REG_XCX)));
+    added_size += tracelist_add
+        (dcontext, trace, targeter,
+         INSTR_CREATE_mov_st(dcontext, OPND_CREATE_ABSMEM(&site->last_miss, OPSZ_PTR),
+                             opnd_create_reg(REG_XCX)));
+    added_size += insert_inline_ibl_counter_inc(dcontext, trace, targeter,
+                                                &site->countdown, -1);
+    jecxz = INSTR_CREATE_jecxz(dcontext, opnd_create_instr(retarget_label));
+    instr_set_ok_to_mangle(jecxz, false);
+    added_size += tracelist_add(dcontext, trace, targeter, jecxz);
+    skip = INSTR_CREATE_jmp_short(dcontext, opnd_create_instr(resume_label));
+    instr_set_ok_to_mangle(skip, false);
+    added_size += tracelist_add(dcontext, trace, targeter, skip);
+    added_size += tracelist_add(dcontext, trace, targeter, retarget_label);
+    added_size += tracelist_add
+        (dcontext, trace, targeter,
+         INSTR_CREATE_mov_st(dcontext,
+                             OPND_CREATE_ABSMEM(&ibl_inline_retarget_pending, OPSZ_1),
+                             OPND_CREATE_INT8(1)));
+    added_size += tracelist_add(dcontext, trace, targeter, resume_label);
+    added_size += tracelist_add
+        (dcontext, trace, targeter,
+         INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_XCX), xax_slot));
+
+    LOG(THREAD, LOG_INTERP, 3,
+        "append_trace_inline_ibl_targets: %d inline target(s) for trace "PFX"\n",
+        site->num_targets, site->tag);
+
+    instrlist_set_translation_target(trace, NULL);
+    instrlist_set_our_mangling(trace, false); /* PR 267260 */
+    return added_size;
+}
+
 #ifdef HASHTABLE_STATISTICS
 /* Add a counter on last IBL exit
  * if speculate_next_tag is not NULL then check case 4817's possible success
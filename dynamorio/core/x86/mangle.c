@@ -3942,6 +3942,201 @@ mangle_seg_ref(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
 }
 #endif /* UNIX */
 
+/***************************************************************************
+ * SHADOW RETURN STACK
+ *
+ * With -shadow_ret_stack, a call ending a bb pushes its return address and
+ * the cache pc of an extra direct exit to that return address (its "landing")
+ * onto the thread's ring, and a ret ending a bb compares its target against
+ * the top entry, jumping to the landing on a match and only falling through
+ * to its ibl exit otherwise.  Only a hit pops: a call that pushed nothing
+ * (one in a trace) then costs just its own return, while a return that
+ * popped nothing or an unwind (longjmp, exceptions) leaves stale entries
+ * that only the frames beneath them miss on.  None of this touches the
+ * eflags.
+ */
+
+/* Returns whether instr, whose mangling precedes the final exit cti
+ * next_instr, should use -shadow_ret_stack.  We only handle shared bbs:
+ * traces are built from temp-private copies and so stay free of the
+ * absolute cache pcs we embed, and coarse units are relocated.
+ */
+static bool
+shadow_ret_stack_applies(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
+                         instr_t *next_instr, bool mangle_calls, uint flags)
+{
+    int opc = instr_get_opcode(instr);
+    if (!DYNAMO_OPTION(shadow_ret_stack) || !TEST(FRAG_SHARED, flags) ||
+        TESTANY(FRAG_IS_TRACE | FRAG_TEMP_PRIVATE | FRAG_COARSE_GRAIN, flags))
+        return false;
+#ifdef X64
+    if (!X64_MODE_DC(dcontext) || DYNAMO_OPTION(x86_to_x64))
+        return false;
+#endif
+    if (next_instr == NULL || next_instr != instrlist_last(ilist) ||
+        !instr_is_exit_cti(next_instr))
+        return false;
+    /* the ring holds pointer-sized return addresses */
+    if (TEST(PREFIX_DATA, instr_get_prefixes(instr)))
+        return false;
+    if (opc == OP_call || opc == OP_call_ind)
+        return mangle_calls;
+    return opc == OP_ret;
+}
+
+/* Points xax at the ring entry whose index is in xdx (zero-extended) */
+static void
+insert_shadow_ret_entry_addr(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                             reg_id_t base)
+{
+#ifdef X64
+    /* entries are 16 bytes, beyond a lea scale */
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_EDX),
+                         opnd_create_base_disp(REG_XDX, REG_XDX, 1, 0, OPSZ_lea)));
+#endif
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XAX),
+                         opnd_create_base_disp(base, REG_XDX, 8,
+                                               offsetof(shadow_ret_stack_t, entry),
+                                               OPSZ_lea)));
+}
+
+#ifdef DEBUG
+/* Flag-free increment of one of the ring's uint counters */
+static void
+insert_shadow_ret_count(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                        reg_id_t base, int offs)
+{
+    PRE(ilist, where, INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_EDX),
+                                          OPND_CREATE_MEM32(base, offs)));
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_EDX),
+                         opnd_create_base_disp(REG_XDX, REG_NULL, 0, 1, OPSZ_lea)));
+    PRE(ilist, where, INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM32(base, offs),
+                                          opnd_create_reg(REG_EDX)));
+}
+#endif
+
+/* Inserts before where (the call's exit cti) the push of retaddr and of the
+ * cache pc of landing, a not-yet-inserted exit cti to retaddr.
+ */
+static void
+insert_shadow_ret_push(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                       app_pc retaddr, instr_t *landing)
+{
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XAX, TLS_XAX_SLOT));
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XDX, TLS_XDX_SLOT));
+    PRE(ilist, where,
+        instr_create_restore_from_tls(dcontext, REG_XAX, TLS_SHADOW_RET_STACK_SLOT));
+    /* bump the top with byte stores so it wraps */
+    PRE(ilist, where, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_EDX),
+                                         OPND_CREATE_MEM8(REG_XAX, 0)));
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_EDX),
+                         opnd_create_base_disp(REG_XDX, REG_NULL, 0, 1, OPSZ_lea)));
+    PRE(ilist, where, INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM8(REG_XAX, 0),
+                                          opnd_create_reg(REG_DL)));
+    PRE(ilist, where, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_EDX),
+                                         opnd_create_reg(REG_DL)));
+    insert_shadow_ret_entry_addr(dcontext, ilist, where, REG_XAX);
+    PRE(ilist, where, INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XDX),
+                                           OPND_CREATE_INTPTR(-(ptr_int_t)retaddr)));
+    PRE(ilist, where,
+        INSTR_CREATE_mov_st(dcontext,
+                            OPND_CREATE_MEMPTR(REG_XAX, offsetof(shadow_ret_entry_t,
+                                                                 neg_retaddr)),
+                            opnd_create_reg(REG_XDX)));
+    PRE(ilist, where,
+        INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_XDX),
+                             opnd_create_instr_ex(landing, OPSZ_PTR, 0)));
+    PRE(ilist, where,
+        INSTR_CREATE_mov_st(dcontext,
+                            OPND_CREATE_MEMPTR(REG_XAX, offsetof(shadow_ret_entry_t,
+                                                                 landing)),
+                            opnd_create_reg(REG_XDX)));
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XDX, TLS_XDX_SLOT));
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XAX, TLS_XAX_SLOT));
+    STATS_INC(num_shadow_ret_calls);
+}
+
+/* Inserts before where (the ret's ibl exit cti, with the app target in xcx)
+ * the comparison against the ring's top entry.  On a match it branches to
+ * hit, whose code is added by append_shadow_ret_hit() past the final exit.
+ */
+static void
+insert_shadow_ret_check(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                        instr_t *hit)
+{
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XAX, TLS_XAX_SLOT));
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XDX, TLS_XDX_SLOT));
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where,
+        instr_create_restore_from_tls(dcontext, REG_XBX, TLS_SHADOW_RET_STACK_SLOT));
+    PRE(ilist, where, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_EDX),
+                                         OPND_CREATE_MEM8(REG_XBX, 0)));
+    insert_shadow_ret_entry_addr(dcontext, ilist, where, REG_XBX);
+    /* target - retaddr lands in xcx for the jecxz, the target in xdx */
+    PRE(ilist, where,
+        INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_XDX),
+                            OPND_CREATE_MEMPTR(REG_XAX, offsetof(shadow_ret_entry_t,
+                                                                 neg_retaddr))));
+    PRE(ilist, where,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XDX),
+                         opnd_create_base_disp(REG_XCX, REG_XDX, 1, 0, OPSZ_lea)));
+    PRE(ilist, where, INSTR_CREATE_xchg(dcontext, opnd_create_reg(REG_XCX),
+                                        opnd_create_reg(REG_XDX)));
+    PRE(ilist, where, INSTR_CREATE_jecxz(dcontext, opnd_create_instr(hit)));
+    /* miss: the ibl expects the target in xcx */
+    PRE(ilist, where, INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_XCX),
+                                          opnd_create_reg(REG_XDX)));
+#ifdef DEBUG
+    insert_shadow_ret_count(dcontext, ilist, where, REG_XBX,
+                            offsetof(shadow_ret_stack_t, misses));
+#endif
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XDX, TLS_XDX_SLOT));
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XAX, TLS_XAX_SLOT));
+    STATS_INC(num_shadow_ret_returns);
+}
+
+/* Appends the out-of-line match path for insert_shadow_ret_check(): pops
+ * the entry, restores the app's registers (including the xcx spilled by
+ * mangle_return()) and jumps to the landing.  It shares the check's
+ * translation so that translate_walk_track() picks the spills live at the
+ * jecxz back up past the final exit.
+ */
+static void
+append_shadow_ret_hit(dcontext_t *dcontext, instrlist_t *ilist, instr_t *hit)
+{
+    instr_t *jmp = INSTR_CREATE_jmp_ind(dcontext, opnd_create_tls_slot
+                                        (os_tls_offset(TLS_SHADOW_RET_TARGET_SLOT)));
+    instrlist_meta_append(ilist, hit);
+    instrlist_meta_append(ilist, jmp);
+    PRE(ilist, jmp, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_EDX),
+                                       OPND_CREATE_MEM8(REG_XBX, 0)));
+    PRE(ilist, jmp,
+        INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_EDX),
+                         opnd_create_base_disp(REG_XDX, REG_NULL, 0, -1, OPSZ_lea)));
+    PRE(ilist, jmp, INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM8(REG_XBX, 0),
+                                        opnd_create_reg(REG_DL)));
+#ifdef DEBUG
+    insert_shadow_ret_count(dcontext, ilist, jmp, REG_XBX,
+                            offsetof(shadow_ret_stack_t, hits));
+#endif
+    PRE(ilist, jmp,
+        INSTR_CREATE_mov_ld(dcontext, opnd_create_reg(REG_XDX),
+                            OPND_CREATE_MEMPTR(REG_XAX, offsetof(shadow_ret_entry_t,
+                                                                 landing))));
+    PRE(ilist, jmp,
+        instr_create_save_to_tls(dcontext, REG_XDX, TLS_SHADOW_RET_TARGET_SLOT));
+    PRE(ilist, jmp,
+        instr_create_restore_from_tls(dcontext, REG_XCX, MANGLE_XCX_SPILL_SLOT));
+    PRE(ilist, jmp, instr_create_restore_from_tls(dcontext, REG_XBX, TLS_XBX_SLOT));
+    PRE(ilist, jmp, instr_create_restore_from_tls(dcontext, REG_XDX, TLS_XDX_SLOT));
+    PRE(ilist, jmp, instr_create_restore_from_tls(dcontext, REG_XAX, TLS_XAX_SLOT));
+}
+
 /* TOP-LEVEL MANGLE
  * This routine is responsible for mangling a fragment into the form
  * we'd like prior to placing it in the code cache
@@ -3954,6 +4149,10 @@ mangle(dcontext_t *dcontext, instrlist_t *ilist, uint *flags INOUT,
        bool mangle_calls, bool record_translation)
 {
     instr_t *instr, *next_instr;
+    /* -shadow_ret_stack code to place after the final exit */
+    instr_t *shadow_landing = NULL, *shadow_hit = NULL;
+    app_pc shadow_xl8 = NULL, shadow_retaddr = NULL;
+    bool shadow_push = false;
 #ifdef WINDOWS
     bool ignorable_sysenter = DYNAMO_OPTION(ignore_syscalls) &&
         DYNAMO_OPTION(ignore_syscalls_follow_sysenter) &&
@@ -4106,6 +4305,24 @@ mangle(dcontext_t *dcontext, instrlist_t *ilist, uint *flags INOUT,
         }
 #endif
 
+        if (shadow_ret_stack_applies(dcontext, ilist, instr, next_instr,
+                                     mangle_calls, *flags)) {
+            shadow_xl8 = instr_get_translation(instr);
+            if (shadow_xl8 == NULL)
+                shadow_xl8 = instr_get_raw_bits(instr);
+            if (instr_is_return(instr))
+                shadow_hit = INSTR_CREATE_label(dcontext);
+            else {
+                shadow_retaddr = (app_pc)
+                    get_call_return_address(dcontext, ilist, instr);
+                shadow_landing = INSTR_CREATE_jmp(dcontext,
+                                                  opnd_create_pc(shadow_retaddr));
+                instr_exit_branch_set_type(shadow_landing,
+                                           instr_branch_type(shadow_landing));
+                shadow_push = true;
+            }
+        }
+
         if (instr_is_call_direct(instr)) {
             /* mangle_direct_call may inline a call and remove next_instr, so
              * it passes us the updated next instr */
@@ -4116,12 +4333,36 @@ mangle(dcontext_t *dcontext, instrlist_t *ilist, uint *flags INOUT,
                                  *flags);
         } else if (instr_is_return(instr)) {
             mangle_return(dcontext, ilist, instr, next_instr, *flags);
+            if (shadow_hit != NULL)
+                insert_shadow_ret_check(dcontext, ilist, next_instr, shadow_hit);
         } else if (instr_is_mbr(instr)) {
             mangle_indirect_jump(dcontext, ilist, instr, next_instr, *flags);
         } else if (instr_get_opcode(instr) == OP_jmp_far) {
             mangle_far_direct_jump(dcontext, ilist, instr, next_instr, *flags);
         }
         /* else nothing to do, e.g. direct branches */
+
+        if (shadow_push) {
+            /* after the app's push and any faultable target load, so that an
+             * app fault never has our code earlier in its mangling region
+             */
+            insert_shadow_ret_push(dcontext, ilist, next_instr, shadow_retaddr,
+                                   shadow_landing);
+            shadow_push = false;
+        }
+    }
+
+    /* The final exit is now last: add any -shadow_ret_stack out-of-line code.
+     * Code after the last exit only keeps final_exit_shares_prev_stub() from
+     * applying, which requires a cbr before the final exit anyway.
+     */
+    if (shadow_landing != NULL || shadow_hit != NULL) {
+        if (record_translation)
+            instrlist_set_translation_target(ilist, shadow_xl8);
+        if (shadow_landing != NULL)
+            instrlist_append(ilist, shadow_landing);
+        else
+            append_shadow_ret_hit(dcontext, ilist, shadow_hit);
     }
 
 #ifdef WINDOWS
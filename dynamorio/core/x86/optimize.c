@@ -103,6 +103,7 @@ static bool is_dead_register(reg_id_t reg,instr_t *where);
 static reg_id_t find_dead_register_across_instrs(instr_t *start,instr_t *end);
 static bool is_nop(instr_t *inst);
 void remove_inst(dcontext_t *dcontext, instrlist_t *ilist, instr_t *inst);
+static int reg_rep_index(reg_id_t reg, bool enclosing);
 
 /* for using a 24 entry bool array to represent some property about 
  * about normal registers and sub register (eax -> dl) */
@@ -121,19 +122,74 @@ void loginst(dcontext_t *dcontext, uint level, instr_t *instr, const char *strin
 void logopnd(dcontext_t *dcontext, uint level, opnd_t opnd, const char *string);
 void logtrace(dcontext_t *dcontext, uint level, instrlist_t *trace, const char *string);
 
+#ifdef DEBUG
+/* per-pass accounting of instrs removed, reported by print_optimization_stats() */
+enum {
+    OPT_PASS_CALL_RETURN_MATCHING,
+    OPT_PASS_UNROLL_LOOPS,
+    OPT_PASS_VECTORIZE,
+    OPT_PASS_PREFETCH,
+    OPT_PASS_RLR,
+    OPT_PASS_REMOVE_UNNECESSARY_ZEROING,
+    OPT_PASS_CONSTANT_PROP,
+    OPT_PASS_REMOVE_DEAD_CODE,
+    OPT_PASS_STACK_ADJUST,
+    OPT_PASS_PEEPHOLE,
+    NUM_OPT_PASSES
+};
+
+static const char * const opt_pass_names[NUM_OPT_PASSES] = {
+    "call_return_matching",
+    "unroll_loops",
+    "vectorize",
+    "prefetch",
+    "rlr",
+    "remove_unnecessary_zeroing",
+    "constant_prop",
+    "remove_dead_code",
+    "stack_adjust",
+    "peephole",
+};
+
+/* FIXME: racy, like the rest of opt_stats_t */
+static int opt_pass_instrs_removed[NUM_OPT_PASSES];
+
+/* nops are not counted since several passes "remove" an instr by
+ * replacing it with a nop
+ */
+static int
+count_non_nop_instrs(instrlist_t *trace)
+{
+    instr_t *inst;
+    int count = 0;
+    for (inst = instrlist_first(trace); inst != NULL; inst = instr_get_next(inst)) {
+        if (instr_get_opcode(inst) != OP_nop)
+            count++;
+    }
+    return count;
+}
 
-
+/* a negative count means the pass added instrs (e.g., prefetch or unrolling) */
+# define RUN_OPT_PASS(pass, call) do {                                   \
+    int pre_count_ = count_non_nop_instrs(trace);                       \
+    call;                                                               \
+    opt_pass_instrs_removed[pass] += pre_count_ - count_non_nop_instrs(trace); \
+} while (0)
+#else
+# define RUN_OPT_PASS(pass, call) call
+#endif
 
 /****************************************************************************/
 /* master routine */
 
+/* Each pass is selected by its own option and can be combined with any other.
+ * On x64 the passes only track 32-bit and narrower values and leave anything
+ * they do not model (64-bit operands, rip-relative and 64-bit absolute
+ * addresses, r8-r15) alone.
+ */
 void 
 optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
-    /* we have un-truncation-check 32-bit casts for opnd_get_immed_int(), for
-     * one thing, here and in loadtoconst.c */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
-
     /* FIXME: this routine is of course not in its final form
      * we are still playing with different optimizations
      */
@@ -157,43 +213,43 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     }
 
     if (dynamo_options.call_return_matching) {
-        call_return_matching(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_CALL_RETURN_MATCHING, call_return_matching(dcontext, tag, trace));
     }
 
     if (dynamo_options.unroll_loops) {
-        unroll_loops(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_UNROLL_LOOPS, unroll_loops(dcontext, tag, trace));
     }
 
     if (dynamo_options.vectorize) {
-        identify_for_loop(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_VECTORIZE, identify_for_loop(dcontext, tag, trace));
     }
 
     if (dynamo_options.prefetch) {
-        prefetch_optimize_trace(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_PREFETCH, prefetch_optimize_trace(dcontext, tag, trace));
     }
 
     if (dynamo_options.rlr) {
-        remove_redundant_loads(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_RLR, remove_redundant_loads(dcontext, tag, trace));
     }
 
     if (dynamo_options.remove_unnecessary_zeroing) {
-        remove_unnecessary_zeroing(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_REMOVE_UNNECESSARY_ZEROING, remove_unnecessary_zeroing(dcontext, tag, trace));
     }
 
     if (dynamo_options.constant_prop) {
-        constant_propagation(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_CONSTANT_PROP, constant_propagation(dcontext, tag, trace));
     }
 
     if (dynamo_options.remove_dead_code) {
-        remove_dead_code(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_REMOVE_DEAD_CODE, remove_dead_code(dcontext, tag, trace));
     }
 
     if (dynamo_options.stack_adjust) {
-        stack_adjust_combiner(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_STACK_ADJUST, stack_adjust_combiner(dcontext, tag, trace));
     }
 
     if (dynamo_options.peephole) {
-        peephole_optimize(dcontext, tag, trace);
+        RUN_OPT_PASS(OPT_PASS_PEEPHOLE, peephole_optimize(dcontext, tag, trace));
     }
 
 #ifdef IA32_ON_IA64
@@ -270,6 +326,7 @@ static struct {
 void
 print_optimization_stats()
 {
+    int i;
     if (dynamo_options.rlr) {
         uint top, bottom;
         LOG(GLOBAL, LOG_OPTS, 1, 
@@ -343,6 +400,14 @@ print_optimization_stats()
         LOG(GLOBAL, LOG_OPTS, 1, "     %d jmps (cbr) in traces\n", opt_stats_t.post_num_jmps_seen);
     }
 
+    LOG(GLOBAL, LOG_OPTS, 1, "Instrs removed per pass (negative = added)\n");
+    for (i = 0; i < NUM_OPT_PASSES; i++) {
+        if (opt_pass_instrs_removed[i] != 0) {
+            LOG(GLOBAL, LOG_OPTS, 1, "   %-26s %d\n", opt_pass_names[i],
+                opt_pass_instrs_removed[i]);
+        }
+    }
+
 #ifdef IA32_ON_IA64
     if (dynamo_options.test_i64) {
         if (opt_stats_t.i64_test)
@@ -1265,7 +1330,7 @@ typedef struct _prop_state_t {
     byte reg_state[8];
     int reg_vals[8];
     /* constant address */
-    int addresses[NUM_CONSTANT_ADDRESS];
+    ptr_int_t addresses[NUM_CONSTANT_ADDRESS];
     int address_vals[NUM_CONSTANT_ADDRESS];
     byte address_state[NUM_CONSTANT_ADDRESS];
 
@@ -1375,7 +1440,7 @@ clear_stack_val(prop_state_t *state, int address)
 
 /* adds an address value pair to the constant address cache */
 static void 
-set_address_val(prop_state_t *state, int address, int val, byte flags)
+set_address_val(prop_state_t *state, ptr_int_t address, int val, byte flags)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1392,7 +1457,7 @@ set_address_val(prop_state_t *state, int address, int val, byte flags)
     }
     if (cont) {
         LOG(THREAD, LOG_OPTS, 3, "constant address cache overflow\n");
-        i = address % NUM_CONSTANT_ADDRESS;
+        i = (int) (address % NUM_CONSTANT_ADDRESS);
         ASSERT(i>0 && i<NUM_CONSTANT_ADDRESS);
         state->addresses[i] = address;
         state->address_vals[i] = val;
@@ -1404,7 +1469,7 @@ set_address_val(prop_state_t *state, int address, int val, byte flags)
 /* updates and address value pair in the constant address cache if the address is
  * already there, else adds it */
 static void 
-update_address_val(prop_state_t *state, int address, int val)
+update_address_val(prop_state_t *state, ptr_int_t address, int val)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1427,7 +1492,7 @@ update_address_val(prop_state_t *state, int address, int val)
 
 /* removes the address from the constant address cache */
 static void 
-clear_address_val(prop_state_t *state, int address)
+clear_address_val(prop_state_t *state, ptr_int_t address)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1454,22 +1519,19 @@ get_immutable_value(opnd_t address, prop_state_t *state, int size)
     switch(size) {
     case OPSZ_1: 
         {
-            char *ptr_byte = ((char*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            char *ptr_byte = (char *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
     case OPSZ_2:
         { 
-            short *ptr_byte = ((short*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            short *ptr_byte = (short *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
     case OPSZ_4:
         {
-            int *ptr_byte = ((int*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            int *ptr_byte = (int *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
@@ -1497,7 +1559,7 @@ static bool
 opnd_is_stack_address(opnd_t address)
 {
     return (opnd_is_near_base_disp(address) && 
-            (opnd_get_base(address) == REG_EBP) && 
+            (opnd_get_base(address) == REG_XBP) && 
             (opnd_get_index(address) == REG_NULL));
 }
 
@@ -1527,9 +1589,8 @@ const_address_const_mem(opnd_t address, prop_state_t *state, bool prefix_data)
 
     /* FIXME : is is_execuatable always right here? */
     /* i.e. is it going to be true, forever, that this location isn't writable */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
     if (cp_global_aggr > 1 &&
-        is_executable_address((app_pc)(ptr_int_t)opnd_get_disp(address)))
+        is_executable_address((app_pc) opnd_get_addr(address)))
         success = true;
 
     return success;
@@ -1546,9 +1607,17 @@ propagate_address(opnd_t old, prop_state_t *state)
     opnd_size_t size;
     bool modified;
     
-    if (!opnd_is_memory_reference(old))
+    /* rip-relative and 64-bit absolute addresses have no registers to fold */
+    if (!opnd_is_base_disp(old))
         return old;
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false)); /* rel and abs mem refs NYI */
+#ifdef X64
+    /* Only 32-bit register values are tracked, and folding one that is used
+     * in an address under an addr32 prefix into the displacement would change
+     * how the address is extended.  64-bit registers fall through untouched.
+     */
+    if (reg_is_32bit(opnd_get_base(old)) || reg_is_32bit(opnd_get_index(old)))
+        return old;
+#endif
     /* tries to simplify the address calculation with propagated values */
     base_reg = opnd_get_base(old) - REG_START_32;
     disp = opnd_get_disp(old);
@@ -1608,6 +1677,7 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
 
     reg_id_t reg;
     int immed, disp, i;
+    ptr_int_t addr;
     opnd_size_t size=OPSZ_NA;
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1677,6 +1747,11 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
             else
                 size = OPSZ_4;
         }
+#ifdef X64
+        /* cached stack and constant address values are at most 32 bits */
+        if (size != OPSZ_1 && size != OPSZ_2 && size != OPSZ_4)
+            return old;
+#endif
     }
 
     if (opnd_is_stack_address(old) && cp_local_aggr > 0) {
@@ -1704,9 +1779,9 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
             return opnd_create_immed_int(immed, size);      
         } else {
             // check for constant address
-            disp = opnd_get_disp(old);
+            addr = (ptr_int_t) opnd_get_addr(old);
             for (i = 0; i < NUM_CONSTANT_ADDRESS; i++) {
-                if (state->addresses[i] == disp && (state->address_state[i] & PS_VALID_VAL) != 0) {
+                if (state->addresses[i] == addr && (state->address_state[i] & PS_VALID_VAL) != 0) {
                     logopnd(state->dcontext, 3, old, " found cached constant address\n");
                     immed = state->address_vals[i];
                     return opnd_create_immed_int(immed, size);
@@ -2072,7 +2147,9 @@ prop_simplify(instr_t *inst, prop_state_t *state)
     if (opcode == OP_lea) {
         temp_opnd = instr_get_src(inst, 0);
         if (opnd_is_constant_address(temp_opnd)) {
-            inst = make_to_imm_store(inst, opnd_get_disp(temp_opnd), state);
+            /* truncation is what a 32-bit lea does too */
+            inst = make_to_imm_store(inst, (int)(ptr_int_t) opnd_get_addr(temp_opnd),
+                                     state);
         }
         return inst;
     }
@@ -2474,8 +2551,10 @@ get_trace_constant(prop_state_t *state)
     /* probably only use exc so just put it in, and maby eax to since is fav */
     /* when need to store flags/pass arg, can always add more location later */
     /* probably cleaner way of getting addresses but who cares for now */
+#ifndef X64 /* x64 spills to tls slots, not absolute dcontext fields */
     set_address_val(state, opnd_get_disp(opnd_create_dcontext_field(state->dcontext, XCX_OFFSET)), 0, PS_KEEP);
     set_address_val(state, opnd_get_disp(opnd_create_dcontext_field(state->dcontext, XAX_OFFSET)), 0, PS_KEEP);
+#endif
 }
 
 /* updates the prop state as appropriate */
@@ -2561,9 +2640,9 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
         } else {
             // do constant addresses
             if (opnd_is_constant_address(opnd) && cp_global_aggr > 0 ) {
-                int disp = opnd_get_disp(opnd);
+                ptr_int_t addr = (ptr_int_t) opnd_get_addr(opnd);
                 for (i = 0; i < NUM_CONSTANT_ADDRESS; i++) {
-                    if (state->addresses[i] == disp && state->address_vals[i] == val && (state->address_state[i] & PS_VALID_VAL) != 0) {
+                    if (state->addresses[i] == addr && state->address_vals[i] == val && (state->address_state[i] & PS_VALID_VAL) != 0) {
                         loginst(dcontext, 3, inst, " mem location already set to val, simplify ");
                         backup = INSTR_CREATE_nop(dcontext);
                         replace_inst(dcontext, state->trace, inst, backup);
@@ -2571,7 +2650,12 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
                         inst = backup;
                     }
                 }
-                update_address_val(state, disp, val);
+                update_address_val(state, addr, val);
+#ifdef X64
+                /* a sign-extended 64-bit store also overwrites the next slot */
+                if (opnd_get_size(opnd) == OPSZ_8)
+                    clear_address_val(state, addr + 4);
+#endif
             }
 
             // do stack vals
@@ -2589,7 +2673,10 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
                 }
 
                 update_stack_val(state, disp, val);
-
+#ifdef X64
+                if (opnd_get_size(opnd) == OPSZ_8)
+                    clear_stack_val(state, disp + 4);
+#endif
             }
         }
     } else {
@@ -2611,7 +2698,11 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
         for (i = 0; i < num_dst; i++) {
             opnd = instr_get_dst(inst, i);
             if (opnd_is_constant_address(opnd) && cp_global_aggr >0) {
-                clear_address_val(state, opnd_get_disp(opnd));
+                clear_address_val(state, (ptr_int_t) opnd_get_addr(opnd));
+#ifdef X64
+                if (opnd_get_size(opnd) == OPSZ_8)
+                    clear_address_val(state, (ptr_int_t) opnd_get_addr(opnd) + 4);
+#endif
             }
         }
         // update stack cahes
@@ -2619,6 +2710,10 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
             opnd = instr_get_dst(inst, i);
             if (opnd_is_stack_address(opnd) && cp_local_aggr > 0) {
                 clear_stack_val(state, opnd_get_disp(opnd));
+#ifdef X64
+                if (opnd_get_size(opnd) == OPSZ_8)
+                    clear_stack_val(state, opnd_get_disp(opnd) + 4);
+#endif
             }
         }
     }
@@ -2649,9 +2744,9 @@ handle_stack(prop_state_t *state, instr_t *inst)
     if (instr_get_opcode(inst) == OP_enter ||
         ((instr_get_opcode(inst) == OP_mov_st || instr_get_opcode(inst) == OP_mov_ld) && 
          opnd_is_reg(instr_get_src(inst, 0)) &&
-         opnd_get_reg(instr_get_src(inst, 0)) == REG_ESP &&
+         opnd_get_reg(instr_get_src(inst, 0)) == REG_XSP &&
          opnd_is_reg(instr_get_dst(inst, 0)) &&
-         opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) {
+         opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) {
         state->cur_scope++;
         LOG(THREAD, LOG_OPTS, 3, "Adjust scope up to %d\n", state->cur_scope);
         return inst; 
@@ -2659,7 +2754,7 @@ handle_stack(prop_state_t *state, instr_t *inst)
     if (instr_get_opcode(inst) == OP_leave ||
         (instr_get_opcode(inst) == OP_pop &&
          opnd_is_reg(instr_get_dst(inst, 0)) &&
-         opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) { 
+         opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) { 
         state->cur_scope--;
 
         for (i = 0; i < NUM_STACK_SLOTS; i++) {
@@ -2671,7 +2766,7 @@ handle_stack(prop_state_t *state, instr_t *inst)
         LOG(THREAD, LOG_OPTS, 3, "Adjust scope down to %d\n", state->cur_scope);
         return inst; 
     }
-    if (instr_writes_to_reg(inst, REG_EBP)) {
+    if (instr_writes_to_reg(inst, REG_XBP)) {
         loginst(dcontext, 2, inst, "Lost stack scope count"); 
         state->lost_scope_count = true;
         for (i = 0; i< NUM_STACK_SLOTS; i++) {
@@ -2708,6 +2803,26 @@ handle_stack(prop_state_t *state, instr_t *inst)
  *   any floating point stuff? probably not feasible or worthwhile
  */ 
 
+#ifdef X64
+/* Constant prop models 32-bit and narrower values only, so on x64 it does not
+ * propagate into an instr with a 64-bit register or memory operand (which
+ * includes push, pop, and call through their implicit stack operands).
+ */
+static bool
+instr_has_64bit_opnd(instr_t *inst)
+{
+    int i, num_src = instr_num_srcs(inst);
+    opnd_t opnd;
+    for (i = 0; i < num_src + instr_num_dsts(inst); i++) {
+        opnd = (i < num_src) ? instr_get_src(inst, i) : instr_get_dst(inst, i - num_src);
+        if ((opnd_is_reg(opnd) && reg_is_64bit(opnd_get_reg(opnd))) ||
+            (opnd_is_memory_reference(opnd) && opnd_get_size(opnd) == OPSZ_8))
+            return true;
+    }
+    return false;
+}
+#endif
+
 /* performs constant prop, loops through all the instruction updating the
  * prop state for each one, propagating information collected so far into 
  * opnds and and calling simplify on the results */
@@ -2760,8 +2875,16 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
         /* propagate to sources */
         num_src = instr_num_srcs(inst);
+        num_dst = instr_num_dsts(inst);
 
         loginst(dcontext, 3, inst, " checking");
+#ifdef X64
+        if (instr_has_64bit_opnd(inst)) {
+            loginst(dcontext, 3, inst, " has a 64-bit operand, not propagating into");
+            num_src = 0;
+            num_dst = 0;
+        }
+#endif
 
         for (i = 0; i < num_src; i++) {
             opnd = instr_get_src(inst, i);
@@ -2783,7 +2906,6 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             }
         }
         // propagate to dsts, just simplify addresses 
-        num_dst = instr_num_dsts(inst);
         for (i = 0; i < num_dst; i++) {
             opnd = instr_get_dst(inst, i);
             prop_opnd = propagate_address(opnd, &state);
@@ -2875,8 +2997,12 @@ remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     }
     for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
         next_inst = instr_get_next(inst);
-        if (is_zeroing_instr(inst)) {
-            cur_reg = opnd_get_reg(instr_get_dst(inst,0)) - REG_START_32;
+        /* zeroing a register without a slot of its own (e.g., sil) is
+         * handled below as a plain write to its enclosing register
+         */
+        if (is_zeroing_instr(inst) &&
+            reg_rep_index(opnd_get_reg(instr_get_dst(inst,0)), false) >= 0) {
+            cur_reg = reg_rep_index(opnd_get_reg(instr_get_dst(inst,0)), false);
             /* if zeroed (and also of all sub registers) then kill the inst 
              * otherwise mark reg and sub regs as zeroed  */
             if (check_down(zeroed, cur_reg)) {
@@ -2900,7 +3026,7 @@ remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                 for (i = 0; i < num_dsts; i++) {
                     dst = instr_get_dst(inst, i);
                     if (opnd_is_reg(dst)) {
-                        cur_reg = opnd_get_reg(dst) - REG_START_32;
+                        cur_reg = reg_rep_index(opnd_get_reg(dst), true);
                         propagate_down(zeroed, cur_reg, false);
                     }   
                 }
@@ -2927,7 +3053,8 @@ static int dc_global_aggr;
 static int dc_local_aggr;
 
 static void
-add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags)
+add_address(dcontext_t *dcontext, ptr_int_t address, byte flag, ptr_int_t *adds,
+            byte *flags)
 {
     bool cont = true;
     int i;
@@ -2940,7 +3067,7 @@ add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags
     }
     if (cont) {
         LOG(THREAD, LOG_OPTS, 3, "constant address cache overflow\n");
-        i = address % NUM_ADD_CACHE;
+        i = (int) (address % NUM_ADD_CACHE);
         adds[i] = address;
         flags[i] = flag;
     }
@@ -2948,7 +3075,7 @@ add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags
 }
 
 static bool
-address_is_dead(dcontext_t *dcontext, int address, int *adds, byte *flags)
+address_is_dead(dcontext_t *dcontext, ptr_int_t address, ptr_int_t *adds, byte *flags)
 {
     int i = 0;
     for (; i < NUM_ADD_CACHE; i++) 
@@ -2958,7 +3085,8 @@ address_is_dead(dcontext_t *dcontext, int address, int *adds, byte *flags)
 }
 
 static void
-address_set_dead(dcontext_t *dcontext, int address, int *adds, byte *flags, bool dead)
+address_set_dead(dcontext_t *dcontext, ptr_int_t address, ptr_int_t *adds, byte *flags,
+                 bool dead)
 {
     int i = 0;
     for (; i < NUM_ADD_CACHE; i++) {
@@ -2977,15 +3105,17 @@ address_set_dead(dcontext_t *dcontext, int address, int *adds, byte *flags, bool
 }
 
 static void
-add_init(dcontext_t *dcontext, int *addresses, byte *flags)
+add_init(dcontext_t *dcontext, ptr_int_t *addresses, byte *flags)
 {
     /* can add all dynamo addresses here, they are never aliased so always */
     /* safe to optimize, but takes up space in our cache, with new jump code */
     /* probably only use exc so just put it in, and maby eax to since is fav */
     /* when need to store flags/pass arg, can always add more location later */
     /* probably cleaner way of getting addresses but who cares for now */
+#ifndef X64 /* x64 spills to tls slots, not absolute dcontext fields */
     add_address(dcontext, opnd_get_disp(opnd_create_dcontext_field(dcontext, XCX_OFFSET)), ADD_KEEP, addresses, flags);
     add_address(dcontext, opnd_get_disp(opnd_create_dcontext_field(dcontext, XAX_OFFSET)), ADD_KEEP, addresses, flags);
+#endif
 }
 
 #if 0 /* not used */
@@ -3046,7 +3176,7 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     instr_t *inst, *prev_inst, *ecx_load;
     opnd_t dst, src;
     bool free[24];
-    int addresses[NUM_ADD_CACHE];
+    ptr_int_t addresses[NUM_ADD_CACHE];
     byte address_state[NUM_ADD_CACHE];
     
     int stack_scope[NUM_STACK_SLOTS];
@@ -3130,16 +3260,16 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             if (opcode == OP_leave || 
                 (opcode == OP_pop &&
                  opnd_is_reg(instr_get_dst(inst, 0)) &&
-                 opnd_get_reg(instr_get_dst(inst, 0))== REG_EBP)) { 
+                 opnd_get_reg(instr_get_dst(inst, 0))== REG_XBP)) { 
                 scope++;
                 LOG(THREAD, LOG_OPTS, 3, "cur scope + to %d\n", scope);
             } else {
                 if (opcode == OP_enter ||
                     ((opcode == OP_mov_st || opcode == OP_mov_ld) &&
                      opnd_is_reg(instr_get_src(inst, 0)) &&
-                     opnd_get_reg(instr_get_src(inst, 0)) == REG_ESP &&
+                     opnd_get_reg(instr_get_src(inst, 0)) == REG_XSP &&
                      opnd_is_reg(instr_get_dst(inst, 0)) &&
-                     opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) {
+                     opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) {
                     scope--;
                     LOG(THREAD, LOG_OPTS, 3, "cur scope - to %d\n", scope);
                     for (i = 0; i < NUM_STACK_SLOTS; i++) {
@@ -3148,7 +3278,7 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                         }
                     }    
                 } else {
-                    if (instr_writes_to_reg(inst, REG_EBP)) {
+                    if (instr_writes_to_reg(inst, REG_XBP)) {
                         LOG(THREAD, LOG_OPTS, 2, "dead code lost count of scope nesting, clearing cache\n");
                         for (i = 0; i < NUM_STACK_SLOTS; i++)  
                             stack_state[i] = 0;
@@ -3165,7 +3295,7 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             for (i = 0; (i < num_dsts) && killinst; i++) {
                 dst = instr_get_dst(inst, i);
                 if (opnd_is_reg(dst)) {
-                    dst_reg = opnd_get_reg(dst) - REG_START_32;
+                    dst_reg = reg_rep_index(opnd_get_reg(dst), false);
                     killinst = killinst && check_down(free, dst_reg);
                 } else {
                     if (opnd_is_constant_address(dst)) {
@@ -3179,7 +3309,13 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                                 remove_inst(dcontext, trace, ecx_load);
                             }
                         } else {
-                            killinst = killinst && address_is_dead(dcontext, opnd_get_disp(dst), addresses, address_state);
+                            /* on x64 an 8-byte store also covers the next
+                             * slot, which we do not bother checking
+                             */
+                            killinst = killinst &&
+                                IF_X64(opnd_get_size(dst) != OPSZ_8 &&)
+                                address_is_dead(dcontext, (ptr_int_t) opnd_get_addr(dst),
+                                                addresses, address_state);
                         }
                     } else {
                         if (opnd_is_stack_address(dst)) {
@@ -3220,12 +3356,12 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                     dst = instr_get_dst(inst, i);
                     if (opnd_is_reg(dst)) {
                         /* mark dst reg and sub regs as free */
-                        dst_reg = opnd_get_reg(dst) - REG_START_32;
+                        dst_reg = reg_rep_index(opnd_get_reg(dst), false);
                         propagate_down(free, dst_reg, true);
                     }
                     else {
                         if (opnd_is_constant_address(dst)) {
-                            address_set_dead(dcontext, opnd_get_disp(dst), 
+                            address_set_dead(dcontext, (ptr_int_t) opnd_get_addr(dst),
                                              addresses, address_state, true);
                         } else {
                             if (opnd_is_stack_address(dst)) {
@@ -3233,7 +3369,7 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                             } 
                             /* reg used in address mark as unfree */
                             for (j=opnd_num_regs_used(dst)-1; j>=0; j--) {
-                                dst_reg = opnd_get_reg_used(dst, j) - REG_START_32;
+                                dst_reg = reg_rep_index(opnd_get_reg_used(dst, j), true);
                                 propagate_down(free, dst_reg, false);
                             }
                         }
@@ -3246,14 +3382,21 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                         /* mark src regs and sub regs not free */
                         src = instr_get_src(inst, i);
                         if (opnd_is_constant_address(src)) {
-                            address_set_dead(dcontext, opnd_get_disp(src), 
+                            address_set_dead(dcontext, (ptr_int_t) opnd_get_addr(src),
                                              addresses, address_state, false);
+#ifdef X64
+                            if (opnd_get_size(src) == OPSZ_8) {
+                                address_set_dead(dcontext,
+                                                 (ptr_int_t) opnd_get_addr(src) + 4,
+                                                 addresses, address_state, false);
+                            }
+#endif
                         } else {
                             if (opnd_is_stack_address(src)) {
                                 stack_address_set_dead(dcontext, opnd_get_disp(src), scope, stack_offsets_ebp, stack_state, stack_scope, false); 
                             } 
                             for (j=opnd_num_regs_used(src)-1; j>=0; j--) {
-                                src_reg = opnd_get_reg_used(src, j) - REG_START_32;
+                                src_reg = reg_rep_index(opnd_get_reg_used(src, j), true);
                                 propagate_down(free, src_reg, false);
                             }
                         }
@@ -3288,15 +3431,15 @@ is_stack_adjustment(instr_t *inst)
     return (
             ((opcode == OP_add || opcode == OP_sub) &&
              opnd_is_reg(instr_get_dst(inst, 0)) &&
-             opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP &&
+             opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP &&
              opnd_is_immed_int(instr_get_src(inst, 0))) ||
 
             (opcode == OP_lea && 
-             opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP && 
-             ((opnd_get_base(instr_get_src(inst, 0)) == REG_ESP && 
+             opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP && 
+             ((opnd_get_base(instr_get_src(inst, 0)) == REG_XSP && 
                opnd_get_index(instr_get_src(inst, 0)) == REG_NULL ) ||
               (opnd_get_base(instr_get_src(inst, 0)) == REG_NULL &&
-               opnd_get_index(instr_get_src(inst, 0)) == REG_ESP &&
+               opnd_get_index(instr_get_src(inst, 0)) == REG_XSP &&
                opnd_get_scale(instr_get_src(inst, 0)) == 1))));
 }
 
@@ -3320,7 +3463,7 @@ set_stack_adjustment(instr_t *inst, int adjust)
     int opcode = instr_get_opcode(inst);
     opnd_t temp_opnd;
     if (opcode == OP_lea) {
-        instr_set_src(inst, 0, opnd_create_base_disp(REG_ESP, REG_NULL, 0, adjust, OPSZ_lea));
+        instr_set_src(inst, 0, opnd_create_base_disp(REG_XSP, REG_NULL, 0, adjust, OPSZ_lea));
         return;
     }
     if (opcode == OP_sub)
@@ -3384,7 +3527,7 @@ stack_adjust_combiner(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             /* could mangle pushes and pops instead of restoring, is */
             /* helpfull?, check for store to ecx_off, might mangle indirect */
             /* macro's by inserting a clean up instruction */
-            if (!instr_uses_reg(inst, REG_ESP) && !instr_is_cti(inst) && 
+            if (!instr_uses_reg(inst, REG_XSP) && !instr_is_cti(inst) && 
                 !instr_is_interrupt(inst) && !instr_is_call(inst)) {
                 /* skip writes to constant address, presume that they will never be stack */
                 if ((opcode == OP_mov_st || opcode == OP_mov_imm) && 
@@ -3497,7 +3640,7 @@ static instr_t *
 remove_return_no_save_eflags(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
 {
     instr_t *inst2;
-    int to_pop = 4;
+    int to_pop = (int) XSP_SZ;
     opnd_t replacement;
 #ifdef DEBUG
     opt_stats_t.num_returns_removed++;
@@ -3548,7 +3691,7 @@ remove_return_no_save_eflags(dcontext_t *dcontext, instrlist_t *trace, instr_t *
 
     /* check for add here, is not uncommon to pop off the args after a return, if so */
     /* can save an instruction */
-    if ((instr_get_opcode(inst) == OP_add) && opnd_is_reg(instr_get_dst(inst, 0)) && (opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP) && opnd_is_immed_int(instr_get_src(inst, 0))) {
+    if ((instr_get_opcode(inst) == OP_add) && opnd_is_reg(instr_get_dst(inst, 0)) && (opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP) && opnd_is_immed_int(instr_get_src(inst, 0))) {
         to_pop += (int) opnd_get_immed_int(instr_get_src(inst, 0));
 #ifdef DEBUG
         opt_stats_t.num_return_instrs_removed++;
@@ -3574,7 +3717,7 @@ remove_return_no_save_eflags(dcontext_t *dcontext, instrlist_t *trace, instr_t *
     } else {
         replacement = OPND_CREATE_INT32(to_pop);
     }
-    inst2 = INSTR_CREATE_add(dcontext, opnd_create_reg(REG_ESP), replacement);
+    inst2 = INSTR_CREATE_add(dcontext, opnd_create_reg(REG_XSP), replacement);
     loginst(dcontext, 3, inst2, "adjusting stack");
     instrlist_preinsert(trace, inst, inst2);
     return inst2;
@@ -3586,7 +3729,7 @@ remove_return(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
 {
     if (!INTERNAL_OPTION(unsafe_ignore_eflags_trace)) {
         instr_t *inst2;
-        int to_pop = 4;
+        int to_pop = (int) XSP_SZ;
         opnd_t replacement;
 #ifdef DEBUG
         opt_stats_t.num_returns_removed++;
@@ -3651,7 +3794,7 @@ remove_return(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
          * if so  can save an instruction */
         if ((instr_get_opcode(inst) == OP_add) &&
             opnd_is_reg(instr_get_dst(inst, 0)) &&
-            (opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP) &&
+            (opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP) &&
             opnd_is_immed_int(instr_get_src(inst, 0))) {
             to_pop += (int) opnd_get_immed_int(instr_get_src(inst, 0));
 #ifdef DEBUG
@@ -3680,13 +3823,13 @@ remove_return(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
                 replacement = OPND_CREATE_INT32(to_pop);
             }
             inst2 =
-                INSTR_CREATE_add(dcontext, opnd_create_reg(REG_ESP), replacement);
+                INSTR_CREATE_add(dcontext, opnd_create_reg(REG_XSP), replacement);
         }
         else {
             LOG(THREAD, LOG_OPTS, 3, "Forward eflags check failed using lea to adjust stack instead of add");
             inst2 =
-                INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ESP),
-                                 opnd_create_base_disp(REG_ESP, REG_NULL, 0,
+                INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XSP),
+                                 opnd_create_base_disp(REG_XSP, REG_NULL, 0,
                                                        to_pop, OPSZ_lea));
         }
         loginst(dcontext, 3, inst2, "adjusting stack");
@@ -3718,7 +3861,7 @@ is_return(dcontext_t *dcontext, instr_t *inst)
             jecxz = instr_get_next(jecxz); 
         return (jecxz != NULL && 
                 instr_get_opcode(pop) == OP_pop &&
-                opnd_get_reg(instr_get_dst(pop, 0)) == REG_ECX &&
+                opnd_get_reg(instr_get_dst(pop, 0)) == REG_XCX &&
                 instr_get_opcode(jecxz) == OP_jecxz);
     }
     else {
@@ -3739,7 +3882,7 @@ is_return(dcontext_t *dcontext, instr_t *inst)
         jne = instr_get_next(cmp); 
         return (jne != NULL && 
                 instr_get_opcode(pop) == OP_pop &&
-                opnd_get_reg(instr_get_dst(pop, 0)) == REG_ECX &&
+                opnd_get_reg(instr_get_dst(pop, 0)) == REG_XCX &&
                 instr_get_opcode(cmp) == OP_cmp && 
                 instr_get_opcode(jne) == OP_jne);
     }
@@ -3875,11 +4018,11 @@ peephole_optimize(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
              */
             instrlist_preinsert(trace, inst,
                                 INSTR_CREATE_mov_ld(dcontext,
-                                                    opnd_create_reg(REG_ESP),
-                                                    opnd_create_reg(REG_EBP)));
+                                                    opnd_create_reg(REG_XSP),
+                                                    opnd_create_reg(REG_XBP)));
             instrlist_preinsert(trace, inst,
                                 INSTR_CREATE_pop(dcontext,
-                                                 opnd_create_reg(REG_EBP)));
+                                                 opnd_create_reg(REG_XBP)));
             instrlist_remove(trace, inst);
             instr_destroy(dcontext, inst);
         }
@@ -3979,6 +4122,14 @@ replace_inc_with_add(dcontext_t *dcontext, instr_t *inst, instrlist_t *trace)
 /****************************************************************************/
 /* josh's load removal optimization */
 #define MAX_DIST 40  
+
+/* only whole 32-bit (or on x64, 64-bit) register values are forwarded */
+static bool
+is_rlr_reg(opnd_t opnd)
+{
+    return (opnd_is_reg_32bit(opnd) IF_X64(|| opnd_is_reg_64bit(opnd)));
+}
+
 void
 remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
@@ -4017,7 +4168,8 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         
         /* to simply things for debugging, just worry about cases where the read
            is indirect off the base pointer. this should be removed later */
-        if (opnd_get_base(mem_read)!=REG_EBP||opnd_get_index(mem_read)!=REG_NULL)
+        if (!opnd_is_base_disp(mem_read) ||
+            opnd_get_base(mem_read)!=REG_XBP||opnd_get_index(mem_read)!=REG_NULL)
             continue;
         LOG(THREAD, LOG_OPTS, 3,"\n");
         loginst(dcontext, 3,instr," reads memory, try to eliminate. ");
@@ -4074,7 +4226,7 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                              (opnd_get_base(mem_read) == opnd_get_base(writeopnd)) &&
                              (opnd_get_index(mem_read) == opnd_get_index(writeopnd))) {
                         int scratch = opnd_get_disp(mem_read) - opnd_get_disp(writeopnd);
-                        if ((scratch < 4) && (scratch > -4)) {
+                        if ((scratch < (int)XSP_SZ) && (scratch > -(int)XSP_SZ)) {
                             first_mem_access=NULL;
                             break;
                         }
@@ -4155,7 +4307,8 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             }
         }
 
-        if (!opnd_is_reg_32bit(orig_reg_opnd)||!opnd_is_reg_32bit(instr_get_dst(instr,0)))
+        if (!is_rlr_reg(orig_reg_opnd) || !is_rlr_reg(instr_get_dst(instr,0)) ||
+            reg_get_size(orig_reg) != reg_get_size(opnd_get_reg(instr_get_dst(instr,0))))
             continue;
 
         if (reg_write_checker==instr) {
@@ -4204,6 +4357,10 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             opnd_t dead_reg_opnd;
             instr_t *copy_to_dead_instr;
             dead_reg=find_dead_register_across_instrs(first_mem_access,instr);
+#ifdef X64
+            if (dead_reg!=REG_NULL && reg_is_64bit(orig_reg))
+                dead_reg=reg_32_to_64(dead_reg);
+#endif
             if (dead_reg!=REG_NULL) {
 
                 dead_reg_opnd=opnd_create_reg(dead_reg);
@@ -4324,7 +4481,8 @@ prefetch_optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             src_mem_access=instr_get_src_mem_access(instr);
 
             //only prefetch if the load is register-indirect
-            if (!(opnd_get_base(src_mem_access)||opnd_get_index(src_mem_access)))
+            if (!opnd_is_base_disp(src_mem_access) ||
+                !(opnd_get_base(src_mem_access)||opnd_get_index(src_mem_access)))
                 break;
 
             prefetchinstr=INSTR_CREATE_prefetchnta(dcontext,
@@ -4400,21 +4558,32 @@ prefetch_optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 /****************************************************************************/
 /* utility routines */
 
+/* x64 spills go to tls slots rather than absolute dcontext fields, so these
+ * never match there
+ */
 bool
 is_store_to_ecxoff(dcontext_t *dcontext, instr_t *inst)
 {
+#ifdef X64
+    return false;
+#else
     int opcode = instr_get_opcode(inst);
     return ((opcode == OP_mov_imm || opcode == OP_mov_st) &&
             opnd_is_near_base_disp(instr_get_dst(inst, 0)) &&
             opnd_get_disp(instr_get_dst(inst, 0)) == opnd_get_disp(opnd_create_dcontext_field(dcontext, XCX_OFFSET)));
+#endif
 }
 
 bool
 is_load_from_ecxoff(dcontext_t *dcontext, instr_t *inst)
 {
+#ifdef X64
+    return false;
+#else
     return (instr_get_opcode(inst) == OP_mov_ld &&
             opnd_is_near_base_disp(instr_get_src(inst, 0)) &&
             opnd_get_disp(instr_get_src(inst, 0)) == opnd_get_disp(opnd_create_dcontext_field(dcontext, XCX_OFFSET)));
+#endif
 }
 
 /* returns true if the opnd is a constant address 
@@ -4446,7 +4615,11 @@ is_dead_register(reg_id_t reg,instr_t *where)
     while (!instr_is_cti(where)) {
         if (instr_reg_in_src(where,reg))
             return false;
-        else if (instr_writes_to_reg(where,reg))
+        /* only a write of the whole register kills it: on x64 a 32-bit
+         * write zeroes the top half, so that counts too
+         */
+        else if (instr_writes_to_exact_reg(where,reg)
+                 IF_X64(|| instr_writes_to_exact_reg(where,reg_32_to_64(reg))))
             return true;
         //!instr_writes_to_reg(...).  probably writing to mem indirectly through reg
         else if (instr_reg_in_dst(where,reg)) 
@@ -4540,7 +4713,7 @@ safe_write(instr_t *mem_writer)
     else if (opnd_get_base(mem_write)==REG_NULL) //if there's no base, its prob. a constant mem addr
         return true;
 
-    else if (opnd_get_base(mem_write)!=REG_EBP || opnd_get_index(mem_write)!=REG_NULL)
+    else if (opnd_get_base(mem_write)!=REG_XBP || opnd_get_index(mem_write)!=REG_NULL)
         return false;
 
     return true;
@@ -4633,6 +4806,32 @@ get_decision_instr(instr_t *jmp)
     return NULL;
 }
 
+/* Returns reg's index in the 24 entry representation used by propagate_down()
+ * and check_down(): 0-7 for eax-edi, 8-15 for ax-di, 16-23 for al-bl and
+ * ah-bh.  A 64-bit register shares its 32-bit register's index, since writing
+ * the 32-bit register zeroes the top half.  Registers with no index of their
+ * own (spl-dil) map to their enclosing register's index if enclosing is set,
+ * which is the safe choice when marking registers live or non-zero.
+ * Returns -1 for anything else, including r8-r15.
+ */
+static int
+reg_rep_index(reg_id_t reg, bool enclosing)
+{
+#ifdef X64
+    if (enclosing && reg >= REG_START_x64_8 && reg <= REG_STOP_x64_8)
+        reg = reg_to_pointer_sized(reg);
+    if (reg >= REG_START_64 && reg <= REG_STOP_64)
+        reg = reg_64_to_32(reg);
+#endif
+    if (reg >= REG_EAX && reg <= REG_EDI)
+        return reg - REG_EAX;
+    if (reg >= REG_AX && reg <= REG_DI)
+        return 8 + (reg - REG_AX);
+    if (reg >= REG_START_8HL && reg <= REG_STOP_8HL)
+        return 16 + (reg - REG_START_8HL);
+    return -1;
+}
+
 static void 
 propagate_down(bool *reg_rep, int index, bool value)
 {
@@ -4672,7 +4871,7 @@ is_nop(instr_t *inst)
     if ((opcode == OP_mov_ld || opcode == OP_mov_st || opcode == OP_xchg) && 
         opnd_same(instr_get_src(inst, 0), instr_get_dst(inst, 0))) 
         return true;
-    if (opcode == OP_lea && 
+    if (opcode == OP_lea && opnd_is_base_disp(instr_get_src(inst, 0)) &&
         opnd_get_disp(instr_get_src(inst, 0)) == 0 && 
         ((opnd_get_base(instr_get_src(inst, 0)) == opnd_get_reg(instr_get_dst(inst, 0)) &&
           opnd_get_index(instr_get_src(inst, 0)) == REG_NULL) ||
@@ -154,37 +154,27 @@ drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
                                                        OPSZ_lea)));
         }
     } else if (opnd_is_base_disp(memref)) {
-        /* special handling for xlat instr, [%ebx,%al] 
-         * - save %eax
-         * - movzx %al => %eax
-         * - lea [%ebx, %eax] => dst
-         * - restore %eax
+        /* special handling for xlat instr, [%ebx,%al]: the index is
+         * zero-extended into whichever of dst and scratch is not the base
+         * - movzx %al => tmp
+         * - lea [%ebx, tmp] => dst
          */
-        bool is_xlat = false;
-        if (opnd_get_index(memref) == DR_REG_AL) {
-            is_xlat = true;
-            if (scratch != DR_REG_XAX && dst != DR_REG_XAX) {
-                /* we do not have to save xax if it is saved by caller */
-                PRE(bb, where,
-                    INSTR_CREATE_mov_ld(drcontext, 
-                                        opnd_create_reg(scratch),
-                                        opnd_create_reg(DR_REG_XAX)));
-            }
+        reg_id_t index = opnd_get_index(memref);
+        if (index != DR_REG_NULL && reg_get_size(index) == OPSZ_1) {
+            reg_id_t base = opnd_get_base(memref);
+            reg_id_t tmp = (reg_to_pointer_sized(base) == dst) ? scratch : dst;
+            if (tmp == DR_REG_NULL || reg_to_pointer_sized(base) == tmp)
+                return false;
             PRE(bb, where,
-                INSTR_CREATE_movzx(drcontext, opnd_create_reg(DR_REG_XAX),
-                                   opnd_create_reg(DR_REG_AL)));
-            memref = opnd_create_base_disp(DR_REG_XBX, DR_REG_XAX, 1, 0,
+                INSTR_CREATE_movzx(drcontext, opnd_create_reg(tmp),
+                                   opnd_create_reg(index)));
+            memref = opnd_create_base_disp(base, tmp, 1, opnd_get_disp(memref),
                                            OPSZ_lea);
         }
         /* lea [ref] => reg */
         opnd_set_size(&memref, OPSZ_lea);
         PRE(bb, where,
             INSTR_CREATE_lea(drcontext, opnd_create_reg(dst), memref));
-        if (is_xlat && scratch != DR_REG_XAX && dst != DR_REG_XAX) {
-            PRE(bb, where,
-                INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_XAX),
-                                    opnd_create_reg(scratch)));
-        }
     } else if (IF_X64(opnd_is_rel_addr(memref) ||) opnd_is_abs_addr(memref)) {
         /* mov addr => reg */
         PRE(bb, where,
@@ -197,6 +187,141 @@ drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
     return true;
 }
 
+/* Replaces the pointer-sized register old_reg, or a sub-register of it, in
+ * the base or index of memref with the same-sized sub-register of new_reg.
+ */
+static bool
+memref_rename_reg(opnd_t *memref, reg_id_t old_reg, reg_id_t new_reg)
+{
+    reg_id_t base = opnd_get_base(*memref);
+    reg_id_t index = opnd_get_index(*memref);
+    if (base != DR_REG_NULL && reg_to_pointer_sized(base) == old_reg)
+        opnd_replace_reg(memref, base, reg_resize_to_opsz(new_reg, reg_get_size(base)));
+    if (index != DR_REG_NULL && reg_to_pointer_sized(index) == old_reg) {
+        /* xlat's %al index needs an 8-bit sub-register, which 32-bit
+         * %esi, %edi, %ebp, and %esp lack
+         */
+        reg_id_t new_index = reg_resize_to_opsz(new_reg, reg_get_size(index));
+        if (new_index == DR_REG_NULL)
+            return false;
+        opnd_replace_reg(memref, index, new_index);
+    }
+    return true;
+}
+
+/* Like drutil_insert_get_mem_addr() but for use when the caller has already
+ * clobbered reg_buf, dst, and scratch: their application values are reloaded
+ * from their spill slots as needed.  reg_buf's value must be preserved, so
+ * if memref uses it we reload its application value into whichever of dst
+ * or scratch memref does not use and rename the register in memref.
+ */
+static bool
+insert_get_mem_addr_shared(void *drcontext, instrlist_t *bb, instr_t *where,
+                           opnd_t memref, reg_id_t reg_buf, reg_id_t dst,
+                           reg_id_t scratch, dr_spill_slot_t slot_buf,
+                           dr_spill_slot_t slot_dst, dr_spill_slot_t slot_scratch)
+{
+    bool uses_buf = opnd_uses_reg(memref, reg_buf);
+    bool uses_dst = opnd_uses_reg(memref, dst);
+    bool uses_scratch = opnd_uses_reg(memref, scratch);
+    if (uses_dst)
+        dr_restore_reg(drcontext, bb, where, dst, slot_dst);
+    if (uses_scratch)
+        dr_restore_reg(drcontext, bb, where, scratch, slot_scratch);
+    if (uses_buf) {
+        reg_id_t spare = uses_scratch ? dst : scratch;
+        /* a memref has at most two general-purpose registers */
+        ASSERT(!uses_dst || !uses_scratch, "memref uses 3 registers");
+        if (!memref_rename_reg(&memref, reg_buf, spare))
+            return false;
+        dr_restore_reg(drcontext, bb, where, spare, slot_buf);
+    }
+    return drutil_insert_get_mem_addr(drcontext, bb, where, memref, dst, scratch);
+}
+
+/* Returns the idx-th memory reference of inst, in the order documented
+ * for drutil_insert_get_mem_addrs(), or a null opnd if there is none.
+ */
+static opnd_t
+instr_get_memref(instr_t *inst, uint idx, bool *write OUT)
+{
+    uint count = 0;
+    int i;
+    if (instr_reads_memory(inst)) {
+        for (i = 0; i < instr_num_srcs(inst); i++) {
+            if (opnd_is_memory_reference(instr_get_src(inst, i)) && count++ == idx) {
+                if (write != NULL)
+                    *write = false;
+                return instr_get_src(inst, i);
+            }
+        }
+    }
+    if (instr_writes_memory(inst)) {
+        for (i = 0; i < instr_num_dsts(inst); i++) {
+            if (opnd_is_memory_reference(instr_get_dst(inst, i)) && count++ == idx) {
+                if (write != NULL)
+                    *write = true;
+                return instr_get_dst(inst, i);
+            }
+        }
+    }
+    return opnd_create_null();
+}
+
+DR_EXPORT
+uint
+drutil_instr_num_memrefs(instr_t *inst)
+{
+    uint count = 0;
+    while (!opnd_is_null(instr_get_memref(inst, count, NULL)))
+        count++;
+    return count;
+}
+
+DR_EXPORT
+opnd_t
+drutil_instr_get_memref(instr_t *inst, uint index, bool *write OUT)
+{
+    return instr_get_memref(inst, index, write);
+}
+
+DR_EXPORT
+bool
+drutil_insert_get_mem_addrs(void *drcontext, instrlist_t *bb, instr_t *where,
+                            reg_id_t reg_buf, int offs, int stride,
+                            reg_id_t dst, reg_id_t scratch,
+                            dr_spill_slot_t slot_buf, dr_spill_slot_t slot_dst,
+                            dr_spill_slot_t slot_scratch, uint *num_addrs OUT)
+{
+    opnd_t memref, prev = opnd_create_null();
+    uint count;
+    if (reg_buf == dst || reg_buf == scratch || dst == scratch ||
+        reg_buf != reg_to_pointer_sized(reg_buf) || dst != reg_to_pointer_sized(dst) ||
+        scratch != reg_to_pointer_sized(scratch))
+        return false;
+    for (count = 0; ; count++) {
+        memref = instr_get_memref(where, count, NULL);
+        if (opnd_is_null(memref))
+            break;
+        /* Sources and destinations often share a memref (e.g., "add %eax, (%ebx)"):
+         * dst still holds its address.
+         */
+        if (count == 0 || !opnd_same(memref, prev)) {
+            if (!insert_get_mem_addr_shared(drcontext, bb, where, memref, reg_buf, dst,
+                                            scratch, slot_buf, slot_dst, slot_scratch))
+                return false;
+        }
+        PRE(bb, where,
+            INSTR_CREATE_mov_st(drcontext,
+                                OPND_CREATE_MEMPTR(reg_buf, offs + count * stride),
+                                opnd_create_reg(dst)));
+        prev = memref;
+    }
+    if (num_addrs != NULL)
+        *num_addrs = count;
+    return true;
+}
+
 DR_EXPORT
 uint
 drutil_opnd_mem_size_in_bytes(opnd_t memref, instr_t *inst)
@@ -218,6 +343,87 @@ opc_is_stringop_loop(uint opc)
             opc == OP_repne_cmps || opc == OP_rep_scas || opc == OP_repne_scas);
 }
 
+DR_EXPORT
+bool
+drutil_instr_is_stringop_loop(instr_t *inst)
+{
+    return opc_is_stringop_loop(instr_get_opcode(inst));
+}
+
+/* Inserts:
+ *    mov    %xcx -> reg_count          (zero-extended for ecx/cx counters)
+ *    <addr of memref> -> reg_start
+ *    lea    -128(%xsp) -> %xsp         (x64 only: skip the red zone)
+ *    pushf
+ *    pushf
+ *    pop    reg_dir
+ *    and    $EFLAGS_DF, reg_dir
+ *    shr    $10, reg_dir
+ *    popf
+ *    lea    128(%xsp) -> %xsp          (x64 only)
+ * The counter must be read first as scratch may be xcx.  The direction
+ * flag can only be read via the stack, and we restore the arithmetic
+ * flags from the first pushf so that our and+shr are invisible to the app.
+ */
+DR_EXPORT
+bool
+drutil_insert_get_rep_string_range(void *drcontext, instrlist_t *bb, instr_t *where,
+                                   opnd_t memref, reg_id_t reg_start,
+                                   reg_id_t reg_count, reg_id_t reg_dir,
+                                   reg_id_t scratch)
+{
+    opnd_t xcx;
+    opnd_size_t xcx_sz;
+    if (!drutil_instr_is_stringop_loop(where) ||
+        opnd_uses_reg(memref, reg_count) ||
+        reg_start == reg_count || reg_start == scratch || reg_count == scratch ||
+        (reg_dir != DR_REG_NULL &&
+         (reg_dir == reg_start || reg_dir == reg_count || reg_dir == scratch)))
+        return false;
+    /* We assume xcx is last src */
+    xcx = instr_get_src(where, instr_num_srcs(where) - 1);
+    ASSERT(opnd_is_reg(xcx) && opnd_uses_reg(xcx, DR_REG_XCX),
+           "rep opnd order assumption violated");
+    xcx_sz = opnd_get_size(xcx);
+    if (xcx_sz == OPSZ_2) {
+        PRE(bb, where,
+            INSTR_CREATE_movzx(drcontext,
+                               opnd_create_reg(reg_resize_to_opsz(reg_count, OPSZ_4)),
+                               xcx));
+    } else {
+        /* a 32-bit destination zeroes the top of a 64-bit register */
+        PRE(bb, where,
+            INSTR_CREATE_mov_ld(drcontext,
+                                opnd_create_reg(reg_resize_to_opsz(reg_count, xcx_sz)),
+                                xcx));
+    }
+    if (!drutil_insert_get_mem_addr(drcontext, bb, where, memref, reg_start, scratch))
+        return false;
+    if (reg_dir != DR_REG_NULL) {
+#ifdef X64
+        PRE(bb, where,
+            INSTR_CREATE_lea(drcontext, opnd_create_reg(DR_REG_XSP),
+                             OPND_CREATE_MEM_lea(DR_REG_XSP, DR_REG_NULL, 0, -128)));
+#endif
+        PRE(bb, where, INSTR_CREATE_pushf(drcontext));
+        PRE(bb, where, INSTR_CREATE_pushf(drcontext));
+        PRE(bb, where, INSTR_CREATE_pop(drcontext, opnd_create_reg(reg_dir)));
+        PRE(bb, where,
+            INSTR_CREATE_and(drcontext, opnd_create_reg(reg_dir),
+                             OPND_CREATE_INT32(EFLAGS_DF)));
+        PRE(bb, where,
+            INSTR_CREATE_shr(drcontext, opnd_create_reg(reg_dir),
+                             OPND_CREATE_INT8(10/*EFLAGS_DF bit*/)));
+        PRE(bb, where, INSTR_CREATE_popf(drcontext));
+#ifdef X64
+        PRE(bb, where,
+            INSTR_CREATE_lea(drcontext, opnd_create_reg(DR_REG_XSP),
+                             OPND_CREATE_MEM_lea(DR_REG_XSP, DR_REG_NULL, 0, 128)));
+#endif
+    }
+    return true;
+}
+
 static instr_t *
 create_nonloop_stringop(void *drcontext, instr_t *inst)
 {
@@ -73,11 +73,14 @@ DR_EXPORT
  * store the memory address referred to by \p memref into the register
  * \p dst.  May clobber the register \p scratch.  Supports far memory
  * references. For far memory references via DS and ES, we assume that
- * the segment base is 0.
+ * the segment base is 0.  For the reference of an xlat instruction, \p
+ * scratch is clobbered only if \p dst is its base register.
  *
  * To obtain each memory address referenced in a single-instruction
  * string loop, use drutil_expand_rep_string() to transform such loops
- * into regular loops containing (non-loop) string instructions.
+ * into regular loops containing (non-loop) string instructions.  To
+ * obtain just the range of memory referenced by such a loop, use
+ * drutil_insert_get_rep_string_range() instead.
  *
  * \return whether successful.
  */
@@ -85,6 +88,62 @@ bool
 drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
                            opnd_t memref, reg_id_t dst, reg_id_t scratch);
 
+DR_EXPORT
+/**
+ * Returns the number of memory references of \p inst: its source memory
+ * references if it reads memory followed by its destination memory
+ * references if it writes memory.  This is the number of addresses
+ * stored by drutil_insert_get_mem_addrs().
+ */
+uint
+drutil_instr_num_memrefs(instr_t *inst);
+
+DR_EXPORT
+/**
+ * Returns the \p index-th memory reference of \p inst in the order
+ * described for drutil_instr_num_memrefs(), or a null operand if \p
+ * index is out of range.  If \p write is non-NULL, it is set to whether
+ * the reference is a destination.
+ */
+opnd_t
+drutil_instr_get_memref(instr_t *inst, uint index, OUT bool *write);
+
+DR_EXPORT
+/**
+ * Inserts instructions prior to \p where in \p bb that determine the
+ * address of every memory reference of \p where, in the order described
+ * for drutil_instr_num_memrefs(), and store the i-th one as a
+ * pointer-sized value at \p offs + i * \p stride bytes from the address
+ * in \p reg_buf.  This lets a memory tracer fill all the address fields
+ * of an instruction's trace buffer records with a single set of register
+ * spills, where calling drutil_insert_get_mem_addr() once per reference
+ * requires spilling and restoring around each call.
+ *
+ * The caller must already have saved the application values of \p
+ * reg_buf, \p dst, and \p scratch to the spill slots \p slot_buf, \p
+ * slot_dst, and \p slot_scratch (e.g., via dr_save_reg()) and loaded the
+ * trace buffer pointer into \p reg_buf.  Application values are reloaded
+ * from the slots only for references that use those registers.  \p
+ * reg_buf is preserved; \p dst and \p scratch are clobbered.  The three
+ * registers must be distinct and pointer-sized.  On 32-bit, if \p reg_buf
+ * is DR_REG_XAX, the reference of an xlat instruction (which is indexed
+ * by %al) is only supported when \p dst and \p scratch each have an
+ * 8-bit sub-register (DR_REG_XBX, DR_REG_XCX, or DR_REG_XDX); otherwise
+ * false is returned.
+ *
+ * Consecutive identical references (such as the source and destination
+ * of a read-modify-write instruction) are computed once.  The number of
+ * addresses stored is returned in \p num_addrs.
+ *
+ * \return whether successful.
+ */
+bool
+drutil_insert_get_mem_addrs(void *drcontext, instrlist_t *bb, instr_t *where,
+                            reg_id_t reg_buf, int offs, int stride,
+                            reg_id_t dst, reg_id_t scratch,
+                            dr_spill_slot_t slot_buf, dr_spill_slot_t slot_dst,
+                            dr_spill_slot_t slot_scratch, OUT uint *num_addrs);
+
 DR_EXPORT
 /**
  * Returns the size of the memory reference \p memref in bytes.
@@ -144,6 +203,44 @@ drutil_expand_rep_string_ex(void *drcontext, instrlist_t *bb, OUT bool *expanded
                             OUT instr_t **stringop);
 
 
+DR_EXPORT
+/**
+ * Returns whether \p inst is a single-instruction string loop (one using
+ * the \p rep or \p repne prefix).
+ */
+bool
+drutil_instr_is_stringop_loop(instr_t *inst);
+
+DR_EXPORT
+/**
+ * An alternative to drutil_expand_rep_string() for clients that only need
+ * the range of memory touched by a single-instruction string loop: leave
+ * the loop intact and call this routine once per memory reference of the
+ * loop instruction \p where.  Inserts instructions prior to \p where in
+ * \p bb that place the address of the first element referenced via \p
+ * memref into \p reg_start and the iteration count into \p reg_count.
+ * If \p reg_dir is not DR_REG_NULL, it is set to 1 if the direction flag
+ * is set (the loop walks down from \p reg_start) and to 0 otherwise.
+ * The element size is drutil_opnd_mem_size_in_bytes(\p memref, \p
+ * where).  The bytes touched are thus [\p reg_start, \p reg_start +
+ * count * size) for an ascending loop and [\p reg_start - (count - 1) *
+ * size, \p reg_start + size) for a descending one.
+ *
+ * For \p repe and \p repne loops the count is an upper bound, as the loop
+ * can terminate early.  May clobber the register \p scratch.  The
+ * arithmetic flags are preserved, but reading the direction flag
+ * requires briefly pushing it onto the application stack (below the
+ * red zone on 64-bit).  The registers passed in must be distinct, and
+ * \p reg_count must not be used by \p memref.
+ *
+ * \return whether successful.
+ */
+bool
+drutil_insert_get_rep_string_range(void *drcontext, instrlist_t *bb, instr_t *where,
+                                   opnd_t memref, reg_id_t reg_start,
+                                   reg_id_t reg_count, reg_id_t reg_dir,
+                                   reg_id_t scratch);
+
 /*@}*/ /* end doxygen group */
 
 #ifdef __cplusplus
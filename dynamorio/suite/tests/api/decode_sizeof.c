@@ -0,0 +1,213 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Differential test of decode_sizeof() against decode().
+ *
+ * Feeds a pseudo-random sequence of byte streams to both decoders and
+ * checks that, wherever decode() finds a valid instruction, decode_sizeof()
+ * agrees on its length and (for 64-bit) on whether it has a rip-relative
+ * data reference.  The streams are biased toward prefixes, escape bytes,
+ * and vex encodings so that the less common paths get covered too.
+ *
+ * Run with "-bench" to instead time decode_sizeof() over a buffer of
+ * valid instructions and report the length-decode throughput.
+ */
+
+#ifndef USE_DYNAMO
+#error NEED USE_DYNAMO
+#endif
+
+#include "configure.h"
+#include "dr_api.h"
+#include "tools.h"
+#include <string.h>
+#include <time.h>
+
+#define ASSERT(x) \
+    ((void)((!(x)) ? \
+        (fprintf(stderr, "ASSERT FAILURE: %s:%d: %s\n", __FILE__,  __LINE__, #x),\
+         abort(), 0) : 0))
+
+#define BOOLS_MATCH(b1, b2) (!!(b1) == !!(b2))
+
+#define NUM_STREAMS 500000
+#define STREAM_LEN 24 /* room for the longest instr plus decode lookahead */
+
+static uint seed = 12345;
+
+static uint
+rand_next(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static const byte interesting_bytes[] = {
+    0x66, 0x67, 0xf2, 0xf3, 0xf0, 0x2e, 0x3e, 0x26, 0x36, 0x64, 0x65, /* prefixes */
+    0x0f, 0x38, 0x3a, 0xc4, 0xc5, 0x8f, /* escapes and vex */
+    0x40, 0x41, 0x48, 0x4c, 0x4f, /* rex */
+    0x05, 0x04, 0x44, 0x84, 0x25, 0x15, 0xf6, 0xf7, 0xd8, 0xdf /* modrm/sib */
+};
+
+static void
+fill_stream(byte *stream)
+{
+    int i;
+    for (i = 0; i < STREAM_LEN; i++) {
+        if (i < 4 && rand_next() % 3 == 0) {
+            stream[i] = interesting_bytes[rand_next() %
+                                          (sizeof(interesting_bytes) /
+                                           sizeof(interesting_bytes[0]))];
+        } else
+            stream[i] = (byte) rand_next();
+    }
+}
+
+static void
+report_mismatch(const char *what, byte *stream, int expect, int got)
+{
+    int i;
+    print("%s mismatch: decode %d vs decode_sizeof %d:", what, expect, got);
+    for (i = 0; i < STREAM_LEN; i++)
+        print(" %02x", stream[i]);
+    print("\n");
+}
+
+static int
+test_random_streams(void *dc)
+{
+    byte stream[STREAM_LEN];
+    instr_t instr;
+    int i, len, mismatches = 0;
+    instr_init(dc, &instr);
+    for (i = 0; i < NUM_STREAMS; i++) {
+        byte *next_pc;
+        int sizeof_len;
+#ifdef X64
+        uint rip_rel_pos;
+#endif
+        fill_stream(stream);
+        instr_reset(dc, &instr);
+        next_pc = decode(dc, stream, &instr);
+        if (next_pc == NULL)
+            continue; /* decode_sizeof may return anything for invalid instrs */
+        len = (int) (next_pc - stream);
+        sizeof_len = decode_sizeof(dc, stream, NULL _IF_X64(&rip_rel_pos));
+        if (sizeof_len != len) {
+            report_mismatch("length", stream, len, sizeof_len);
+            mismatches++;
+            continue;
+        }
+#ifdef X64
+        if (!BOOLS_MATCH(rip_rel_pos != 0,
+                         instr_get_rel_addr_src_idx(&instr) >= 0 ||
+                         instr_get_rel_addr_dst_idx(&instr) >= 0)) {
+            report_mismatch("rip-rel", stream, 0, rip_rel_pos);
+            mismatches++;
+        }
+#endif
+    }
+    instr_free(dc, &instr);
+    return mismatches;
+}
+
+/* Fills buf with valid instrs drawn from the random streams, so the benchmark
+ * sees a realistic mix of lengths rather than mostly invalid code.
+ */
+static int
+fill_valid_instrs(void *dc, byte *buf, int buf_size)
+{
+    byte stream[STREAM_LEN];
+    instr_t instr;
+    int used = 0;
+    instr_init(dc, &instr);
+    while (used + STREAM_LEN < buf_size) {
+        byte *next_pc;
+        fill_stream(stream);
+        instr_reset(dc, &instr);
+        next_pc = decode(dc, stream, &instr);
+        if (next_pc == NULL)
+            continue;
+        memcpy(buf + used, stream, next_pc - stream);
+        used += (int) (next_pc - stream);
+    }
+    instr_free(dc, &instr);
+    return used;
+}
+
+#define BENCH_BUF_SIZE (64*1024)
+#define BENCH_ITERS 2000
+
+static void
+bench_decode_sizeof(void *dc)
+{
+    static byte buf[BENCH_BUF_SIZE];
+    int used = fill_valid_instrs(dc, buf, BENCH_BUF_SIZE);
+    int i;
+    uint count = 0;
+    clock_t start, end;
+    start = clock();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        byte *pc = buf;
+        while (pc < buf + used) {
+            int len = decode_sizeof(dc, pc, NULL _IF_X64(NULL));
+            ASSERT(len > 0);
+            pc += len;
+            count++;
+        }
+    }
+    end = clock();
+    print("instrs %u ns/instr %.2f\n", count,
+           (double)(end - start) * 1e9 / CLOCKS_PER_SEC / count);
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *dc = GLOBAL_DCONTEXT;
+    int mismatches;
+    if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+        bench_decode_sizeof(dc);
+        return 0;
+    }
+    mismatches = test_random_streams(dc);
+#ifdef X64
+    /* repeat for 32-bit code */
+    set_x86_mode(dc, true);
+    mismatches += test_random_streams(dc);
+    set_x86_mode(dc, false);
+#endif
+    if (mismatches > 0)
+        print("%d mismatches\n", mismatches);
+    print("all done\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Round-trip test of the compressed memtrace codec in api/samples.
+ *
+ * Encodes a pseudo-random sequence of records shaped like a memory trace
+ * (runs of references from the same pc, strided and repeated addresses,
+ * string-loop ranges) mixed with arbitrary 64-bit values, then decodes
+ * the stream in small, unevenly sized chunks the way memtrace_reader
+ * does and checks that every record comes back exactly.
+ */
+
+#ifndef USE_DYNAMO
+#error NEED USE_DYNAMO
+#endif
+
+#include "configure.h"
+#include "dr_api.h"
+#include "tools.h"
+#include <string.h>
+#include "../../../api/samples/memtrace_codec.c"
+
+#define ASSERT(x) \
+    ((void)((!(x)) ? \
+        (fprintf(stderr, "ASSERT FAILURE: %s:%d: %s\n", __FILE__,  __LINE__, #x),\
+         abort(), 0) : 0))
+
+#define NUM_RECORDS 200000
+#define NUM_PCS 64
+
+static uint seed = 12345;
+
+static uint
+rand_next(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static uint64
+rand_uint64(void)
+{
+    return ((uint64)rand_next() << 60) ^ ((uint64)rand_next() << 45) ^
+        ((uint64)rand_next() << 30) ^ ((uint64)rand_next() << 15) ^ rand_next();
+}
+
+static memtrace_z_record_t records[NUM_RECORDS];
+
+static void
+make_records(void)
+{
+    uint64 pcs[NUM_PCS], addrs[NUM_PCS];
+    uint i, j;
+    for (i = 0; i < NUM_PCS; i++) {
+        pcs[i] = 0x400000 + rand_next() * 16;
+        addrs[i] = 0x7fff0000 + rand_next() * 8;
+    }
+    for (i = 0; i < NUM_RECORDS; ) {
+        uint which = rand_next() % NUM_PCS;
+        uint run = 1 + rand_next() % 5;
+        uint kind = rand_next() % 16;
+        for (j = 0; j < run && i < NUM_RECORDS; j++, i++) {
+            memtrace_z_record_t *rec = &records[i];
+            rec->pc = pcs[which];
+            if (kind == 0) {
+                /* arbitrary values, including ones whose deltas need all 64 bits */
+                rec->pc = rand_uint64();
+                rec->addr = rand_uint64();
+                rec->size = rand_uint64();
+                rec->type = (uint) rand_uint64();
+            } else if (kind == 1) {
+                /* a string loop range */
+                rec->addr = addrs[which];
+                rec->size = rand_next();
+                rec->type = MEMREF_RANGE | (4 << MEMREF_ELEM_SIZE_SHIFT) |
+                    (rand_next() % 2 == 0 ? 0 : MEMREF_DESCENDING);
+            } else {
+                /* a strided or repeated access */
+                addrs[which] += (kind % 3) * 8;
+                rec->addr = addrs[which] + j * 4;
+                rec->size = (kind < 8) ? 4 : 8;
+                rec->type = (j % 2 == 0) ? 0 : MEMREF_WRITE;
+            }
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    memtrace_z_state_t *enc = malloc(sizeof(*enc));
+    memtrace_z_state_t *dec = malloc(sizeof(*dec));
+    byte *stream = malloc(NUM_RECORDS * MEMTRACE_Z_MAX_RECORD_SIZE);
+    size_t len = 0, pos = 0, avail = 0, sz;
+    uint i, mismatches = 0;
+    memtrace_z_record_t rec;
+
+    make_records();
+    memtrace_z_init(enc);
+    for (i = 0; i < NUM_RECORDS; i++) {
+        sz = memtrace_z_encode(enc, &records[i], stream + len);
+        ASSERT(sz > 0 && sz <= MEMTRACE_Z_MAX_RECORD_SIZE);
+        len += sz;
+    }
+    /* compressed records must be well under a raw mem_ref_t */
+    ASSERT(len < NUM_RECORDS * sizeof(mem_ref_t) / 2);
+
+    memtrace_z_init(dec);
+    for (i = 0; i < NUM_RECORDS; ) {
+        sz = memtrace_z_decode(dec, stream + pos, avail, &rec);
+        if (sz == 0) {
+            /* a partial record: make more of the stream available */
+            ASSERT(avail < MEMTRACE_Z_MAX_RECORD_SIZE);
+            ASSERT(pos + avail < len);
+            avail += 1 + rand_next() % 7;
+            if (pos + avail > len)
+                avail = len - pos;
+            continue;
+        }
+        ASSERT(sz <= avail);
+        if (rec.pc != records[i].pc || rec.addr != records[i].addr ||
+            rec.size != records[i].size || rec.type != records[i].type) {
+            if (mismatches++ < 10)
+                print("record %u mismatch\n", i);
+        }
+        pos += sz;
+        avail -= sz;
+        i++;
+    }
+    ASSERT(pos == len);
+    if (mismatches > 0)
+        print("%d mismatches\n", mismatches);
+    free(enc);
+    free(dec);
+    free(stream);
+    print("all done\n");
+    return 0;
+}
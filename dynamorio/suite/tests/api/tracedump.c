@@ -0,0 +1,164 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs the api/samples tracedump reader over small binary trace dump files
+ * written here in the layout documented in dr_tools.h: a full
+ * -tracedump_binary -tracedump_origins file and a -tracedump_compact file,
+ * each with an index, plus a file without an index as left behind by a
+ * process that did not exit normally.  Each indexed file is read in full
+ * and then for a single tag, which seeks through the index and so must
+ * find both traces recorded for that tag.
+ */
+
+#include "configure.h"
+#include "dr_api.h"
+
+#define main tracedump_main
+#include "../../../api/samples/tracedump.c"
+#undef main
+
+#define TAG_A ((app_pc)0x10000)
+#define TAG_B ((app_pc)0x20000)
+#define CACHE_PC ((app_pc)0x50000000)
+#define NUM_TRACES 3
+#define NOP 0x90
+
+typedef struct _test_trace_t {
+    int frag_id;
+    app_pc tag;
+    int bb_size;
+    int code_size;
+} test_trace_t;
+
+/* TAG_A's trace is flushed and built again, so it is in the file twice */
+static const test_trace_t traces[NUM_TRACES] = {
+    { 1, TAG_A, 2, 3 },
+    { 2, TAG_B, 1, 2 },
+    { 3, TAG_A, 1, 1 },
+};
+
+static void
+write_bytes(file_t f, const void *buf, size_t size)
+{
+    ssize_t res = dr_write_file(f, buf, size);
+    assert(res == (ssize_t) size);
+}
+
+static void
+write_dump(const char *path, bool compact, bool with_index)
+{
+    tracedump_file_header_t fhdr;
+    tracedump_trace_header_t hdr;
+    tracedump_index_entry_t index[NUM_TRACES];
+    tracedump_index_trailer_t trailer;
+    byte code[8];
+    int i;
+    file_t f = dr_open_file(path, DR_FILE_WRITE_OVERWRITE);
+    assert(f != INVALID_FILE);
+    memset(code, NOP, sizeof(code));
+
+    memset(&fhdr, 0, sizeof(fhdr));
+    fhdr.version = _USES_DR_VERSION_;
+    fhdr.x64 = IF_X64_ELSE(true, false);
+    fhdr.linkcount_size = 0;
+    fhdr.flags = compact ? TRACEDUMP_FILE_COMPACT : 0;
+    write_bytes(f, &fhdr, sizeof(fhdr));
+
+    for (i = 0; i < NUM_TRACES; i++) {
+        index[i].tag = traces[i].tag;
+        index[i].offset = dr_file_tell(f);
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.frag_id = traces[i].frag_id;
+        hdr.tag = traces[i].tag;
+        hdr.cache_start_pc = CACHE_PC;
+        hdr.entry_offs = 0;
+        hdr.num_exits = 0;
+        hdr.code_size = traces[i].code_size;
+        hdr.num_bbs = 1;
+        hdr.x64 = IF_X64_ELSE(true, false);
+        write_bytes(f, &hdr, sizeof(hdr));
+        write_bytes(f, &traces[i].tag, sizeof(traces[i].tag));
+        write_bytes(f, &traces[i].bb_size, sizeof(traces[i].bb_size));
+        if (compact)
+            continue;
+        write_bytes(f, code, traces[i].bb_size);
+        write_bytes(f, code, traces[i].code_size);
+    }
+
+    if (with_index) {
+        trailer.index_offset = dr_file_tell(f);
+        trailer.num_entries = NUM_TRACES;
+        memcpy(trailer.magic, TRACEDUMP_INDEX_MAGIC, sizeof(trailer.magic));
+        write_bytes(f, index, sizeof(index));
+        write_bytes(f, &trailer, sizeof(trailer));
+    }
+    dr_close_file(f);
+}
+
+static void
+read_dump(void *drcontext, const char *path, app_pc tag)
+{
+    file_t f = dr_open_file(path, DR_FILE_READ);
+    assert(f != INVALID_FILE);
+    read_data(f, drcontext, tag);
+    dr_close_file(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *drcontext = dr_standalone_init();
+    char path[MAXIMUM_PATH];
+    dr_snprintf(path, sizeof(path)/sizeof(path[0]), "tracedump.%d.tmp",
+                dr_get_process_id());
+    path[sizeof(path)/sizeof(path[0]) - 1] = '\0';
+
+    write_dump(path, false/*binary*/, true/*index*/);
+    dr_printf("== binary: all traces\n");
+    read_dump(drcontext, path, NULL);
+    dr_printf("== binary: tag "PFX"\n", TAG_A);
+    read_dump(drcontext, path, TAG_A);
+
+    write_dump(path, true/*compact*/, true/*index*/);
+    dr_printf("== compact: all traces\n");
+    read_dump(drcontext, path, NULL);
+    dr_printf("== compact: tag "PFX"\n", TAG_B);
+    read_dump(drcontext, path, TAG_B);
+
+    write_dump(path, true/*compact*/, false/*no index*/);
+    dr_printf("== compact without index: all traces\n");
+    read_dump(drcontext, path, NULL);
+
+    dr_delete_file(path);
+    dr_printf("all done\n");
+    return 0;
+}
@@ -0,0 +1,269 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs the api/samples tracedump reader over trace dumps written by DR
+ * itself.  For each of -tracedump_binary, -tracedump_binary -tracedump_async,
+ * and -thread_private -tracedump_compact, a child process runs a hot loop
+ * under DR via dr_app_start() with its own -logdir, and once it exits we
+ * read every dump file it left behind: first in full, and then for the tag
+ * of the first trace, which seeks through the index and must find every
+ * trace the full read found for that tag.
+ */
+
+#include "configure.h"
+#include "dr_api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define main tracedump_main
+#include "../../../api/samples/tracedump.c"
+#undef main
+
+/* enough to get well past -trace_threshold */
+#define ITERS 100000
+
+typedef struct _variant_t {
+    const char *name;
+    const char *ops;
+} variant_t;
+
+/* -enable_traces undoes -disable_traces in the suite's run-list options */
+static const variant_t variants[] = {
+    { "binary", "-enable_traces -tracedump_binary" },
+    { "async", "-enable_traces -tracedump_binary -tracedump_async" },
+    { "compact", "-enable_traces -thread_private -tracedump_compact" },
+};
+#define NUM_VARIANTS (sizeof(variants)/sizeof(variants[0]))
+
+static int
+inc(int x)
+{
+    return x + 1;
+}
+
+static int
+dec(int x)
+{
+    return x - 1;
+}
+
+/* Indirect calls so that traces end in indirect branches too */
+static int (*volatile funcs[2])(int) = { inc, dec };
+
+static void
+run_under_dr(const char *logdir, const char *ops)
+{
+    static char env[4096];
+    const char *base = getenv("DYNAMORIO_OPTIONS");
+    int i, sum = 0;
+    snprintf(env, sizeof(env), "%s -logdir %s %s",
+             base == NULL ? "" : base, logdir, ops);
+    env[sizeof(env) - 1] = '\0';
+    setenv("DYNAMORIO_OPTIONS", env, 1/*overwrite*/);
+
+    dr_app_setup();
+    dr_app_start();
+    for (i = 0; i < ITERS; i++)
+        sum = funcs[i % 3 == 0](sum);
+    dr_app_stop();
+    /* closes the dumps and writes their indices */
+    dr_app_cleanup();
+    exit(sum == 0 ? 1 : 0);
+}
+
+/* Runs the sample's reader on path, sending its output to outpath */
+static void
+read_dump(void *drcontext, const char *path, app_pc tag, const char *outpath)
+{
+    int saved = dup(STDOUT_FILENO);
+    int out = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    file_t f = dr_open_file(path, DR_FILE_READ | DR_FILE_ALLOW_LARGE);
+    assert(saved >= 0 && out >= 0 && f != INVALID_FILE);
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    read_data(f, drcontext, tag);
+    dup2(saved, STDOUT_FILENO);
+    close(out);
+    close(saved);
+    dr_close_file(f);
+}
+
+/* Counts the traces in the reader's output, and those for tag.  If tag is
+ * NULL, sets it to the first trace's tag.  Returns -1 if the output has a
+ * trace header without a tag.
+ */
+static int
+count_traces(const char *outpath, app_pc *tag, int *num_for_tag)
+{
+    char line[512];
+    int num = 0;
+    bool want_tag = false;
+    FILE *fp = fopen(outpath, "r");
+    assert(fp != NULL);
+    *num_for_tag = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "TRACE # ", 8) == 0) {
+            if (want_tag)
+                break;
+            num++;
+            want_tag = true;
+        } else if (strncmp(line, "Tag = ", 6) == 0 && want_tag) {
+            app_pc this_tag = (app_pc) strtoull(line + 6, NULL, 16);
+            if (*tag == NULL)
+                *tag = this_tag;
+            if (this_tag == *tag)
+                (*num_for_tag)++;
+            want_tag = false;
+        }
+    }
+    fclose(fp);
+    return want_tag ? -1 : num;
+}
+
+/* Reads each dump in dir.  Returns the number of traces found. */
+static int
+check_dumps(void *drcontext, const char *dir, const char *outpath)
+{
+    char path[MAXIMUM_PATH];
+    struct dirent *ent;
+    int total = 0;
+    DIR *d = opendir(dir);
+    assert(d != NULL);
+    while ((ent = readdir(d)) != NULL) {
+        app_pc tag = NULL;
+        int num, num_for_tag, num_tag_read, num_for_tag_read;
+        if (strncmp(ent->d_name, "traces", 6) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        path[sizeof(path) - 1] = '\0';
+        read_dump(drcontext, path, NULL, outpath);
+        num = count_traces(outpath, &tag, &num_for_tag);
+        if (num < 0)
+            printf("%s: malformed output\n", ent->d_name);
+        if (num <= 0)
+            continue;
+        total += num;
+        read_dump(drcontext, path, tag, outpath);
+        num_tag_read = count_traces(outpath, &tag, &num_for_tag_read);
+        if (num_tag_read != num_for_tag || num_for_tag_read != num_for_tag) {
+            printf("%s: tag "PFX" lookup found %d traces (%d for the tag), "
+                   "not %d\n", ent->d_name, (ptr_uint_t) tag, num_tag_read,
+                   num_for_tag_read, num_for_tag);
+        }
+    }
+    closedir(d);
+    return total;
+}
+
+/* Removes dir, which holds files and at most one level of subdirectories */
+static void
+remove_dir(const char *dir, bool recurse)
+{
+    char path[MAXIMUM_PATH];
+    struct dirent *ent;
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        path[sizeof(path) - 1] = '\0';
+        if (recurse)
+            remove_dir(path, false);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char logdir[MAXIMUM_PATH], procdir[MAXIMUM_PATH], outpath[MAXIMUM_PATH];
+    void *drcontext = NULL;
+    uint i;
+    for (i = 0; i < NUM_VARIANTS; i++) {
+        struct dirent *ent;
+        DIR *d;
+        int status;
+        pid_t child;
+        snprintf(logdir, sizeof(logdir), "tracedump_dr.%d.%s", getpid(),
+                 variants[i].name);
+        logdir[sizeof(logdir) - 1] = '\0';
+        mkdir(logdir, 0755);
+        child = fork();
+        assert(child >= 0);
+        if (child == 0)
+            run_under_dr(logdir, variants[i].ops);
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%s: child failed\n", variants[i].name);
+            continue;
+        }
+
+        /* DR is only initialized here after the children are done with it */
+        if (drcontext == NULL)
+            drcontext = dr_standalone_init();
+        /* the child's dir is <app>.<pid>.<counter> */
+        d = opendir(logdir);
+        assert(d != NULL);
+        procdir[0] = '\0';
+        while ((ent = readdir(d)) != NULL) {
+            if (ent->d_name[0] != '.') {
+                snprintf(procdir, sizeof(procdir), "%s/%s", logdir, ent->d_name);
+                procdir[sizeof(procdir) - 1] = '\0';
+                break;
+            }
+        }
+        closedir(d);
+        snprintf(outpath, sizeof(outpath), "%s.out", logdir);
+        outpath[sizeof(outpath) - 1] = '\0';
+        if (procdir[0] == '\0')
+            printf("%s: no log dir\n", variants[i].name);
+        else if (check_dumps(drcontext, procdir, outpath) == 0)
+            printf("%s: no traces\n", variants[i].name);
+        else
+            printf("%s: traces read in full and by tag\n", variants[i].name);
+        unlink(outpath);
+        remove_dir(logdir, true);
+    }
+    printf("all done\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs a marked sequence of memory instructions with known operands for
+ * drutil-memrefs.dll.c to check its computed addresses and string loop
+ * ranges against.
+ */
+
+#ifndef ASM_CODE_ONLY /* C code */
+#include "tools.h"
+
+#define BUF_SIZE 256
+
+/* asm routine: see the sequence below */
+void memrefs_test(unsigned char *src, unsigned char *dst);
+
+static unsigned char src[BUF_SIZE];
+static unsigned char dst[BUF_SIZE];
+static unsigned char expect[BUF_SIZE];
+
+int
+main(void)
+{
+    int i;
+    for (i = 0; i < BUF_SIZE; i++)
+        src[i] = (unsigned char) i;
+    /* what memrefs_test leaves in dst */
+    for (i = 0; i < 37; i++)
+        expect[i] = src[i];
+    for (i = 64; i < 64 + 11 * 4; i++)
+        expect[i] = 1;
+    for (i = 176; i < 192; i++)
+        expect[i] = src[i - 64];
+    for (i = 128; i < 128 + (int) sizeof(void *); i++)
+        expect[i] = src[i];
+    expect[24] += 5;
+    expect[250] = src[5];
+
+    memrefs_test(src, dst);
+    for (i = 0; i < BUF_SIZE; i++) {
+        if (dst[i] != expect[i]) {
+            print("dst[%d] is %d, not %d\n", i, dst[i], expect[i]);
+            break;
+        }
+    }
+    print("all done\n");
+    return 0;
+}
+
+#else /* asm code *************************************************************/
+#include "asm_defines.asm"
+START_FILE
+
+/* Between the markers (each a nop followed by xchg xbp, xbp) xbx holds src
+ * and xdx holds dst, which the client reports addresses relative to.  The
+ * markers and everything between them must stay in a single bb.
+ */
+#define FUNCNAME memrefs_test
+        DECLARE_FUNC_SEH(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+        mov      REG_XAX, ARG1
+        mov      REG_XCX, ARG2
+        PUSH_SEH(REG_XBX)
+        PUSH_SEH(REG_XSI)
+        PUSH_SEH(REG_XDI)
+        END_PROLOG
+        mov      REG_XBX, REG_XAX
+        mov      REG_XDX, REG_XCX
+
+        nop
+        xchg     REG_XBP, REG_XBP
+
+        /* ascending rep movs: two memrefs */
+        mov      REG_XSI, REG_XBX
+        mov      REG_XDI, REG_XDX
+        mov      REG_XCX, 37
+        rep movsb
+        /* ascending rep stos of dwords */
+        lea      REG_XDI, [REG_XDX + 64]
+        mov      eax, HEX(01010101)
+        mov      REG_XCX, 11
+        rep stosd
+        /* descending rep movs */
+        std
+        lea      REG_XSI, [REG_XBX + 127]
+        lea      REG_XDI, [REG_XDX + 191]
+        mov      REG_XCX, 16
+        rep movsb
+        cld
+        /* a string loop that does not iterate */
+        lea      REG_XDI, [REG_XDX + 200]
+        mov      REG_XCX, 0
+        rep stosb
+        /* one memref on the stack and one elsewhere */
+        push     PTRSZ [REG_XBX + 128]
+        pop      PTRSZ [REG_XDX + 128]
+        /* read-modify-write: the same memref as source and destination */
+        mov      REG_XCX, 3
+        add      DWORD [REG_XDX + REG_XCX*4 + 12], 5
+        /* indexed by al */
+        mov      al, 5
+        xlatb
+        mov      BYTE [REG_XDX + 250], al
+
+        nop
+        xchg     REG_XBP, REG_XBP
+
+        add      REG_XSP, 0 /* make a legal SEH64 epilog */
+        pop      REG_XDI
+        pop      REG_XSI
+        pop      REG_XBX
+        ret
+        END_FUNC(FUNCNAME)
+#undef FUNCNAME
+
+END_FILE
+#endif
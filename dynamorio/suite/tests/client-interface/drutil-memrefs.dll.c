@@ -0,0 +1,284 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests drutil's address computation: every memory instruction gets its
+ * addresses from drutil_insert_get_mem_addrs(), and string loops their
+ * ranges from drutil_insert_get_rep_string_range(), and a clean call checks
+ * them against the application's machine context.  The addresses and
+ * ranges of the known sequence between drutil-memrefs.c's markers are
+ * also reported.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drutil.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+#define MAX_MEMREFS 8
+
+/* The app is single-threaded, so the instrumentation can use globals. */
+static ptr_uint_t addrs[MAX_MEMREFS];
+static struct {
+    ptr_uint_t start;
+    ptr_uint_t count;
+    ptr_uint_t dir;
+} ranges[MAX_MEMREFS];
+
+/* the known sequence lies between these, exclusive */
+static app_pc marker_start;
+static app_pc marker_end;
+
+static char report[2048];
+static size_t report_len;
+static uint num_checked;
+static uint num_bad;
+
+static void event_exit(void);
+static dr_emit_flags_t event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                         bool for_trace, bool translating,
+                                         OUT void **user_data);
+static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                                       instr_t *inst, bool for_trace, bool translating,
+                                       void *user_data);
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    bool ok;
+    drmgr_init();
+    drutil_init();
+    dr_register_exit_event(event_exit);
+    ok = drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                 event_bb_insert, NULL);
+    CHECK(ok, "drmgr register bb failed");
+}
+
+static void
+event_exit(void)
+{
+    dr_fprintf(STDERR, "%s", report);
+    if (num_checked == 0)
+        dr_fprintf(STDERR, "no memory references checked\n");
+    else if (num_bad == 0)
+        dr_fprintf(STDERR, "all memory references matched\n");
+    drutil_exit();
+    drmgr_exit();
+}
+
+static void
+append(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    va_start(ap, fmt);
+    len = dr_vsnprintf(report + report_len, sizeof(report) - report_len - 1, fmt, ap);
+    va_end(ap);
+    CHECK(len >= 0, "report overflow");
+    report_len += len;
+}
+
+/* Reports addr relative to the buffers whose bases the known sequence holds
+ * in xbx and xdx.
+ */
+static void
+append_addr(dr_mcontext_t *mc, ptr_uint_t addr)
+{
+    if (addr >= mc->xbx && addr < mc->xbx + 256)
+        append(" src+%d", (int)(addr - mc->xbx));
+    else if (addr >= mc->xdx && addr < mc->xdx + 256)
+        append(" dst+%d", (int)(addr - mc->xdx));
+    else if (addr >= mc->xsp - sizeof(void *) && addr <= mc->xsp)
+        append(" stack");
+    else
+        append(" "PFX, addr);
+}
+
+static void
+record_range(uint idx, ptr_uint_t start, ptr_uint_t count, ptr_uint_t dir)
+{
+    ranges[idx].start = start;
+    ranges[idx].count = count;
+    ranges[idx].dir = dir;
+}
+
+static void
+check_memrefs(app_pc pc, uint known)
+{
+    void *drcontext = dr_get_current_drcontext();
+    dr_mcontext_t mc = {sizeof(mc), DR_MC_CONTROL | DR_MC_INTEGER,};
+    instr_t inst;
+    bool is_loop;
+    uint i, num;
+    dr_get_mcontext(drcontext, &mc);
+    instr_init(drcontext, &inst);
+    decode(drcontext, pc, &inst);
+    num = drutil_instr_num_memrefs(&inst);
+    is_loop = drutil_instr_is_stringop_loop(&inst);
+    if (known)
+        append("%s %d:", decode_opcode_name(instr_get_opcode(&inst)), num);
+    for (i = 0; i < num; i++) {
+        opnd_t memref = drutil_instr_get_memref(&inst, i, NULL);
+        ptr_uint_t addr = (ptr_uint_t) opnd_compute_address(memref, &mc);
+        /* Our clean call context sees DR's own TLS segment bases rather than
+         * the app's, so we can only check references via them in known code.
+         */
+        if (!opnd_is_far_base_disp(memref) ||
+            (opnd_get_segment(memref) != DR_SEG_FS &&
+             opnd_get_segment(memref) != DR_SEG_GS)) {
+            num_checked++;
+            if (addrs[i] != addr) {
+                num_bad++;
+                dr_fprintf(STDERR, "memref %d of "PFX" is "PFX", not "PFX"\n",
+                           i, pc, addrs[i], addr);
+            }
+        }
+        if (is_loop) {
+            opnd_t xcx = instr_get_src(&inst, instr_num_srcs(&inst) - 1);
+            ptr_uint_t count = (ptr_uint_t) reg_get_value(opnd_get_reg(xcx), &mc);
+            ptr_uint_t dir = (mc.xflags & EFLAGS_DF) != 0 ? 1 : 0;
+            if (ranges[i].start != addrs[i] || ranges[i].count != count ||
+                ranges[i].dir != dir) {
+                num_bad++;
+                dr_fprintf(STDERR, "range %d of "PFX" is "PFX" x%d %d, not "
+                           PFX" x%d %d\n", i, pc, ranges[i].start,
+                           (int) ranges[i].count, (int) ranges[i].dir,
+                           addrs[i], (int) count, (int) dir);
+            }
+        }
+        if (known) {
+            append_addr(&mc, addrs[i]);
+            if (is_loop) {
+                append(" x%d*%d %s", (int) ranges[i].count,
+                       drutil_opnd_mem_size_in_bytes(memref, &inst),
+                       ranges[i].dir ? "down" : "up");
+            }
+            if (i + 1 < num)
+                append(",");
+        }
+    }
+    if (known)
+        append("\n");
+    instr_free(drcontext, &inst);
+}
+
+static bool
+instr_is_marker_xchg(instr_t *inst)
+{
+    return (instr_get_opcode(inst) == OP_xchg &&
+            opnd_is_reg(instr_get_src(inst, 0)) &&
+            opnd_get_reg(instr_get_src(inst, 0)) == DR_REG_XBP &&
+            opnd_is_reg(instr_get_src(inst, 1)) &&
+            opnd_get_reg(instr_get_src(inst, 1)) == DR_REG_XBP);
+}
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating, OUT void **user_data)
+{
+    instr_t *inst, *next;
+    for (inst = instrlist_first(bb); inst != NULL; inst = next) {
+        next = instr_get_next(inst);
+        if (next != NULL && instr_get_opcode(inst) == OP_nop &&
+            instr_is_marker_xchg(next)) {
+            if (marker_start == NULL || marker_start == instr_get_app_pc(next))
+                marker_start = instr_get_app_pc(next);
+            else
+                marker_end = instr_get_app_pc(inst);
+        }
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                bool for_trace, bool translating, void *user_data)
+{
+    app_pc pc = instr_get_app_pc(inst);
+    uint i, num = drutil_instr_num_memrefs(inst), num_addrs;
+    bool ok;
+    if (num == 0)
+        return DR_EMIT_DEFAULT;
+    CHECK(num <= MAX_MEMREFS, "too many memrefs");
+
+    /* reg_buf and dst are the known sequence's bases, so the app values of
+     * both must be reloaded for it
+     */
+    dr_save_reg(drcontext, bb, inst, DR_REG_XDX, SPILL_SLOT_1);
+    dr_save_reg(drcontext, bb, inst, DR_REG_XBX, SPILL_SLOT_2);
+    dr_save_reg(drcontext, bb, inst, DR_REG_XCX, SPILL_SLOT_3);
+    instrlist_meta_preinsert(bb, inst, INSTR_CREATE_mov_imm
+                             (drcontext, opnd_create_reg(DR_REG_XDX),
+                              OPND_CREATE_INTPTR(addrs)));
+    ok = drutil_insert_get_mem_addrs(drcontext, bb, inst, DR_REG_XDX, 0,
+                                     sizeof(addrs[0]), DR_REG_XBX, DR_REG_XCX,
+                                     SPILL_SLOT_1, SPILL_SLOT_2, SPILL_SLOT_3,
+                                     &num_addrs);
+    CHECK(ok, "drutil_insert_get_mem_addrs failed");
+    CHECK(num_addrs == num, "drutil_insert_get_mem_addrs count mismatch");
+    dr_restore_reg(drcontext, bb, inst, DR_REG_XCX, SPILL_SLOT_3);
+    dr_restore_reg(drcontext, bb, inst, DR_REG_XBX, SPILL_SLOT_2);
+    dr_restore_reg(drcontext, bb, inst, DR_REG_XDX, SPILL_SLOT_1);
+
+    if (drutil_instr_is_stringop_loop(inst)) {
+        /* string loops reference memory via xsi and xdi and count in xcx */
+        dr_save_reg(drcontext, bb, inst, DR_REG_XAX, SPILL_SLOT_1);
+        dr_save_reg(drcontext, bb, inst, DR_REG_XBX, SPILL_SLOT_2);
+        dr_save_reg(drcontext, bb, inst, DR_REG_XDX, SPILL_SLOT_3);
+        dr_save_reg(drcontext, bb, inst, DR_REG_XBP, SPILL_SLOT_4);
+        for (i = 0; i < num; i++) {
+            ok = drutil_insert_get_rep_string_range
+                (drcontext, bb, inst, drutil_instr_get_memref(inst, i, NULL),
+                 DR_REG_XAX, DR_REG_XBX, DR_REG_XDX, DR_REG_XBP);
+            CHECK(ok, "drutil_insert_get_rep_string_range failed");
+            dr_insert_clean_call(drcontext, bb, inst, (void *) record_range, false, 4,
+                                 OPND_CREATE_INT32(i), opnd_create_reg(DR_REG_XAX),
+                                 opnd_create_reg(DR_REG_XBX),
+                                 opnd_create_reg(DR_REG_XDX));
+        }
+        dr_restore_reg(drcontext, bb, inst, DR_REG_XBP, SPILL_SLOT_4);
+        dr_restore_reg(drcontext, bb, inst, DR_REG_XDX, SPILL_SLOT_3);
+        dr_restore_reg(drcontext, bb, inst, DR_REG_XBX, SPILL_SLOT_2);
+        dr_restore_reg(drcontext, bb, inst, DR_REG_XAX, SPILL_SLOT_1);
+    }
+
+    dr_insert_clean_call(drcontext, bb, inst, (void *) check_memrefs, false, 2,
+                         OPND_CREATE_INTPTR(pc),
+                         OPND_CREATE_INT32(marker_end != NULL &&
+                                           pc > marker_start && pc < marker_end));
+    return DR_EMIT_DEFAULT;
+}
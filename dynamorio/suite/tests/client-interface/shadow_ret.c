@@ -0,0 +1,126 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Keeps a thread calling and returning under -shadow_ret_stack while the
+ * client suspends it and checks its translated registers: see
+ * shadow_ret.dll.c.
+ */
+
+#ifndef ASM_CODE_ONLY /* C code */
+#include "tools.h"
+#include <pthread.h>
+#include <sched.h>
+
+/* the client suspends all other threads at each of our sched_yield calls */
+#define NUM_YIELDS 2000
+
+/* asm routine: calls and returns until *stop is non-zero */
+void call_ret_loop(volatile int *stop);
+
+static volatile int stop;
+static volatile int started;
+
+static void *
+thread_func(void *arg)
+{
+    started = 1;
+    call_ret_loop(&stop);
+    return NULL;
+}
+
+int
+main(void)
+{
+    pthread_t thread;
+    int i;
+    if (pthread_create(&thread, NULL, thread_func, NULL) != 0) {
+        print("failed to create thread\n");
+        return 1;
+    }
+    while (!started)
+        sched_yield();
+    for (i = 0; i < NUM_YIELDS; i++)
+        sched_yield();
+    stop = 1;
+    pthread_join(thread, NULL);
+    print("all done\n");
+    return 0;
+}
+
+#else /* asm code *************************************************************/
+#include "asm_defines.asm"
+START_FILE
+
+/* keep in sync with shadow_ret.dll.c */
+#define MAGIC_XAX HEX(1a1a1a1a)
+#define MAGIC_XBX HEX(1b1b1b1b)
+#define MAGIC_XCX HEX(1c1c1c1c)
+#define MAGIC_XDX HEX(1d1d1d1d)
+#define MAGIC_XSI HEX(15151515)
+
+/* Every instruction in the loop leaves xax, xbx, xcx, xdx, and xsi alone, so
+ * wherever the thread is suspended they must translate to the values above.
+ * Each ret ends a bb and matches the ring entry its call pushed, so a
+ * suspension lands on the out-of-line match path as well.
+ */
+#define FUNCNAME call_ret_loop
+        DECLARE_FUNC(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+        mov      REG_XAX, ARG1
+        push     REG_XBX
+        push     REG_XSI
+        push     REG_XDI
+        mov      REG_XDI, REG_XAX
+        mov      REG_XAX, MAGIC_XAX
+        mov      REG_XBX, MAGIC_XBX
+        mov      REG_XCX, MAGIC_XCX
+        mov      REG_XDX, MAGIC_XDX
+        /* last: the client trusts the others once it sees this */
+        mov      REG_XSI, MAGIC_XSI
+     loop_top:
+        call     loop_callee
+        cmp      DWORD [REG_XDI], 0
+        je       loop_top
+        /* first, for the same reason */
+        mov      REG_XSI, 0
+        pop      REG_XDI
+        pop      REG_XSI
+        pop      REG_XBX
+        ret
+     loop_callee:
+        ret
+        END_FUNC(FUNCNAME)
+#undef FUNCNAME
+
+END_FILE
+#endif
@@ -0,0 +1,105 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Suspends the app's looping thread from the main thread's sched_yield
+ * calls and checks that its registers translate to the values the app
+ * holds constant, wherever in the shadow return stack code it stopped.
+ */
+
+#include "dr_api.h"
+#include <syscall.h>
+
+/* keep in sync with shadow_ret.c */
+#define MAGIC_XAX 0x1a1a1a1a
+#define MAGIC_XBX 0x1b1b1b1b
+#define MAGIC_XCX 0x1c1c1c1c
+#define MAGIC_XDX 0x1d1d1d1d
+#define MAGIC_XSI 0x15151515
+
+static uint num_checked;
+static uint num_bad;
+
+static bool
+event_filter_syscall(void *drcontext, int sysnum)
+{
+    return sysnum == SYS_sched_yield;
+}
+
+static bool
+event_pre_syscall(void *drcontext, int sysnum)
+{
+    void **drcontexts;
+    uint num_suspended, i;
+    if (sysnum != SYS_sched_yield)
+        return true;
+    if (!dr_suspend_all_other_threads(&drcontexts, &num_suspended, NULL)) {
+        dr_fprintf(STDERR, "failed to suspend threads\n");
+        return true;
+    }
+    for (i = 0; i < num_suspended; i++) {
+        dr_mcontext_t mc = {sizeof(mc),DR_MC_ALL,};
+        if (!dr_get_mcontext(drcontexts[i], &mc)) {
+            dr_fprintf(STDERR, "failed to get mcontext\n");
+            continue;
+        }
+        if (mc.xsi != MAGIC_XSI)
+            continue; /* not (yet or still) in the loop */
+        num_checked++;
+        if (mc.xax != MAGIC_XAX || mc.xbx != MAGIC_XBX ||
+            mc.xcx != MAGIC_XCX || mc.xdx != MAGIC_XDX) {
+            num_bad++;
+            dr_fprintf(STDERR, "bad registers at "PFX": "PFX" "PFX" "PFX" "PFX"\n",
+                       mc.pc, mc.xax, mc.xbx, mc.xcx, mc.xdx);
+        }
+    }
+    if (!dr_resume_all_other_threads(drcontexts, num_suspended))
+        dr_fprintf(STDERR, "failed to resume threads\n");
+    return true;
+}
+
+static void
+event_exit(void)
+{
+    if (num_checked == 0)
+        dr_fprintf(STDERR, "never suspended the looping thread\n");
+    else if (num_bad == 0)
+        dr_fprintf(STDERR, "looping thread registers translated\n");
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    dr_register_filter_syscall_event(event_filter_syscall);
+    dr_register_pre_syscall_event(event_pre_syscall);
+    dr_register_exit_event(event_exit);
+}
@@ -0,0 +1,173 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* bbbench.c
+ *
+ * Basic block building microbenchmark.  Runs a sequence of threads, one
+ * after another, each of which calls 4096 distinct small functions once.
+ * Under DR with -thread_private -disable_traces every thread has to build
+ * all of those blocks again, so the per-thread time is dominated by block
+ * building.  With a second argument of 1 the threads all run at once
+ * instead, so block building also measures contention on DR's shared
+ * structures.  Driven by drbench.pl (see the block building examples
+ * there), but can be run directly:
+ *
+ *   gcc -O1 -o bbbench bbbench.c -lpthread
+ *   bbbench [<num threads> [<concurrent 0|1>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+# define NOINLINE __declspec(noinline)
+#else
+# define NOINLINE __attribute__((noinline))
+#endif
+
+#define NUM_FUNCS 4096
+#define MAX_THREADS 256
+
+typedef int (*func_t)(int);
+
+/* 8^4 distinct functions named f0000 through f7777, each a few blocks long */
+#define F(n) static NOINLINE int f##n(int x) {      \
+        if (x & 0##n)                               \
+            x = x * 3 + 0##n;                       \
+        else                                        \
+            x = (x >> 1) ^ 0##n;                    \
+        return (x > 0##n) ? x - 0##n : x + 1;       \
+    }
+#define F8(p) F(p##0) F(p##1) F(p##2) F(p##3) F(p##4) F(p##5) F(p##6) F(p##7)
+#define F64(p) F8(p##0) F8(p##1) F8(p##2) F8(p##3) \
+               F8(p##4) F8(p##5) F8(p##6) F8(p##7)
+#define F512(p) F64(p##0) F64(p##1) F64(p##2) F64(p##3) \
+                F64(p##4) F64(p##5) F64(p##6) F64(p##7)
+F512(0) F512(1) F512(2) F512(3) F512(4) F512(5) F512(6) F512(7)
+
+#define T(n) f##n,
+#define T8(p) T(p##0) T(p##1) T(p##2) T(p##3) T(p##4) T(p##5) T(p##6) T(p##7)
+#define T64(p) T8(p##0) T8(p##1) T8(p##2) T8(p##3) \
+               T8(p##4) T8(p##5) T8(p##6) T8(p##7)
+#define T512(p) T64(p##0) T64(p##1) T64(p##2) T64(p##3) \
+                T64(p##4) T64(p##5) T64(p##6) T64(p##7)
+static func_t funcs[NUM_FUNCS] = {
+    T512(0) T512(1) T512(2) T512(3) T512(4) T512(5) T512(6) T512(7)
+};
+
+static volatile int result;
+
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+thread_func(void *arg)
+{
+    int i, x = 0;
+    for (i = 0; i < NUM_FUNCS; i++)
+        x = funcs[i](x);
+    result += x;
+    return 0;
+}
+
+static double
+now_us(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1e6 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    int num_threads = 20;
+    int concurrent = 0;
+    int i;
+    double start, end;
+#ifdef _WIN32
+    static HANDLE threads[MAX_THREADS];
+#else
+    static pthread_t threads[MAX_THREADS];
+#endif
+
+    if (argc > 1)
+        num_threads = atoi(argv[1]);
+    if (argc > 2)
+        concurrent = atoi(argv[2]);
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [<num threads 1-%d> [<concurrent 0|1>]]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+    start = now_us();
+    /* By default one at a time, so all of the work is block building, not
+     * contention.  Otherwise start them all before waiting for any.
+     */
+    for (i = 0; i < num_threads; i++) {
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, thread_func, NULL, 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, thread_func, NULL);
+#endif
+        if (!concurrent || i == num_threads - 1) {
+            int j;
+            for (j = concurrent ? 0 : i; j <= i; j++) {
+#ifdef _WIN32
+                WaitForSingleObject(threads[j], INFINITE);
+                CloseHandle(threads[j]);
+#else
+                pthread_join(threads[j], NULL);
+#endif
+            }
+        }
+    }
+    end = now_us();
+    printf("threads %d%s funcs %d us/func %.3f (result %d)\n", num_threads,
+           concurrent ? " concurrent" : "", NUM_FUNCS,
+           (end - start) / ((double)num_threads * NUM_FUNCS), result);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#!/usr/bin/perl
+
+# **********************************************************
+# Copyright (c) 2013 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+# 
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+# 
+# * Neither the name of Google, Inc. nor the names of its contributors may be
+#   used to endorse or promote products derived from this software without
+#   specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+
+## drbench.pl
+##
+## Runs an application under DR repeatedly with several sets of DR options
+## and reports, for each set, the median and minimum of what was measured,
+## along with the change relative to the first set.  What is measured is
+## either the wall-clock time per process (the default) or one or more
+## values the application prints itself on lines of the form
+## "<metric> <value>" (-metric, which may be repeated).
+##
+## Each -config gives a label and the DR options for one set; the sets are
+## run in turn within each of the -runs iterations.  In options, @DIR@ is
+## replaced by a scratch directory that lives as long as the harness, and
+## @VAL@ by each value of -sweep in turn, giving one table per value.
+## A config marked with -clean <label> empties @DIR@ before each of its
+## runs.  -warmup runs every config once, untimed, before measuring.
+##
+## Examples, with the workloads in this directory:
+##
+##   # persisted cache startup: none, generating, and reusing
+##   drbench.pl -clean cold -config "nopcache=" \
+##     -config "cold=-persist -persist_dir @DIR@" \
+##     -config "warm=-persist -persist_dir @DIR@" <drrun> <app>
+##
+##   # IBL hit latency by table load factor, linear vs bucketed
+##   drbench.pl -runs 3 -metric ns/call -sweep "20 35 50 65 80" \
+##     -ops "-shared_ibt_table_trace_load @VAL@ -shared_ibt_table_bb_load @VAL@ \
+##           -private_ibl_targets_load @VAL@ -private_bb_ibl_targets_load @VAL@" \
+##     -config "linear=" -config "bucketed=-ibl_bucket_lines" <drrun> ./iblbench
+##
+##   # block building, with IR in a per-thread arena or with vmarea snapshots
+##   drbench.pl -metric us/func -ops "-thread_private -disable_traces" \
+##     -config "heap=" -config "-instr_arena=-instr_arena" <drrun> ./bbbench
+##   drbench.pl -metric us/func -ops "-thread_private -disable_traces" \
+##     -config "locked=" -config "-vmarea_snapshots=-vmarea_snapshots" \
+##     <drrun> ./bbbench 16 1
+##
+##   # flush pause tail latency
+##   drbench.pl -metric p99_us -metric max_us -config "default=" \
+##     -config "-flush_pipelined_synch=-flush_pipelined_synch" <drrun> ./flushbench 64
+##
+##   # thread init and exit cost
+##   drbench.pl -metric us/thread -config "default=" \
+##     -config "-thread_state_pool 16=-thread_state_pool 16" <drrun> ./threadchurn 2000 8
+##
+##   # private library loading, timing 50 processes per run
+##   drbench.pl -procs 50 -warmup -client <client.so> -config "relocate=" \
+##     -config "-privload_image_cache_dir=-privload_image_cache_dir @DIR@" \
+##     <drrun> /bin/true
+
+use Time::HiRes qw(time);
+use File::Temp qw(tempdir);
+use File::Path qw(rmtree);
+
+$usage = "Usage: $0 [-runs <N>] [-procs <N>] [-ops \"<DR options>\"] ".
+    "[-client <path>] [-metric <name>]... [-sweep \"<values>\"] [-clean <label>]... ".
+    "[-warmup] -config \"<label>=<DR options>\"... <drrun> <app> [<args>...]\n";
+
+$runs = 5;
+$procs = 1;
+$ops = "";
+$client = "";
+$sweep = "";
+$warmup = 0;
+while ($#ARGV >= 0 && $ARGV[0] =~ /^-/) {
+    my $arg = shift;
+    if ($arg eq "-runs") {
+        $runs = shift;
+    } elsif ($arg eq "-procs") {
+        $procs = shift;
+    } elsif ($arg eq "-ops") {
+        $ops = shift;
+    } elsif ($arg eq "-client") {
+        $client = shift;
+    } elsif ($arg eq "-metric") {
+        push @metrics, shift;
+    } elsif ($arg eq "-sweep") {
+        $sweep = shift;
+    } elsif ($arg eq "-clean") {
+        $clean{shift()} = 1;
+    } elsif ($arg eq "-warmup") {
+        $warmup = 1;
+    } elsif ($arg eq "-config") {
+        my $config = shift;
+        die $usage unless ($config =~ /^([^=]+)=(.*)$/);
+        push @labels, $1;
+        push @config_ops, $2;
+    } else {
+        die $usage;
+    }
+}
+die $usage if ($#ARGV < 1 || $runs < 1 || $procs < 1 || $#labels < 0);
+$drrun = shift;
+@app = @ARGV;
+
+$dir = tempdir("drbench-XXXXXX", TMPDIR => 1, CLEANUP => 1);
+
+# Returns the measured values of one run: the time per process in ms, or
+# the app's own values for @metrics.
+sub run_once {
+    my ($dr_ops) = @_;
+    my $cmd = join(' ', $drrun, $ops, $dr_ops,
+                   ($client eq "") ? () : ("-c", $client), "--", @app);
+    my $out;
+    my $start = time();
+    for (my $i = 0; $i < $procs; $i++) {
+        $out = `$cmd 2>&1`;
+        die "Error: $cmd failed:\n$out" if ($? != 0);
+    }
+    return ((time() - $start) * 1000 / $procs) if ($#metrics < 0);
+    my @vals;
+    foreach my $metric (@metrics) {
+        die "Error: no $metric in output of $cmd:\n$out"
+            unless ($out =~ /\Q$metric\E\s+([\d\.]+)/);
+        push @vals, $1;
+    }
+    return @vals;
+}
+
+sub median {
+    my @vals = sort { $a <=> $b } @_;
+    return $vals[int($#vals / 2)];
+}
+
+sub min {
+    my @vals = sort { $a <=> $b } @_;
+    return $vals[0];
+}
+
+sub expand {
+    my ($str, $val) = @_;
+    $str =~ s/\@DIR\@/$dir/g;
+    $str =~ s/\@VAL\@/$val/g;
+    return $str;
+}
+
+@names = ($#metrics < 0) ? ("ms/process") : @metrics;
+$width = 10;
+foreach $label (@labels) {
+    $width = length($label) if (length($label) > $width);
+}
+$ops_template = $ops;
+foreach $val (($sweep eq "") ? ("") : split(' ', $sweep)) {
+    $ops = &expand($ops_template, $val);
+    my @expanded = map { &expand($_, $val) } @config_ops;
+    my %samples; # "<config>,<metric>" => list of values
+    print "\n$val:\n" if ($sweep ne "");
+    if ($warmup) {
+        for (my $c = 0; $c <= $#labels; $c++) {
+            &run_once($expanded[$c]);
+        }
+    }
+    for (my $i = 0; $i < $runs; $i++) {
+        for (my $c = 0; $c <= $#labels; $c++) {
+            rmtree($dir, {keep_root => 1}) if ($clean{$labels[$c]});
+            my @vals = &run_once($expanded[$c]);
+            for (my $m = 0; $m <= $#names; $m++) {
+                push @{$samples{"$c,$m"}}, $vals[$m];
+            }
+        }
+    }
+    for (my $m = 0; $m <= $#names; $m++) {
+        my $base = &median(@{$samples{"0,$m"}});
+        for (my $c = 0; $c <= $#labels; $c++) {
+            my $median = &median(@{$samples{"$c,$m"}});
+            printf("%-${width}s %-12s median %10.3f  min %10.3f", $labels[$c], $names[$m],
+                   $median, &min(@{$samples{"$c,$m"}}));
+            printf("  (%+.1f%%)", ($median - $base) * 100 / $base)
+                if ($c > 0 && $base > 0);
+            print "\n";
+        }
+    }
+}
@@ -0,0 +1,190 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* drkstats.c
+ *
+ * Live viewer for the path timing statistics (kstats) that a process run
+ * with -kstats -kstats_export_dir <dir> publishes in
+ * <dir>/dynamorio.<pid>.kstats.  Maps the file read-only and prints, for
+ * each timer with any activity, the sum over exited and live threads.  With
+ * -i it repeats every <secs> seconds, printing the change since the last
+ * sample instead, until the process removes the file at exit.
+ *
+ *   drkstats [-i <secs>] <file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "configure.h"
+#include "globals_shared.h"
+#include "dr_stats.h"
+
+typedef struct {
+    uint64 num;
+    uint64 cycles;  /* self + sub */
+    uint64 outliers;
+} total_t;
+
+static void
+add_var(total_t *t, const kstat_export_var_t *v)
+{
+    t->num += v->num_self;
+    t->cycles += v->total_self + v->total_sub;
+    t->outliers += v->total_outliers;
+}
+
+/* Sums the exited-thread totals and all live slots into totals, retrying
+ * if a thread exits (moving its values between the two) while we read.
+ * Returns the number of live threads.
+ */
+static uint
+read_totals(const kstat_export_header_t *hdr, total_t *totals)
+{
+    const byte *base = (const byte *) hdr;
+    uint seq, live, i, j;
+    do {
+        seq = hdr->merge_seq;
+        __sync_synchronize();
+        memset(totals, 0, hdr->num_vars * sizeof(*totals));
+        live = 0;
+        for (j = 0; j < hdr->num_vars; j++) {
+            add_var(&totals[j], (const kstat_export_var_t *)
+                    (base + hdr->totals_offs) + j);
+        }
+        for (i = 0; i < hdr->max_threads; i++) {
+            const kstat_export_slot_t *slot = (const kstat_export_slot_t *)
+                (base + hdr->slots_offs + i * hdr->slot_size);
+            if (slot->thread_id == 0)
+                continue;
+            live++;
+            for (j = 0; j < hdr->num_vars; j++)
+                add_var(&totals[j], &slot->vars[j]);
+        }
+        __sync_synchronize();
+    } while ((seq & 1) != 0 || seq != hdr->merge_seq);
+    return live;
+}
+
+static void
+print_totals(const kstat_export_header_t *hdr, const total_t *cur, const total_t *prev,
+             uint live)
+{
+    const char *names = (const char *) hdr + hdr->names_offs;
+    uint64 freq = (hdr->frequency_per_msec == 0) ? 1 : hdr->frequency_per_msec;
+    uint j;
+    printf("pid %d: %u live threads\n", (int) hdr->process_id, live);
+    printf("%-32s %12s %16s %10s %10s\n", "timer", "num", "cycles", "ms", "out ms");
+    for (j = 0; j < hdr->num_vars; j++) {
+        uint64 num = cur[j].num - (prev == NULL ? 0 : prev[j].num);
+        uint64 cycles = cur[j].cycles - (prev == NULL ? 0 : prev[j].cycles);
+        uint64 out = cur[j].outliers - (prev == NULL ? 0 : prev[j].outliers);
+        if (num == 0)
+            continue;
+        printf("%-32.*s %12llu %16llu %10llu %10llu\n",
+               KSTAT_EXPORT_NAME_LEN, names + j * KSTAT_EXPORT_NAME_LEN,
+               (unsigned long long) num, (unsigned long long) cycles,
+               (unsigned long long) (cycles / freq), (unsigned long long) (out / freq));
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int interval = 0;
+    int i, fd;
+    struct stat st;
+    kstat_export_header_t *hdr;
+    total_t *cur, *prev;
+    uint live;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-i <secs>] <dir>/dynamorio.<pid>.kstats\n", argv[0]);
+        return 1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < sizeof(*hdr)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    hdr = (kstat_export_header_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s\n", path);
+        return 1;
+    }
+    if (memcmp(hdr->magic, KSTAT_EXPORT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != KSTAT_EXPORT_VERSION ||
+        hdr->slots_offs + (uint64) hdr->max_threads * hdr->slot_size > st.st_size) {
+        fprintf(stderr, "%s is not a version %d kstats file\n", path,
+                KSTAT_EXPORT_VERSION);
+        return 1;
+    }
+    cur = (total_t *) calloc(hdr->num_vars, sizeof(*cur));
+    prev = (total_t *) calloc(hdr->num_vars, sizeof(*prev));
+    live = read_totals(hdr, cur);
+    print_totals(hdr, cur, NULL, live);
+    while (interval > 0) {
+        total_t *tmp;
+        sleep(interval);
+        /* the process deletes the file at exit */
+        if (access(path, F_OK) != 0)
+            break;
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+        live = read_totals(hdr, cur);
+        print_totals(hdr, cur, prev, live);
+    }
+    free(cur);
+    free(prev);
+    munmap(hdr, st.st_size);
+    return 0;
+}
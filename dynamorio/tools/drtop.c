@@ -0,0 +1,301 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+/* drtop.c
+ *
+ * Live viewer for the statistics that a process run with
+ * -stats_export_dir <dir> publishes in <dir>/dynamorio.<pid>.stats: the
+ * Linux counterpart of DRview and DRstats.  Maps the file read-only and, every
+ * <secs> seconds, shows the rates of block building, indirect branch lookup
+ * misses, and cache flushes, the sizes of the caches, and the <rows>
+ * statistics that changed the most since the last sample.  Stops after
+ * <count> samples if given, or when the process removes the file at exit.
+ * With -csv every sample's values of all statistics are also appended to
+ * <file>, one row per sample, for later comparison of runs.  -batch prints
+ * each sample after the last rather than redrawing the terminal.
+ *
+ *   drtop [-i <secs>] [-n <rows>] [-c <count>] [-csv <file>] [-batch] <file>
+ *
+ * Statistics that only debug builds keep read as "-" for release builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "configure.h"
+#include "globals_shared.h"
+#include "dr_stats.h"
+
+#define STATS_OFFS ((size_t) &((dr_statistics_t *)0)->stats)
+
+/* rates shown above the table: sums of the named statistics */
+typedef struct {
+    const char *label;
+    const char *names[3];
+    int idx[3];
+    int rate; /* else a level */
+} summary_t;
+
+static summary_t summaries[] = {
+    {"blocks built/s", {"Basic block fragments generated"}, {-1, -1, -1}, 1},
+    {"traces built/s", {"Trace fragments generated"}, {-1, -1, -1}, 1},
+    {"IBL misses/s", {"Fcache exits, ind target not in cache",
+                      "Fcache exits, ind target in cache but not table"},
+     {-1, -1, -1}, 1},
+    {"flushes/s", {"Cache consistency flushes"}, {-1, -1, -1}, 1},
+    {"bb cache bytes", {"Fcache bb capacity (bytes)",
+                        "Fcache shared bb capacity (bytes)"}, {-1, -1, -1}, 0},
+    {"trace cache bytes", {"Fcache trace capacity (bytes)",
+                           "Fcache shared trace capacity (bytes)"}, {-1, -1, -1}, 0},
+};
+#define NUM_SUMMARIES (sizeof(summaries) / sizeof(summaries[0]))
+
+static const dr_statistics_t *dstats;
+static uint num_stats;
+static long long *cur, *prev;
+static int *order;
+
+static void
+find_summaries(void)
+{
+    uint s, n, i;
+    for (s = 0; s < NUM_SUMMARIES; s++) {
+        for (n = 0; n < 3 && summaries[s].names[n] != NULL; n++) {
+            for (i = 0; i < num_stats; i++) {
+                if (strncmp(dstats->stats[i].name, summaries[s].names[n],
+                            STAT_NAME_MAX_LEN) == 0) {
+                    summaries[s].idx[n] = i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void
+read_stats(long long *vals)
+{
+    uint i;
+    for (i = 0; i < num_stats; i++)
+        vals[i] = (long long) dstats->stats[i].value;
+}
+
+static long long
+delta(int i)
+{
+    return cur[i] - prev[i];
+}
+
+static int
+cmp_delta(const void *a, const void *b)
+{
+    long long da = llabs(delta(*(const int *)a));
+    long long db = llabs(delta(*(const int *)b));
+    return (da < db) ? 1 : ((da > db) ? -1 : 0);
+}
+
+static void
+print_sample(double elapsed, uint rows, int redraw)
+{
+    uint s, n, i;
+    if (redraw)
+        printf("\033[H\033[2J");
+    printf("pid %d  %.*s  %.1fs\n", (int) dstats->process_id, MAXIMUM_PATH,
+           dstats->process_name, elapsed);
+    for (s = 0; s < NUM_SUMMARIES; s++) {
+        long long sum = 0;
+        int found = 0;
+        for (n = 0; n < 3 && summaries[s].names[n] != NULL; n++) {
+            int idx = summaries[s].idx[n];
+            if (idx < 0)
+                continue;
+            found = 1;
+            sum += summaries[s].rate ? delta(idx) : cur[idx];
+        }
+        if (!found)
+            printf("  %-18s %14s\n", summaries[s].label, "-");
+        else if (summaries[s].rate)
+            printf("  %-18s %14.1f\n", summaries[s].label, sum / elapsed);
+        else
+            printf("  %-18s %14lld\n", summaries[s].label, sum);
+    }
+    printf("\n%-52s %16s %14s\n", "statistic", "value", "per second");
+    for (i = 0; i < num_stats; i++)
+        order[i] = i;
+    qsort(order, num_stats, sizeof(*order), cmp_delta);
+    for (i = 0; i < num_stats && i < rows; i++) {
+        int idx = order[i];
+        if (delta(idx) == 0)
+            break;
+        printf("%-52.*s %16lld %14.1f\n", STAT_NAME_MAX_LEN, dstats->stats[idx].name,
+               cur[idx], delta(idx) / elapsed);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void
+print_csv_name(FILE *f, const char *name)
+{
+    uint i;
+    fputc('"', f);
+    for (i = 0; i < STAT_NAME_MAX_LEN && name[i] != '\0'; i++) {
+        if (name[i] == '"')
+            fputc('"', f);
+        fputc(name[i], f);
+    }
+    fputc('"', f);
+}
+
+static void
+print_csv(FILE *f, double time, int header)
+{
+    uint i;
+    if (header) {
+        fprintf(f, "time_s");
+        for (i = 0; i < num_stats; i++) {
+            fputc(',', f);
+            print_csv_name(f, dstats->stats[i].name);
+        }
+        fputc('\n', f);
+    }
+    fprintf(f, "%.3f", time);
+    for (i = 0; i < num_stats; i++)
+        fprintf(f, ",%lld", cur[i]);
+    fputc('\n', f);
+    fflush(f);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = NULL, *csv_path = NULL;
+    int interval = 1, count = 0, batch = !isatty(STDOUT_FILENO);
+    uint rows = 20;
+    int i, fd, samples;
+    struct stat st;
+    FILE *csv = NULL;
+    double start, last, t;
+    long long *tmp;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            rows = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "-batch") == 0)
+            batch = 1;
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || interval <= 0) {
+        fprintf(stderr, "usage: %s [-i <secs>] [-n <rows>] [-c <count>] [-csv <file>] "
+                "[-batch] <dir>/dynamorio.<pid>.stats\n", argv[0]);
+        return 1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < STATS_OFFS) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    dstats = (dr_statistics_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (dstats == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s\n", path);
+        return 1;
+    }
+    num_stats = dstats->num_stats;
+    if (strncmp(dstats->magicstring, DYNAMORIO_MAGIC_STRING,
+                DYNAMORIO_MAGIC_STRING_LEN - 1) != 0 ||
+        STATS_OFFS + (uint64) num_stats * sizeof(single_stat_t) > st.st_size) {
+        fprintf(stderr, "%s is not a "PRODUCT_NAME" statistics file\n", path);
+        return 1;
+    }
+    if (csv_path != NULL) {
+        csv = fopen(csv_path, "w");
+        if (csv == NULL) {
+            fprintf(stderr, "cannot open %s\n", csv_path);
+            return 1;
+        }
+    }
+    cur = (long long *) calloc(num_stats + 1, sizeof(*cur));
+    prev = (long long *) calloc(num_stats + 1, sizeof(*prev));
+    order = (int *) calloc(num_stats + 1, sizeof(*order));
+    find_summaries();
+    read_stats(cur);
+    start = last = now();
+    if (csv != NULL)
+        print_csv(csv, 0., 1);
+    for (samples = 0; count == 0 || samples < count; samples++) {
+        sleep(interval);
+        /* the process deletes the file at exit */
+        if (access(path, F_OK) != 0)
+            break;
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+        read_stats(cur);
+        t = now();
+        print_sample(t - last, rows, !batch);
+        if (csv != NULL)
+            print_csv(csv, t - start, 0);
+        last = t;
+    }
+    if (csv != NULL)
+        fclose(csv);
+    free(cur);
+    free(prev);
+    free(order);
+    munmap((void *) dstats, st.st_size);
+    return 0;
+}
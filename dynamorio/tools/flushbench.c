@@ -0,0 +1,137 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* flushbench.c
+ *
+ * Flush pause-time microbenchmark (Linux only).  Every thread repeatedly
+ * maps a page, writes a tiny function into it, calls it, and unmaps the
+ * page again, so under DR each iteration builds a block and then flushes
+ * it while all the other threads are doing the same.  Each thread records
+ * how long every iteration took; the tail of that distribution is the time
+ * threads spent stopped for other threads' flushes.
+ * Driven by drbench.pl (see the flush example there), but can be run directly:
+ *
+ *   gcc -O2 -o flushbench flushbench.c -lpthread
+ *   flushbench [<num threads> [<iterations per thread>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define MAX_THREADS 256
+
+typedef int (*jit_func_t)(int);
+
+static int iters = 2000;
+static double *latencies; /* iters per thread, in us */
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *
+thread_func(void *arg)
+{
+    double *lat = latencies + (long)arg * iters;
+    int i, x = 0;
+    for (i = 0; i < iters; i++) {
+        double start = now_us();
+        unsigned char *pc = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+                                 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (pc == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+#if defined(__x86_64__)
+        /* lea eax, [rdi + i & 0x7f]; ret */
+        pc[0] = 0x8d; pc[1] = 0x47; pc[2] = (unsigned char)(i & 0x7f); pc[3] = 0xc3;
+#else
+        /* mov eax, [esp+4]; add eax, i & 0x7f; ret */
+        pc[0] = 0x8b; pc[1] = 0x44; pc[2] = 0x24; pc[3] = 0x04;
+        pc[4] = 0x83; pc[5] = 0xc0; pc[6] = (unsigned char)(i & 0x7f); pc[7] = 0xc3;
+#endif
+        x = ((jit_func_t)pc)(x) & 0xffff;
+        munmap(pc, 4096);
+        lat[i] = now_us() - start;
+    }
+    return (void *)(long)x;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static pthread_t threads[MAX_THREADS];
+    int num_threads = 16;
+    long i, total;
+    double start, end;
+
+    if (argc > 1)
+        num_threads = atoi(argv[1]);
+    if (argc > 2)
+        iters = atoi(argv[2]);
+    if (num_threads < 1 || num_threads > MAX_THREADS || iters < 1) {
+        fprintf(stderr, "Usage: %s [<num threads 1-%d> [<iterations per thread>]]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+    total = (long)num_threads * iters;
+    latencies = malloc(total * sizeof(*latencies));
+    if (latencies == NULL)
+        return 1;
+    start = now_us();
+    for (i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, thread_func, (void *)i);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    end = now_us();
+    qsort(latencies, total, sizeof(*latencies), compare_double);
+    printf("threads %d flushes/s %.0f median_us %.1f p99_us %.1f max_us %.1f\n",
+           num_threads, total * 1e6 / (end - start), latencies[total / 2],
+           latencies[total * 99 / 100], latencies[total - 1]);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,117 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* iblbench.c
+ *
+ * Indirect branch microbenchmark for measuring IBL hit latency under DR.
+ * Makes indirect calls to a pseudo-random sequence of up to 512 distinct
+ * targets, so that after warmup every lookup is an IBL table hit whose
+ * probe length depends on the table's load factor and layout.
+ * Driven by drbench.pl (see the IBL example there), but can be run directly:
+ *
+ *   gcc -O2 -o iblbench iblbench.c
+ *   iblbench [<num targets> [<millions of calls>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _MSC_VER
+# define NOINLINE __declspec(noinline)
+#else
+# define NOINLINE __attribute__((noinline))
+#endif
+
+#define MAX_TARGETS 512
+
+typedef int (*target_func_t)(int);
+
+/* 8^3 distinct functions named f000 through f777 */
+#define F(n) static NOINLINE int f##n(int x) { return x ^ 0##n; }
+#define F8(p) F(p##0) F(p##1) F(p##2) F(p##3) F(p##4) F(p##5) F(p##6) F(p##7)
+#define F64(p) F8(p##0) F8(p##1) F8(p##2) F8(p##3) \
+               F8(p##4) F8(p##5) F8(p##6) F8(p##7)
+F64(0) F64(1) F64(2) F64(3) F64(4) F64(5) F64(6) F64(7)
+
+#define T(n) f##n,
+#define T8(p) T(p##0) T(p##1) T(p##2) T(p##3) T(p##4) T(p##5) T(p##6) T(p##7)
+#define T64(p) T8(p##0) T8(p##1) T8(p##2) T8(p##3) \
+               T8(p##4) T8(p##5) T8(p##6) T8(p##7)
+static target_func_t targets[MAX_TARGETS] = {
+    T64(0) T64(1) T64(2) T64(3) T64(4) T64(5) T64(6) T64(7)
+};
+
+#define SEQUENCE_LEN 4096
+
+int
+main(int argc, char *argv[])
+{
+    static target_func_t sequence[SEQUENCE_LEN];
+    int num_targets = MAX_TARGETS;
+    long millions = 50;
+    unsigned int seed = 12345;
+    long i, j, iters;
+    int x = 0;
+    clock_t start, end;
+    double ns;
+
+    if (argc > 1)
+        num_targets = atoi(argv[1]);
+    if (argc > 2)
+        millions = atol(argv[2]);
+    if (num_targets < 1 || num_targets > MAX_TARGETS || millions < 1) {
+        fprintf(stderr, "Usage: %s [<num targets 1-%d> [<millions of calls>]]\n",
+                argv[0], MAX_TARGETS);
+        return 1;
+    }
+    /* fixed seed so all runs see the same sequence */
+    for (i = 0; i < SEQUENCE_LEN; i++) {
+        seed = seed * 1103515245 + 12345;
+        sequence[i] = targets[(seed >> 16) % num_targets];
+    }
+    /* warm up: have DR build and add every target to its IBL tables */
+    for (i = 0; i < SEQUENCE_LEN * 16; i++)
+        x = sequence[i % SEQUENCE_LEN](x);
+
+    iters = millions * 1000000 / SEQUENCE_LEN;
+    start = clock();
+    for (i = 0; i < iters; i++) {
+        for (j = 0; j < SEQUENCE_LEN; j++)
+            x = sequence[j](x);
+    }
+    end = clock();
+    ns = (double)(end - start) * 1e9 / CLOCKS_PER_SEC / (iters * SEQUENCE_LEN);
+    printf("targets %d calls %ld ns/call %.2f (result %d)\n",
+           num_targets, iters * SEQUENCE_LEN, ns, x);
+    return 0;
+}
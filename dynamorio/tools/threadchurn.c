@@ -0,0 +1,146 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* threadchurn.c
+ *
+ * Thread churn microbenchmark.  Creates short-lived threads in waves of a
+ * fixed width, waiting for each wave to exit before starting the next, as
+ * a thread-per-request server would.  Each thread does only a handful of
+ * calls, so under DR the time per thread is dominated by DR's per-thread
+ * initialization and exit.  Driven by drbench.pl (see the thread example
+ * there), but can be run directly:
+ *
+ *   gcc -O1 -o threadchurn threadchurn.c -lpthread
+ *   threadchurn [<num threads> [<wave width>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+# define NOINLINE __declspec(noinline)
+#else
+# define NOINLINE __attribute__((noinline))
+#endif
+
+#define MAX_WIDTH 64
+
+static volatile int result;
+
+static NOINLINE int
+work(int x)
+{
+    return (x & 1) ? x * 3 + 1 : x >> 1;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+thread_func(void *arg)
+{
+    int i, x = (int)(size_t)arg;
+    for (i = 0; i < 16; i++)
+        x = work(x);
+    result += x;
+    return 0;
+}
+
+static double
+now_us(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1e6 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    int num_threads = 2000;
+    int width = 8;
+    int i, j, n;
+    double start, end;
+#ifdef _WIN32
+    static HANDLE threads[MAX_WIDTH];
+#else
+    static pthread_t threads[MAX_WIDTH];
+#endif
+
+    if (argc > 1)
+        num_threads = atoi(argv[1]);
+    if (argc > 2)
+        width = atoi(argv[2]);
+    if (num_threads < 1 || width < 1 || width > MAX_WIDTH) {
+        fprintf(stderr, "Usage: %s [<num threads> [<wave width 1-%d>]]\n",
+                argv[0], MAX_WIDTH);
+        return 1;
+    }
+    start = now_us();
+    for (i = 0; i < num_threads; i += n) {
+        n = (num_threads - i < width) ? num_threads - i : width;
+        for (j = 0; j < n; j++) {
+#ifdef _WIN32
+            threads[j] = CreateThread(NULL, 0, thread_func, (void *)(size_t)(i + j),
+                                      0, NULL);
+#else
+            pthread_create(&threads[j], NULL, thread_func, (void *)(size_t)(i + j));
+#endif
+        }
+        for (j = 0; j < n; j++) {
+#ifdef _WIN32
+            WaitForSingleObject(threads[j], INFINITE);
+            CloseHandle(threads[j]);
+#else
+            pthread_join(threads[j], NULL);
+#endif
+        }
+    }
+    end = now_us();
+    printf("threads %d width %d us/thread %.3f (result %d)\n", num_threads, width,
+           (end - start) / num_threads, result);
+    return 0;
+}